@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#define ADMISSION_IP_LIMIT 20			// default --ip-limit, connections open at once from one address, 0 disables
+#define ADMISSION_IP_RATE 30			// default --ip-rate, new connections per minute from one address, 0 disables
+#define ADMISSION_IP_BURST 10			// connections an address may open back to back before --ip-rate holds it back
+#define ADMISSION_SHED_LATENCY_MS 250	// default --shed-latency, average loop busy time above which nobody gets in, 0 disables
+#define ADMISSION_SWEEP_EVERY 4096		// admissions between two sweeps of idle addresses out of the table
+
+enum AdmissionVerdict {
+	ADMIT,
+	REFUSE_OVERLOAD,	//-> the loop is running behind
+	REFUSE_IP_LIMIT,	//-> too many connections open from the address
+	REFUSE_IP_RATE,		//-> the address connects faster than the rate
+	ADMISSION_VERDICT_COUNT
+};
+
+// Decides whether a new connection is taken, before any state is built for it. Per address it keeps
+// the connections open and a leaky bucket of the recent ones: every connection taken adds one, the
+// bucket drains at the rate per minute and a full bucket (ADMISSION_IP_BURST) refuses. Loopback
+// addresses, bouncers and the benchmarks on the host itself, skip the per-address limits. On top of
+// that everybody is refused while the loop runs behind, a reconnect flood after an outage is then
+// turned away at the door instead of stretching every iteration further
+class AdmissionControl {
+	private:
+		struct Source {
+			double		bucket = 0;		//-> recent connections, drained at rate_ per minute
+			uint64_t	drainedAt = 0;	//-> ns
+			uint32_t	open = 0;
+		};
+
+		std::unordered_map<std::string, Source>	sources_;
+		uint32_t	ipLimit_;
+		uint32_t	ipRate_;
+		uint64_t	shedLatencyNs_;
+		uint64_t	sinceSweep_;
+		uint64_t	verdicts_[ADMISSION_VERDICT_COUNT];	//-> connections per verdict, admitted ones included
+
+		void	drain(Source& source, uint64_t now) const;
+		void	sweep(uint64_t now);
+
+	public:
+		AdmissionControl(uint32_t ipLimit, uint32_t ipRate, uint32_t shedLatencyMs);
+
+		AdmissionVerdict	admit(const std::string& address, uint64_t now, uint64_t loopBusyNs);
+		void	restore(const std::string& address);	//-> a connection taken over by a hot upgrade
+		void	release(const std::string& address);	//-> an admitted connection closed
+		size_t	getTracked() const;
+		uint64_t	getCount(AdmissionVerdict verdict) const;
+
+		static bool			isLoopback(const std::string& address);
+		static const char*	reason(AdmissionVerdict verdict);	//-> for the ERROR line and the log
+};
@@ -2,9 +2,15 @@
 
 #include <string>
 #include "../includes/Client.hpp"
+#include "../includes/Validators.hpp"
+#include "../includes/ChannelHistory.hpp"
+#include "../includes/StateSnapshot.hpp"
+#include "../includes/HotUpgrade.hpp"
 #include <vector>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include "../includes/Mask.hpp"
 
 
 class Client;
@@ -23,9 +29,23 @@ class Channel {
 		std::set<Client*> members_;     // pointer to store clients
 		std::set<Client*> operators_;	// keep track of operator rights
 		std::set<Client*> invited_;		// list of invitees of the channel
+		ChannelHistory history_;		// recent PRIVMSG/TOPIC/KICK lines for CHATHISTORY
+		std::set<std::string> pendingOperators_;	// operators before a restart by operatorKey(), opped again when they rejoin
+		time_t createdAt_;				// channel timestamp, the older one wins when linked servers disagree
+		time_t topicTime_;				// when the topic was set, the older topic wins a link burst
+		MaskList bans_;					// +b
+		MaskList exceptions_;			// +e, overrides a ban
+		MaskList inviteExceptions_;		// +I, joins an invite-only channel without invitation
+		std::unordered_map<const Client*, std::pair<uint64_t, bool>> banCache_;	// member to (identity, banned), cleared when +b/+e change
+
+		MaskList& maskList(char mode);
+		static bool matchesClient(const MaskList& list, const Client& client);	// nick!user@host or nick!user@address
 
 	public:
 		Channel(Client* client, const std::string &name, const std::string& );
+		explicit Channel(const ChannelSnapshot& snapshot);	// restored at startup, no members
+		Channel(const ChannelHandover& handover, const std::vector<Client*>& clients);	// taken over by a hot upgrade
+		Channel(const std::string& name, time_t createdAt);	// learned from a server link, modes follow
 		~Channel();
 
 		//METHODS
@@ -43,25 +63,40 @@ class Channel {
 		void setChannelKey(const std::string& key);
 		void setKeyProtected(bool keyProtected);
 		void setOperator(Client* client, bool isOperator);
-		bool isKeyProtected();
-		bool isInviteOnly();
+		bool isKeyProtected() const;
+		bool isInviteOnly() const;
 		bool isClientInvited(Client* client) const;
 		void setInviteOnly(bool inviteOnly);
-		std::string getName() const;
+		const std::string& getName() const;
 
-		std::string getChannelKey() const;
+		const std::string& getChannelKey() const;
 		bool checkKey(Channel* channel, Client* client, const std::string& providedKey);
 		const std::set<Client *> &getMembers() const; 			// list all clients in the channel
 		const std::set<Client*> &getOperators() const;			// list all operators
+		const std::set<Client*> &getInvited() const;
+		const std::set<std::string> &getPendingOperators() const;
+		bool takePendingOperator(const Client& client);	// true once for an operator from before the restart
+		static std::string operatorKey(const Client& client);	// lowercase nick!user@address, empty without an address
+		ChannelHistory &getHistory();
 		int getUserLimit() const;
 		void setUserLimit(int userLimit);
+		time_t getCreatedAt() const;
+		void setCreatedAt(time_t createdAt);
 		bool checkChannelLimit(Client &client, Channel &channel);
 
 		// CHANNEL TOPIC
 		bool isTopicOperatorOnly() const;
-		std::string getTopic() const;
+		const std::string& getTopic() const;
 		void setTopic(const std::string& topic);
+		time_t getTopicTime() const;
+		void setTopicTime(time_t topicTime);
 		void setTopicOperatorOnly(bool topicOperatorOnly);
+
+		// BAN, EXCEPTION AND INVEX LISTS, mode is 'b', 'e' or 'I'
+		const MaskList& getMaskList(char mode) const;
+		bool addMask(char mode, const std::string& mask, const std::string& setBy, time_t setAt);
+		bool removeMask(char mode, const std::string& mask);
+		void clearMasks();
+		bool isBanned(Client& client);					// matches +b and no +e, remembered per member
+		bool isInviteException(Client& client) const;	// like the bans, by host and by address
 };
-bool isValidChannelName(const std::string& name);
-bool isValidChannelKey(const std::string &key);
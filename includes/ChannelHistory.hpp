@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define HISTORY_CHANNEL_MAX_LINES 1000			// per channel ring, oldest lines go first
+#define HISTORY_CHANNEL_MAX_BYTES 262144		// per channel memory, counted with HistoryEntry::footprint()
+#define HISTORY_TOTAL_MAX_BYTES 67108864		// all channels together, the server evicts the oldest lines first
+#define HISTORY_PAGE_MAX 100					// lines per CHATHISTORY reply, clients page with BEFORE/AFTER
+
+// one relayed line. The payload is the exact line the channel members got, CRLF included, shared with
+// the broadcast that produced it, so keeping it costs a reference and no copy
+struct HistoryEntry {
+	uint64_t	msgId;								//-> server wide, increasing
+	uint64_t	timeMs;								//-> server-time, ms since the epoch
+	std::shared_ptr<const std::string>	line;
+
+	size_t	footprint() const;	//-> bytes accounted against the caps
+};
+
+// selects entries by msgid or by server-time, NONE leaves that side of a range open
+struct HistoryRef {
+	enum Type { NONE, MSGID, TIME };
+
+	Type		type;
+	uint64_t	value;
+
+	static bool	parse(const std::string& text, HistoryRef& ref);	//-> "*", "msgid=..." or "timestamp=..."
+};
+
+// bounded ring of the recent lines of one channel, ordered by msgId
+class ChannelHistory {
+	private:
+		std::deque<HistoryEntry>	entries_;
+		size_t						bytes_;
+		bool						truncated_;	//-> older lines than entries_ exist, evicted or from before a restart
+
+		size_t	popOldest();
+
+	public:
+		ChannelHistory();
+
+		const HistoryEntry&	add(HistoryEntry entry);	//-> evicts the oldest lines past the per channel caps
+		size_t	evictThrough(uint64_t msgId);	//-> drops the oldest entry if its msgId is at most msgId, returns bytes freed
+		size_t	getBytes() const;
+		size_t	getSize() const;
+		uint64_t	getOldestId() const;		//-> UINT64_MAX when empty
+		void	markTruncated();
+		bool	isTruncated() const;
+
+		// entries strictly after `after` and strictly before `before`, at most limit of them: the newest
+		// ones when newest is set, the oldest otherwise. Always returned oldest first
+		std::vector<const HistoryEntry*>	select(const HistoryRef& after, const HistoryRef& before, size_t limit, bool newest) const;
+		// whether `selected` lines picked by select() are the full answer, or older lines the ring no
+		// longer holds could belong to it
+		bool	covers(const HistoryRef& after, size_t selected, size_t limit, bool newest) const;
+};
+
+std::string	formatServerTime(uint64_t timeMs);	//-> 2026-01-31T23:59:59.123Z
+uint64_t	serverTimeNow();
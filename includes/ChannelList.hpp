@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "../includes/Mask.hpp"
+
+#define LIST_SENDQ_TARGET 32768		// a listing refills the send queue up to this, it resumes below SENDQ_LOW_WATERMARK
+#define LIST_SCAN_BATCH 1024		// channels one listing looks at per loop iteration, matching or not
+
+class Channel;
+
+// a LIST in progress. The filters are the ELIST ones, comma separated and all of them have to hold:
+//   >n <n			more / fewer than n users
+//   C>n C<n		created more / less than n minutes ago
+//   T>n T<n		topic set more / less than n minutes ago, a channel without topic never matches
+//   mask !mask		channel name matches one of the masks / none of the negated ones
+// The channels are walked in name order, next is the last one looked at so channels created or
+// destroyed while the listing is sent do not disturb it
+struct ListQuery {
+	size_t				minUsers = 0;		//-> at least
+	size_t				maxUsers = SIZE_MAX;	//-> fewer than
+	time_t				createdAfter = 0;
+	time_t				createdBefore = 0;	//-> 0 means no bound, for the topic times too
+	time_t				topicAfter = 0;
+	time_t				topicBefore = 0;
+	std::vector<Mask>	masks;
+	std::vector<Mask>	excluded;
+	std::string			next;				//-> empty before the first batch, channel names never are
+
+	void	addFilters(const std::string& filters, time_t now);
+	bool	matches(const Channel& channel) const;
+};
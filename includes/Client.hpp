@@ -6,75 +6,127 @@
 #include <unistd.h>
 #include <set>  // for set
 #include <cstdint> // 'uint32_t'
+#include <deque>
+#include <map>
+#include <vector>
+#include <sys/uio.h> // writev
 #include "Channel.hpp"
 #include "../includes/macros.hpp"
+#include "../includes/IoBackend.hpp"
+#include "../includes/HotUpgrade.hpp"
 #include "../includes/Server.hpp"
 
 class Server;
 
+// registration progress, set by the PASS, NICK, USER and QUIT handlers. Commands are gated on it with
+// a single compare instead of re-checking the fields a registration fills in
+enum ClientState : uint8_t {
+	CLIENT_CONNECTING,	// accepted, waiting for a matching PASS
+	CLIENT_PASS_OK,		// password accepted, waiting for NICK and USER
+	CLIENT_REGISTERED,	// welcome sent, every command is allowed
+	CLIENT_CLOSING,		// quit or dropped after an I/O error, being torn down
+	CLIENT_SERVER		// another server, its lines go to the link protocol (ServerLink.hpp)
+};
+
 class Client {
 
 	private:
 		int clientFD_;
-		int epollFd_;
+		IoBackend& io_;
 		std::string readBuffer_;
-		std::string sendBuffer_;
+		std::deque<std::string> sendQueue_;	// outgoing data, small messages are coalesced into chunks
+		size_t sendOffset_;						// bytes of sendQueue_.front() already written
+		size_t sendsInFlight_;					// chunks handed to a completion backend and not reported back yet
+		size_t sendQueueBytes_;					// bytes waiting in sendQueue_
+		std::vector<int>& flushList_;			// server list of clients with output to flush this iteration
+		bool pendingFlush_;						// already in flushList_
+		bool sendQueueExceeded_;				// output hit SENDQ_HARD_LIMIT, client gets evicted on flush
 		std::string nickname_;
 		std::string username_;
 		std::string hostname_;
+		std::string address_;					// peer address counted by admission control, empty for connections this server opened
 		std::string realName_;
 		std::string password_;
+		std::string prefix_;					// ":nick!user@host", rebuilt when one of the three changes
+		uint64_t identity_ = 0;					// new value on every prefix_ or address_ change, channels cache ban checks by it
 		std::set<std::string> joinedChannels_;    // keeps track of joined channels
-		bool authenticated_;
-		bool connected_;
-		bool isPassValid_;
+		std::map<std::string, std::string> monitored_;	// MONITOR targets: folded nickname to the spelling the client gave
+		ClientState state_;
+		bool readPaused_;						// reading is off while the output queue is backed up
+		bool waitingForList_;					// reading is off until the LIST being sent ended, not a throttle
+		bool serverOperator_;					// authenticated with OPER
+		Client* uplink_;						// the server link a remote user is reached through, null when local
+		std::string server_;					// server a remote user is on, for a link the server at the other end
+		time_t nickTs_;							// when the nickname was taken, older wins a collision between servers
 
 		// PRIVATE MEMBER FUNCTIONS
-		bool isSocketValid() const;
+		void consumeSendQueue(size_t bytes);
+		void updatePrefix();
 
 	public:
-		Client(int clientFD, std::string clientIP, int epollFd);
+		Client(int clientFD, const std::string& clientIP, IoBackend& io, std::vector<int>& flushList);
+		Client(int clientFD, const ClientHandover& handover, IoBackend& io, std::vector<int>& flushList);
+		Client(Client& uplink, const std::string& server, time_t nickTs, IoBackend& io, std::vector<int>& flushList);	// user on another server, no socket
 		~Client();
 
 		// PUBLIC MEMBER FUNCTIONS
-		int receiveData();
 		int sendData();
-		void addReadBuffer(const std::string& received);
+		int sendCompleted(ssize_t result);
+		void addReadBuffer(const char* data, size_t len);
 
 		// ACCESSORS
 		int getClientFD() const;
-		int getEpollFd() const;
 
-		std::string getHostname() const;
-		std::string getNickname() const;
-		std::string getUsername() const;
-		std::string getRealName() const;
-		std::string getPassword() const;
-		std::string getReadBuffer() const;
-		std::string getSendBuffer() const;
-		std::string getClientIdentifier() const;
+		const std::string& getHostname() const;
+		const std::string& getAddress() const;
+		const std::string& getNickname() const;
+		const std::string& getUsername() const;
+		const std::string& getRealName() const;
+		const std::string& getPassword() const;
+		const std::string& getReadBuffer() const;
+		const std::string& getClientIdentifier() const;
+		uint64_t getIdentity() const;
+		size_t getSendQueueSize() const;
+		std::string getPendingOutput() const;	// queued and not written yet, handed over by a hot upgrade
 
-		bool isConnected() const;
-		bool isAuthenticated();
-		bool getIsAuthenticated() const;
-		bool getIsPassValid() const;
+		ClientState getState() const;
+		bool isRegistered() const;
+		bool isReadPaused() const;
+		bool isWaitingForList() const;
+		bool isSendQueueExceeded() const;
+		bool isServerOperator() const;
+		bool isRemote() const;
+		Client* getUplink() const;
+		const std::string& getServer() const;
+		time_t getNickTs() const;
 
 
-		void setHostname(std::string hostname);
-		void setNickname(std::string nickname);
-		void setUsername(std::string username);
-		void setRealName(std::string realName);
-		void setPassword(std::string password);
-		void setBuffer(std::string buffer);
-		void setConnected(bool connected);
-		void setAuthenticated(bool authenticated);
-		void setIsPassValid(bool isPassValid);
-		void appendSendBuffer(std::string sendMsg);
-		void epollEventChange(uint32_t eventType); // any better name??
+		void setHostname(const std::string& hostname);
+		void setAddress(const std::string& address);
+		void setNickname(const std::string& nickname);
+		void setUsername(const std::string& username);
+		void setRealName(const std::string& realName);
+		void setPassword(const std::string& password);
+		void setBuffer(const std::string& buffer);
+		void setState(ClientState state);
+		bool completeRegistration();
+		void setReadPaused(bool readPaused);
+		void setWaitingForList(bool waitingForList);
+		void setServerOperator(bool serverOperator);
+		void setServer(const std::string& server);
+		void setNickTs(time_t nickTs);
+		void clearPendingFlush();
+		void appendSendBuffer(const std::string& sendMsg);
 
 		//------ CHANNEL -------
 		void addToJoinedChannelList(const std::string &channelName);
 		bool isInChannel(const std::string& channelName);
 		void leaveChannel(const std::string &channelName);
 		const std::set<std::string> &getJoinedChannels() const;
+
+		//------ MONITOR -------
+		bool addMonitored(const std::string& key, const std::string& nickname);	// false when already monitored
+		bool removeMonitored(const std::string& key);
+		void clearMonitored();
+		const std::map<std::string, std::string>& getMonitored() const;
 };
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include <sys/epoll.h>
+#include "IoBackend.hpp"
+#include "macros.hpp"
+
+// Readiness based backend: level triggered epoll, one recv()/writev() per ready socket
+class EpollBackend : public IoBackend {
+	private:
+		int					epollFd_;
+		int					listenFd_;
+		int					wakeFd_;
+		std::vector<uint8_t>	readEnabled_;	//-> per fd, EPOLLIN wanted
+		std::vector<uint8_t>	writeWanted_;	//-> per fd, output left over after the last send
+		std::vector<uint32_t>	registered_;	//-> per fd, mask currently known to epoll
+		char				readBuf_[BUF_SIZE];
+		struct epoll_event	events_[MAX_EVENTS];
+
+		void	growTo(int fd);
+		void	updateEvents(int fd);
+
+	public:
+		EpollBackend();
+		~EpollBackend();
+
+		const char*	getName() const override;
+		bool	supportsHandover() const override;
+		void	addListener(int listenFd) override;
+		void	addWakeup(int fd) override;
+		void	addClient(int clientFd) override;
+		void	removeClient(int clientFd) override;
+		void	setReadEnabled(int clientFd, bool enabled) override;
+		ssize_t	send(int clientFd, const struct iovec* iov, int iovCount) override;
+		int		wait(IoHandler& handler, int timeoutMs) override;
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ChannelHistory.hpp"
+
+#define HISTORY_SEGMENT_BYTES 16777216		// default --history-segment, a channel starts a new segment past this
+#define HISTORY_RETAIN_BYTES 1073741824		// default --history-retain, per channel, oldest segments are deleted past this
+#define HISTORY_INDEX_STRIDE 4096			// log bytes between two entries of the sparse index
+#define HISTORY_OPEN_CHANNELS 64			// channels whose active segment stays open, least recently written closes first
+#define HISTORY_SYNC_MS 1000				// written data is fdatasync()ed at most this long after it was queued
+#define HISTORY_RECORD_HEADER 20			// msgid, time and line length in front of every line
+
+// On-disk channel history, everything the channel rings record is appended here as well. Layout under
+// the directory: one subdirectory per channel (name %XX escaped), holding segments named after their
+// first msgid, 20 digits so they sort by name:
+//   <msgid>.log  records: u64 msgid, u64 time ms, u32 length, then the line with its CRLF
+//   <msgid>.idx  sparse index: u64 msgid, u64 time ms, u64 log offset of the first record of every
+//                block, a block starting at least HISTORY_INDEX_STRIDE bytes after the previous one
+// Within a channel msgids increase and times never decrease, so both index by binary search.
+//
+// A single writer thread owns the files: the event loop only queues appends and queries and picks up
+// answers, it never waits on the disk. Queries map the segments they touch read-only, answers come
+// back through takeResults() and the wake fd (an eventfd) makes the loop look for them
+struct HistoryQuery {
+	uint64_t	id;
+	std::string	channel;
+	HistoryRef	after;
+	HistoryRef	before;
+	size_t		limit;
+	bool		newest;		//-> the newest lines of the range, like ChannelHistory::select()
+};
+
+struct HistoryResult {
+	uint64_t	id;
+	std::string	channel;
+	std::vector<HistoryEntry>	entries;	//-> oldest first
+};
+
+struct HistoryStoreStats {
+	uint64_t	segments;
+	uint64_t	bytes;			//-> log and index files together
+	uint64_t	records;		//-> appended since startup
+	uint64_t	queries;
+	uint64_t	writeErrors;
+};
+
+class HistoryStore {
+	private:
+		struct IndexEntry {
+			uint64_t	msgId;
+			uint64_t	timeMs;
+			uint64_t	offset;
+		};
+		struct Segment {
+			std::string	path;			//-> without the .log/.idx extension
+			uint64_t	firstId;
+			uint64_t	lastId;
+			uint64_t	firstTime;
+			uint64_t	lastTime;
+			uint64_t	logBytes;
+			uint64_t	idxBytes;
+			uint64_t	lastIndexed;	//-> log offset of the last index entry
+		};
+		struct ChannelLog {
+			std::string	dir;
+			std::vector<Segment>	segments;	//-> oldest first, the last one is written to
+			uint64_t	bytes;
+			int			logFd;			//-> of the last segment, -1 while closed
+			int			idxFd;
+			uint64_t	lastUsed;
+			bool		dirty;			//-> written since the last fdatasync()
+			std::string	logBuffer;		//-> records of the current batch, written by flush()
+			std::string	idxBuffer;
+		};
+		struct Append {
+			std::string	channel;
+			HistoryEntry	entry;
+		};
+		struct Batch {
+			std::vector<Append>			appends;
+			std::vector<HistoryQuery>	queries;
+		};
+
+		std::string		dir_;
+		uint64_t		segmentBytes_;
+		uint64_t		retainBytes_;
+		int				wakeFd_;
+		uint64_t		nextMsgId_;		//-> after the newest record found at startup
+		std::set<std::string>	recovered_;	//-> channels with records from before this run, read-only once started
+
+		Batch			pending_;		//-> loop side, handed over by submit()
+		std::mutex		lock_;
+		std::condition_variable	wakeWriter_;
+		Batch			queued_;		//-> guarded by lock_
+		std::vector<HistoryResult>	results_;	//-> guarded by lock_
+		bool			stopping_;		//-> guarded by lock_
+		std::thread		writer_;
+
+		// writer thread only
+		std::map<std::string, ChannelLog>	channels_;
+		uint64_t		useClock_;
+		int				openChannels_;
+		std::atomic<uint64_t>	segments_;
+		std::atomic<uint64_t>	bytes_;
+		std::atomic<uint64_t>	records_;
+		std::atomic<uint64_t>	queries_;
+		std::atomic<uint64_t>	writeErrors_;
+
+		void	recover();
+		void	recoverChannel(const std::string& name, const std::string& dir);
+		bool	recoverSegment(Segment& segment, bool last);
+		void	run();
+		ChannelLog*	writeRecord(const Append& append);
+		void	flush(ChannelLog& log);
+		bool	openSegment(ChannelLog& log, uint64_t firstId, uint64_t timeMs);
+		bool	reopen(ChannelLog& log);
+		void	closeFiles(ChannelLog& log);
+		void	closeLeastUsed();
+		void	syncDirty();
+		void	applyRetention(ChannelLog& log);
+		HistoryResult	answer(const HistoryQuery& query);
+		void	readSegment(const Segment& segment, const HistoryQuery& query, std::vector<HistoryEntry>& out);
+
+	public:
+		HistoryStore(const std::string& dir, uint64_t segmentBytes, uint64_t retainBytes);
+		~HistoryStore();
+
+		void	append(const std::string& channel, const HistoryEntry& entry);
+		void	query(const HistoryQuery& query);
+		void	submit();				//-> hands what was queued since the last call to the writer, once per loop iteration
+		void	takeResults(std::vector<HistoryResult>& results);
+
+		int			getWakeFd() const;
+		uint64_t	getNextMsgId() const;
+		bool		hadHistory(const std::string& channel) const;	//-> records from before this run exist
+		HistoryStoreStats	getStats() const;
+		const std::string&	getDir() const;
+};
+
+std::string	escapeChannelDir(const std::string& channel);
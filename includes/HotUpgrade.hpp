@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>	// pid_t
+#include "ChannelHistory.hpp"
+#include "StateSnapshot.hpp"
+
+#define UPGRADE_MAGIC "IRCUPGR"			// first 8 bytes of the handed over state, NUL included
+#define UPGRADE_VERSION 6				// old and new process must agree, a mismatch aborts the upgrade
+#define UPGRADE_TIMEOUT_MS 10000		// the new process gets this long to take over, then the old one carries on
+#define UPGRADE_DRAIN_MS 1000			// longest wait for CHATHISTORY answers from disk and LIST replies before handing over anyway
+#define UPGRADE_FDS_PER_MESSAGE 250		// descriptors per SCM_RIGHTS message, the kernel takes at most 253
+#define UPGRADE_READY '+'				// sent back by the new process once the state is rebuilt
+
+// A hot upgrade starts the binary again with --upgrade-fd=N, N being its end of a Unix socket pair.
+// The old process writes a u64 state size, a u64 descriptor count and the encoded UpgradeState, then
+// the descriptors: the listening socket first, the clients after it in the order of the state, with
+// SCM_RIGHTS in messages of UPGRADE_FDS_PER_MESSAGE. The new process rebuilds everything without
+// touching the sockets, answers UPGRADE_READY and waits for the old process to exit (the socket
+// reaches EOF) before it opens the history store, the stats segment and starts its loop
+struct ClientHandover {
+	std::string	hostname;
+	std::string	address;		//-> counted by admission control, empty for links this server dialed
+	std::string	nickname;
+	std::string	username;
+	std::string	realName;
+	std::string	password;
+	uint8_t		state;			//-> ClientState
+	bool		serverOperator;
+	bool		readPaused;
+	int64_t		nickTs;
+	std::string	readBuffer;		//-> received and not handled yet
+	std::string	output;			//-> queued and not written yet
+	std::vector<std::string>	monitored;	//-> MONITOR targets as the client gave them
+	uint32_t	captureId;		//-> connection id in the --capture file, 0 when not captured
+};
+
+struct ChannelHandover {
+	ChannelSnapshot	snapshot;	//-> operators: the ones still waiting to rejoin after a restart
+	std::vector<uint32_t>	members;	//-> indices into UpgradeState::clients
+	std::vector<uint32_t>	operators;
+	std::vector<uint32_t>	invited;
+	bool		historyTruncated;
+	std::vector<HistoryEntry>	history;	//-> oldest first
+};
+
+struct UpgradeState {
+	uint64_t	nextMsgId;
+	uint64_t	nextBatchId;
+	uint32_t	nextCaptureId;	//-> 0 when the old process did not capture
+	std::vector<ClientHandover>		clients;
+	std::vector<ChannelHandover>	channels;
+
+	void	encode(std::string& out) const;
+	bool	decode(const std::string& data, std::string& error);
+};
+
+// fork() and exec() of binary with args and --upgrade-fd=<its end of the pair>, returns the pid or -1
+pid_t	spawnUpgrade(const std::string& binary, const std::vector<std::string>& args, int& sock);
+bool	sendUpgradeState(int sock, const std::string& state, const std::vector<int>& fds);
+bool	awaitUpgradeReady(int sock);		//-> old process, false on a timeout or a new process that died
+bool	receiveUpgradeState(int sock, std::string& state, std::vector<int>& fds);
+bool	confirmUpgrade(int sock);			//-> new process, answers UPGRADE_READY and waits for the old one to exit
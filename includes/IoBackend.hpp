@@ -0,0 +1,117 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <memory>		// for std::unique_ptr
+#include <cstdint>
+#include <unistd.h>		// close
+#include <fcntl.h>		// open
+#include <sys/types.h>	// ssize_t
+#include <sys/uio.h>	// iovec
+#include <sys/socket.h>
+#include <netinet/in.h>	// sockaddr_in
+#include <netinet/tcp.h>	// TCP_NODELAY
+
+// Receives what the backend observed on its sockets. Called from inside IoBackend::wait(),
+// the read data pointer is only valid for the duration of the call
+class IoHandler {
+	public:
+		virtual ~IoHandler() {}
+
+		virtual void	onAccept(int clientFd, const struct sockaddr_in& clientAddr) = 0;
+		virtual void	onRead(int clientFd, const char* data, size_t len) = 0;
+		virtual void	onWritable(int clientFd) = 0;						//-> socket can take more output (readiness backends)
+		virtual void	onSendComplete(int clientFd, ssize_t result) = 0;	//-> one queued chunk finished (completion backends)
+		virtual void	onHangup(int clientFd) = 0;						//-> peer closed or the socket failed
+};
+
+// All client I/O of the server goes through this interface so the event loop does not care whether
+// readiness (epoll), completions (io_uring) or an in-process fake network (MemoryBackend) drive it.
+// Client fds are whatever the backend hands to onAccept(), the server never touches them directly
+class IoBackend {
+	protected:
+		uint64_t	syscalls_;			//-> syscalls issued by the backend, for syscalls/message comparisons
+		uint64_t	blockedNs_;			//-> time spent waiting in the kernel for events
+		uint64_t	acceptDrops_;		//-> connections closed on arrival because the process was out of descriptors
+		int			reserveFd_;			//-> /dev/null held open to make room for that, -1 when it could not be reopened
+
+		// replies are batched per loop iteration already, so do not let Nagle hold the batch back
+		bool	setNoDelay(int clientFd) {
+			int noDelay = 1;
+			syscalls_++;
+			return (setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay)) == 0);
+		}
+
+		// accept() failed with EMFILE or ENFILE: the connection stays pending and wakes the loop again and
+		// again. Giving up the reserve descriptor makes room to accept it and close it on the spot. Returns
+		// whether to log it, at 1, 2, 4, 8... drops so a flood does not flood the log too
+		bool	dropPendingConnection(int listenFd) {
+			if (reserveFd_ >= 0)
+				close(reserveFd_);
+			syscalls_ += 3;
+			int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+			if (fd >= 0) {
+				close(fd);
+				acceptDrops_++;
+			}
+			reserveFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+			return ((acceptDrops_ & (acceptDrops_ - 1)) == 0);
+		}
+
+	public:
+		static const ssize_t SEND_PENDING = -2;	//-> send() queued the data, results come through onSendComplete()
+
+		IoBackend() : syscalls_(0), blockedNs_(0), acceptDrops_(0), reserveFd_(open("/dev/null", O_RDONLY | O_CLOEXEC)) {}
+		virtual ~IoBackend() {
+			if (reserveFd_ >= 0)
+				close(reserveFd_);
+		}
+
+		virtual const char*	getName() const = 0;
+		virtual bool	usesSockets() const { return true; }	//-> false: the server skips its listening socket
+		// whether a hot upgrade can hand the sockets to another process as they are: nothing read from
+		// them or queued for them is held inside the backend between two wait() calls
+		virtual bool	supportsHandover() const { return false; }
+		virtual void	addListener(int listenFd) = 0;
+		virtual void	addClient(int clientFd) = 0;
+		virtual void	removeClient(int clientFd) = 0;
+		virtual void	setReadEnabled(int clientFd, bool enabled) = 0;
+		// returns bytes written, -1 on a dead socket or SEND_PENDING. Buffers handed over for a
+		// pending send must stay untouched until every chunk has been reported complete, a client
+		// destroyed before that gives them to retireSendQueue() instead of freeing them
+		virtual ssize_t	send(int clientFd, const struct iovec* iov, int iovCount) = 0;
+		// waits up to timeoutMs for activity and dispatches it to the handler, returns the number of
+		// events handled or -1 on error
+		virtual int		wait(IoHandler& handler, int timeoutMs) = 0;
+
+		// fd (an eventfd) turns readable when another thread has results for the loop: wait() returns and
+		// resets it, the server collects the results itself. Nothing to do for a backend that never blocks
+		virtual void	addWakeup(int fd) {
+			(void)fd;
+		}
+
+		// releases the connection for good, after removeClient() when the client is destroyed
+		virtual void	closeClient(int clientFd) {
+			close(clientFd);
+		}
+
+		// the send queue of a client destroyed after removeClient() with sends still pending: kept until
+		// their completions came back. Nothing is ever pending on a backend that writes right away
+		virtual void	retireSendQueue(int clientFd, std::deque<std::string>&& queue) {
+			(void)clientFd;
+			(void)queue;
+		}
+
+		// a connection the server does not take: one try at writing line, then it is closed. Never added
+		virtual void	refuseClient(int clientFd, const std::string& line) {
+			syscalls_ += 2;
+			if (::send(clientFd, line.data(), line.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {} // best effort
+			close(clientFd);
+		}
+
+		uint64_t	getSyscalls() const { return syscalls_; }
+		uint64_t	getBlockedNs() const { return blockedNs_; }
+		uint64_t	getAcceptDrops() const { return acceptDrops_; }
+};
+
+std::unique_ptr<IoBackend>	createIoBackend(const std::string& name);
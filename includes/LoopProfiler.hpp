@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#define LOOP_REPORT_INTERVAL 30			// seconds between loop summary log lines
+#define LOOP_SATURATION_PERCENT 80		// busy share of the loop that turns the summary into a warning
+
+// Cumulative event loop counters. Only the loop thread writes them, with relaxed atomic stores, so
+// any other reader can load them at any time without a lock and without slowing the loop down
+struct LoopCounters {
+	std::atomic<uint64_t>	iterations{0};
+	std::atomic<uint64_t>	events{0};			//-> returned by the backend wait()
+	std::atomic<uint64_t>	waitNs{0};			//-> blocked in epoll_wait() / io_uring_enter()
+	std::atomic<uint64_t>	readNs{0};			//-> accepting, receiving and buffering input
+	std::atomic<uint64_t>	dispatchNs{0};		//-> parsing lines and running command handlers
+	std::atomic<uint64_t>	flushNs{0};			//-> after the wait: timers, listings, history hand-over and writing queued output
+	std::atomic<uint64_t>	lines{0};			//-> protocol lines parsed
+	std::atomic<uint64_t>	bytesIn{0};
+	std::atomic<uint64_t>	bytesOut{0};
+	std::atomic<uint64_t>	maxBusyNs{0};		//-> longest iteration without the blocked part, since the last summary
+};
+
+// Splits every event loop iteration into wait, read, dispatch and flush time and logs a summary
+// every LOOP_REPORT_INTERVAL seconds
+class LoopProfiler {
+	private:
+		LoopCounters	counters_;
+		uint64_t		iterationDispatchNs_;	//-> dispatch time of the running iteration
+		uint64_t		lastReportAt_;
+		uint64_t		reported_[8];			//-> counter values at the last summary, as listed in reportIfDue()
+
+		static void		add(std::atomic<uint64_t>& counter, uint64_t value);
+
+	public:
+		LoopProfiler();
+
+		void	addDispatch(uint64_t ns);
+		void	addLine();
+		void	addBytesIn(size_t bytes);
+		void	addBytesOut(size_t bytes);
+		// waitCallNs is the whole backend wait() call, handlers included, blockedNs the part spent in the kernel
+		void	endIteration(int events, uint64_t waitCallNs, uint64_t blockedNs, uint64_t flushNs);
+		void	reportIfDue(uint64_t now);
+
+		const LoopCounters&	getCounters() const;
+};
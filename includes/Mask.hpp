@@ -0,0 +1,78 @@
+#pragma once
+
+#include <ctime>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define MASKLIST_ANCHOR_CHARS 64	// longest anchor a MaskList hashes, longer ones are cut
+
+// ASCII lower case, the case mapping nicknames are compared with (stringCompCaseIgnore())
+std::string	foldCase(std::string_view text);
+
+// IRC glob: * matches any run of characters, ? exactly one, everything else itself, without regard to
+// case. Compiled once per query so matching many names does not fold or parse the pattern again. The
+// literal text in front of the first wildcard is kept, a sorted index only has to look at the keys
+// starting with it
+class Mask {
+	private:
+		std::string	pattern_;	//-> folded
+		std::string	prefix_;	//-> folded, up to the first * or ?
+		std::string	suffix_;	//-> folded, after the last * or ?
+		bool		literal_;	//-> no wildcard at all, matching is comparing
+
+	public:
+		explicit Mask(std::string_view pattern);
+
+		bool				matches(std::string_view text) const;	//-> text is folded on the fly
+		const std::string&	getPattern() const;
+		const std::string&	getPrefix() const;
+		const std::string&	getSuffix() const;
+		bool				isLiteral() const;
+		bool				matchesAll() const;	//-> only *s, every name matches
+};
+
+// one entry of a channel ban, exception or invite exception list
+struct MaskEntry {
+	std::string	mask;		//-> nick!user@host, completed by MaskList::normalize()
+	std::string	setBy;
+	time_t		setAt;
+};
+
+// hostmask list compiled for matching many subjects against many masks. Each mask is filed under its
+// longest anchor, literal text a match has to contain at a known place: the start of the mask, its end,
+// or a run starting at a ! or @ (the user of *!ident@*, the host of *!*@10.0.*). Buckets are keyed by a
+// hash of the anchor. A subject hashes itself from the same places one character at a time and looks up
+// only the anchor lengths some mask has, so it runs the few masks that share an anchor with it instead
+// of the whole list. Masks with nothing to anchor on, *!*@* and the like, are run one by one
+class MaskList {
+	private:
+		struct Buckets {
+			std::unordered_map<uint64_t, std::vector<Mask>>	masks;	//-> anchor hash to the masks filed under it
+			uint64_t	lengths = 0;	//-> bit n-1 set when an anchor of n characters is in the map
+		};
+
+		std::vector<MaskEntry>	entries_;	//-> in the order they were set, for the list replies
+		std::unordered_set<std::string>	literals_;
+		Buckets		byPrefix_;
+		Buckets		bySuffix_;	//-> hashed from the last character backwards
+		Buckets		byInfix_;	//-> anchors starting at a ! or @
+		std::vector<Mask>	others_;
+
+		void	compile(const std::string& mask);
+		bool	runBuckets(const Buckets& buckets, std::string_view subject, size_t from, bool backwards) const;
+
+	public:
+		bool	add(const std::string& mask, const std::string& setBy, time_t setAt);	//-> false when already listed
+		bool	remove(const std::string& mask);	//-> false when not listed
+		void	clear();
+		bool	matches(std::string_view subject) const;	//-> nick!user@host
+		bool	empty() const;
+		size_t	size() const;
+		const std::vector<MaskEntry>&	getEntries() const;
+
+		static std::string	normalize(const std::string& mask);	//-> nick -> nick!*@*, user@host -> *!user@host
+};
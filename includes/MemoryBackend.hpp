@@ -0,0 +1,67 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include "IoBackend.hpp"
+#include "macros.hpp"
+
+// In-process fake network: connections are virtual fds, no kernel object behind them. The owner plays
+// the peers with connect(), deliver(), takeOutput() and disconnect() and runs the server through
+// Server::runIteration(). Events are handed out in the order they were queued and wait() never
+// blocks, so the same driver produces the same run every time
+class MemoryBackend : public IoBackend {
+	private:
+		enum EventType {
+			EVENT_ACCEPT,
+			EVENT_READ,
+			EVENT_WRITABLE,
+			EVENT_HANGUP
+		};
+		struct Event {
+			EventType	type;
+			int			fd;
+		};
+		struct Connection {
+			bool		open;			//-> between addClient() and removeClient()
+			bool		closed;			//-> the server destroyed its client
+			bool		hungUp;			//-> the peer disconnected
+			bool		readEnabled;
+			bool		readQueued;		//-> an EVENT_READ is waiting in events_
+			bool		writeWanted;	//-> the last send() was short
+			std::string	input;			//-> delivered, not read by the server yet
+			std::string	output;			//-> written by the server, not taken by the peer yet
+		};
+
+		std::vector<Connection>	conns_;		//-> by virtual fd, fds are never reused
+		std::deque<Event>	events_;
+		size_t				outputLimit_;	//-> output a peer buffers before send() writes short, 0 for no limit
+		char				readBuf_[BUF_SIZE];
+
+		Connection&	conn(int fd);
+		void		queueRead(int fd);
+
+	public:
+		explicit MemoryBackend(size_t outputLimit = 0);
+
+		// IoBackend
+		const char*	getName() const override;
+		bool	usesSockets() const override;
+		void	addListener(int listenFd) override;
+		void	addClient(int clientFd) override;
+		void	removeClient(int clientFd) override;
+		void	setReadEnabled(int clientFd, bool enabled) override;
+		ssize_t	send(int clientFd, const struct iovec* iov, int iovCount) override;
+		int		wait(IoHandler& handler, int timeoutMs) override;
+		void	closeClient(int clientFd) override;
+		void	refuseClient(int clientFd, const std::string& line) override;
+
+		// peer side
+		int			connect();								//-> accepted on the next wait()
+		void		deliver(int fd, const std::string& data);
+		std::string	takeOutput(int fd);						//-> also unblocks a server waiting to write
+		size_t		discardOutput(int fd);
+		void		disconnect(int fd);
+		bool		isClosed(int fd) const;					//-> the server dropped the connection
+		size_t		getPendingEvents() const;
+};
@@ -4,46 +4,97 @@
 #include <iostream>
 #include <algorithm> // transform
 #include <sys/socket.h> //-> needed for socket
-#include <sys/epoll.h>	//-> needed for epoll
 #include <netdb.h>      //-> needed for addrinfo
 #include <cstring>		//-> needed for memset etc.
 #include <unistd.h>		//-> needed for close etc.
 #include <fcntl.h>		//-> needed for fcntl
 #include <arpa/inet.h>	// Client IP  log "inet_ntop()"
+#include <netinet/tcp.h>	// TCP_NODELAY
 #include <map>			// for map
 #include <memory>		// for std::unique_ptr
 #include <vector>		// for vector
+#include <deque>
 #include <sstream>		// for istringstream
 #include <functional>   // for std::function
 #include <algorithm>	// for transform
 #include <csignal>		// for signal
-#include <regex>
 #include <ctime>
 #include <iomanip>  // put_time
 #include "../includes/macros.hpp"
 #include "../includes/Client.hpp"
 #include "../includes/Channel.hpp"
+#include "../includes/Stats.hpp"
+#include "../includes/LoopProfiler.hpp"
+#include "../includes/SharedStats.hpp"
+#include "../includes/TrafficCapture.hpp"
+#include "../includes/HistoryStore.hpp"
+#include "../includes/StateSnapshot.hpp"
+#include "../includes/HotUpgrade.hpp"
+#include "../includes/IoBackend.hpp"
+#include "../includes/ServerConfig.hpp"
+#include "../includes/Mask.hpp"
+#include "../includes/ChannelList.hpp"
 
 
 class Client;
 class Channel;
 
-class Server {
+class Server : public IoHandler {
+
+	friend class ServerBench;	//-> tools/microbench.cpp times the private hot paths
 
 	private:
 		int			port_;
 		std::string	password_;
 		int			serverSocket_;
-		int			epollFd;
+		ServerConfig	config_;
+		std::unique_ptr<IoBackend>	io_;	//-> epoll or io_uring, picked with --io
 		static volatile sig_atomic_t isRunning_;
+		static volatile sig_atomic_t upgradeRequested_;	//-> SIGUSR2 or UPGRADE, handled at the end of the loop iteration
 		struct addrinfo		hints_, *res_;
-		const std::string	serverName_ = "IRCS_SERV";
+		std::string	serverName_;	//-> --server-name, what linked servers know this one as
 
 		std::map<int, std::unique_ptr<Client>> clients_; //-> List of clients
 		std::map<std::string, Channel*>  channelMap_; //-> List of created channels
+		std::map<std::string, Client*>	nickIndex_;	//-> folded nickname to client, local and remote, for getClient()
+		std::multimap<std::string, Client*>	userIndex_;	//-> folded username of the registered users, for WHO masks
+		std::multimap<std::string, Client*>	hostIndex_;	//-> folded hostname of the registered users
+		std::map<std::string, std::set<Client*>>	watchers_;	//-> MONITOR: folded nickname to the local clients watching it
 
 		using CommandHandler = std::function<void(Client& client, const std::vector<std::string>& params)>;
 		std::map<std::string, CommandHandler> commands;
+		ServerStats	stats_;
+		LoopProfiler	profiler_;		//-> where each loop iteration spends its time
+		std::unique_ptr<SharedStats>	sharedStats_;	//-> shared memory counters for ircstat, null when disabled
+		std::unique_ptr<TrafficCapture>	capture_;	//-> inbound traffic recorder, null unless --capture
+		SharedStatsValues	published_;	//-> last values written to sharedStats_, for the rates
+		uint64_t	publishedBusyNs_;
+		uint64_t	lastPublishAt_;
+		std::vector<int>	flushList_;	//-> clients with output queued during this loop iteration
+		std::vector<int>	flushing_;	//-> batch currently being flushed (swapped with flushList_)
+		uint64_t	nextMsgId_;		//-> msgid of the next line kept in channel history
+		uint64_t	nextBatchId_;	//-> reference of the next BATCH sent to a client
+		size_t		historyBytes_;	//-> all channel histories together, capped at HISTORY_TOTAL_MAX_BYTES
+		std::deque<std::pair<Channel*, uint64_t>>	historyOrder_;	//-> (channel, msgid) of the kept lines, oldest first
+		size_t		historyStale_;	//-> entries of historyOrder_ their channel already evicted
+		std::unique_ptr<HistoryStore>	historyStore_;	//-> on-disk history, null unless --history-dir
+		std::map<uint64_t, int>	historyQueries_;	//-> CHATHISTORY answered from disk: query id to client fd
+		uint64_t	nextQueryId_;
+		std::map<int, ListQuery>	listQueries_;	//-> LIST replies still being sent: client fd to filters and cursor
+		std::unique_ptr<StateSnapshot>	snapshot_;	//-> channel state saver, null unless --snapshot
+		std::string	snapshotCursor_;	//-> last channel added to the snapshot being taken, empty when none is
+		uint64_t	lastSnapshotAt_;
+		uint64_t	upgradeDeadline_;	//-> a requested upgrade stops waiting for CHATHISTORY answers and listings then, 0 when none is
+		std::vector<Client*>	links_;		//-> servers linked directly to this one, CLIENT_SERVER clients
+		std::map<std::string, RemoteServer>	servers_;	//-> every other server of the network by name
+		std::vector<std::unique_ptr<Client>>	remoteClients_;	//-> users on other servers, reached through their uplink
+		std::map<std::string, int>	dialing_;	//-> links this server is connecting to: name to fd
+		std::map<std::string, time_t>	nextDial_;	//-> when a link that is down is dialed again
+		uint64_t	lastLinkTick_;
+		AdmissionControl	admission_;	//-> per-address limits and load shedding for new connections
+		uint64_t	loopBusyNs_;	//-> moving average of the busy part of an iteration, what shedding looks at
+		uint64_t	lastRefusalLog_;	//-> refusals are logged at most once a second
+		uint64_t	refusedSinceLog_;
 
 		// private member functions used for the server setup within the Server constructor
 		void		initAddrInfo(); 		//-> init addrinfo struct settings
@@ -57,30 +108,91 @@ class Server {
 		void		customSignals(bool customSignals);
 
 		// dependent methods for "ServerActivity"
-		void		acceptNewClient(int epollFd);
+		void		acceptNewClient(int clientFd, const struct sockaddr_in& clientSocAddr);
 		std::string getClientIP(struct sockaddr_in clientSocAddr);
-		void		receiveData(int currentFD);
+		void		receiveData(int currentFD, const char* data, size_t len);
 		void		sendData(int currentFD);
+		void		flushClient(Client& client);
+		void		flushClients();
+		void		publishSharedStats(uint64_t now);
+		void		throttleClient(Client& client, const std::string& reason);
+		void		unthrottleClient(Client& client);
+		void		deliverHistoryResults();
+		void		continueLists();
+		bool		continueList(Client& client, ListQuery& query);
+		void		restoreSnapshot();
+		void		snapshotTick(uint64_t now);
+		void		hotUpgrade();
+		void		resumeUpgrade();
+
+		// server links, CommandsLink.cpp
+		void		linkTick(uint64_t now);
+		void		dialLink(const LinkBlock& link);
+		void		sendLinkHello(Client& client, const LinkBlock& link);
+		void		sendBurst(Client& link);
+		void		dropLink(Client& link);
+		void		removeServer(const std::string& name);
+		void		handleLinkLine(Client& link, const std::string& line);
+		void		linkServer(Client& link, const std::string& source, const std::vector<std::string>& params);
+		void		linkSquit(Client& link, const std::string& source, const std::vector<std::string>& params);
+		void		linkNick(Client& link, const std::vector<std::string>& params);
+		void		linkNickChange(Client& link, Client& user, const std::vector<std::string>& params);
+		void		linkKill(Client& link, const std::string& source, const std::vector<std::string>& params);
+		void		linkSjoin(Client& link, const std::string& source, const std::vector<std::string>& params);
+		void		linkTopicBurst(Client& link, const std::string& source, const std::vector<std::string>& params);
+		void		linkBmask(Client& link, const std::string& source, const std::vector<std::string>& params);
+		void		sendBmask(Client& link, bool onward, const std::string& source, Channel& channel, char list, const std::vector<std::string>& masks);
+		bool		resolveNickCollision(Client& link, const std::string& nick, time_t nickTs);
+		void		killClient(Client& user, const std::string& reason);
+		void		removeRemoteClient(Client& user, const std::string& reason);
+		void		resetChannelModes(Channel& channel, const std::string& source);
+		void		mergeChannelModes(Channel& channel, const std::string& source, const std::string& modes, const std::vector<std::string>& args);
+		std::string	nickLine(Client& client);
+		std::string	sjoinLine(const std::string& source, Channel& channel, const std::string& members);
+		void		propagate(const std::string& line, Client* except);
+
+		// nickname, username and host indexes
+		void		setClientNickname(Client& client, const std::string& nickname);
+		void		indexUser(Client& client);
+		void		unindexClient(Client& client);
+		void		announceRegistration(Client& client);
+		bool		watchNickname(Client& client, const std::string& nickname);
+		void		unwatchNickname(Client& client, const std::string& nickname);
+		void		unwatchAll(Client& client);
+		void		notifyWatchers(const std::string& nickname, Client* user);
+		std::string	whoReply(Client& client, Client& user, Channel* channel, bool whox, const std::string& fields, const std::string& token);
 
 		std::pair<std::string, std::vector<std::string>> parseCommand(const std::string& line);
 
 	public:
-		Server(int port, std::string password);
+		Server(int port, std::string password, const ServerConfig& config = ServerConfig());
+		Server(int port, std::string password, const ServerConfig& config, std::unique_ptr<IoBackend> io);
 		~Server();
 
+		// IoHandler
+		void		onAccept(int clientFd, const struct sockaddr_in& clientAddr) override;
+		void		onRead(int clientFd, const char* data, size_t len) override;
+		void		onWritable(int clientFd) override;
+		void		onSendComplete(int clientFd, ssize_t result) override;
+		void		onHangup(int clientFd) override;
+
 		void		startServer();
+		int			runIteration(int timeoutMs);
 		void		processBuffer(Client& client);
 		void		registerCommands();
 		void		closeServer();
 		void		closeClient(Client& client);
+		void		flushAndClose(Client& client);	//-> closeClient() once what is queued was handed to the backend
 
 		int			getPort() const;
 		int			getServerSocket() const;
 		std::string	getPassword() const;
 		std::string	getServerName() const;
+		const ServerStats&	getStats() const;
 
 		// CLIENT
 		Client* 	getClient(const std::string& nickName);
+		bool		findUsers(const Mask& mask, bool opersOnly, std::vector<Client*>& users);
 
 		// CHANNEL
 		bool 		channelExists(const std::string& channelName);
@@ -108,11 +220,20 @@ class Server {
 		void		handleMode(Client& client, const std::vector<std::string>& params);
 		void 		handleChannelMode(Client& client, Channel &channel, const std::vector<std::string>& params);
 		void		handleKick(Client& client, const std::vector<std::string>& params);
+		void		handlePart(Client& client, const std::vector<std::string>& params);
 		void		handleJoin(Client& client, const std::vector<std::string>& params);
 		void		handlePrivMsg(Client& client, const std::vector<std::string>& params);
 		void		handleInvite(Client& client, const std::vector<std::string>& params);
 		void		handleTopic(Client& client, const std::vector<std::string>& params);
 		void		handleWhois(Client& client, const std::vector<std::string>& params);
+		void		handleWho(Client& client, const std::vector<std::string>& params);
+		void		handleMonitor(Client& client, const std::vector<std::string>& params);
+		void		handleOper(Client& client, const std::vector<std::string>& params);
+		void		handleStats(Client& client, const std::vector<std::string>& params);
+		void		handleChatHistory(Client& client, const std::vector<std::string>& params);
+		void		handleList(Client& client, const std::vector<std::string>& params);
+		void		handleUpgrade(Client& client, const std::vector<std::string>& params);
+		void		handleServer(Client& client, const std::vector<std::string>& params);
 		void		handleSingleMode(Client &client, Channel &channel, const char &operation, char &modeChar,
 						const std::string &modeParam, const std::vector<std::string>& params);
 
@@ -122,22 +243,28 @@ class Server {
 		void 		channelKeyMode(Client& client, Channel& channel, char operation, const std::string& key);
 		void		topicRestrictionMode(Client& client, Channel& channel, char operation);
 		void		operatorMode(Client& client, Channel& channel, char operation, const std::string& user);
+		void		maskListMode(Client& client, Channel& channel, char operation, char list, const std::string& mask);
+		void		sendMaskList(Client& client, Channel& channel, char list);
 		bool		isValidUserLimit(const std::string& str, int& userLimit);
 		bool 		checkInvitation(Client &client, Channel &channel);
 		bool		checkChannelLimit(Client &client, Channel &channel);
 		bool		stringCompCaseIgnore(const std::string &str1, const std::string &str2);
 		bool		isNickDuplicate(std::string  userName);
-		bool		isNickUserValid(std::string cmd, std::string name);
+		bool		isNickUserValid(const std::string& cmd, const std::string& name);
 
 		// MESSAGE Handle Methods
-		void		messageHandle(int code, Client &client, std::string cmd, const std::vector<std::string>& params);
-		void		messageHandle(Client &client, std::string cmd, const std::vector<std::string>& params);
-		std::string	createMessage(int code, Client &client, std::string cmd, const std::vector<std::string>& params);
-		void		messageToClient(Client &targetClient, Client &fromClient, std::string command, const std::string msgToSend);
-		void		messageToClient(Client &targetClient, Client &fromClient, std::string command, const std::string msgToSend, std::string channelName);
-		void		messageBroadcast(Channel &targetChannel, Client &fromClient, std::string command, const std::string msgToSend);
-		void		messageBroadcast(Client &fromClient, std::string command, const std::string msgToSend);
+		void		messageHandle(int code, Client &client, const std::string& cmd, const std::vector<std::string>& params);
+		void		messageHandle(Client &client, const std::string& cmd, const std::vector<std::string>& params);
+		std::string	createMessage(int code, Client &client, const std::string& cmd, const std::vector<std::string>& params);
+		void		messageToClient(Client &targetClient, Client &fromClient, const std::string& command, const std::string& msgToSend);
+		void		messageToClient(Client &targetClient, Client &fromClient, const std::string& command, const std::string& msgToSend, const std::string& channelName);
+		void		messageBroadcast(Channel &targetChannel, Client &fromClient, const std::string& command, const std::string& msgToSend);
+		void		messageBroadcast(Client &fromClient, const std::string& command, const std::string& msgToSend);
+		void		sendFail(Client &client, const std::string& command, const std::string& code, const std::string& context, const std::string& description);
+		void		recordHistory(Channel &channel, std::shared_ptr<const std::string> line);
+		void		sendHistoryBatch(Client &client, const std::string& channelName, const std::vector<const HistoryEntry*>& entries);
 };
 
 // To track server activity
 void	logMessage(logMsgType type, const std::string &action, const std::string &msg);
+std::vector<std::string>	split(const std::string& input, const char delmiter);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <vector>
+#include "HistoryStore.hpp"
+#include "StateSnapshot.hpp"
+#include "ServerLink.hpp"
+#include "Admission.hpp"
+
+// Optional settings given after <port> <password> as --key=value
+struct ServerConfig {
+	std::string	ioBackend = "epoll";	//-> --io=epoll|uring
+	std::string	operName;				//-> --oper=name:password, OPER is refused when unset
+	std::string	operPassword;
+	std::string	captureFile;			//-> --capture=file records every inbound line for tools/ircreplay
+	std::string	shmName;				//-> --shm=/name for the stats segment, "off" disables it, default /ircserv-<port>
+	std::string	historyDir;				//-> --history-dir=path keeps channel history on disk, off when unset
+	uint64_t	historySegmentBytes = HISTORY_SEGMENT_BYTES;	//-> --history-segment=size, k/m/g suffixes
+	uint64_t	historyRetainBytes = HISTORY_RETAIN_BYTES;		//-> --history-retain=size per channel
+	std::string	snapshotFile;			//-> --snapshot=file saves channel state and restores it at startup
+	int			snapshotInterval = SNAPSHOT_INTERVAL;	//-> --snapshot-interval=seconds
+	std::string	upgradeBinary;			//-> set by main, started again by a hot upgrade (SIGUSR2 or UPGRADE)
+	std::vector<std::string>	upgradeArgs;	//-> set by main, the command line it gets: <port> <password> [options]
+	int			upgradeFd = -1;			//-> --upgrade-fd=N, only given to the new process by a hot upgrade
+	std::string	serverName = "IRCS_SERV";	//-> --server-name=name, unique within a network of linked servers
+	std::vector<LinkBlock>	links;		//-> --link=name:password[@host:port], once per server allowed to link
+	uint32_t	ipLimit = ADMISSION_IP_LIMIT;	//-> --ip-limit=N connections open at once per address, 0 for no limit
+	uint32_t	ipRate = ADMISSION_IP_RATE;		//-> --ip-rate=N new connections per minute and address, 0 for no limit
+	uint32_t	shedLatencyMs = ADMISSION_SHED_LATENCY_MS;	//-> --shed-latency=ms, 0 never sheds
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <ctime>
+
+#define LINK_PROTOCOL "TS"				// second PASS parameter of a server, tells it apart from a client
+#define LINK_PROTOCOL_VERSION "6"
+#define LINK_DESCRIPTION "ft_irc"			// what this server says about itself in SERVER
+#define LINK_RETRY_SEC 10				// a configured link that is down is dialed again this often
+#define LINK_TICK_MS 1000				// how often the loop looks for links to dial
+#define LINK_SJOIN_MEMBERS_BYTES 400	// member list of one burst SJOIN line, longer channels take several
+#define LINK_BMASK_BYTES 400			// masks of one BMASK line
+
+// Server links, nick based in the spirit of TS6. Both ends send PASS <password> TS 6 and
+// SERVER <name> 1 :<description>, the password has to match the --link block of that name on both
+// sides. Then each end bursts what it knows that the other does not:
+//   :<parent> SERVER <name> <hops> :<description>		servers behind it, parents first
+//   NICK <nick> <ts> <user> <host> <server> :<realname>		every user, ts is when it took the nick
+//   :<server> SJOIN <ts> <#channel> <+modes> [args] :[@]nick ...	members, @ for operators
+//   :<server> TB <#channel> <channel ts> <topic ts> :<topic>
+//   :<server> BMASK <channel ts> <#channel> <b|e|I> :<mask> ...	ban, exception and invex lists
+//   :<server> PING :<server>				answered with PONG, marks the end of the burst
+// After that users act through the link with their nickname as prefix (:nick PRIVMSG, PART, KICK, TOPIC,
+// MODE, INVITE, QUIT, NICK <new> :<ts>), joins go out as SJOIN. Channel PRIVMSG only goes to the links
+// that have members of the channel behind them, the other state changes to every link. A link that goes
+// down takes its servers and users with it (SQUIT to the rest of the network).
+//
+// Collisions are settled by timestamp the same way on both ends, so no extra round trip is needed:
+// of two users with one nick the one that took it first stays and the other is killed, both when they
+// took it in the same second. A channel created earlier keeps its modes and operators and the other side
+// loses its own, the same creation time merges both
+struct LinkBlock {
+	std::string	name;			//-> --link=name:password[@host:port]
+	std::string	password;
+	std::string	host;			//-> empty: the other end dials, this one only accepts
+	int			port = 0;
+};
+
+// another server of the network, known from a SERVER line
+struct RemoteServer {
+	std::string	parent;			//-> the server that introduced it
+	int			hops;
+	std::string	description;
+	class Client*	uplink;		//-> the direct link it is reached through
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#define SHM_STATS_MAGIC 0x49524353u		// "IRCS"
+#define SHM_STATS_VERSION 1				// bump when SharedStatsValues changes
+#define SHM_STATS_INTERVAL_MS 1000		// how often the event loop publishes
+
+// Health counters the server publishes for out of band readers (tools/ircstat). Cumulative counters
+// never reset, rates are per second over the last publish interval
+struct SharedStatsValues {
+	uint64_t	pid;
+	uint64_t	startedAt;			//-> unix seconds
+	uint64_t	updatedAt;			//-> unix milliseconds of the last publish
+	uint64_t	clients;
+	uint64_t	channels;
+	uint64_t	linesIn;
+	uint64_t	bytesIn;
+	uint64_t	bytesOut;
+	uint64_t	linesPerSec;
+	uint64_t	bytesInPerSec;
+	uint64_t	bytesOutPerSec;
+	uint64_t	sendqBytes;			//-> output queued over all clients
+	uint64_t	sendqMaxBytes;		//-> longest single client queue
+	uint64_t	throttledClients;
+	uint64_t	throttleEvents;		//-> since the last STATS r, like the evictions
+	uint64_t	sendqEvictions;
+	uint64_t	loopIterations;
+	uint64_t	loopBusyPermille;	//-> share of the interval the loop was not blocked in the kernel
+	uint64_t	loopMaxIterationUs;	//-> longest busy iteration since the last loop summary
+};
+
+// Memory layout of the segment. Seqlock: the single writer makes seq odd, stores the words and makes
+// it even again, a reader retries until it saw the same even seq before and after copying. Readers
+// never write to the segment, so they cannot stall the server however often they poll
+struct SharedStatsBlock {
+	uint32_t				magic;
+	uint32_t				version;
+	uint32_t				valueCount;		//-> words in values[], lets a reader detect layout changes
+	uint32_t				reserved;
+	std::atomic<uint64_t>	seq;
+	std::atomic<uint64_t>	values[sizeof(SharedStatsValues) / sizeof(uint64_t)];
+};
+
+// copies a consistent snapshot, false while the writer is mid-update or the segment is foreign
+inline bool readSharedStats(const SharedStatsBlock* block, SharedStatsValues& out) {
+	if (block->magic != SHM_STATS_MAGIC || block->version != SHM_STATS_VERSION
+		|| block->valueCount != sizeof(SharedStatsValues) / sizeof(uint64_t))
+		return (false);
+	uint64_t before = block->seq.load(std::memory_order_acquire);
+	if (before & 1)
+		return (false);
+	uint64_t words[sizeof(SharedStatsValues) / sizeof(uint64_t)];
+	for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+		words[i] = block->values[i].load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (block->seq.load(std::memory_order_relaxed) != before)
+		return (false);
+	std::memcpy(&out, words, sizeof(out));
+	return (true);
+}
+
+// Writer side, owned by the server. The segment is /ircserv-<port> unless --shm names another one
+class SharedStats {
+	private:
+		std::string			name_;
+		SharedStatsBlock*	block_;
+
+	public:
+		explicit SharedStats(const std::string& name);
+		~SharedStats();
+
+		void	publish(const SharedStatsValues& values);
+		const std::string&	getName() const;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SNAPSHOT_MAGIC "IRCSNAP"			// first 8 bytes of a snapshot file, NUL included
+#define SNAPSHOT_VERSION 3					// bump when the record layout changes, older versions stay loadable
+#define SNAPSHOT_HEADER_SIZE 32				// magic, version, channel count, reserved, creation time
+#define SNAPSHOT_INTERVAL 60				// default --snapshot-interval, seconds between two snapshots
+#define SNAPSHOT_CHANNELS_PER_ITERATION 4096	// channels serialized per loop iteration while a snapshot is taken
+
+class Channel;
+
+// Channel state that survives a restart: modes, key, limit, topic, creation and topic times, the
+// operators and the ban, exception and invite exception lists. Members, invites and history do not, the
+// clients reconnect and history has its own store. An operator is kept as Channel::operatorKey() and
+// only a client with the same nickname, user and address gets +o back.
+//
+// File layout: header (magic, u32 version, u32 channel count, u64 reserved, u64 creation time in ms),
+// then per channel u16 name length and name, u16 key length and key, u16 topic length and topic, u8
+// flags (SNAPSHOT_FLAG_*), i32 user limit, u16 operator count and per operator u8 length and key.
+// Since version 2 a u16 mask count follows, per mask u8 list ('b', 'e' or 'I'), u16 length and mask,
+// u8 length and setter, i64 time set. Since version 3 i64 creation time and i64 topic time close the
+// record, and operators of older versions, saved by nickname alone, are dropped. A u64 FNV-1a hash of
+// everything before it closes the file
+enum SnapshotFlags {
+	SNAPSHOT_FLAG_KEY = 1,
+	SNAPSHOT_FLAG_INVITE_ONLY = 2,
+	SNAPSHOT_FLAG_TOPIC_OPS = 4
+};
+
+struct MaskSnapshot {
+	char		list;		//-> 'b', 'e' or 'I'
+	std::string	mask;
+	std::string	setBy;
+	int64_t		setAt;
+};
+
+struct ChannelSnapshot {
+	std::string	name;
+	std::string	key;
+	std::string	topic;
+	uint8_t		flags;
+	int32_t		userLimit;
+	std::vector<std::string>	operators;
+	std::vector<MaskSnapshot>	masks;
+	int64_t		createdAt;	//-> 0 when unknown, before version 3
+	int64_t		topicTime;
+};
+
+// Taken in slices: begin(), add() for every channel spread over loop iterations, then commit() hands the
+// finished buffer to a thread that writes it next to the target, syncs it and renames it over the old
+// file. A crash at any point leaves either the previous snapshot or the new one, never a mix
+class StateSnapshot {
+	private:
+		std::string		path_;
+		std::string		buffer_;		//-> snapshot being taken
+		uint32_t		count_;
+		std::thread		writer_;
+		std::atomic<bool>	writing_;	//-> the writer thread has not finished the last commit()
+		std::atomic<bool>	failed_;	//-> the last write failed, logged by the thread
+
+		void	appendString(const std::string& str, size_t lengthBytes);
+		bool	writeFile(const std::string& data);
+
+	public:
+		explicit StateSnapshot(const std::string& path);
+		~StateSnapshot();
+
+		void	begin();
+		void	add(const Channel& channel);
+		void	commit(bool wait);		//-> wait: write on the calling thread, used at shutdown
+		bool	isWriting() const;
+		size_t	getCount() const;
+		const std::string&	getPath() const;
+
+		static uint8_t	flagsOf(const Channel& channel);	//-> SNAPSHOT_FLAG_* of the channel modes
+		static std::vector<MaskSnapshot>	masksOf(const Channel& channel);	//-> +b, then +e, then +I
+		// false with error set on a damaged or unknown file, true with no channels when there is no file
+		static bool	load(const std::string& path, std::vector<ChannelSnapshot>& channels, std::string& error);
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <chrono>
+
+// nanoseconds on the monotonic clock, served by the vDSO so taking a timestamp costs no syscall
+inline uint64_t statsNow() {
+	return (std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// HDR style log-linear histogram: every power of two range is split into 32 linear sub buckets, so
+// a reported percentile is within ~3% of the recorded value. Fixed size, recording is a bit scan and an increment
+class LatencyHistogram {
+	public:
+		static const int SUB_BITS = 5;
+		static const int SUB_COUNT = 1 << SUB_BITS;
+		static const int BUCKET_COUNT = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+	private:
+		uint64_t	counts_[BUCKET_COUNT];
+		uint64_t	total_;
+		uint64_t	sum_;
+		uint64_t	max_;
+
+		static int		bucketIndex(uint64_t value);
+		static uint64_t	bucketValue(int index);
+
+	public:
+		LatencyHistogram();
+
+		void		record(uint64_t value);
+		void		reset();
+		uint64_t	percentile(double p) const;	//-> p in [0, 1]
+		uint64_t	getCount() const;
+		uint64_t	getMean() const;
+		uint64_t	getMax() const;
+};
+
+// parts of the event loop that get their own latency histogram
+enum StatsPhase {
+	PHASE_PARSE,		//-> splitting a line into command and params
+	PHASE_DISPATCH,		//-> running the command handler
+	PHASE_BROADCAST,	//-> fanning a message out to a channel
+	PHASE_FLUSH,		//-> writing the queued output at the end of a loop iteration
+	PHASE_COUNT
+};
+
+const char*	statsPhaseName(StatsPhase phase);
+
+// Server wide counters, updated from the event loop
+struct ServerStats {
+	uint64_t	throttleEvents = 0;		//-> times a client was paused because its output queue backed up
+	uint64_t	throttledClients = 0;	//-> clients currently paused
+	uint64_t	sendqEvictions = 0;		//-> clients closed because their output queue hit SENDQ_HARD_LIMIT
+	uint64_t	linesIn = 0;			//-> protocol lines parsed
+	uint64_t	bytesIn = 0;
+	uint64_t	bytesOut = 0;
+	uint64_t	resetAt = statsNow();	//-> when counting started, for rates
+
+	std::map<std::string, LatencyHistogram>	commandLatency;		//-> handler run time per command, ns
+	LatencyHistogram	phaseLatency[PHASE_COUNT];				//-> ns
+	std::map<int, uint64_t>	errorNumerics;						//-> error replies sent, per numeric
+
+	void	reset(); //-> everything except the throttledClients gauge
+};
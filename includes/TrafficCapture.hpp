@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#define CAPTURE_MAGIC "IRCCAP"			// first 6 bytes of a capture file
+#define CAPTURE_VERSION 1				// bump when the record layout changes
+#define CAPTURE_HEADER_SIZE 16			// magic, version, reserved byte, start time
+#define CAPTURE_FLUSH_BYTES 65536		// records are written out in blocks of about this size
+
+// Record layout after the header: type byte, varint nanoseconds since the previous record, varint
+// connection id and for lines a varint length plus the line without "\r\n". Connection ids count up
+// from 1 per accepted client, unlike fds they are never reused within a capture. A hot upgrade hands
+// the ids over and the new process appends to the same file, so the capture spans both processes
+enum CaptureRecordType {
+	CAPTURE_OPEN = 1,
+	CAPTURE_LINE = 2,
+	CAPTURE_CLOSE = 3
+};
+
+struct CaptureRecord {
+	CaptureRecordType	type;
+	uint64_t			timeNs;			//-> since the capture started
+	uint32_t			connection;
+	std::string			line;
+};
+
+inline bool readCaptureVarint(const std::string& data, size_t& offset, uint64_t& value) {
+	value = 0;
+	for (int shift = 0; shift < 64 && offset < data.size(); shift += 7) {
+		uint8_t byte = data[offset++];
+		value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return (true);
+	}
+	return (false);
+}
+
+// decodes the record at offset, timeNs has to hold the previous record's time. False at the end of
+// the data or on a truncated record (a server killed without flushing)
+inline bool readCaptureRecord(const std::string& data, size_t& offset, CaptureRecord& record) {
+	if (offset >= data.size())
+		return (false);
+	uint64_t delta, connection, length = 0;
+	uint8_t type = data[offset++];
+	if (type < CAPTURE_OPEN || type > CAPTURE_CLOSE || !readCaptureVarint(data, offset, delta)
+		|| !readCaptureVarint(data, offset, connection)
+		|| (type == CAPTURE_LINE && !readCaptureVarint(data, offset, length)) || length > data.size() - offset)
+		return (false);
+	record.type = static_cast<CaptureRecordType>(type);
+	record.timeNs += delta;
+	record.connection = connection;
+	record.line.assign(data, offset, length);
+	offset += length;
+	return (true);
+}
+
+// Writer side, owned by the server when started with --capture=file. Lines are recorded as
+// processBuffer() handles them, so a throttled client's lines carry the time they were processed
+class TrafficCapture {
+	private:
+		std::string		path_;
+		int				fd_;
+		std::string		buffer_;		//-> encoded records not written yet
+		uint64_t		startNs_;
+		uint64_t		lastNs_;
+		uint32_t		nextConnection_;
+		std::map<int, uint32_t>	connections_;	//-> client fd to connection id
+
+		void	appendVarint(uint64_t value);
+		void	appendRecord(CaptureRecordType type, int clientFd, const char* line, size_t len);
+		void	flush();
+
+	public:
+		explicit TrafficCapture(const std::string& path, bool resume = false, uint32_t nextConnection = 1);
+		~TrafficCapture();
+
+		void	connectionOpened(int clientFd);
+		void	connectionResumed(int clientFd, uint32_t connection);
+		void	connectionClosed(int clientFd);
+		void	lineReceived(int clientFd, const std::string& line);
+		uint32_t	getConnectionId(int clientFd) const;
+		uint32_t	getNextConnection() const;
+		const std::string&	getPath() const;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <linux/io_uring.h>
+#include "IoBackend.hpp"
+#include "macros.hpp"
+
+#define URING_ENTRIES 4096			// submission queue size
+#define URING_CQ_ENTRIES 16384		// completion queue size
+#define URING_BUF_COUNT 4096		// provided receive buffers, power of two
+#define URING_BUF_GROUP 0			// buffer group id of the receive buffers
+
+// Completion based backend on raw io_uring syscalls: multishot accept, multishot recv into a
+// registered provided buffer ring and linked sends. One io_uring_enter() per loop iteration both
+// submits everything queued and waits for completions
+class UringBackend : public IoBackend {
+	private:
+		enum Op { OP_ACCEPT = 1, OP_RECV, OP_SEND, OP_CANCEL, OP_WAKEUP };
+
+		struct FdState {
+			uint16_t	gen;			//-> bumped on add/remove so completions of a closed fd are dropped
+			uint8_t		recvSeq;		//-> tells the current multishot recv apart from a cancelled one
+			bool		open;
+			bool		readEnabled;
+			bool		recvArmed;
+			uint32_t	sendsPending;	//-> SEND entries queued or in the kernel, one completion each
+		};
+
+		// a removed client whose sends had not all completed: its chunks live here until they have
+		struct Retired {
+			int			fd;
+			uint16_t	gen;			//-> generation the sends were queued with
+			uint32_t	sendsPending;
+			std::deque<std::string>	queue;
+		};
+
+		int				ringFd_;
+		int				listenFd_;
+		int				wakeFd_;
+		unsigned		sqEntries_;
+		unsigned		sqMask_;
+		unsigned		cqMask_;
+		unsigned		sqTail_;		//-> local tail, published on submit
+		unsigned		toSubmit_;
+		void*			sqRing_;
+		size_t			sqRingSize_;
+		void*			cqRing_;
+		size_t			cqRingSize_;
+		struct io_uring_sqe*	sqes_;
+		size_t			sqesSize_;
+		unsigned*		sqHead_;
+		unsigned*		sqTailPtr_;
+		unsigned*		sqArray_;
+		unsigned*		cqHead_;
+		unsigned*		cqTail_;
+		struct io_uring_cqe*	cqes_;
+
+		struct io_uring_buf_ring*	bufRing_;
+		size_t			bufRingSize_;
+		char*			bufPool_;
+		uint16_t		bufTail_;
+		std::vector<FdState>	fds_;
+		std::vector<Retired>	retired_;
+
+		static uint64_t	packUserData(Op op, int fd, uint16_t gen, uint8_t seq);
+		struct io_uring_sqe*	getSqe();
+		int		submit(unsigned minComplete, int timeoutMs);
+		void	recycleBuffer(uint16_t bid);
+		void	armAccept();
+		void	armWakeup();
+		void	armRecv(int fd);
+		void	cancel(uint64_t userData, int fd, uint32_t flags);
+		FdState&	state(int fd);
+		void	handleCompletion(IoHandler& handler, const struct io_uring_cqe& cqe);
+
+	public:
+		UringBackend();
+		~UringBackend();
+
+		const char*	getName() const override;
+		void	addListener(int listenFd) override;
+		void	addWakeup(int fd) override;
+		void	addClient(int clientFd) override;
+		void	removeClient(int clientFd) override;
+		void	setReadEnabled(int clientFd, bool enabled) override;
+		ssize_t	send(int clientFd, const struct iovec* iov, int iovCount) override;
+		void	retireSendQueue(int clientFd, std::deque<std::string>&& queue) override;
+		int		wait(IoHandler& handler, int timeoutMs) override;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <string_view>
+
+// Syntax checks for names and keys, each a length check plus one pass over a 256-entry character
+// table built at compile time: no allocation, no locale. The accepted sets are the ones of the
+// regexes they replace, tools/microbench.cpp checks both agree before timing them
+
+using CharTable = std::array<bool, 256>;
+
+constexpr CharTable makeCharTable(std::string_view chars) {
+	CharTable table{};
+	for (char c : chars)
+		table[static_cast<unsigned char>(c)] = true;
+	return (table);
+}
+
+#define VALID_LETTERS "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+#define VALID_DIGITS "0123456789"
+
+constexpr CharTable NICK_FIRST_CHARS = makeCharTable(VALID_LETTERS "[]\\`_^{}|");
+constexpr CharTable NICK_CHARS = makeCharTable(VALID_LETTERS VALID_DIGITS "-[]\\`_^{}|");
+constexpr CharTable USER_INVALID_CHARS = makeCharTable(" \t\n\v\f\r@");
+constexpr CharTable CHANNEL_NAME_INVALID_CHARS = makeCharTable(" ,\a:");
+constexpr CharTable CHANNEL_KEY_CHARS = makeCharTable(VALID_LETTERS VALID_DIGITS "!@#$%^&*()-_+=~");
+constexpr CharTable PASSWORD_CHARS = makeCharTable(VALID_LETTERS VALID_DIGITS);
+
+#define NICK_MAX_LEN 9
+#define USER_MAX_LEN 10
+#define CHANNEL_NAME_MAX_LEN 50
+#define CHANNEL_KEY_MAX_LEN 32
+#define PASSWORD_MIN_LEN 6
+#define PASSWORD_MAX_LEN 16
+
+// every character in table, or none of them when invert is set
+constexpr bool allCharsIn(std::string_view str, const CharTable& table, bool invert = false) {
+	for (char c : str)
+		if (table[static_cast<unsigned char>(c)] == invert)
+			return (false);
+	return (true);
+}
+
+// a letter or one of []\`_^{}| first, then those, digits and - up to 9 characters
+constexpr bool isValidNickname(std::string_view nick) {
+	return (!nick.empty() && nick.size() <= NICK_MAX_LEN
+		&& NICK_FIRST_CHARS[static_cast<unsigned char>(nick[0])]
+		&& allCharsIn(nick.substr(1), NICK_CHARS));
+}
+
+// anything but whitespace and @, 1-10 characters
+constexpr bool isValidUsername(std::string_view user) {
+	return (!user.empty() && user.size() <= USER_MAX_LEN && allCharsIn(user, USER_INVALID_CHARS, true));
+}
+
+// alphanumeric, 6-16 characters
+constexpr bool isValidPassword(std::string_view password) {
+	return (password.size() >= PASSWORD_MIN_LEN && password.size() <= PASSWORD_MAX_LEN
+		&& allCharsIn(password, PASSWORD_CHARS));
+}
+
+// # first, no space, comma, BEL or colon, up to 50 characters
+constexpr bool isValidChannelName(std::string_view name) {
+	return (!name.empty() && name.size() <= CHANNEL_NAME_MAX_LEN && name[0] == '#'
+		&& allCharsIn(name, CHANNEL_NAME_INVALID_CHARS, true));
+}
+
+// letters, digits and !@#$%^&*()-_+=~, 1-32 characters
+constexpr bool isValidChannelKey(std::string_view key) {
+	return (!key.empty() && key.size() <= CHANNEL_KEY_MAX_LEN && allCharsIn(key, CHANNEL_KEY_CHARS));
+}
+
+static_assert(isValidNickname("Wiz") && isValidNickname("[a]-9") && !isValidNickname("9lives")
+	&& !isValidNickname("abcdefghij") && !isValidNickname("a#b"));
+static_assert(isValidUsername("~guest") && !isValidUsername("a b") && !isValidUsername("user@host"));
+static_assert(isValidPassword("benchpass1") && !isValidPassword("short") && !isValidPassword("pass word"));
+static_assert(isValidChannelName("#ft_irc") && !isValidChannelName("ft_irc") && !isValidChannelName("#a,b"));
+static_assert(isValidChannelKey("s3cr3t!") && !isValidChannelKey("") && !isValidChannelKey("two words"));
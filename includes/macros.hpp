@@ -13,10 +13,22 @@
 #define MAX_CHAN_USER 100
 #define MAX_CHAN_TOTAL 1000
 #define CHAN_USER_LIMIT 100
+#define CHAN_MASK_LIST_MAX 1000	// entries of each +b, +e and +I list of a channel
 #define MAX_EVENTS 42
 #define MAX_MSG_LEN 512
+#define WHO_MAX_RESULTS 500			// replies to one WHO, more matches end with ERR_TOOMANYMATCHES
+#define MONITOR_MAX_TARGETS 100		// nicknames one client can MONITOR
+#define MONITOR_LINE_BYTES 400		// comma separated nicknames per MONITOR reply line
 #define BUF_SIZE 1024
+#define SENDQ_HIGH_WATERMARK 65536	// stop reading from a client once this much output is queued
+#define SENDQ_LOW_WATERMARK 16384	// resume reading once the output queue drains below this
+#define SENDQ_HARD_LIMIT 1048576	// evict a client whose queued output grows past this
+#define SENDQ_LINK_LIMIT 67108864	// the same for a server link, it carries everyone behind it
+#define SENDQ_CHUNK_SIZE 4096		// small replies are coalesced into chunks of this size
+#define SEND_IOV_MAX 64				// chunks handed to a single writev()
 
 enum logMsgType { INFO, WARNING, ERROR, DEBUG };
 
-#define DEBUG_MODE true // change it to false during evaluation
+#ifndef DEBUG_MODE
+#define DEBUG_MODE true // change it to false during evaluation, make release, lto and pgo build with it off
+#endif
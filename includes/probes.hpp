@@ -0,0 +1,23 @@
+#pragma once
+
+// USDT tracepoints for bpftrace/perf, compiled in with `make usdt` (-DUSE_USDT, needs sys/sdt.h from
+// systemtap-sdt-dev). A disabled probe is a single nop in the binary, without USE_USDT they vanish
+// (arguments land in an unevaluated sizeof so nothing is computed and nothing counts as unused).
+// Provider is "ircserv", see tools/bpftrace/ for scripts using them
+
+#ifdef USE_USDT
+# include <sys/sdt.h>
+# define PROBE_ACCEPT(fd, ip)						DTRACE_PROBE2(ircserv, accept, fd, ip)
+# define PROBE_RECV(fd, bytes)						DTRACE_PROBE2(ircserv, recv, fd, bytes)
+# define PROBE_SEND(fd, bytes)						DTRACE_PROBE2(ircserv, send, fd, bytes)
+# define PROBE_COMMAND(fd, command, durationNs)		DTRACE_PROBE3(ircserv, command, fd, command, durationNs)
+# define PROBE_BROADCAST(channel, members, bytes)	DTRACE_PROBE3(ircserv, broadcast, channel, members, bytes)
+# define PROBE_CLOSE(fd, nick)						DTRACE_PROBE2(ircserv, close, fd, nick)
+#else
+# define PROBE_ACCEPT(fd, ip)						do { (void)sizeof((fd, ip)); } while (0)
+# define PROBE_RECV(fd, bytes)						do { (void)sizeof((fd, bytes)); } while (0)
+# define PROBE_SEND(fd, bytes)						do { (void)sizeof((fd, bytes)); } while (0)
+# define PROBE_COMMAND(fd, command, durationNs)		do { (void)sizeof((fd, command, durationNs)); } while (0)
+# define PROBE_BROADCAST(channel, members, bytes)	do { (void)sizeof((channel, members, bytes)); } while (0)
+# define PROBE_CLOSE(fd, nick)						do { (void)sizeof((fd, nick)); } while (0)
+#endif
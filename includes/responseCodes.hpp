@@ -7,17 +7,37 @@
 #define	RPL_CREATED 			003 // Server creation"
 #define	RPL_MYINFO 				004 // <servername> <version> <available user modes> <available channel modes>"
 #define RPL_ISUPPORT	 		005
+#define RPL_STATSCOMMANDS		212 // <command> <count> <byte count> <remote count>
+#define RPL_ENDOFSTATS			219 // <stats letter> :End of STATS report
 #define RPL_UMODEIS 			221 // test
+#define RPL_STATSDEBUG			249 // free form STATS lines (latency and counters)
 #define RPL_WHOISUSER 			311
+#define RPL_ENDOFWHO			315 // <mask> :End of WHO list
 #define RPL_ENDOFWHOIS 			318
+#define RPL_WHOREPLY			352 // <channel> <user> <host> <server> <nick> <flags> :<hopcount> <realname>
+#define RPL_WHOSPCRPL			354 // WHOX, the fields the client asked for
+#define RPL_LISTSTART			321 // Channel :Users  Name
+#define RPL_LIST				322 // <channel> <users> :<topic>
+#define RPL_LISTEND				323 // :End of /LIST
 #define RPL_NOTOPIC				331
 #define RPL_TOPIC				332
 #define RPL_INVITING			341
 #define RPL_NAMREPLY			353
 #define RPL_ENDOFNAMES			366
+#define RPL_INVITELIST			346 // <channel> <mask> <set by> <set at>, +I
+#define RPL_ENDOFINVITELIST		347
+#define RPL_EXCEPTLIST			348 // <channel> <mask> <set by> <set at>, +e
+#define RPL_ENDOFEXCEPTLIST		349
+#define RPL_BANLIST				367 // <channel> <mask> <set by> <set at>
 #define RPL_ENDOFBANLIST		368 //Signals the end of the ban list
 #define RPL_PONG 				399
 #define RPL_CHANNELMODEIS		324
+#define RPL_YOUREOPER			381 // OPER succeeded
+#define RPL_UPGRADING			382 // UPGRADE accepted, numbered like RPL_REHASHING
+#define RPL_MONONLINE			730 // :nick!user@host[,nick!user@host]*
+#define RPL_MONOFFLINE			731 // :nick[,nick]*
+#define RPL_MONLIST				732 // :nick[,nick]*
+#define RPL_ENDOFMONLIST		733 // :End of MONITOR list
 
 
 // ****************ERROR CODES************** //
@@ -28,6 +48,7 @@
 #define ERR_CANNOTSENDTOCHAN	404 // When client cannot send msg (mode +m, +b, etc..)
 #define ERR_TOOMANYTARGETS		407 // When to many target client(user) or channel
 #define ERR_NOORIGIN 			409
+#define ERR_TOOMANYMATCHES		416 // <command> <mask> :Output too large, truncated
 #define ERR_NORECIPIENT 		411
 #define ERR_NOTEXTTOSEND		412 // when PRIVMSG has no text to send
 #define ERR_UNKNOWNCOMMAND 		421
@@ -35,6 +56,7 @@
 #define ERR_ERRONEUSNICKNAME	432 // Erroneous nickname (e.g., contains forbidden characters)
 #define ERR_NICKNAMEINUSE 		433 // Nickname is already in use
 #define ERR_ERRONEUSUSER 		434 // Erroneous username
+#define ERR_BANNICKCHANGE		435 // NICK of a member banned on one of its channels
 #define ERR_USERNOTINCHANNEL	441 // target user of a command not on given channel
 #define ERR_NOTONCHANNEL		442 // client attempting a channel affecting command not a member on the channel
 #define ERR_USERONCHANNEL		443 // user already on the channel they were invited to
@@ -43,10 +65,15 @@
 #define ERR_ALREADYREGISTERED	462 // Tries when already registered
 #define ERR_PASSWDMISMATCH		464 // incorrect password
 #define ERR_CHANNELISFULL		471 // channel is full (user limit reached)
+#define ERR_NOPRIVILEGES		481 // command needs server operator privileges
+#define ERR_NOOPERHOST			491 // no oper block matches the given name
 #define ERR_INVITEONLYCHAN		473 // trying to join an invite-only channel without invitation
+#define ERR_BANNEDFROMCHAN		474 // JOIN matched by a +b mask
+#define ERR_BANLISTFULL			478 // <channel> <mode char> :Channel list is full
 #define ERR_BADCHANNELKEY		475
 #define ERR_BADCHANMASK			479 // channel name does not match the proper syntax
 #define	ERR_CHANOPRIVSNEEDED	482 // user doesn't have the required channel operator rights
+#define ERR_MONLISTFULL			734 // <limit> <targets> :Monitor list is full
 #define ERR_UMODEUNKNOWNFLAG	501
 #define ERR_UNKNOWNMODE			472
 #define ERR_USERSDONTMATCH		502
@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <iterator>
+#include "../includes/Admission.hpp"
+
+AdmissionControl::AdmissionControl(uint32_t ipLimit, uint32_t ipRate, uint32_t shedLatencyMs)
+	: ipLimit_(ipLimit), ipRate_(ipRate), shedLatencyNs_(static_cast<uint64_t>(shedLatencyMs) * 1000000ULL), sinceSweep_(0), verdicts_() {}
+
+void AdmissionControl::drain(Source& source, uint64_t now) const {
+	if (now > source.drainedAt)
+		source.bucket -= std::min(source.bucket, (now - source.drainedAt) * 1e-9 * ipRate_ / 60.0);
+	source.drainedAt = now;
+}
+
+// addresses with nothing open and an empty bucket carry no information, they go
+void AdmissionControl::sweep(uint64_t now) {
+	sinceSweep_ = 0;
+	for (auto it = sources_.begin(); it != sources_.end(); ) {
+		drain(it->second, now);
+		it = it->second.open == 0 && it->second.bucket <= 0 ? sources_.erase(it) : std::next(it);
+	}
+}
+
+AdmissionVerdict AdmissionControl::admit(const std::string& address, uint64_t now, uint64_t loopBusyNs) {
+	AdmissionVerdict verdict = ADMIT;
+	if (shedLatencyNs_ && loopBusyNs > shedLatencyNs_)
+		verdict = REFUSE_OVERLOAD;
+	else if (!isLoopback(address)) {
+		if (++sinceSweep_ >= ADMISSION_SWEEP_EVERY)
+			sweep(now);
+		Source& source = sources_[address];
+		drain(source, now);
+		if (ipLimit_ && source.open >= ipLimit_)
+			verdict = REFUSE_IP_LIMIT;
+		else if (ipRate_ && source.bucket + 1 > ADMISSION_IP_BURST)
+			verdict = REFUSE_IP_RATE;
+		else {
+			source.bucket += 1;
+			source.open++;
+		}
+	}
+	verdicts_[verdict]++;
+	return (verdict);
+}
+
+void AdmissionControl::restore(const std::string& address) {
+	if (!isLoopback(address))
+		sources_[address].open++;
+}
+
+void AdmissionControl::release(const std::string& address) {
+	auto source = sources_.find(address);
+	if (source != sources_.end() && source->second.open > 0)
+		source->second.open--;
+}
+
+size_t AdmissionControl::getTracked() const {
+	return (sources_.size());
+}
+
+uint64_t AdmissionControl::getCount(AdmissionVerdict verdict) const {
+	return (verdicts_[verdict]);
+}
+
+bool AdmissionControl::isLoopback(const std::string& address) {
+	return (address.compare(0, 4, "127.") == 0);
+}
+
+const char* AdmissionControl::reason(AdmissionVerdict verdict) {
+	switch (verdict) {
+		case REFUSE_OVERLOAD: return ("Server overloaded, try again later");
+		case REFUSE_IP_LIMIT: return ("Too many connections from your address");
+		case REFUSE_IP_RATE: return ("Connecting too fast, try again later");
+		default: return ("Admitted");
+	}
+}
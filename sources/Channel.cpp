@@ -5,7 +5,8 @@
 
 
 Channel::Channel(Client* client, const std::string &name, const std::string& key)
-	: name_(name), key_(""), keyProtected_(false), inviteOnly_(false), topicOperatorOnly_(true), userLimit_(-1), topic_("") {
+	: name_(name), key_(""), keyProtected_(false), inviteOnly_(false), topicOperatorOnly_(true), userLimit_(-1), topic_(""),
+	createdAt_(time(nullptr)), topicTime_(0) {
 
 	if (!key.empty() && (key != "x")) {
 		setChannelKey(key);
@@ -17,6 +18,36 @@ Channel::Channel(Client* client, const std::string &name, const std::string& key
 		logMessage(DEBUG, "CLIENT", "Client " + client->getNickname() + "set as operator.");
 }
 
+// quiet on purpose, a restart brings back every channel at once
+Channel::Channel(const ChannelSnapshot& snapshot)
+	: name_(snapshot.name), key_(snapshot.key), keyProtected_(snapshot.flags & SNAPSHOT_FLAG_KEY),
+	inviteOnly_(snapshot.flags & SNAPSHOT_FLAG_INVITE_ONLY), topicOperatorOnly_(snapshot.flags & SNAPSHOT_FLAG_TOPIC_OPS),
+	userLimit_(snapshot.userLimit), topic_(snapshot.topic), pendingOperators_(snapshot.operators.begin(), snapshot.operators.end()),
+	createdAt_(snapshot.createdAt ? snapshot.createdAt : time(nullptr)),
+	topicTime_(snapshot.topicTime || snapshot.topic.empty() ? snapshot.topicTime : createdAt_) {
+	for (const MaskSnapshot& mask : snapshot.masks)
+		if (mask.list == 'b' || mask.list == 'e' || mask.list == 'I')
+			maskList(mask.list).add(mask.mask, mask.setBy, mask.setAt);
+}
+
+Channel::Channel(const ChannelHandover& handover, const std::vector<Client*>& clients) : Channel(handover.snapshot) {
+	for (uint32_t index : handover.members)
+		members_.insert(clients[index]);
+	for (uint32_t index : handover.operators)
+		operators_.insert(clients[index]);
+	for (uint32_t index : handover.invited)
+		invited_.insert(clients[index]);
+	for (const HistoryEntry& entry : handover.history)
+		history_.add(entry);
+	if (handover.historyTruncated)
+		history_.markTruncated();
+}
+
+Channel::Channel(const std::string& name, time_t createdAt)
+	: name_(name), key_(""), keyProtected_(false), inviteOnly_(false), topicOperatorOnly_(false), userLimit_(-1), topic_(""),
+	createdAt_(createdAt), topicTime_(0) {
+}
+
 Channel::~Channel() {
 	members_.clear();
 	operators_.clear();
@@ -58,6 +89,7 @@ void Channel::addChannelMember(Client *client) {
 void Channel::removeMember(Client *client) {
 
  	size_t status =  members_.erase(client);
+	banCache_.erase(client);
  	if (status)
 		logMessage(DEBUG, "CHANNEL", "Member <" + client->getNickname() + "> is removed from channel " + this->getName());
  	else
@@ -81,11 +113,11 @@ void Channel::removeMember(Client *client) {
 		": Client " +  client->getNickname() + " added to invited list");
 }
 
-bool Channel::isKeyProtected() {
+bool Channel::isKeyProtected() const {
 	return (this->keyProtected_);
 }
 
-bool Channel::isInviteOnly() {
+bool Channel::isInviteOnly() const {
 	return inviteOnly_;
 }
 
@@ -96,35 +128,6 @@ bool Channel::isClientInvited(Client* client) const {
 	return false;
 }
 
-bool isValidChannelKey(const std::string &key) {
-
-	if (key.length() < 1 || key.length() > 32)
-		return false;
-
-	const std::string allowedSymbols = "!@#$%^&*()-_+=~";
-
-	for (char c: key) {
-		if (!std::isalnum(c) && allowedSymbols.find(c) == std::string::npos)
-			return false;
-	}
-	return true;
-}
-
-bool isValidChannelName(const std::string& name) {
-
-	if (name.empty() || name.size() > 50)
-		return false;
-	if (name[0] != '#')
-		return false;
-
-	static const std::string inavalidChar = " ,\a:";
-	for (size_t i = 0; i < name.size(); i++) {
-		if (inavalidChar.find(name[i]) != std::string::npos)
-			return false;
-	}
-	return true;
-}
-
 bool Channel::checkKey(Channel* channel, Client* client, const std::string& providedKey) {
 
 	if (!channel->isKeyProtected())
@@ -169,12 +172,21 @@ bool Channel::isTopicOperatorOnly() const {
 	return topicOperatorOnly_;
 }
 
-std::string Channel::getTopic() const {
+const std::string& Channel::getTopic() const {
 	return topic_;
 }
 
 void Channel::setTopic(const std::string& topic) {
 	topic_ = topic;
+	topicTime_ = time(nullptr);
+}
+
+time_t Channel::getTopicTime() const {
+	return topicTime_;
+}
+
+void Channel::setTopicTime(time_t topicTime) {
+	topicTime_ = topicTime;
 }
 
 void Channel::setTopicOperatorOnly(bool topicOperatorOnly) {
@@ -193,11 +205,11 @@ void Channel::setInviteOnly(bool inviteOnly) {
 	inviteOnly_ = inviteOnly;
 }
 
-std::string Channel::getChannelKey() const {
+const std::string& Channel::getChannelKey() const {
 	return this->key_;
 }
 
-std::string Channel::getName() const {
+const std::string& Channel::getName() const {
 	return this->name_;
 }
 
@@ -205,10 +217,34 @@ const std::set<Client*>& Channel::getMembers() const {
 	return members_;
 }
 
+ChannelHistory& Channel::getHistory() {
+	return history_;
+}
+
 const std::set<Client*>& Channel::getOperators() const {
 	return operators_;
 }
 
+const std::set<Client*>& Channel::getInvited() const {
+	return invited_;
+}
+
+const std::set<std::string>& Channel::getPendingOperators() const {
+	return pendingOperators_;
+}
+
+// the nickname alone is up for grabs after a restart, the user and the address it connected from are not
+bool Channel::takePendingOperator(const Client& client) {
+	std::string key = operatorKey(client);
+	return !key.empty() && pendingOperators_.erase(key) != 0;
+}
+
+std::string Channel::operatorKey(const Client& client) {
+	if (client.getAddress().empty())
+		return ("");
+	return (foldCase(client.getNickname()) + "!" + client.getUsername() + "@" + client.getAddress());
+}
+
 void Channel::setOperator(Client* client, bool isOperator) {
 	if (isOperator)
 		operators_.insert(client);
@@ -224,3 +260,69 @@ void Channel::setUserLimit(int userLimit) {
 int Channel::getUserLimit() const {
 	return userLimit_;
 }
+
+time_t Channel::getCreatedAt() const {
+	return createdAt_;
+}
+
+void Channel::setCreatedAt(time_t createdAt) {
+	createdAt_ = createdAt;
+}
+
+// BAN, EXCEPTION AND INVEX LISTS
+
+MaskList& Channel::maskList(char mode) {
+	return (mode == 'e' ? exceptions_ : mode == 'I' ? inviteExceptions_ : bans_);
+}
+
+const MaskList& Channel::getMaskList(char mode) const {
+	return (mode == 'e' ? exceptions_ : mode == 'I' ? inviteExceptions_ : bans_);
+}
+
+bool Channel::addMask(char mode, const std::string& mask, const std::string& setBy, time_t setAt) {
+	if (mode != 'I')
+		banCache_.clear();
+	return (maskList(mode).add(mask, setBy, setAt));
+}
+
+bool Channel::removeMask(char mode, const std::string& mask) {
+	if (mode != 'I')
+		banCache_.clear();
+	return (maskList(mode).remove(mask));
+}
+
+void Channel::clearMasks() {
+	bans_.clear();
+	exceptions_.clear();
+	inviteExceptions_.clear();
+	banCache_.clear();
+}
+
+// the host is whatever the client sent in USER, so nick!user@address is matched too: the address it
+// connected from is the one part it cannot choose. Remote users have no address here
+bool Channel::matchesClient(const MaskList& list, const Client& client) {
+	if (list.empty())
+		return (false);
+	if (list.matches(std::string_view(client.getClientIdentifier()).substr(1)))
+		return (true);
+	if (client.getAddress().empty() || client.getAddress() == client.getHostname())
+		return (false);
+	return (list.matches(client.getNickname() + "!" + client.getUsername() + "@" + client.getAddress()));
+}
+
+// every PRIVMSG to the channel asks, a member is matched against the lists again only after its
+// nick!user@host, its address or the lists changed. Someone joining is not remembered
+bool Channel::isBanned(Client& client) {
+	if (bans_.empty())
+		return (false);
+	if (!members_.count(&client))
+		return (matchesClient(bans_, client) && !matchesClient(exceptions_, client));
+	std::pair<uint64_t, bool>& verdict = banCache_[&client];
+	if (verdict.first != client.getIdentity())
+		verdict = {client.getIdentity(), matchesClient(bans_, client) && !matchesClient(exceptions_, client)};
+	return (verdict.second);
+}
+
+bool Channel::isInviteException(Client& client) const {
+	return (matchesClient(inviteExceptions_, client));
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include "../includes/ChannelHistory.hpp"
+
+// the entry, the payload string with its buffer and the shared_ptr control block
+size_t HistoryEntry::footprint() const {
+	return (sizeof(HistoryEntry) + sizeof(std::string) + line->capacity() + 2 * sizeof(void*));
+}
+
+bool HistoryRef::parse(const std::string& text, HistoryRef& ref) {
+	ref = HistoryRef{NONE, 0};
+	if (text == "*")
+		return (true);
+	if (text.compare(0, 6, "msgid=") == 0) {
+		const char* digits = text.c_str() + 6;
+		char* end;
+		ref.value = std::strtoull(digits, &end, 10);
+		ref.type = MSGID;
+		return (*digits && !*end);
+	}
+	if (text.compare(0, 10, "timestamp=") == 0) {
+		struct tm tm = {};
+		int millis = 0;
+		int consumed = 0;
+		if (std::sscanf(text.c_str() + 10, "%4d-%2d-%2dT%2d:%2d:%2d.%3dZ%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+			&tm.tm_hour, &tm.tm_min, &tm.tm_sec, &millis, &consumed) != 7 || text.size() != 10 + static_cast<size_t>(consumed))
+			return (false);
+		tm.tm_year -= 1900;
+		tm.tm_mon -= 1;
+		time_t seconds = timegm(&tm);
+		if (seconds < 0)
+			return (false);
+		ref.type = TIME;
+		ref.value = static_cast<uint64_t>(seconds) * 1000 + millis;
+		return (true);
+	}
+	return (false);
+}
+
+ChannelHistory::ChannelHistory() : bytes_(0), truncated_(false) {}
+
+size_t ChannelHistory::popOldest() {
+	size_t freed = entries_.front().footprint();
+	entries_.pop_front();
+	bytes_ -= freed;
+	truncated_ = true;
+	return (freed);
+}
+
+// server-time never goes backwards inside a ring so both kinds of reference can be binary searched
+const HistoryEntry& ChannelHistory::add(HistoryEntry entry) {
+	if (!entries_.empty() && entry.timeMs < entries_.back().timeMs)
+		entry.timeMs = entries_.back().timeMs;
+	bytes_ += entry.footprint();
+	entries_.push_back(std::move(entry));
+	while (entries_.size() > 1 && (entries_.size() > HISTORY_CHANNEL_MAX_LINES || bytes_ > HISTORY_CHANNEL_MAX_BYTES))
+		popOldest();
+	return (entries_.back());
+}
+
+size_t ChannelHistory::evictThrough(uint64_t msgId) {
+	if (entries_.empty() || entries_.front().msgId > msgId)
+		return (0);
+	return (popOldest());
+}
+
+size_t ChannelHistory::getBytes() const {
+	return (bytes_);
+}
+
+size_t ChannelHistory::getSize() const {
+	return (entries_.size());
+}
+
+uint64_t ChannelHistory::getOldestId() const {
+	return (entries_.empty() ? UINT64_MAX : entries_.front().msgId);
+}
+
+void ChannelHistory::markTruncated() {
+	truncated_ = true;
+}
+
+bool ChannelHistory::isTruncated() const {
+	return (truncated_);
+}
+
+static uint64_t refKey(const HistoryEntry& entry, HistoryRef::Type type) {
+	return (type == HistoryRef::MSGID ? entry.msgId : entry.timeMs);
+}
+
+std::vector<const HistoryEntry*> ChannelHistory::select(const HistoryRef& after, const HistoryRef& before, size_t limit, bool newest) const {
+	auto first = entries_.begin();
+	auto last = entries_.end();
+	if (after.type != HistoryRef::NONE)
+		first = std::partition_point(first, last, [&](const HistoryEntry& entry) {
+			return (refKey(entry, after.type) <= after.value);
+		});
+	if (before.type != HistoryRef::NONE)
+		last = std::partition_point(first, last, [&](const HistoryEntry& entry) {
+			return (refKey(entry, before.type) < before.value);
+		});
+	size_t count = std::min(limit, static_cast<size_t>(last - first));
+	if (newest)
+		first = last - count;
+	std::vector<const HistoryEntry*> selected;
+	selected.reserve(count);
+	for (size_t i = 0; i < count; i++)
+		selected.push_back(&first[i]);
+	return (selected);
+}
+
+// the ring holds a contiguous run of the newest lines, so a full page of the newest ones is exact and
+// so is anything after a reference at or past the oldest line it still has
+bool ChannelHistory::covers(const HistoryRef& after, size_t selected, size_t limit, bool newest) const {
+	if (!truncated_ || (newest && selected == limit))
+		return (true);
+	return (after.type != HistoryRef::NONE && !entries_.empty() && refKey(entries_.front(), after.type) <= after.value);
+}
+
+std::string formatServerTime(uint64_t timeMs) {
+	time_t seconds = timeMs / 1000;
+	struct tm tm;
+	gmtime_r(&seconds, &tm);
+	char buf[64]; // -Wformat-truncation sizes every field for a full int
+	std::snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ", tm.tm_year + 1900, tm.tm_mon + 1,
+		tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, static_cast<int>(timeMs % 1000));
+	return (buf);
+}
+
+uint64_t serverTimeNow() {
+	return (std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count());
+}
@@ -0,0 +1,65 @@
+#include <cstdlib>
+#include "../includes/ChannelList.hpp"
+#include "../includes/Channel.hpp"
+
+// digits only, false for anything else so a typo does not turn into a 0 bound
+static bool parseCount(const std::string& text, size_t& value) {
+	if (text.empty() || text.size() > 9 || text.find_first_not_of("0123456789") != std::string::npos)
+		return (false);
+	value = std::strtoull(text.c_str(), nullptr, 10);
+	return (true);
+}
+
+// the minute conditions are turned into timestamps once, matching a channel is then two compares
+void ListQuery::addFilters(const std::string& filters, time_t now) {
+	size_t start = 0;
+	while (start <= filters.size()) {
+		size_t comma = filters.find(',', start);
+		std::string filter = filters.substr(start, comma - start);
+		start = comma == std::string::npos ? filters.size() + 1 : comma + 1;
+		size_t value;
+		if (filter.empty())
+			continue;
+		if ((filter[0] == '>' || filter[0] == '<') && parseCount(filter.substr(1), value)) {
+			if (filter[0] == '>')
+				minUsers = value + 1;
+			else
+				maxUsers = value;
+		}
+		else if ((filter[0] == 'C' || filter[0] == 'T') && filter.size() > 1 && (filter[1] == '>' || filter[1] == '<')
+				&& parseCount(filter.substr(2), value)) {
+			time_t bound = now - static_cast<time_t>(value) * 60;
+			time_t& after = filter[0] == 'C' ? createdAfter : topicAfter;
+			time_t& before = filter[0] == 'C' ? createdBefore : topicBefore;
+			if (filter[1] == '<') // less than n minutes ago
+				after = bound;
+			else
+				before = bound;
+		}
+		else if (filter[0] == '!' && filter.size() > 1)
+			excluded.emplace_back(filter.substr(1));
+		else
+			masks.emplace_back(filter);
+	}
+}
+
+bool ListQuery::matches(const Channel& channel) const {
+	size_t users = channel.getMembers().size();
+	if (users < minUsers || users >= maxUsers)
+		return (false);
+	if ((createdAfter && channel.getCreatedAt() <= createdAfter) || (createdBefore && channel.getCreatedAt() >= createdBefore))
+		return (false);
+	if (topicAfter || topicBefore) {
+		if (channel.getTopic().empty() || (topicAfter && channel.getTopicTime() <= topicAfter)
+				|| (topicBefore && channel.getTopicTime() >= topicBefore))
+			return (false);
+	}
+	bool listed = masks.empty();
+	for (const Mask& mask : masks)
+		if ((listed = mask.matches(channel.getName())))
+			break;
+	for (const Mask& mask : excluded)
+		if (mask.matches(channel.getName()))
+			return (false);
+	return (listed);
+}
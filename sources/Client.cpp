@@ -1,82 +1,156 @@
 #include "../includes/Client.hpp"
+#include "../includes/probes.hpp"
 
-Client::Client(int clientFD, std::string clientIP, int epollFd)
-: clientFD_(clientFD), epollFd_(epollFd), nickname_(""), username_(""), hostname_(clientIP),
- realName_(""), password_(""), authenticated_(false), connected_(true), isPassValid_(false) {
+Client::Client(int clientFD, const std::string& clientIP, IoBackend& io, std::vector<int>& flushList)
+: clientFD_(clientFD), io_(io), sendOffset_(0), sendsInFlight_(0), sendQueueBytes_(0), flushList_(flushList),
+ pendingFlush_(false), sendQueueExceeded_(false), nickname_(""), username_(""), hostname_(clientIP),
+ realName_(""), password_(""), state_(CLIENT_CONNECTING), readPaused_(false), waitingForList_(false), serverOperator_(false), uplink_(nullptr),
+ nickTs_(0) {
 
+	updatePrefix();
+	PROBE_ACCEPT(clientFD_, hostname_.c_str());
 	logMessage(INFO, "CLIENT", "New client created. ClientFD[" + std::to_string(clientFD_) + "]");
 }
 
+// taken over from the previous process by a hot upgrade, the output it did not write yet goes out first.
+// Quiet like the restored channels, the clients did not notice anything
+Client::Client(int clientFD, const ClientHandover& handover, IoBackend& io, std::vector<int>& flushList)
+: clientFD_(clientFD), io_(io), readBuffer_(handover.readBuffer), sendOffset_(0), sendsInFlight_(0), sendQueueBytes_(0),
+ flushList_(flushList), pendingFlush_(false), sendQueueExceeded_(false), nickname_(handover.nickname),
+ username_(handover.username), hostname_(handover.hostname), address_(handover.address), realName_(handover.realName), password_(handover.password),
+ state_(static_cast<ClientState>(handover.state)), readPaused_(false), waitingForList_(false), serverOperator_(handover.serverOperator), uplink_(nullptr),
+ nickTs_(handover.nickTs) {
+
+	updatePrefix();
+	if (!handover.output.empty()) {
+		sendQueue_.push_back(handover.output); // may end in the middle of a line, appendSendBuffer() would add a CRLF
+		sendQueueBytes_ = handover.output.size();
+		pendingFlush_ = true;
+		flushList_.push_back(clientFD_);
+	}
+}
+
+// introduced by a server link, registered from the start. The fields come from the NICK line
+Client::Client(Client& uplink, const std::string& server, time_t nickTs, IoBackend& io, std::vector<int>& flushList)
+: clientFD_(-1), io_(io), sendOffset_(0), sendsInFlight_(0), sendQueueBytes_(0), flushList_(flushList), pendingFlush_(false),
+ sendQueueExceeded_(false), state_(CLIENT_REGISTERED), readPaused_(false), waitingForList_(false), serverOperator_(false), uplink_(&uplink),
+ server_(server), nickTs_(nickTs) {
+}
+
 Client::~Client() {
 	joinedChannels_.clear();
 	nickname_.clear();
 	readBuffer_.clear();
-	sendBuffer_.clear();
+	if (sendsInFlight_) // the backend still sends from these chunks
+		io_.retireSendQueue(clientFD_, std::move(sendQueue_));
+	sendQueue_.clear();
 	logMessage(DEBUG, "CLIENT", "Client destroyed");
-	close(clientFD_);
+	if (!uplink_)
+		io_.closeClient(clientFD_);
 }
 
 // PUBLIC MEMBER FUNCTIONS
 // =======================
 
-int Client::receiveData() {
-	char buffer[BUF_SIZE];
-
-	ssize_t bytesRead = recv(clientFD_, buffer, BUF_SIZE, MSG_DONTWAIT);
-	if (bytesRead > 0) {
-		std::string received(buffer, bytesRead);
-		addReadBuffer(received);
-		return SUCCESS;
-	}
-	else if (!bytesRead) {
-		std::cout << "Client " << clientFD_ << " disconnected." << std::endl;
-	}
-	else if (bytesRead < 0) {
-		std::cerr << "recv failed\n";
+// hands the queued chunks to the I/O backend, SEND_IOV_MAX at a time. A readiness backend writes them
+// right away with writev() (one call unless the queue is huge), a completion backend takes them as one
+// linked batch and the next batch only goes out once sendCompleted() saw all of them
+int Client::sendData() {
+	while (!sendQueue_.empty() && !sendsInFlight_) {
+		struct iovec iov[SEND_IOV_MAX];
+		int iovCount = 0;
+		size_t total = 0;
+		size_t offset = sendOffset_;
+		for (auto it = sendQueue_.begin(); it != sendQueue_.end() && iovCount < SEND_IOV_MAX; ++it) {
+			iov[iovCount].iov_base = const_cast<char*>(it->data()) + offset;
+			iov[iovCount].iov_len = it->size() - offset;
+			total += iov[iovCount].iov_len;
+			offset = 0;
+			iovCount++;
+		}
+		ssize_t sentByte = io_.send(this->clientFD_, iov, iovCount);
+		if (sentByte == IoBackend::SEND_PENDING) {
+			sendsInFlight_ = iovCount;
+			break;
+		}
+		if (sentByte < 0)
+			return (FAIL);
+		PROBE_SEND(clientFD_, sentByte);
+		consumeSendQueue(sentByte);
+		if (static_cast<size_t>(sentByte) < total) // socket buffer full, the backend waits for writability
+			break;
 	}
-	return FAIL;
+	return (SUCCESS);
 }
 
-
-int Client::sendData() {
-	if (sendBuffer_.empty())
-		return (SUCCESS);
-
-	int sentByte = send(this->clientFD_, this->sendBuffer_.c_str(), this->sendBuffer_.size(), MSG_DONTWAIT);
-	if (sentByte < 0 && errno != EWOULDBLOCK && errno != EAGAIN)
+// one chunk of a pending batch finished. Chunks after a failed one come back cancelled and stay queued.
+// Once the batch is done the client goes back on the flush list, either for the rest of its queue or
+// so a throttled client gets resumed
+int Client::sendCompleted(ssize_t result) {
+	if (sendsInFlight_)
+		sendsInFlight_--;
+	if (result < 0 && result != -ECANCELED)
 		return (FAIL);
-	this->sendBuffer_.erase(0, sentByte);
-	if (sendBuffer_.empty()) {
-		epollEventChange(EPOLLIN);
+	if (result > 0) {
+		PROBE_SEND(clientFD_, result);
+		consumeSendQueue(result);
+	}
+	if (!sendsInFlight_ && (!sendQueue_.empty() || readPaused_) && !pendingFlush_) {
+		pendingFlush_ = true;
+		flushList_.push_back(clientFD_);
 	}
 	return (SUCCESS);
 }
 
-// After successfull msg process method will call appendSendBuffer to create EPOLLOUT event
-void Client::appendSendBuffer(std::string sendMsg) {
-	if (sendMsg.length() >= 2 &&
-		sendMsg.substr(sendMsg.length() - 2) != "\r\n") {
-		sendMsg += "\r\n";
+// Queues the message and puts the client on the server flush list, the actual write happens
+// once per event loop iteration in Server::flushClients()
+// a message without its CRLF gets one. Small messages go into the open chunk at the back of the queue,
+// a new chunk reserves SENDQ_CHUNK_SIZE so the ones after it are appended without reallocating.
+// Nothing is queued for a remote user, the server forwards what concerns it to its link instead
+void Client::appendSendBuffer(const std::string& sendMsg) {
+	if (uplink_)
+		return ;
+	bool addCrlf = sendMsg.length() >= 2 && sendMsg.compare(sendMsg.length() - 2, 2, "\r\n") != 0;
+	size_t size = sendMsg.size() + (addCrlf ? 2 : 0);
+	if (sendQueueExceeded_)
+		return ;
+	if (sendQueueBytes_ + size > (state_ == CLIENT_SERVER ? SENDQ_LINK_LIMIT : SENDQ_HARD_LIMIT)) {
+		sendQueueExceeded_ = true;
+		logMessage(WARNING, "CLIENT", "Max SendQ exceeded. ClientFD[" + std::to_string(clientFD_) + "]");
+	}
+	else {
+		if (sendQueue_.size() <= sendsInFlight_ || sendQueue_.back().size() + size > SENDQ_CHUNK_SIZE) {
+			sendQueue_.emplace_back();
+			sendQueue_.back().reserve(std::max(size, static_cast<size_t>(SENDQ_CHUNK_SIZE)));
+		}
+		sendQueue_.back().append(sendMsg);
+		if (addCrlf)
+			sendQueue_.back().append("\r\n", 2);
+		sendQueueBytes_ += size;
+	}
+	if (!pendingFlush_) {
+		pendingFlush_ = true;
+		flushList_.push_back(clientFD_);
 	}
-	this->sendBuffer_.append(sendMsg);
-	epollEventChange(EPOLLOUT);
 }
 
-void Client::addReadBuffer(const std::string& received) {
-	readBuffer_.append(received);
+void Client::consumeSendQueue(size_t bytes) {
+	sendQueueBytes_ -= bytes;
+	while (bytes > 0) {
+		size_t left = sendQueue_.front().size() - sendOffset_;
+		if (bytes < left) {
+			sendOffset_ += bytes;
+			return ;
+		}
+		bytes -= left;
+		sendQueue_.pop_front();
+		sendOffset_ = 0;
+	}
 }
 
-// Method to change EPOLL IN/OUT event depending on client request
-void Client::epollEventChange(uint32_t eventType) {
-
-	struct epoll_event newEvent;
-	newEvent.events = eventType;
-	newEvent.data.fd = this->getClientFD();
-
-	if (epoll_ctl(this->epollFd_, EPOLL_CTL_MOD, newEvent.data.fd, &newEvent) < 0) {
-		this->sendBuffer_.clear();
-		throw std::runtime_error("epoll_ctl() failed for client data receive/send " + std::string(strerror(errno)));
-	}
+void Client::addReadBuffer(const char* data, size_t len) {
+	PROBE_RECV(clientFD_, len);
+	readBuffer_.append(data, len);
 }
 
 //------ CHANNEL --------
@@ -97,133 +171,209 @@ void Client::leaveChannel(const std::string &channelName) {
 		joinedChannels_.erase(channelName);
 }
 
-bool Client::isConnected() const {
-	if (!connected_) {
-		return false;
-	}
-	if (clientFD_ < 0) {
-		return false;
-	}
-	if (!isSocketValid()) {
-		return false;
-	}
-	return true;
+//------ MONITOR --------
+
+bool Client::addMonitored(const std::string& key, const std::string& nickname) {
+	return (monitored_.emplace(key, nickname).second);
 }
 
-bool Client::isAuthenticated() {
-	if (realName_.empty() || username_.empty() || nickname_.empty()
-		|| password_.empty() || !isPassValid_ || !clientFD_ || hostname_.empty()) {
-		return false;
-	}
-	authenticated_ = true;
-	return authenticated_;
+bool Client::removeMonitored(const std::string& key) {
+	return (monitored_.erase(key) > 0);
+}
+
+void Client::clearMonitored() {
+	monitored_.clear();
+}
+
+// PASS_OK -> REGISTERED once both NICK and USER went through, true when this call registered the client
+bool Client::completeRegistration() {
+	if (state_ != CLIENT_PASS_OK || nickname_.empty() || username_.empty())
+		return (false);
+	state_ = CLIENT_REGISTERED;
+	return (true);
 }
 
 // PRIVATE MEMBER FUNCTIONS
 // ========================
 
-bool Client::isSocketValid() const {
-	if (clientFD_ < 0)
-		return false;
+// never reused, a client at the address of a gone one gets a new one
+static uint64_t nextIdentity() {
+	static uint64_t lastIdentity = 0;
+	return (++lastIdentity);
+}
 
-	// Use send with MSG_NOSIGNAL to test if socket is alive
-	// This doesn't actually send data
-	int result = send(clientFD_, "", 0, MSG_NOSIGNAL);
-	if (result == -1) {
-		if (errno == EBADF || errno == ENOTSOCK || errno == EPIPE || errno == ECONNRESET) {
-			return false;
-		}
-	}
-	return true;
+void Client::updatePrefix() {
+	prefix_.clear();
+	prefix_.append(":").append(nickname_).append("!").append(username_).append("@").append(hostname_);
+	identity_ = nextIdentity();
 }
 
 // ACCESSORS
 // =========
 
-int Client::getClientFD () const {
+int Client::getClientFD() const {
 	return clientFD_;
 }
 
-int Client::getEpollFd() const {
-	return (this->epollFd_);
+const std::string& Client::getHostname() const {
+	return hostname_;
 }
 
-std::string Client::getHostname () const {
-	return hostname_;
+const std::string& Client::getAddress() const {
+	return (address_);
 }
 
-std::string Client::getNickname () const {
+const std::string& Client::getNickname() const {
 	return nickname_;
 }
 
-std::string Client::getUsername () const {
+const std::string& Client::getUsername() const {
 	return username_;
 }
 
-std::string Client::getRealName() const {
+const std::string& Client::getRealName() const {
 	return realName_;
 }
 
-std::string Client::getPassword() const {
+const std::string& Client::getPassword() const {
 	return password_;
 }
 
-std::string Client::getReadBuffer() const {
+const std::string& Client::getReadBuffer() const {
 	return readBuffer_;
 }
 
-std::string Client::getSendBuffer() const {
-	return sendBuffer_;
+ClientState Client::getState() const {
+	return state_;
+}
+
+bool Client::isRegistered() const {
+	return state_ == CLIENT_REGISTERED;
+}
+
+const std::string& Client::getClientIdentifier() const {
+	return (prefix_);
+}
+
+uint64_t Client::getIdentity() const {
+	return (identity_);
+}
+
+bool Client::isReadPaused() const {
+	return readPaused_;
 }
 
-bool Client::getIsAuthenticated() const {
-	return authenticated_;
+bool Client::isWaitingForList() const {
+	return waitingForList_;
 }
 
-std::string Client::getClientIdentifier() const {
-	return (":" + nickname_ + "!" + username_ + "@" + hostname_);
+size_t Client::getSendQueueSize() const {
+	return sendQueueBytes_;
 }
 
-bool Client::getIsPassValid() const {
-	return isPassValid_;
+std::string Client::getPendingOutput() const {
+	std::string output;
+	output.reserve(sendQueueBytes_);
+	size_t offset = sendOffset_;
+	for (const std::string& chunk : sendQueue_) {
+		output.append(chunk, offset, std::string::npos);
+		offset = 0;
+	}
+	return (output);
+}
+
+bool Client::isSendQueueExceeded() const {
+	return sendQueueExceeded_;
+}
+
+bool Client::isServerOperator() const {
+	return serverOperator_;
+}
+
+bool Client::isRemote() const {
+	return uplink_ != nullptr;
+}
+
+Client* Client::getUplink() const {
+	return uplink_;
+}
+
+const std::string& Client::getServer() const {
+	return server_;
+}
+
+time_t Client::getNickTs() const {
+	return nickTs_;
 }
 
 const std::set<std::string>& Client::getJoinedChannels() const {
 	return joinedChannels_;
 }
 
-void Client::setHostname(std::string hostname) {
+const std::map<std::string, std::string>& Client::getMonitored() const {
+	return monitored_;
+}
+
+void Client::setHostname(const std::string& hostname) {
 	hostname_ = hostname;
+	updatePrefix();
+}
+
+void Client::setAddress(const std::string& address) {
+	address_ = address;
+	identity_ = nextIdentity();
 }
 
-void Client::setNickname(std::string nickname) {
+void Client::setNickname(const std::string& nickname) {
 	nickname_ = nickname;
+	updatePrefix();
 }
 
-void Client::setUsername(std::string username) {
+void Client::setUsername(const std::string& username) {
 	username_ = username;
+	updatePrefix();
 }
 
-void Client::setRealName(std::string realName) {
+void Client::setRealName(const std::string& realName) {
 	realName_ = realName;
 }
 
-void Client::setPassword(std::string password) {
+void Client::setPassword(const std::string& password) {
 	password_ = password;
 }
 
-void Client::setBuffer(std::string buffer) {
+void Client::setBuffer(const std::string& buffer) {
 	readBuffer_ = buffer;
 }
 
-void Client::setConnected(bool connected) {
-	connected_ = connected;
+void Client::setState(ClientState state) {
+	state_ = state;
+}
+
+void Client::clearPendingFlush() {
+	pendingFlush_ = false;
+}
+
+void Client::setReadPaused(bool readPaused) {
+	if (readPaused_ != readPaused && !waitingForList_)
+		io_.setReadEnabled(clientFD_, !readPaused);
+	readPaused_ = readPaused;
+}
+
+void Client::setWaitingForList(bool waitingForList) {
+	if (waitingForList_ != waitingForList && !readPaused_)
+		io_.setReadEnabled(clientFD_, !waitingForList);
+	waitingForList_ = waitingForList;
+}
+
+void Client::setServerOperator(bool serverOperator) {
+	serverOperator_ = serverOperator;
 }
 
-void Client::setAuthenticated(bool authenticated) {
-	authenticated_ = authenticated;
+void Client::setServer(const std::string& server) {
+	server_ = server;
 }
 
-void Client::setIsPassValid(bool isPassValid) {
-	isPassValid_ = isPassValid;
+void Client::setNickTs(time_t nickTs) {
+	nickTs_ = nickTs;
 }
@@ -15,7 +15,7 @@ std::vector<std::string> split(const std::string& input, const char delmiter) {
 }
 
 bool Server::checkInvitation(Client &client, Channel &channel) {
-	if (channel.isInviteOnly() && !channel.isClientInvited(&client)) {
+	if (channel.isInviteOnly() && !channel.isClientInvited(&client) && !channel.isInviteException(client)) {
 		messageHandle(ERR_INVITEONLYCHAN, client, channel.getName(), {});
 		logMessage(WARNING, "CHANNEL",
 		"Client '" + client.getNickname() + "' attempted to join invite-only channel '" +
@@ -72,6 +72,11 @@ void Server::handleJoin(Client& client, const std::vector<std::string>& params)
 			channel = getChannel(channelName);
 			if (!checkInvitation(client, *channel))
 				continue;
+			if (channel->isBanned(client) && !channel->isClientInvited(&client)) {
+				messageHandle(ERR_BANNEDFROMCHAN, client, channel->getName(), {});
+				logMessage(WARNING, "CHANNEL", "Client '" + client.getNickname() + "' is banned from channel '" + channel->getName() + "'.");
+				continue;
+			}
 			if (!channel->checkKey(channel, &client, channelKey)) {
 				messageHandle(ERR_BADCHANNELKEY, client, "JOIN", {channel->getName(), " :Bad channel key"});
 				continue;
@@ -93,9 +98,12 @@ void Server::handleJoin(Client& client, const std::vector<std::string>& params)
 		}
 		channel->addChannelMember(&client);
 		client.addToJoinedChannelList(channel->getName());
+		if (channel->takePendingOperator(client))
+			channel->setOperator(&client, true); // was operator when the snapshot was taken
 		logMessage(INFO, "CHANNEL", "Client '" + client.getNickname() + "' joined channel [" + channel->getName() + "]");
 
 		messageBroadcast(*channel, client, "JOIN", "");
+		propagate(sjoinLine(serverName_, *channel, (channel->isOperator(&client) ? "@" : "") + client.getNickname()), client.getUplink());
 		if (channel->getTopic() != "") {
 			messageHandle(RPL_TOPIC, client, "JOIN", {channel->getName() + " :" + channel->getTopic()});
 		}
@@ -187,6 +195,11 @@ void Server::handleSingleMode(Client &client, Channel &channel, const char &oper
 		case 'l':
 			userLimitMode(client, channel, operation, modeParam);
 			break;
+		case 'b':
+		case 'e':
+		case 'I':
+			maskListMode(client, channel, operation, modeChar, modeParam);
+			break;
 		default:
 			messageHandle(ERR_UNKNOWNMODE, client, "MODE", {std::string(1, modeChar)});
 			logMessage(WARNING, "MODE", "Client " + client.getNickname()
@@ -202,14 +215,16 @@ bool Server::checkModeParam(const char modeChar, const char operation) {
 		return true;
 	if (modeChar == 'o' && operation == '-')
 		return true;
+	if (modeChar == 'b' || modeChar == 'e' || modeChar == 'I')
+		return true;
 	return false;
 }
 
 void Server::handleChannelMode(Client& client, Channel &channel, const std::vector<std::string>& params) {
 
 	std::string modeString = params[1];
-	if (modeString == "b" || modeString == "+b")
-		return messageHandle(RPL_ENDOFBANLIST, client, channel.getName(), {client.getNickname()});
+	if (modeString == "b" || modeString == "e" || modeString == "I")
+		return sendMaskList(client, channel, modeString[0]);
 	if (modeString.size() < 2 || (modeString[0] != '+' && modeString[0] != '-')) {
 		messageHandle(ERR_UNKNOWNMODE, client, "MODE", {modeString});
 		logMessage(WARNING, "MODE", "Client '" + client.getNickname()
@@ -217,12 +232,22 @@ void Server::handleChannelMode(Client& client, Channel &channel, const std::vect
 		return;
 	}
 	const char operation = modeString[0];
+	if (channel.isOperator(&client)) { // the other servers check it the same way
+		std::string line = ":" + client.getNickname() + " MODE";
+		for (const std::string& param : params)
+			line += " " + param;
+		propagate(line + "\r\n", client.getUplink());
+	}
 	size_t paramIndex = 2;
 	for (size_t i = 1; i < modeString.size(); i++) {
 		char modeChar = modeString[i];
 		std::string modeParam = "";
 
 		if (checkModeParam(modeChar, operation)) {
+			if (paramIndex >= params.size() && (modeChar == 'b' || modeChar == 'e' || modeChar == 'I')) {
+				sendMaskList(client, channel, modeChar); // +b without a mask asks for the list
+				continue;
+			}
 			if (paramIndex >= params.size()) {
 				messageHandle(ERR_NEEDMOREPARAMS, client, "MODE", params);
 				logMessage(WARNING, "MODE", "Client '" + client.getNickname()
@@ -341,6 +366,40 @@ void Server::channelKeyMode(Client& client, Channel& channel, char operation, co
 	}
 }
 
+// +b, +e and +I take a mask, completed to nick!user@host the way it is listed and matched
+void Server::maskListMode(Client& client, Channel& channel, char operation, char list, const std::string& mask) {
+	if (!channel.isOperator(&client)) {
+		messageHandle(ERR_CHANOPRIVSNEEDED, client, "MODE", {channel.getName(), ":You're not a channel operator"});
+		return logMessage(WARNING, "MODE", "Client '" + client.getNickname() + "' attempted to change +" + list + " on '"
+			+ channel.getName() + "' without operator privileges.");
+	}
+	if (mask.empty() || mask.find_first_of(" ,") != std::string::npos || mask[0] == ':')
+		return logMessage(WARNING, "MODE", "Invalid mask '" + mask + "' for +" + list + " on " + channel.getName());
+	std::string normalized = MaskList::normalize(mask);
+	if (operation == '+') {
+		if (channel.getMaskList(list).size() >= CHAN_MASK_LIST_MAX) {
+			messageHandle(ERR_BANLISTFULL, client, "MODE", {channel.getName(), std::string(1, list)});
+			return logMessage(WARNING, "MODE", "+" + std::string(1, list) + " list of " + channel.getName() + " is full");
+		}
+		if (!channel.addMask(list, normalized, client.getClientIdentifier().substr(1), time(nullptr)))
+			return logMessage(DEBUG, "MODE", normalized + " already on the +" + list + " list of " + channel.getName());
+	} else if (!channel.removeMask(list, normalized)) {
+		return logMessage(DEBUG, "MODE", normalized + " not on the +" + list + " list of " + channel.getName());
+	}
+	messageBroadcast(channel, client, "MODE", std::string(1, operation) + list + " " + normalized);
+	logMessage(INFO, "MODE", std::string(1, operation) + list + " " + normalized + " on " + channel.getName()
+		+ " by client '" + client.getNickname() + "'");
+}
+
+void Server::sendMaskList(Client& client, Channel& channel, char list) {
+	int entryCode = list == 'e' ? RPL_EXCEPTLIST : list == 'I' ? RPL_INVITELIST : RPL_BANLIST;
+	int endCode = list == 'e' ? RPL_ENDOFEXCEPTLIST : list == 'I' ? RPL_ENDOFINVITELIST : RPL_ENDOFBANLIST;
+	for (const MaskEntry& entry : channel.getMaskList(list).getEntries())
+		messageHandle(entryCode, client, "MODE", {channel.getName() + " " + entry.mask + " " + entry.setBy + " "
+			+ std::to_string(entry.setAt)});
+	messageHandle(endCode, client, channel.getName(), {});
+}
+
 bool Server::isValidUserLimit(const std::string& str, int& userLimit) {
 	std::istringstream iss(str);
 	int temp;
@@ -437,11 +496,41 @@ void Server::handleKick(Client& client, const std::vector<std::string>& params)
 		return logMessage(WARNING, "KICK", "User " + userToKick + " not found on channel " + channel);
 	}
 	messageBroadcast(*targetChannel, client, "KICK", clientToKick->getNickname() + " :" + kickReason);
+	propagate(":" + client.getNickname() + " KICK " + channel + " " + clientToKick->getNickname() + " :" + kickReason + "\r\n", client.getUplink());
 	targetChannel->removeMember(clientToKick);
 	clientToKick->leaveChannel(channel);
 	logMessage(INFO, "KICK", "User " + userToKick + " kicked from " + channel + " by " + client.getNickname() + " (reason: " + kickReason + ")");
 }
 
+void Server::handlePart(Client& client, const std::vector<std::string>& params) {
+
+	if (params.empty() || params[0].empty()) {
+		messageHandle(ERR_NEEDMOREPARAMS, client, "PART", params);
+		return logMessage(WARNING, "PART", "No channel specified");
+	}
+	std::string reason = (params.size() > 1) ? params[1] : "";
+	std::vector<std::string> channels = split(params[0], ',');
+	for (const std::string& channelName : channels) {
+		Channel* channel = getChannel(channelName);
+		if (!channel) {
+			messageHandle(ERR_NOSUCHCHANNEL, client, channelName, params);
+			logMessage(WARNING, "PART", "Channel " + channelName + " does not exist");
+			continue;
+		}
+		if (!channel->isMember(&client)) {
+			messageHandle(ERR_NOTONCHANNEL, client, channelName, params);
+			logMessage(WARNING, "PART", "User " + client.getNickname() + " not on channel " + channelName);
+			continue;
+		}
+		messageBroadcast(*channel, client, "PART", reason.empty() ? "" : ":" + reason); // the leaving client gets it too
+		propagate(":" + client.getNickname() + " PART " + channelName + " :" + reason + "\r\n", client.getUplink());
+		channel->removeMember(&client);
+		channel->removeOperator(&client);
+		client.leaveChannel(channelName);
+		logMessage(INFO, "PART", "User " + client.getNickname() + " left " + channelName);
+	}
+}
+
 int Server::handleInviteParams(Client& client, const std::vector<std::string>& params) {
 	if (params.empty()) {
 		messageHandle(ERR_NEEDMOREPARAMS, client, "INVITE", params);
@@ -480,13 +569,7 @@ void Server::handleInvite(Client& client, const std::vector<std::string>& params
 		messageHandle(ERR_CHANOPRIVSNEEDED, client, channelInvitedTo, {channelInvitedTo, ":You're not a channel operator"});
 		return logMessage(WARNING, "INVITE", "User " + client.getNickname() + " does not have operator rights for invite-only channel " + channelInvitedTo);
 	}
-	Client* clientToBeInvited = nullptr;
-	for (auto& pair : clients_) {
-		if (pair.second && pair.second->getNickname() == userToBeInvited) {
-			clientToBeInvited = pair.second.get();
-			break;
-		}
-	}
+	Client* clientToBeInvited = getClient(userToBeInvited);
 	if (clientToBeInvited == nullptr) {
 		messageHandle(ERR_NOSUCHNICK, client, "INVITE", {userToBeInvited});
 		return logMessage(WARNING, "INVITE", "User " + userToBeInvited + " does not exist");
@@ -552,6 +635,7 @@ void Server::handleTopic(Client& client, const std::vector<std::string>& params)
 	if (topicGiven && !targetChannel->isTopicOperatorOnly() && topic != ":") { // if topic is given and the mode +t has not been set we can set the topic
 		targetChannel->setTopic(topic);
 		messageBroadcast(*targetChannel, client, "TOPIC", topic);
+		propagate(":" + client.getNickname() + " TOPIC " + channel + " :" + topic + "\r\n", client.getUplink());
 		return logMessage(DEBUG, "TOPIC", "User " + client.getNickname() + " set new topic: " + topic + " for channel " + channel);
 	}
 	else if (topicGiven && targetChannel->isTopicOperatorOnly()) { // if topic can be set by operators only (mode +t), either set the topic if user is operator or print error
@@ -566,5 +650,147 @@ void Server::handleTopic(Client& client, const std::vector<std::string>& params)
 		targetChannel->setTopic(topic);
 	messageHandle(RPL_TOPIC, client, "JOIN", {targetChannel->getName() + " :" + targetChannel->getTopic()});
 	messageBroadcast(*targetChannel, client, "TOPIC", topic);
+	propagate(":" + client.getNickname() + " TOPIC " + channel + " :" + topic + "\r\n", client.getUplink());
 	logMessage(DEBUG, "TOPIC", "User " + client.getNickname() + " set new topic: " + topic + " for channel " + channel);
 }
+
+// LIST [<filter>{,<filter>}], filters as in ListQuery. The replies are not built all at once: each loop
+// iteration adds the next batch once the client read the previous one (continueLists()), so a listing
+// of many channels costs neither a long pause of the loop nor a huge send queue. Commands the client
+// sends meanwhile wait until the listing ended
+void Server::handleList(Client& client, const std::vector<std::string>& params) {
+	ListQuery query;
+	if (!params.empty())
+		query.addFilters(params[0], time(nullptr));
+	messageHandle(RPL_LISTSTART, client, "LIST", {});
+	if (!continueList(client, query))
+		listQueries_[client.getClientFD()] = std::move(query);
+}
+
+// next batch of one listing: at most LIST_SCAN_BATCH channels looked at, and no more replies than fit
+// below LIST_SENDQ_TARGET. True once it sent RPL_LISTEND
+bool Server::continueList(Client& client, ListQuery& query) {
+	auto it = query.next.empty() ? channelMap_.begin() : channelMap_.upper_bound(query.next);
+	std::string chunk;
+	for (size_t scanned = 0; it != channelMap_.end() && scanned < LIST_SCAN_BATCH; ++it, ++scanned) {
+		if (client.getSendQueueSize() + chunk.size() >= LIST_SENDQ_TARGET)
+			break;
+		query.next = it->first;
+		Channel& channel = *it->second;
+		if (!query.matches(channel))
+			continue;
+		chunk += createMessage(RPL_LIST, client, "LIST", {channel.getName(), std::to_string(channel.getMembers().size()),
+			":" + channel.getTopic()});
+		if (chunk.size() >= SENDQ_CHUNK_SIZE) {
+			client.appendSendBuffer(chunk);
+			chunk.clear();
+		}
+	}
+	if (!chunk.empty())
+		client.appendSendBuffer(chunk);
+	if (it != channelMap_.end())
+		return (false);
+	messageHandle(RPL_LISTEND, client, "LIST", {});
+	return (true);
+}
+
+// once per loop iteration: listings whose client has room in its send queue again get their next batch.
+// A finished listing lets the lines its client sent in the meantime through
+void Server::continueLists() {
+	std::vector<int> ready;
+	for (const auto& [fd, query] : listQueries_)
+		if (clients_.at(fd)->getSendQueueSize() < SENDQ_LOW_WATERMARK)
+			ready.push_back(fd);
+	for (int fd : ready) {
+		auto query = listQueries_.find(fd);
+		Client& client = *clients_.at(fd);
+		if (!continueList(client, query->second))
+			continue;
+		listQueries_.erase(query);
+		logMessage(DEBUG, "LIST", "Listing sent. ClientFD: " + std::to_string(fd));
+		client.setWaitingForList(false);
+		if (client.isReadPaused() && client.getSendQueueSize() < SENDQ_LOW_WATERMARK)
+			unthrottleClient(client);
+		if (!client.isReadPaused())
+			processBuffer(client); // may close the client or start the next listing
+	}
+}
+
+// IRCv3 CHATHISTORY LATEST|BEFORE|AFTER <channel> <* | msgid=N | timestamp=T> <limit>, members only.
+// Replies with a chathistory BATCH of at most HISTORY_PAGE_MAX lines, oldest first, each tagged with
+// its server-time and msgid so the client can ask for the next page
+void Server::handleChatHistory(Client& client, const std::vector<std::string>& params) {
+	if (params.size() < 4) {
+		sendFail(client, "CHATHISTORY", "NEED_MORE_PARAMS", params.empty() ? "" : params[0], "Missing parameters");
+		return;
+	}
+	std::string subcommand = params[0];
+	std::transform(subcommand.begin(), subcommand.end(), subcommand.begin(), ::toupper);
+	if (subcommand != "LATEST" && subcommand != "BEFORE" && subcommand != "AFTER") {
+		sendFail(client, "CHATHISTORY", "INVALID_PARAMS", subcommand, "Unknown subcommand");
+		return;
+	}
+	HistoryRef ref;
+	if (!HistoryRef::parse(params[2], ref) || (ref.type == HistoryRef::NONE && subcommand != "LATEST")) {
+		sendFail(client, "CHATHISTORY", "INVALID_PARAMS", subcommand + " " + params[2], "Invalid message reference");
+		return;
+	}
+	char* end;
+	long limit = std::strtol(params[3].c_str(), &end, 10);
+	if (*end || limit < 1) {
+		sendFail(client, "CHATHISTORY", "INVALID_PARAMS", subcommand + " " + params[3], "Invalid limit");
+		return;
+	}
+	Channel* channel = getChannel(params[1]);
+	if (!channel || !isClientChannelMember(channel, client)) {
+		sendFail(client, "CHATHISTORY", "INVALID_TARGET", subcommand + " " + params[1], "Messages could not be retrieved");
+		return;
+	}
+
+	const HistoryRef open = {HistoryRef::NONE, 0};
+	size_t pageSize = std::min(limit, static_cast<long>(HISTORY_PAGE_MAX));
+	HistoryRef after = subcommand == "BEFORE" ? open : ref;
+	HistoryRef before = subcommand == "BEFORE" ? ref : open;
+	bool newest = subcommand != "AFTER";
+	std::vector<const HistoryEntry*> page = channel->getHistory().select(after, before, pageSize, newest);
+
+	// part of the answer is older than the ring, the store reads it without holding up the loop
+	if (historyStore_ && !channel->getHistory().covers(after, page.size(), pageSize, newest)) {
+		uint64_t id = nextQueryId_++;
+		historyQueries_[id] = client.getClientFD();
+		historyStore_->query(HistoryQuery{id, channel->getName(), after, before, pageSize, newest});
+		logMessage(DEBUG, "CHATHISTORY", subcommand + " " + channel->getName() + ": reading from disk");
+		return;
+	}
+	sendHistoryBatch(client, channel->getName(), page);
+	logMessage(DEBUG, "CHATHISTORY", subcommand + " " + channel->getName() + ": " + std::to_string(page.size()) + " lines");
+}
+
+void Server::sendHistoryBatch(Client& client, const std::string& channelName, const std::vector<const HistoryEntry*>& entries) {
+	std::string batch = std::to_string(nextBatchId_++);
+	client.appendSendBuffer(":" + serverName_ + " BATCH +" + batch + " chathistory " + channelName + "\r\n");
+	for (const HistoryEntry* entry : entries)
+		client.appendSendBuffer("@batch=" + batch + ";time=" + formatServerTime(entry->timeMs) + ";msgid="
+			+ std::to_string(entry->msgId) + " " + *entry->line);
+	client.appendSendBuffer(":" + serverName_ + " BATCH -" + batch + "\r\n");
+}
+
+// answers of the history store, for clients that are still connected
+void Server::deliverHistoryResults() {
+	std::vector<HistoryResult> results;
+	historyStore_->takeResults(results);
+	for (const HistoryResult& result : results) {
+		auto query = historyQueries_.find(result.id);
+		if (query == historyQueries_.end())
+			continue;
+		auto client = clients_.find(query->second);
+		historyQueries_.erase(query);
+		if (client == clients_.end())
+			continue;
+		std::vector<const HistoryEntry*> page;
+		for (const HistoryEntry& entry : result.entries)
+			page.push_back(&entry);
+		sendHistoryBatch(*client->second, result.channel, page);
+		logMessage(DEBUG, "CHATHISTORY", result.channel + ": " + std::to_string(page.size()) + " lines from disk");
+	}
+}
@@ -9,25 +9,29 @@ void Server::handlePass(Client& client, const std::vector<std::string>& params)
 		logMessage(WARNING, "PASS", "Empty password");
 		return;
 	}
+	else if (params.size() > 1 && params[1] == LINK_PROTOCOL && !client.isRegistered()) { // a server, SERVER checks it
+		client.setPassword(params[0]);
+		logMessage(INFO, "PASS", "Link password received from ClientFD: " + std::to_string(client.getClientFD()));
+	}
 	else if (params[0] != this->getPassword()) {
 		messageHandle(ERR_PASSWDMISMATCH, client, "PASS", params);
 		logMessage(WARNING, "PASS", "Password mismatch. Given Password: " + params[0]);
 		return;
 	}
-	else if (client.getIsAuthenticated()) {
+	else if (client.isRegistered()) {
 		messageHandle(ERR_ALREADYREGISTERED, client, "PASS", params);
 		logMessage(WARNING, "PASS", "Client is already registered");
 	}
 	else {
 		client.setPassword(params[0]);
-		client.setIsPassValid(true);
+		client.setState(CLIENT_PASS_OK);
 		logMessage(INFO, "PASS", "Password validated for ClientFD: " + std::to_string(client.getClientFD()));
 	}
 }
 
 int Server::handleNickParams(Client& client, const std::vector<std::string>& params) {
 
-	if (!client.getIsPassValid()) {
+	if (client.getState() == CLIENT_CONNECTING) {
 		messageHandle(ERR_PASSWDMISMATCH, client, "NICK", params);
 		logMessage(WARNING, "NICK", "Password is not set yet" + params[0]);
 		return (FAIL);
@@ -64,19 +68,30 @@ void Server::handleNick(Client& client, const std::vector<std::string>& params)
 	if (handleNickParams(client, params) == FAIL)
 		return;
 
-	if (client.isAuthenticated())
+	if (client.isRegistered())
 	{
+		for (const std::string& channelName : client.getJoinedChannels()) {
+			Channel* channel = getChannel(channelName);
+			if (channel && !channel->isOperator(&client) && channel->isBanned(client)) {
+				messageHandle(ERR_BANNICKCHANGE, client, channelName, {});
+				logMessage(WARNING, "NICK", "Client '" + client.getNickname() + "' is banned on " + channelName + ", nickname kept");
+				return;
+			}
+		}
 		std::string replyMsg = client.getClientIdentifier() + " NICK :" + params[0] + "\r\n";
 		client.appendSendBuffer(replyMsg);
 		messageBroadcast(client, "NICK", replyMsg);
 		logMessage(INFO, "NICK", "Nickname changed to " + params[0] + ". Old Nickname: " + client.getNickname());
-		client.setNickname(params[0]);
+		client.setNickTs(time(nullptr));
+		propagate(":" + client.getNickname() + " NICK " + params[0] + " :" + std::to_string(client.getNickTs()) + "\r\n", nullptr);
+		setClientNickname(client, params[0]);
 	}
 	else {
-		client.setNickname(params[0]);
+		setClientNickname(client, params[0]);
 		logMessage(INFO, "NICK", "Nickname set to " + client.getNickname());
-		if (client.isAuthenticated()) {
+		if (client.completeRegistration()) {
 			messageHandle(client, "NICK", params);
+			announceRegistration(client);
 			logMessage(INFO, "REGISTRATION", "Client registration is successful. Nickname: " + client.getNickname());
 		}
 	}
@@ -84,7 +99,7 @@ void Server::handleNick(Client& client, const std::vector<std::string>& params)
 
 int Server::handleUserParams(Client& client, const std::vector<std::string>& params) {
 
-	if (!client.getIsPassValid()) {
+	if (client.getState() == CLIENT_CONNECTING) {
 		messageHandle(ERR_PASSWDMISMATCH, client, "USER", params);
 		logMessage(WARNING, "USER", "Password is not set yet" + params[0]);
 		return (FAIL);
@@ -124,8 +139,9 @@ void Server::handleUser(Client& client, const std::vector<std::string>& params)
 	client.setHostname(params[1]);
 	client.setRealName(params[3]);
 	logMessage(INFO, "USER", "Username and details are set. Username: " + client.getUsername());
-	if (client.isAuthenticated()) {
+	if (client.completeRegistration()) {
 		messageHandle(client, "USER", params);
+		announceRegistration(client);
 		logMessage(INFO, "REGISTRATION", "Client registration is successful. Nickname: " + client.getNickname());
 	}
 }
@@ -157,8 +173,8 @@ void Server::handlePrivMsg(Client& client, const std::vector<std::string>& param
 
 	bool isChannel = false;
 	std::string target = params[0];
-	Client *targetClient;
-	Channel *targetChannel;
+	Client *targetClient = nullptr;
+	Channel *targetChannel = nullptr;
 	if (target[0] == '#') {
 		isChannel = true;
 		targetChannel = getChannel(target);
@@ -168,10 +184,15 @@ void Server::handlePrivMsg(Client& client, const std::vector<std::string>& param
 			logMessage(WARNING, "PRIVMSG", "No Channel/ client is not a member of channel: \"" + target + "\"");
 			return ;
 		}
+		if (!targetChannel->isOperator(&client) && targetChannel->isBanned(client)) {
+			messageHandle(ERR_CANNOTSENDTOCHAN, client, "PRIVMSG", {target});
+			logMessage(DEBUG, "PRIVMSG", "Client '" + client.getNickname() + "' is banned on " + target);
+			return ;
+		}
 	}
 	else {
 		targetClient = getClient(target);
-		if (targetClient == nullptr || (targetClient && !targetClient->isAuthenticated())) {
+		if (targetClient == nullptr || (targetClient && !targetClient->isRegistered())) {
 			messageHandle(ERR_NOSUCHNICK, client, "PRIVMSG", {target});
 			logMessage(WARNING, "PRIVMSG", "No such nickname: \"" + target + "\"");
 			return ;
@@ -202,3 +223,73 @@ void Server::handlePrivMsg(Client& client, const std::vector<std::string>& param
 		logMessage(DEBUG, "PRIVMSG", "Sending Msg to client: " + targetClient->getNickname());
 	}
 }
+
+// IRCv3 MONITOR +|- <nick>{,<nick>}, C (clear), L (list) and S (status). Once a nickname is on the
+// list the server pushes RPL_MONONLINE/RPL_MONOFFLINE when it comes or goes, see notifyWatchers()
+void Server::handleMonitor(Client& client, const std::vector<std::string>& params) {
+	std::string subcommand = params.empty() ? "" : params[0];
+	std::transform(subcommand.begin(), subcommand.end(), subcommand.begin(), ::toupper);
+	if (subcommand.empty() || ((subcommand == "+" || subcommand == "-") && params.size() < 2)) {
+		messageHandle(ERR_NEEDMOREPARAMS, client, "MONITOR", params);
+		return ;
+	}
+	// comma separated nicknames, as many per line as fit below MONITOR_LINE_BYTES
+	auto sendNicknames = [&](int code, const std::vector<std::string>& nicknames) {
+		std::string line;
+		for (size_t i = 0; i < nicknames.size(); i++) {
+			line += (line.empty() ? "" : ",") + nicknames[i];
+			if (i + 1 == nicknames.size() || line.size() + nicknames[i + 1].size() >= MONITOR_LINE_BYTES) {
+				messageHandle(code, client, "MONITOR", {":" + line});
+				line.clear();
+			}
+		}
+	};
+	std::vector<std::string> targets;
+	if (subcommand == "+" || subcommand == "S") {
+		if (subcommand == "+")
+			targets = split(params[1], ',');
+		else
+			for (const auto& [key, nickname] : client.getMonitored())
+				targets.push_back(nickname);
+		std::vector<std::string> online;
+		std::vector<std::string> offline;
+		for (size_t i = 0; i < targets.size(); i++) {
+			if (!isValidNickname(targets[i]))
+				continue;
+			if (subcommand == "+" && client.getMonitored().size() >= MONITOR_MAX_TARGETS
+					&& !client.getMonitored().count(foldCase(targets[i]))) {
+				std::string rest = targets[i];
+				for (size_t j = i + 1; j < targets.size(); j++)
+					rest += "," + targets[j];
+				messageHandle(ERR_MONLISTFULL, client, "MONITOR", {std::to_string(MONITOR_MAX_TARGETS), rest});
+				break;
+			}
+			if (subcommand == "+")
+				watchNickname(client, targets[i]);
+			Client* user = getClient(targets[i]);
+			if (user && user->isRegistered())
+				online.push_back(user->getClientIdentifier().substr(1));
+			else
+				offline.push_back(targets[i]);
+		}
+		sendNicknames(RPL_MONONLINE, online);
+		sendNicknames(RPL_MONOFFLINE, offline);
+	}
+	else if (subcommand == "-") {
+		for (const std::string& target : split(params[1], ','))
+			unwatchNickname(client, target);
+	}
+	else if (subcommand == "C")
+		unwatchAll(client);
+	else if (subcommand == "L") {
+		for (const auto& [key, nickname] : client.getMonitored())
+			targets.push_back(nickname);
+		sendNicknames(RPL_MONLIST, targets);
+		messageHandle(RPL_ENDOFMONLIST, client, "MONITOR", {});
+	}
+	else {
+		messageHandle(ERR_UNKNOWNCOMMAND, client, "MONITOR " + params[0], params);
+		return ;
+	}
+	logMessage(DEBUG, "MONITOR", subcommand + ": " + client.getNickname() + " watches " + std::to_string(client.getMonitored().size()));
+}
@@ -0,0 +1,619 @@
+#include "../includes/Server.hpp"
+#include "../includes/responseCodes.hpp"
+#include "../includes/macros.hpp"
+
+// Server to server linking, the protocol is described in ServerLink.hpp
+
+static const LinkBlock* findLinkBlock(const std::vector<LinkBlock>& links, const std::string& name) {
+	for (const LinkBlock& link : links)
+		if (link.name == name)
+			return (&link);
+	return (nullptr);
+}
+
+// "+iklt key limit", what a SJOIN carries
+static std::string channelModes(const Channel& channel) {
+	std::string modes = "+";
+	std::string args;
+	if (channel.isInviteOnly())
+		modes += "i";
+	if (channel.isKeyProtected()) {
+		modes += "k";
+		args += " " + channel.getChannelKey();
+	}
+	if (channel.getUserLimit() > 0) {
+		modes += "l";
+		args += " " + std::to_string(channel.getUserLimit());
+	}
+	if (channel.isTopicOperatorOnly())
+		modes += "t";
+	return (modes + args);
+}
+
+// members of the channel on this server only, remote ones get nothing queued anyway
+static void sendToMembers(Channel& channel, const std::string& line) {
+	for (Client* member : channel.getMembers())
+		member->appendSendBuffer(line);
+}
+
+std::string Server::nickLine(Client& client) {
+	return ("NICK " + client.getNickname() + " " + std::to_string(client.getNickTs()) + " " + client.getUsername() + " "
+		+ client.getHostname() + " " + (client.isRemote() ? client.getServer() : serverName_) + " :" + client.getRealName() + "\r\n");
+}
+
+std::string Server::sjoinLine(const std::string& source, Channel& channel, const std::string& members) {
+	return (":" + source + " SJOIN " + std::to_string(channel.getCreatedAt()) + " " + channel.getName() + " "
+		+ channelModes(channel) + " :" + members + "\r\n");
+}
+
+// to every link but the one the line came from (null for a local source)
+void Server::propagate(const std::string& line, Client* except) {
+	for (Client* link : links_)
+		if (link != except)
+			link->appendSendBuffer(line);
+}
+
+// LINK SETUP
+// ==========
+
+// once per LINK_TICK_MS: dial the configured links with an address that are neither up nor being dialed,
+// each at most once per LINK_RETRY_SEC
+void Server::linkTick(uint64_t now) {
+	if (config_.links.empty() || now - lastLinkTick_ < LINK_TICK_MS * 1000000ULL)
+		return ;
+	lastLinkTick_ = now;
+	time_t seconds = time(nullptr);
+	for (const LinkBlock& link : config_.links) {
+		if (link.host.empty() || servers_.count(link.name) || dialing_.count(link.name) || seconds < nextDial_[link.name])
+			continue;
+		nextDial_[link.name] = seconds + LINK_RETRY_SEC;
+		dialLink(link);
+	}
+}
+
+// a non-blocking connect, the socket then goes through the backend like an accepted client. PASS and
+// SERVER wait in its queue until the connection is up, a refused one fails the write and is closed
+void Server::dialLink(const LinkBlock& link) {
+	struct addrinfo hints;
+	struct addrinfo* res = nullptr;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	int error = getaddrinfo(link.host.c_str(), std::to_string(link.port).c_str(), &hints, &res);
+	if (error) {
+		logMessage(WARNING, "LINK", "Cannot resolve [" + link.host + "] for " + link.name + ": " + gai_strerror(error));
+		return ;
+	}
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0 || (connect(fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS)) {
+		logMessage(WARNING, "LINK", "Connecting to " + link.name + " failed: " + strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		freeaddrinfo(res);
+		return ;
+	}
+	freeaddrinfo(res);
+	try {
+		io_->addClient(fd);
+	}
+	catch (const std::exception& e) {
+		io_->closeClient(fd);
+		logMessage(WARNING, "LINK", "Connecting to " + link.name + " failed: " + e.what());
+		return ;
+	}
+	std::unique_ptr<Client>& client = clients_[fd] = std::make_unique<Client>(fd, link.host, *io_, flushList_);
+	client->setServer(link.name); // the name it has to answer with
+	dialing_[link.name] = fd;
+	sendLinkHello(*client, link);
+	logMessage(INFO, "LINK", "Dialing " + link.name + " at " + link.host + ":" + std::to_string(link.port));
+}
+
+void Server::sendLinkHello(Client& client, const LinkBlock& link) {
+	client.appendSendBuffer("PASS " + link.password + " " LINK_PROTOCOL " " LINK_PROTOCOL_VERSION "\r\n");
+	client.appendSendBuffer("SERVER " + serverName_ + " 1 :" LINK_DESCRIPTION "\r\n");
+}
+
+// SERVER <name> <hops> :<description> from a connection that sent PASS <password> TS 6, either one this
+// server dialed or one it accepted. When both ends dial each other at once, the connection dialed by the
+// server with the smaller name is kept, both ends decide the same
+void Server::handleServer(Client& client, const std::vector<std::string>& params) {
+
+	if (client.isRegistered()) {
+		messageHandle(ERR_ALREADYREGISTERED, client, "SERVER", params);
+		return;
+	}
+	if (params.size() < 3) {
+		messageHandle(ERR_NEEDMOREPARAMS, client, "SERVER", params);
+		return;
+	}
+	const std::string& name = params[0];
+	const LinkBlock* link = findLinkBlock(config_.links, name);
+	bool dialed = !client.getServer().empty();
+	std::string error;
+	if (!link || client.getPassword() != link->password)
+		error = "No matching link block for " + name;
+	else if (dialed && client.getServer() != name)
+		error = "Dialed " + client.getServer() + ", answered as " + name;
+	else if (name == serverName_ || servers_.count(name))
+		error = "Server " + name + " already exists";
+	else if (!dialed && dialing_.count(name) && serverName_ < name)
+		error = "Crossed link with " + name + ", keeping the one dialed by " + serverName_;
+	if (!error.empty()) {
+		logMessage(WARNING, "LINK", error + ". ClientFD: " + std::to_string(client.getClientFD()));
+		client.appendSendBuffer("ERROR :Closing Link: " + error + "\r\n");
+		return flushAndClose(client);
+	}
+	auto dialing = dialing_.find(name);
+	if (dialing != dialing_.end()) {
+		int crossedFd = dialing->second;
+		dialing_.erase(dialing);
+		auto crossed = clients_.find(crossedFd);
+		if (!dialed && crossed != clients_.end()) // crossed, ours gives way
+			closeClient(*crossed->second);
+	}
+	client.setState(CLIENT_SERVER);
+	client.setServer(name);
+	servers_[name] = RemoteServer{serverName_, 1, params[2], &client};
+	if (!dialed)
+		sendLinkHello(client, *link);
+	propagate(":" + serverName_ + " SERVER " + name + " 2 :" + params[2] + "\r\n", nullptr);
+	links_.push_back(&client);
+	sendBurst(client);
+	logMessage(INFO, "LINK", "Linked with " + name + (dialed ? " (dialed)" : " (accepted)") + ", burst sent");
+}
+
+// everything the other end cannot know yet: servers parents first, users, channels with their members
+// and topics. The PING at the end comes back as PONG once the other end processed all of it
+void Server::sendBurst(Client& link) {
+	std::vector<std::pair<std::string, const RemoteServer*>> servers;
+	for (const auto& [name, server] : servers_)
+		if (server.uplink != &link)
+			servers.emplace_back(name, &server);
+	std::stable_sort(servers.begin(), servers.end(), [](const std::pair<std::string, const RemoteServer*>& a,
+		const std::pair<std::string, const RemoteServer*>& b) { return (a.second->hops < b.second->hops); });
+	for (const auto& [name, server] : servers)
+		link.appendSendBuffer(":" + server->parent + " SERVER " + name + " " + std::to_string(server->hops + 1) + " :" + server->description + "\r\n");
+
+	for (const auto& [fd, client] : clients_)
+		if (client && client->isRegistered())
+			link.appendSendBuffer(nickLine(*client));
+	for (const std::unique_ptr<Client>& client : remoteClients_)
+		if (client->getUplink() != &link)
+			link.appendSendBuffer(nickLine(*client));
+
+	for (const auto& [name, channel] : channelMap_) {
+		std::string members;
+		bool sent = false;
+		for (Client* member : channel->getMembers()) {
+			if (member->getUplink() == &link)
+				continue;
+			std::string entry = (channel->isOperator(member) ? "@" : "") + member->getNickname();
+			if (!members.empty() && members.size() + entry.size() >= LINK_SJOIN_MEMBERS_BYTES) {
+				link.appendSendBuffer(sjoinLine(serverName_, *channel, members));
+				members.clear();
+				sent = true;
+			}
+			members += (members.empty() ? "" : " ") + entry;
+		}
+		if (!members.empty()) {
+			link.appendSendBuffer(sjoinLine(serverName_, *channel, members));
+			sent = true;
+		}
+		if (sent && !channel->getTopic().empty())
+			link.appendSendBuffer(":" + serverName_ + " TB " + name + " " + std::to_string(channel->getCreatedAt()) + " "
+				+ std::to_string(channel->getTopicTime()) + " :" + channel->getTopic() + "\r\n");
+		for (char list : {'b', 'e', 'I'}) {
+			std::vector<std::string> masks;
+			for (const MaskEntry& entry : channel->getMaskList(list).getEntries())
+				masks.push_back(entry.mask);
+			if (sent && !masks.empty())
+				sendBmask(link, false, serverName_, *channel, list, masks);
+		}
+	}
+	link.appendSendBuffer(":" + serverName_ + " PING :" + serverName_ + "\r\n");
+}
+
+// called by closeClient() for a link: its servers and their users are gone for this side of the network
+void Server::dropLink(Client& link) {
+	links_.erase(std::find(links_.begin(), links_.end(), &link));
+	propagate(":" + serverName_ + " SQUIT " + link.getServer() + " :Link closed\r\n", nullptr);
+	size_t users = remoteClients_.size();
+	size_t servers = servers_.size();
+	removeServer(link.getServer());
+	logMessage(WARNING, "LINK", "Lost link to " + link.getServer() + ": " + std::to_string(servers - servers_.size())
+		+ " servers and " + std::to_string(users - remoteClients_.size()) + " users split off");
+}
+
+// the server and every server behind it, their users quit with "<parent> <server>" like a netsplit
+void Server::removeServer(const std::string& name) {
+	auto root = servers_.find(name);
+	if (root == servers_.end())
+		return ;
+	std::string reason = root->second.parent + " " + name;
+	std::set<std::string> gone = {name};
+	for (size_t before = 0; before != gone.size(); ) {
+		before = gone.size();
+		for (const auto& [server, info] : servers_)
+			if (gone.count(info.parent))
+				gone.insert(server);
+	}
+	std::vector<std::unique_ptr<Client>> kept;
+	kept.reserve(remoteClients_.size());
+	for (std::unique_ptr<Client>& user : remoteClients_) {
+		if (!gone.count(user->getServer())) {
+			kept.push_back(std::move(user));
+			continue;
+		}
+		messageBroadcast(*user, "QUIT", " :" + reason);
+		leaveAllChannels(*user);
+		unindexClient(*user);
+	}
+	remoteClients_.swap(kept);
+	for (const std::string& server : gone)
+		servers_.erase(server);
+}
+
+// LINK PROTOCOL
+// =============
+
+// one line from a linked server. The prefix is a server name (they have a dot) or the nickname of a user
+// behind this link, anything from the wrong direction is dropped. User commands that act on channels go
+// through the same handlers as local ones, those propagate them further
+void Server::handleLinkLine(Client& link, const std::string& line) {
+	std::string source = link.getServer();
+	size_t start = 0;
+	if (!line.empty() && line[0] == ':') {
+		size_t space = line.find(' ');
+		if (space == std::string::npos)
+			return ;
+		source = line.substr(1, std::min(space, line.find('!')) - 1);
+		start = space + 1;
+	}
+	std::pair<std::string, std::vector<std::string>> parsed = parseCommand(line.substr(start));
+	std::string command = parsed.first;
+	const std::vector<std::string>& params = parsed.second;
+	std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+
+	if (source.find('.') == std::string::npos) {
+		Client* user = getClient(source);
+		if (!user || user->getUplink() != &link) {
+			logMessage(DEBUG, "LINK", "Dropped " + command + " from unknown user " + source + " via " + link.getServer());
+			return ;
+		}
+		if (command == "NICK")
+			return linkNickChange(link, *user, params);
+		if (command == "QUIT") {
+			std::string reason = params.empty() ? "Client quit" : params[0];
+			propagate(":" + user->getNickname() + " QUIT :" + reason + "\r\n", &link);
+			logMessage(INFO, "QUIT", "User " + user->getNickname() + " on " + user->getServer() + " quit (reason: " + reason + ")");
+			return removeRemoteClient(*user, reason);
+		}
+		if (command == "KILL")
+			return linkKill(link, source, params);
+		if (command == "PRIVMSG" || command == "PART" || command == "KICK" || command == "TOPIC" || command == "MODE" || command == "INVITE")
+			return commands[command](*user, params);
+		logMessage(DEBUG, "LINK", "Ignored " + command + " from " + source + " via " + link.getServer());
+		return ;
+	}
+	auto server = servers_.find(source);
+	if (server == servers_.end() || server->second.uplink != &link) {
+		logMessage(DEBUG, "LINK", "Dropped " + command + " from unknown server " + source + " via " + link.getServer());
+		return ;
+	}
+	if (command == "PING")
+		link.appendSendBuffer(":" + serverName_ + " PONG " + serverName_ + " :" + (params.empty() ? source : params[0]) + "\r\n");
+	else if (command == "PONG" && params.size() > 1 && params[1] == serverName_)
+		logMessage(INFO, "LINK", "Burst to " + link.getServer() + " processed");
+	else if (command == "ERROR") {
+		logMessage(WARNING, "LINK", link.getServer() + " closed the link: " + (params.empty() ? "" : params[0]));
+		closeClient(link);
+	}
+	else if (command == "SERVER")
+		linkServer(link, source, params);
+	else if (command == "NICK")
+		linkNick(link, params);
+	else if (command == "SJOIN")
+		linkSjoin(link, source, params);
+	else if (command == "TB")
+		linkTopicBurst(link, source, params);
+	else if (command == "BMASK")
+		linkBmask(link, source, params);
+	else if (command == "SQUIT")
+		linkSquit(link, source, params);
+	else if (command == "KILL")
+		linkKill(link, source, params);
+	else
+		logMessage(DEBUG, "LINK", "Ignored " + command + " from " + source + " via " + link.getServer());
+}
+
+// :<parent> SERVER <name> <hops> :<description>, a server further away. A name this side knows already
+// means a loop or a second link into the same network, the link is dropped
+void Server::linkServer(Client& link, const std::string& source, const std::vector<std::string>& params) {
+	if (params.size() < 3)
+		return ;
+	const std::string& name = params[0];
+	if (name == serverName_ || servers_.count(name) || name.find('.') == std::string::npos) {
+		logMessage(ERROR, "LINK", link.getServer() + " introduced " + name + " which already exists, dropping the link");
+		link.appendSendBuffer("ERROR :Server " + name + " already exists\r\n");
+		return flushAndClose(link);
+	}
+	int hops = std::atoi(params[1].c_str());
+	servers_[name] = RemoteServer{source, hops, params[2], &link};
+	propagate(":" + source + " SERVER " + name + " " + std::to_string(hops + 1) + " :" + params[2] + "\r\n", &link);
+	logMessage(INFO, "LINK", "Server " + name + " joined the network behind " + link.getServer());
+}
+
+// :<server> SQUIT <name> :<reason>, a link somewhere behind this one went down
+void Server::linkSquit(Client& link, const std::string& source, const std::vector<std::string>& params) {
+	if (params.empty())
+		return ;
+	if (params[0] == serverName_ || params[0] == link.getServer()) {
+		logMessage(WARNING, "LINK", link.getServer() + " closed the link");
+		return closeClient(link);
+	}
+	auto server = servers_.find(params[0]);
+	if (server == servers_.end() || server->second.uplink != &link)
+		return ;
+	propagate(":" + source + " SQUIT " + params[0] + " :" + (params.size() > 1 ? params[1] : "") + "\r\n", &link);
+	size_t users = remoteClients_.size();
+	removeServer(params[0]);
+	logMessage(WARNING, "LINK", "Server " + params[0] + " split off behind " + link.getServer() + " with "
+		+ std::to_string(users - remoteClients_.size()) + " users");
+}
+
+// NICK <nick> <ts> <user> <host> <server> :<realname>
+void Server::linkNick(Client& link, const std::vector<std::string>& params) {
+	if (params.size() < 6 || !isValidNickname(params[0]))
+		return ;
+	auto server = servers_.find(params[4]);
+	if (server == servers_.end() || server->second.uplink != &link)
+		return ;
+	time_t nickTs = std::strtoll(params[1].c_str(), nullptr, 10);
+	if (!resolveNickCollision(link, params[0], nickTs))
+		return ;
+	std::unique_ptr<Client> user = std::make_unique<Client>(link, params[4], nickTs, *io_, flushList_);
+	user->setUsername(params[2]);
+	user->setHostname(params[3]);
+	user->setRealName(params[5]);
+	setClientNickname(*user, params[0]); // registered from the start, watchers get the full prefix
+	indexUser(*user);
+	propagate(nickLine(*user), &link);
+	remoteClients_.push_back(std::move(user));
+}
+
+// :<old> NICK <new> :<ts>
+void Server::linkNickChange(Client& link, Client& user, const std::vector<std::string>& params) {
+	if (params.empty() || !isValidNickname(params[0]))
+		return ;
+	time_t nickTs = params.size() > 1 ? std::strtoll(params[1].c_str(), nullptr, 10) : time(nullptr);
+	std::string oldNick = user.getNickname();
+	if (!stringCompCaseIgnore(oldNick, params[0]) && !resolveNickCollision(link, params[0], nickTs)) {
+		propagate(":" + serverName_ + " KILL " + oldNick + " :Nick collision\r\n", &link);
+		return removeRemoteClient(user, "Killed (Nick collision)");
+	}
+	std::string line = user.getClientIdentifier() + " NICK :" + params[0] + "\r\n";
+	messageBroadcast(user, "NICK", line);
+	setClientNickname(user, params[0]);
+	user.setNickTs(nickTs);
+	propagate(":" + oldNick + " NICK " + params[0] + " :" + std::to_string(nickTs) + "\r\n", &link);
+}
+
+// a nick coming in from link, taken at nickTs, against whoever has it here. Both ends of the link compare
+// the same two timestamps, so each kills its own loser and no kill has to cross the link: the user that
+// took the nick first stays, in the same second both go. True when the incoming one may have the nick
+bool Server::resolveNickCollision(Client& link, const std::string& nick, time_t nickTs) {
+	Client* existing = getClient(nick);
+	if (!existing)
+		return (true);
+	if (!existing->isRegistered()) { // not known to the network yet, it just picks another one
+		setClientNickname(*existing, "");
+		messageHandle(ERR_NICKNAMEINUSE, *existing, "NICK", {nick});
+		return (true);
+	}
+	logMessage(WARNING, "LINK", "Nick collision on " + nick + ": " + std::to_string(existing->getNickTs()) + " here, "
+		+ std::to_string(nickTs) + " from " + link.getServer());
+	if (nickTs > existing->getNickTs())
+		return (false);
+	propagate(":" + serverName_ + " KILL " + existing->getNickname() + " :Nick collision\r\n", &link);
+	killClient(*existing, "Nick collision");
+	return (nickTs < existing->getNickTs());
+}
+
+// :<source> KILL <nick> :<reason>
+void Server::linkKill(Client& link, const std::string& source, const std::vector<std::string>& params) {
+	if (params.empty())
+		return ;
+	Client* target = getClient(params[0]);
+	if (!target || !target->isRegistered())
+		return ;
+	std::string reason = params.size() > 1 ? params[1] : "Killed";
+	propagate(":" + source + " KILL " + target->getNickname() + " :" + reason + "\r\n", &link);
+	logMessage(WARNING, "LINK", target->getNickname() + " killed by " + source + " (" + reason + ")");
+	killClient(*target, reason);
+}
+
+// without propagating, the caller tells the links
+void Server::killClient(Client& user, const std::string& reason) {
+	if (user.isRemote())
+		return removeRemoteClient(user, "Killed (" + reason + ")");
+	user.appendSendBuffer(":" + serverName_ + " KILL " + user.getNickname() + " :" + reason + "\r\n");
+	messageBroadcast(user, "QUIT", " :Killed (" + reason + ")");
+	user.setState(CLIENT_CLOSING); // closeClient() would send a QUIT to the links
+	flushAndClose(user);
+}
+
+void Server::removeRemoteClient(Client& user, const std::string& reason) {
+	messageBroadcast(user, "QUIT", " :" + reason);
+	leaveAllChannels(user);
+	unindexClient(user);
+	for (auto it = remoteClients_.begin(); it != remoteClients_.end(); ++it) {
+		if (it->get() == &user) {
+			remoteClients_.erase(it);
+			return ;
+		}
+	}
+}
+
+// :<server> SJOIN <ts> <#channel> <+modes> [args] :[@]nick ...
+// The older channel wins: with a smaller ts the local modes and operators are dropped and theirs apply,
+// with the same ts both are merged, with a larger one theirs are ignored and only the members join
+void Server::linkSjoin(Client& link, const std::string& source, const std::vector<std::string>& params) {
+	if (params.size() < 4 || !isValidChannelName(params[1]) || params[2].empty() || params[2][0] != '+')
+		return ;
+	time_t channelTs = std::strtoll(params[0].c_str(), nullptr, 10);
+	const std::string& name = params[1];
+	std::vector<std::string> modeArgs(params.begin() + 3, params.end() - 1);
+	Channel* channel = getChannel(name);
+	if (!channel) {
+		channel = new Channel(name, channelTs);
+		if (historyStore_ && historyStore_->hadHistory(name))
+			channel->getHistory().markTruncated();
+		channelMap_[name] = channel;
+	}
+	bool empty = channel->getMembers().empty(); // nobody to keep anything for, a leftover takes theirs
+	bool theirs = empty || channelTs <= channel->getCreatedAt();
+	if (empty || channelTs < channel->getCreatedAt()) {
+		resetChannelModes(*channel, source);
+		channel->setCreatedAt(channelTs);
+	}
+	if (theirs)
+		mergeChannelModes(*channel, source, params[2], modeArgs);
+
+	std::string accepted;
+	for (const std::string& entry : split(params.back(), ' ')) {
+		bool op = !entry.empty() && entry[0] == '@';
+		Client* member = getClient(op ? entry.substr(1) : entry);
+		if (!member || member->getUplink() != &link)
+			continue; // lost a nick collision on the way
+		if (!channel->isMember(member)) {
+			channel->addChannelMember(member);
+			member->addToJoinedChannelList(name);
+			messageBroadcast(*channel, *member, "JOIN", "");
+		}
+		if (op && theirs && !channel->isOperator(member)) {
+			channel->setOperator(member, true);
+			sendToMembers(*channel, ":" + source + " MODE " + name + " +o " + member->getNickname() + "\r\n");
+		}
+		accepted += (accepted.empty() ? "" : " ") + std::string(op && theirs ? "@" : "") + member->getNickname();
+	}
+	if (!accepted.empty())
+		propagate(sjoinLine(source, *channel, accepted), &link);
+}
+
+// the local side lost the channel ts: modes and operator status go, announced to the local members
+void Server::resetChannelModes(Channel& channel, const std::string& source) {
+	std::string removed = channelModes(channel);
+	if (channel.isKeyProtected()) // "-k *" like channelKeyMode()
+		removed.replace(removed.find(' '), removed.find(' ', removed.find(' ') + 1) - removed.find(' '), " *");
+	if (removed != "+" && !channel.getMembers().empty())
+		sendToMembers(channel, ":" + source + " MODE " + channel.getName() + " -" + removed.substr(1) + "\r\n");
+	std::set<Client*> operators = channel.getOperators();
+	for (Client* op : operators) {
+		channel.setOperator(op, false);
+		sendToMembers(channel, ":" + source + " MODE " + channel.getName() + " -o " + op->getNickname() + "\r\n");
+	}
+	for (char list : {'b', 'e', 'I'})
+		for (const MaskEntry& entry : channel.getMaskList(list).getEntries())
+			sendToMembers(channel, ":" + source + " MODE " + channel.getName() + " -" + list + " " + entry.mask + "\r\n");
+	channel.clearMasks();
+	channel.setInviteOnly(false);
+	channel.setChannelKey("");
+	channel.setKeyProtected(false);
+	channel.setUserLimit(-1);
+	channel.setTopicOperatorOnly(false);
+}
+
+// sets what the SJOIN has on top of the local modes. Where both have a key or limit both ends keep the
+// larger one, so they agree after merging
+void Server::mergeChannelModes(Channel& channel, const std::string& source, const std::string& modes, const std::vector<std::string>& args) {
+	std::string added = "+";
+	std::string addedArgs;
+	size_t argIndex = 0;
+	for (char mode : modes.substr(1)) {
+		if (mode == 'i' && !channel.isInviteOnly()) {
+			channel.setInviteOnly(true);
+			added += "i";
+		}
+		else if (mode == 't' && !channel.isTopicOperatorOnly()) {
+			channel.setTopicOperatorOnly(true);
+			added += "t";
+		}
+		else if (mode == 'k' && argIndex < args.size()) {
+			const std::string& key = args[argIndex++];
+			if (isValidChannelKey(key) && (!channel.isKeyProtected() || key > channel.getChannelKey())) {
+				channel.setChannelKey(key);
+				channel.setKeyProtected(true);
+				added += "k";
+				addedArgs += " " + key;
+			}
+		}
+		else if (mode == 'l' && argIndex < args.size()) {
+			int limit = std::atoi(args[argIndex++].c_str());
+			if (limit > channel.getUserLimit() && limit <= CHAN_USER_LIMIT) {
+				channel.setUserLimit(limit);
+				added += "l";
+				addedArgs += " " + std::to_string(limit);
+			}
+		}
+	}
+	if (added != "+")
+		sendToMembers(channel, ":" + source + " MODE " + channel.getName() + " " + added + addedArgs + "\r\n");
+}
+
+// :<server> TB <#channel> <channel ts> <topic ts> :<topic>, the older topic wins. Only for the same
+// channel ts, a side that lost the channel lost its topic with it
+void Server::linkTopicBurst(Client& link, const std::string& source, const std::vector<std::string>& params) {
+	if (params.size() < 4 || params[3].empty())
+		return ;
+	Channel* channel = getChannel(params[0]);
+	if (!channel || std::strtoll(params[1].c_str(), nullptr, 10) != channel->getCreatedAt())
+		return ;
+	time_t topicTs = std::strtoll(params[2].c_str(), nullptr, 10);
+	const std::string& topic = params[3];
+	if (!channel->getTopic().empty() && (topicTs > channel->getTopicTime()
+		|| (topicTs == channel->getTopicTime() && topic <= channel->getTopic())))
+		return ;
+	channel->setTopic(topic);
+	channel->setTopicTime(topicTs);
+	sendToMembers(*channel, ":" + source + " TOPIC " + channel->getName() + " :" + topic + "\r\n");
+	propagate(":" + source + " TB " + channel->getName() + " " + params[1] + " " + params[2] + " :" + topic + "\r\n", &link);
+}
+
+// :<server> BMASK <channel ts> <#channel> <b|e|I> :<mask> ..., added to the list of a channel with the same
+// ts. Setter and time do not travel, the masks are listed as set by the server that sent them
+void Server::linkBmask(Client& link, const std::string& source, const std::vector<std::string>& params) {
+	if (params.size() < 4 || params[2].size() != 1 || std::string("beI").find(params[2][0]) == std::string::npos)
+		return ;
+	Channel* channel = getChannel(params[1]);
+	if (!channel || std::strtoll(params[0].c_str(), nullptr, 10) != channel->getCreatedAt())
+		return ;
+	char list = params[2][0];
+	std::vector<std::string> added;
+	for (const std::string& mask : split(params[3], ' ')) {
+		if (mask.empty() || channel->getMaskList(list).size() >= CHAN_MASK_LIST_MAX)
+			continue;
+		std::string normalized = MaskList::normalize(mask);
+		if (channel->addMask(list, normalized, source, time(nullptr))) {
+			sendToMembers(*channel, ":" + source + " MODE " + channel->getName() + " +" + list + " " + normalized + "\r\n");
+			added.push_back(normalized);
+		}
+	}
+	if (!added.empty())
+		sendBmask(link, true, source, *channel, list, added);
+}
+
+// onward: to every link but the one it came from (propagate()), otherwise the burst to that link only
+void Server::sendBmask(Client& link, bool onward, const std::string& source, Channel& channel, char list, const std::vector<std::string>& masks) {
+	std::string prefix = ":" + source + " BMASK " + std::to_string(channel.getCreatedAt()) + " " + channel.getName() + " " + list + " :";
+	std::string line;
+	for (size_t i = 0; i < masks.size(); i++) {
+		line += (line.empty() ? "" : " ") + masks[i];
+		if (i + 1 < masks.size() && line.size() + masks[i + 1].size() < LINK_BMASK_BYTES)
+			continue;
+		if (onward)
+			propagate(prefix + line + "\r\n", &link);
+		else
+			link.appendSendBuffer(prefix + line + "\r\n");
+		line.clear();
+	}
+}
@@ -1,6 +1,7 @@
 #include "../includes/Server.hpp"
 #include "../includes/responseCodes.hpp"
 #include "../includes/macros.hpp"
+#include "../includes/probes.hpp"
 
 void Server::registerCommands() {
 
@@ -11,9 +12,10 @@ void Server::registerCommands() {
 	};
 
 	commands["WHO"] = [this](Client& client, const std::vector<std::string>& params) {
-		(void)params;
-		(void)this;
-		logMessage(WARNING, "WHO", "WHO command ignored. ClientFD: " + std::to_string(client.getClientFD()));
+		handleWho(client, params);
+	};
+	commands["MONITOR"] = [this](Client& client, const std::vector<std::string>& params) {
+		handleMonitor(client, params);
 	};
 
 	commands["PING"] = [this](Client& client, const std::vector<std::string>& params) {
@@ -62,6 +64,33 @@ void Server::registerCommands() {
 	commands["WHOIS"] = [this](Client& client, const std::vector<std::string>& params) {
 		handleWhois(client, params);
 	};
+
+	commands["PART"] = [this](Client& client, const std::vector<std::string>& params) {
+		handlePart(client, params);
+	};
+
+	commands["OPER"] = [this](Client& client, const std::vector<std::string>& params) {
+		handleOper(client, params);
+	};
+
+	commands["STATS"] = [this](Client& client, const std::vector<std::string>& params) {
+		handleStats(client, params);
+	};
+
+	commands["CHATHISTORY"] = [this](Client& client, const std::vector<std::string>& params) {
+		handleChatHistory(client, params);
+	};
+	commands["LIST"] = [this](Client& client, const std::vector<std::string>& params) {
+		handleList(client, params);
+	};
+
+	commands["UPGRADE"] = [this](Client& client, const std::vector<std::string>& params) {
+		handleUpgrade(client, params);
+	};
+
+	commands["SERVER"] = [this](Client& client, const std::vector<std::string>& params) {
+		handleServer(client, params);
+	};
 }
 
 void Server::handlePing(Client& client, const std::vector<std::string>& params) {
@@ -79,29 +108,56 @@ void Server::handlePing(Client& client, const std::vector<std::string>& params)
 }
 
 void Server::handleQuit(Client& client, const std::vector<std::string>& params) {
-	if (!client.isConnected() || !client.isAuthenticated()) {//no broadcasting from unconnected or unregistered clients
-		logMessage(INFO, "QUIT", "Closed unauthenticated/unresponsive client " + client.getNickname());
+	bool registered = client.isRegistered();
+	client.setState(CLIENT_CLOSING);
+	if (!registered) {//no broadcasting from unregistered clients
+		logMessage(INFO, "QUIT", "Closed unauthenticated client " + client.getNickname());
 		return closeClient(client);
 	}
 	std::string reason = "Client quit";
 	if (!params.empty())
 		reason = params[0];
 	messageBroadcast(client, "QUIT", " :" + reason);
+	propagate(":" + client.getNickname() + " QUIT :" + reason + "\r\n", nullptr);
 	logMessage(INFO, "QUIT", "User " + client.getNickname() + " quit (reason: " + reason + ")");
 	closeClient(client);
 	logMessage(DEBUG, "QUIT", "Server still alive after closing client");
 }
 
+// for a last line like ERROR or KILL: a completion backend submits it before the socket is shut down
+// and keeps the buffer until the send completed (IoBackend::retireSendQueue())
+void Server::flushAndClose(Client& client) {
+	client.sendData();
+	closeClient(client);
+}
+
 void Server::closeClient(Client& client) {
 
 	int clientfd = client.getClientFD();
-	int epollfd = client.getEpollFd();
+	PROBE_CLOSE(clientfd, client.getNickname().c_str());
+	if (client.getState() == CLIENT_SERVER)
+		dropLink(client);
+	else if (client.isRegistered()) // hung up without QUIT, handleQuit() told the links otherwise
+		propagate(":" + client.getNickname() + " QUIT :Connection closed\r\n", nullptr);
+	auto dialing = dialing_.find(client.getServer());
+	if (dialing != dialing_.end() && dialing->second == clientfd) {
+		logMessage(WARNING, "LINK", "Could not link with " + dialing->first + ", retrying in " + std::to_string(LINK_RETRY_SEC) + "s");
+		dialing_.erase(dialing);
+	}
 	leaveAllChannels(client); // remove client from Channel member lists and clear joinedChannels
-	client.setConnected(false);
-	struct epoll_event ev;
-	ev.events = EPOLLIN;
-	ev.data.fd = clientfd;
-	epoll_ctl(epollfd, EPOLL_CTL_DEL, clientfd, &ev);
+	unindexClient(client);
+	unwatchAll(client);
+	if (client.isReadPaused())
+		stats_.throttledClients--;
+	client.setState(CLIENT_CLOSING);
+	if (capture_)
+		capture_->connectionClosed(clientfd);
+	for (auto it = historyQueries_.begin(); it != historyQueries_.end(); ) // answers would go to the next owner of the fd
+		it = it->second == clientfd ? historyQueries_.erase(it) : std::next(it);
+	listQueries_.erase(clientfd);
+	if (!client.getAddress().empty())
+		admission_.release(client.getAddress());
+	io_->removeClient(clientfd);
 	clients_.erase(clientfd);
 }
 
@@ -134,3 +190,222 @@ void Server::handleWhois(Client& client, const std::vector<std::string>& params)
 	}
 	messageHandle(RPL_ENDOFWHOIS, client, "WHOIS", {nickName, ":End of /WHOIS list"});
 }
+
+// WHO [<mask> [o][%<fields>[,<token>]]]. A channel lists its members, anything else is a glob matched
+// against nicknames, usernames and hosts through their indexes, o keeps server operators only. With %
+// the replies are WHOX (354) carrying the fields asked for. At most WHO_MAX_RESULTS users, the replies
+// go into the send queue a chunk at a time
+void Server::handleWho(Client& client, const std::vector<std::string>& params) {
+	std::string mask = (params.empty() || params[0].empty() || params[0] == "0") ? "*" : params[0];
+	std::string options = params.size() > 1 ? params[1] : "";
+	size_t percent = options.find('%');
+	bool opersOnly = options.substr(0, percent).find('o') != std::string::npos;
+	bool whox = percent != std::string::npos;
+	std::string fields = whox ? options.substr(percent + 1) : "";
+	std::string token;
+	size_t comma = fields.find(',');
+	if (comma != std::string::npos) {
+		token = fields.substr(comma + 1, 3); // WHOX tokens are up to three digits
+		fields.resize(comma);
+	}
+
+	std::vector<Client*> users;
+	bool truncated = false;
+	Channel* channel = mask[0] == '#' ? getChannel(mask) : nullptr;
+	if (channel) {
+		for (Client* member : channel->getMembers()) {
+			if (opersOnly && !member->isServerOperator())
+				continue;
+			if (users.size() == WHO_MAX_RESULTS) {
+				truncated = true;
+				break;
+			}
+			users.push_back(member);
+		}
+	}
+	else if (mask[0] != '#')
+		truncated = findUsers(Mask(mask), opersOnly, users);
+
+	std::string chunk;
+	for (Client* user : users) {
+		chunk += whoReply(client, *user, channel, whox, fields, token);
+		if (chunk.size() >= SENDQ_CHUNK_SIZE) {
+			client.appendSendBuffer(chunk);
+			chunk.clear();
+		}
+	}
+	if (!chunk.empty())
+		client.appendSendBuffer(chunk);
+	if (truncated)
+		messageHandle(ERR_TOOMANYMATCHES, client, "WHO", {mask});
+	messageHandle(RPL_ENDOFWHO, client, "WHO", {mask});
+	logMessage(DEBUG, "WHO", mask + ": " + std::to_string(users.size()) + " users" + (truncated ? ", truncated" : ""));
+}
+
+// registered users whose nickname, username or host matches, each once and ordered by nickname. Only
+// the keys starting with the literal prefix of the mask are visited, a mask starting with a wildcard
+// walks the whole index. True when there were more than WHO_MAX_RESULTS
+bool Server::findUsers(const Mask& mask, bool opersOnly, std::vector<Client*>& users) {
+	std::map<std::string, Client*> found; // folded nickname, drops a user matched by several fields
+	const std::string& prefix = mask.getPrefix();
+	auto scan = [&](const auto& index) {
+		for (auto it = index.lower_bound(prefix); it != index.end() && found.size() <= WHO_MAX_RESULTS; ++it) {
+			if (it->first.compare(0, prefix.size(), prefix) != 0)
+				break;
+			Client* user = it->second;
+			if (user->isRegistered() && (!opersOnly || user->isServerOperator()) && mask.matches(it->first))
+				found.emplace(foldCase(user->getNickname()), user);
+		}
+	};
+	scan(nickIndex_);
+	if (!mask.matchesAll()) { // everyone has a nickname, the other indexes cannot add anybody
+		scan(userIndex_);
+		scan(hostIndex_);
+	}
+	for (auto it = found.begin(); it != found.end() && users.size() < WHO_MAX_RESULTS; ++it)
+		users.push_back(it->second);
+	return (found.size() > WHO_MAX_RESULTS);
+}
+
+// one 352, or with WHOX one 354 with the requested fields in the fixed order tcuihsnfdlaor. IPs, idle
+// time and accounts are not tracked, they get the WHOX placeholders
+std::string Server::whoReply(Client& client, Client& user, Channel* channel, bool whox, const std::string& fields, const std::string& token) {
+	std::string channelName = channel ? channel->getName() : "*";
+	std::string server = user.isRemote() ? user.getServer() : serverName_;
+	auto remote = servers_.find(server);
+	std::string hops = std::to_string(remote == servers_.end() ? 0 : remote->second.hops);
+	std::string flags = std::string("H") + (user.isServerOperator() ? "*" : "") + (channel && channel->isOperator(&user) ? "@" : "");
+	if (!whox)
+		return (createMessage(RPL_WHOREPLY, client, "WHO", {channelName, user.getUsername(), user.getHostname(), server,
+			user.getNickname(), flags, ":" + hops + " " + user.getRealName()}));
+	std::vector<std::string> reply;
+	for (char field : std::string("tcuihsnfdlaor")) {
+		if (fields.find(field) == std::string::npos)
+			continue;
+		switch (field) {
+			case 't': reply.push_back(token.empty() ? "0" : token); break;
+			case 'c': reply.push_back(channelName); break;
+			case 'u': reply.push_back(user.getUsername()); break;
+			case 'i': reply.push_back("255.255.255.255"); break;
+			case 'h': reply.push_back(user.getHostname()); break;
+			case 's': reply.push_back(server); break;
+			case 'n': reply.push_back(user.getNickname()); break;
+			case 'f': reply.push_back(flags); break;
+			case 'd': reply.push_back(hops); break;
+			case 'l': reply.push_back("0"); break;
+			case 'a': reply.push_back("0"); break;
+			case 'o': reply.push_back("n/a"); break;
+			case 'r': reply.push_back(":" + user.getRealName()); break;
+		}
+	}
+	return (createMessage(RPL_WHOSPCRPL, client, "WHO", reply));
+}
+
+void Server::handleOper(Client& client, const std::vector<std::string>& params) {
+
+	if (params.size() < 2) {
+		messageHandle(ERR_NEEDMOREPARAMS, client, "OPER", params);
+		return;
+	}
+	if (config_.operName.empty() || params[0] != config_.operName) {
+		messageHandle(ERR_NOOPERHOST, client, "OPER", {});
+		logMessage(WARNING, "OPER", "No oper block for '" + params[0] + "'. ClientFD: " + std::to_string(client.getClientFD()));
+		return;
+	}
+	if (params[1] != config_.operPassword) {
+		messageHandle(ERR_PASSWDMISMATCH, client, "OPER", {});
+		logMessage(WARNING, "OPER", "Wrong oper password from " + client.getNickname());
+		return;
+	}
+	client.setServerOperator(true);
+	messageHandle(RPL_YOUREOPER, client, "OPER", {});
+	logMessage(INFO, "OPER", client.getNickname() + " is now a server operator");
+}
+
+// hot upgrade, operators only. The reply goes out with this loop iteration, the handover follows it
+void Server::handleUpgrade(Client& client, const std::vector<std::string>& params) {
+
+	(void)params;
+	if (!client.isServerOperator()) {
+		messageHandle(ERR_NOPRIVILEGES, client, "UPGRADE", {});
+		return;
+	}
+	upgradeRequested_ = true;
+	messageHandle(RPL_UPGRADING, client, config_.upgradeBinary, {});
+	logMessage(INFO, "UPGRADE", "Hot upgrade requested by " + client.getNickname());
+}
+
+// ns -> "12.3us"
+static std::string formatMicros(uint64_t ns) {
+	std::ostringstream oss;
+	oss << std::fixed << std::setprecision(1) << ns / 1000.0 << "us";
+	return (oss.str());
+}
+
+static std::string formatLatency(const std::string& name, const LatencyHistogram& histogram) {
+	return (name + " n=" + std::to_string(histogram.getCount())
+		+ " p50=" + formatMicros(histogram.percentile(0.50))
+		+ " p99=" + formatMicros(histogram.percentile(0.99))
+		+ " p999=" + formatMicros(histogram.percentile(0.999))
+		+ " max=" + formatMicros(histogram.getMax()));
+}
+
+// STATS m: command usage, t: latency percentiles per command and loop phase, z: traffic counters,
+// r: reset everything. Operators only
+void Server::handleStats(Client& client, const std::vector<std::string>& params) {
+
+	if (params.empty()) {
+		messageHandle(ERR_NEEDMOREPARAMS, client, "STATS", params);
+		return;
+	}
+	if (!client.isServerOperator()) {
+		messageHandle(ERR_NOPRIVILEGES, client, "STATS", {});
+		return;
+	}
+	std::string query = params[0].substr(0, 1);
+	if (query == "m") {
+		for (const auto& entry : stats_.commandLatency)
+			messageHandle(RPL_STATSCOMMANDS, client, "STATS", {entry.first, std::to_string(entry.second.getCount()), "0", "0"});
+	}
+	else if (query == "t") {
+		for (const auto& entry : stats_.commandLatency)
+			messageHandle(RPL_STATSDEBUG, client, "STATS", {query, ":" + formatLatency(entry.first, entry.second)});
+		for (int phase = 0; phase < PHASE_COUNT; phase++) {
+			std::string name = std::string("phase:") + statsPhaseName(static_cast<StatsPhase>(phase));
+			messageHandle(RPL_STATSDEBUG, client, "STATS", {query, ":" + formatLatency(name, stats_.phaseLatency[phase])});
+		}
+	}
+	else if (query == "z") {
+		uint64_t seconds = (statsNow() - stats_.resetAt) / 1000000000ULL;
+		messageHandle(RPL_STATSDEBUG, client, "STATS", {query, ":clients=" + std::to_string(clients_.size())
+			+ " channels=" + std::to_string(channelMap_.size()) + " seconds=" + std::to_string(seconds)});
+		messageHandle(RPL_STATSDEBUG, client, "STATS", {query, ":lines=" + std::to_string(stats_.linesIn)
+			+ " bytesIn=" + std::to_string(stats_.bytesIn) + " bytesOut=" + std::to_string(stats_.bytesOut)});
+		messageHandle(RPL_STATSDEBUG, client, "STATS", {query, ":throttleEvents=" + std::to_string(stats_.throttleEvents)
+			+ " throttled=" + std::to_string(stats_.throttledClients) + " sendqEvictions=" + std::to_string(stats_.sendqEvictions)});
+		messageHandle(RPL_STATSDEBUG, client, "STATS", {query, ":admitted=" + std::to_string(admission_.getCount(ADMIT))
+			+ " refusedOverload=" + std::to_string(admission_.getCount(REFUSE_OVERLOAD))
+			+ " refusedIpLimit=" + std::to_string(admission_.getCount(REFUSE_IP_LIMIT))
+			+ " refusedIpRate=" + std::to_string(admission_.getCount(REFUSE_IP_RATE))
+			+ " droppedNoFds=" + std::to_string(io_->getAcceptDrops()) + " loopBusyUs=" + std::to_string(loopBusyNs_ / 1000)
+			+ " trackedAddresses=" + std::to_string(admission_.getTracked())});
+		messageHandle(RPL_STATSDEBUG, client, "STATS", {query, ":historyLines=" + std::to_string(historyOrder_.size() - historyStale_)
+			+ " historyBytes=" + std::to_string(historyBytes_)});
+		if (historyStore_) {
+			HistoryStoreStats store = historyStore_->getStats();
+			messageHandle(RPL_STATSDEBUG, client, "STATS", {query, ":historySegments=" + std::to_string(store.segments)
+				+ " historyDiskBytes=" + std::to_string(store.bytes) + " historyRecords=" + std::to_string(store.records)
+				+ " historyQueries=" + std::to_string(store.queries) + " historyWriteErrors=" + std::to_string(store.writeErrors)});
+		}
+		std::string errors;
+		for (const auto& entry : stats_.errorNumerics)
+			errors += " " + std::to_string(entry.first) + "=" + std::to_string(entry.second);
+		messageHandle(RPL_STATSDEBUG, client, "STATS", {query, ":errors" + (errors.empty() ? " none" : errors)});
+	}
+	else if (query == "r") {
+		stats_.reset();
+		messageHandle(RPL_STATSDEBUG, client, "STATS", {query, ":Statistics reset"});
+		logMessage(INFO, "STATS", "Statistics reset by " + client.getNickname());
+	}
+	messageHandle(RPL_ENDOFSTATS, client, query, {});
+}
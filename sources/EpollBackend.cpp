@@ -0,0 +1,190 @@
+#include "../includes/EpollBackend.hpp"
+#include "../includes/UringBackend.hpp"
+#include "../includes/Server.hpp"
+
+EpollBackend::EpollBackend() : epollFd_(-1), listenFd_(-1), wakeFd_(-1) {
+	epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+	if (epollFd_ < 0)
+		throw std::runtime_error("epoll fd creating failed");
+}
+
+EpollBackend::~EpollBackend() {
+	if (epollFd_ >= 0)
+		close(epollFd_);
+}
+
+const char* EpollBackend::getName() const {
+	return ("epoll");
+}
+
+bool EpollBackend::supportsHandover() const {
+	return (true);
+}
+
+void EpollBackend::growTo(int fd) {
+	if (fd >= static_cast<int>(registered_.size())) {
+		readEnabled_.resize(fd + 1, 0);
+		writeWanted_.resize(fd + 1, 0);
+		registered_.resize(fd + 1, 0);
+	}
+}
+
+void EpollBackend::addListener(int listenFd) {
+	struct epoll_event serverEvent; // epoll event for Listening socket (new connections monitoring)
+	serverEvent.events = EPOLLIN;
+	serverEvent.data.fd = listenFd;
+	syscalls_++;
+	if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenFd, &serverEvent) < 0)
+		throw std::runtime_error("Adding server socket to epoll failed");
+	listenFd_ = listenFd;
+}
+
+void EpollBackend::addWakeup(int fd) {
+	struct epoll_event wakeEvent;
+	wakeEvent.events = EPOLLIN;
+	wakeEvent.data.fd = fd;
+	syscalls_++;
+	if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &wakeEvent) < 0)
+		throw std::runtime_error("Adding wakeup fd to epoll failed");
+	wakeFd_ = fd;
+}
+
+void EpollBackend::addClient(int clientFd) {
+	struct epoll_event clientEvent;
+	clientEvent.events = EPOLLIN; // start listening for read events
+	clientEvent.data.fd = clientFd;
+
+	if (!setNoDelay(clientFd))
+		logMessage(WARNING, "SERVER", "Failed to set TCP_NODELAY for ClientFD: " + std::to_string(clientFd));
+	growTo(clientFd);
+	syscalls_++;
+	if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, clientFd, &clientEvent) < 0)
+		throw std::runtime_error("epoll_ctl() failed for client");
+	readEnabled_[clientFd] = 1;
+	writeWanted_[clientFd] = 0;
+	registered_[clientFd] = EPOLLIN;
+}
+
+void EpollBackend::removeClient(int clientFd) {
+	syscalls_++;
+	epoll_ctl(epollFd_, EPOLL_CTL_DEL, clientFd, NULL);
+	if (clientFd < static_cast<int>(registered_.size())) {
+		readEnabled_[clientFd] = 0;
+		writeWanted_[clientFd] = 0;
+		registered_[clientFd] = 0;
+	}
+}
+
+void EpollBackend::setReadEnabled(int clientFd, bool enabled) {
+	growTo(clientFd);
+	readEnabled_[clientFd] = enabled;
+	updateEvents(clientFd);
+}
+
+// EPOLLIN unless reading is paused, EPOLLOUT while there is output left over. Skips the syscall when nothing changed
+void EpollBackend::updateEvents(int fd) {
+	uint32_t events = 0;
+
+	if (readEnabled_[fd])
+		events |= EPOLLIN;
+	if (writeWanted_[fd])
+		events |= EPOLLOUT;
+	if (events == registered_[fd])
+		return ;
+
+	struct epoll_event newEvent;
+	newEvent.events = events;
+	newEvent.data.fd = fd;
+	syscalls_++;
+	if (epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &newEvent) < 0)
+		throw std::runtime_error("epoll_ctl() failed for client data receive/send " + std::string(strerror(errno)));
+	registered_[fd] = events;
+}
+
+ssize_t EpollBackend::send(int clientFd, const struct iovec* iov, int iovCount) {
+	size_t total = 0;
+	for (int i = 0; i < iovCount; i++)
+		total += iov[i].iov_len;
+
+	syscalls_++;
+	ssize_t sentByte = writev(clientFd, iov, iovCount);
+	if (sentByte < 0) {
+		if (errno != EWOULDBLOCK && errno != EAGAIN)
+			return (-1);
+		sentByte = 0;
+	}
+	growTo(clientFd);
+	writeWanted_[clientFd] = (static_cast<size_t>(sentByte) < total);
+	updateEvents(clientFd);
+	return (sentByte);
+}
+
+int EpollBackend::wait(IoHandler& handler, int timeoutMs) {
+	syscalls_++;
+	uint64_t waitStart = statsNow();
+	int epActiveSockets = epoll_wait(epollFd_, events_, MAX_EVENTS, timeoutMs);
+	blockedNs_ += statsNow() - waitStart;
+	if (epActiveSockets < 0)
+		return (errno == EINTR ? 0 : -1);
+
+	for (int i = 0; i < epActiveSockets; ++i) {
+		int currentFD = events_[i].data.fd;
+		uint32_t events = events_[i].events;
+
+		if (currentFD == wakeFd_) {
+			uint64_t count;
+			syscalls_++;
+			if (read(wakeFd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+				logMessage(WARNING, "SERVER", "Reading wakeup fd failed: " + std::string(strerror(errno)));
+			continue;
+		}
+		if (currentFD == listenFd_) {
+			struct sockaddr_in clientSocAddr;
+			socklen_t clientSocLen = sizeof(clientSocAddr);
+			syscalls_++;
+			int clientFd = accept4(listenFd_, (struct sockaddr*)&clientSocAddr, &clientSocLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (clientFd < 0) {
+				int error = errno;
+				if ((error != EMFILE && error != ENFILE) || dropPendingConnection(listenFd_))
+					logMessage(WARNING, "SERVER", "Client accept() failed: " + std::string(strerror(error))
+						+ " (" + std::to_string(acceptDrops_) + " connections dropped for lack of descriptors)");
+				continue;
+			}
+			handler.onAccept(clientFd, clientSocAddr);
+			continue;
+		}
+		if (events & EPOLLIN) {
+			syscalls_++;
+			ssize_t bytesRead = recv(currentFD, readBuf_, BUF_SIZE, MSG_DONTWAIT);
+			if (bytesRead > 0)
+				handler.onRead(currentFD, readBuf_, bytesRead);
+			else if (bytesRead == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+				handler.onHangup(currentFD);
+				continue;
+			}
+		}
+		// a throttled client has no EPOLLIN registered and maybe nothing left to send, so a hangup would
+		// never show up as a failed send and the level-triggered event would wake every wait
+		if ((events & (EPOLLHUP | EPOLLERR)) && !(events & EPOLLIN)) {
+			handler.onHangup(currentFD);
+			continue;
+		}
+		if (events & EPOLLOUT)
+			handler.onWritable(currentFD);
+	}
+	return (epActiveSockets);
+}
+
+std::unique_ptr<IoBackend> createIoBackend(const std::string& name) {
+	if (name == "uring") {
+		try {
+			return (std::make_unique<UringBackend>());
+		}
+		catch (const std::exception& e) {
+			logMessage(WARNING, "SERVER", std::string("io_uring backend unavailable (") + e.what() + "), falling back to epoll");
+		}
+	}
+	else if (name != "epoll")
+		throw std::runtime_error("Unknown I/O backend: " + name);
+	return (std::make_unique<EpollBackend>());
+}
@@ -0,0 +1,599 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../includes/HistoryStore.hpp"
+#include "../includes/Server.hpp"
+
+#define HISTORY_RECORD_MAX 65536	// longer lengths only show up in a torn or foreign file
+
+// read-only view of a whole file, unmapped when it goes out of scope
+struct MappedFile {
+	const char*	data = nullptr;
+	size_t		size = 0;
+
+	MappedFile(const std::string& path, size_t length) {
+		int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return ;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			size = std::min(length, static_cast<size_t>(st.st_size));
+			void* mapped = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+			if (mapped != MAP_FAILED)
+				data = static_cast<const char*>(mapped);
+			else
+				size = 0;
+		}
+		close(fd);
+	}
+	~MappedFile() {
+		if (data)
+			munmap(const_cast<char*>(data), size);
+	}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+};
+
+struct RecordHeader {
+	uint64_t	msgId;
+	uint64_t	timeMs;
+	uint32_t	length;
+};
+
+// false on a record that does not fit the data or cannot be one (zeroes left by a crash)
+static bool readRecord(const char* data, size_t size, size_t offset, RecordHeader& header) {
+	if (size - offset < HISTORY_RECORD_HEADER)
+		return (false);
+	std::memcpy(&header.msgId, data + offset, 8);
+	std::memcpy(&header.timeMs, data + offset + 8, 8);
+	std::memcpy(&header.length, data + offset + 16, 4);
+	return (header.msgId != 0 && header.length != 0 && header.length <= HISTORY_RECORD_MAX
+		&& header.length <= size - offset - HISTORY_RECORD_HEADER);
+}
+
+static bool writeAll(int fd, const std::string& data) {
+	size_t written = 0;
+	while (written < data.size()) {
+		ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (false);
+		written += n;
+	}
+	return (true);
+}
+
+static std::string segmentName(uint64_t firstId) {
+	std::string digits = std::to_string(firstId);
+	return (std::string(20 - digits.size(), '0') + digits);
+}
+
+static uint64_t refKey(uint64_t msgId, uint64_t timeMs, HistoryRef::Type type) {
+	return (type == HistoryRef::MSGID ? msgId : timeMs);
+}
+
+std::string escapeChannelDir(const std::string& channel) {
+	static const char hex[] = "0123456789ABCDEF";
+	std::string dir;
+	for (unsigned char c : channel) {
+		if (std::isalnum(c) || c == '-' || c == '_')
+			dir += c;
+		else {
+			dir += '%';
+			dir += hex[c >> 4];
+			dir += hex[c & 15];
+		}
+	}
+	return (dir);
+}
+
+static std::string unescapeChannelDir(const std::string& dir) {
+	std::string channel;
+	for (size_t i = 0; i < dir.size(); i++) {
+		if (dir[i] == '%' && i + 2 < dir.size() && std::isxdigit(dir[i + 1]) && std::isxdigit(dir[i + 2])) {
+			channel += static_cast<char>(std::stoi(dir.substr(i + 1, 2), nullptr, 16));
+			i += 2;
+		}
+		else
+			channel += dir[i];
+	}
+	return (channel);
+}
+
+HistoryStore::HistoryStore(const std::string& dir, uint64_t segmentBytes, uint64_t retainBytes)
+	: dir_(dir), segmentBytes_(segmentBytes), retainBytes_(retainBytes), wakeFd_(-1), nextMsgId_(1),
+	stopping_(false), useClock_(0), openChannels_(0), segments_(0), bytes_(0), records_(0), queries_(0), writeErrors_(0) {
+	if (mkdir(dir_.c_str(), 0700) < 0 && errno != EEXIST)
+		throw std::runtime_error("history " + dir_ + ": " + strerror(errno));
+	recover();
+	wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakeFd_ < 0)
+		throw std::runtime_error("history eventfd: " + std::string(strerror(errno)));
+	writer_ = std::thread(&HistoryStore::run, this);
+}
+
+// everything queued is written out and synced before the thread exits
+HistoryStore::~HistoryStore() {
+	submit();
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		stopping_ = true;
+	}
+	wakeWriter_.notify_one();
+	writer_.join();
+	close(wakeFd_);
+}
+
+// STARTUP
+// =======
+
+void HistoryStore::recover() {
+	DIR* root = opendir(dir_.c_str());
+	if (!root)
+		throw std::runtime_error("history " + dir_ + ": " + strerror(errno));
+	std::vector<std::string> names;
+	while (struct dirent* entry = readdir(root))
+		if (entry->d_name[0] != '.')
+			names.push_back(entry->d_name);
+	closedir(root);
+	for (const std::string& name : names)
+		recoverChannel(unescapeChannelDir(name), dir_ + "/" + name);
+}
+
+void HistoryStore::recoverChannel(const std::string& name, const std::string& dir) {
+	DIR* files = opendir(dir.c_str());
+	if (!files)
+		return ;
+	std::vector<std::string> logs;
+	while (struct dirent* entry = readdir(files)) {
+		std::string file = entry->d_name;
+		if (file.size() > 4 && file.compare(file.size() - 4, 4, ".log") == 0)
+			logs.push_back(file.substr(0, file.size() - 4));
+	}
+	closedir(files);
+	std::sort(logs.begin(), logs.end());
+
+	ChannelLog log{dir, {}, 0, -1, -1, 0, false, "", ""};
+	for (size_t i = 0; i < logs.size(); i++) {
+		Segment segment{dir + "/" + logs[i], 0, 0, 0, 0, 0, 0, 0};
+		if (!recoverSegment(segment, i + 1 == logs.size())) {
+			unlink((segment.path + ".log").c_str());
+			unlink((segment.path + ".idx").c_str());
+			continue;
+		}
+		log.bytes += segment.logBytes + segment.idxBytes;
+		log.segments.push_back(segment);
+	}
+	if (log.segments.empty())
+		return ;
+	segments_ += log.segments.size();
+	bytes_ += log.bytes;
+	nextMsgId_ = std::max(nextMsgId_, log.segments.back().lastId + 1);
+	recovered_.insert(name);
+	channels_[name] = std::move(log);
+}
+
+// Rebuilds the bookkeeping of a segment from its files and cuts them back to the last whole record:
+// a crash can leave a torn record, zeroes or index entries the log never got. Only the block after the
+// last index entry is scanned, the ones before it were whole when the next entry was written
+bool HistoryStore::recoverSegment(Segment& segment, bool last) {
+	std::vector<IndexEntry> index;
+	size_t idxSize;
+	{
+		MappedFile idx(segment.path + ".idx", SIZE_MAX);
+		idxSize = idx.size;
+		index.resize(idx.size / sizeof(IndexEntry));
+		if (!index.empty())
+			std::memcpy(index.data(), idx.data, index.size() * sizeof(IndexEntry));
+	}
+	MappedFile log(segment.path + ".log", SIZE_MAX);
+	while (!index.empty() && index.back().offset >= log.size)
+		index.pop_back();
+
+	size_t offset = index.empty() ? 0 : index.back().offset;
+	RecordHeader header;
+	uint64_t previousId = 0;
+	while (readRecord(log.data, log.size, offset, header) && header.msgId > previousId) {
+		if (index.empty())
+			index.push_back(IndexEntry{header.msgId, header.timeMs, 0});
+		segment.lastId = header.msgId;
+		segment.lastTime = header.timeMs;
+		previousId = header.msgId;
+		offset += HISTORY_RECORD_HEADER + header.length;
+	}
+	if (!previousId)
+		return (false);
+	if (offset < log.size) {
+		logMessage(WARNING, "HISTORY", segment.path + ".log: " + std::to_string(log.size - offset)
+			+ " bytes after the last whole record dropped" + (last ? "" : " in a sealed segment"));
+		if (truncate((segment.path + ".log").c_str(), offset) < 0)
+			return (false);
+	}
+	if (idxSize != index.size() * sizeof(IndexEntry)) {
+		int fd = open((segment.path + ".idx").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		if (fd < 0 || !writeAll(fd, std::string(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(IndexEntry)))) {
+			if (fd >= 0)
+				close(fd);
+			return (false);
+		}
+		close(fd);
+	}
+	segment.firstId = index.front().msgId;
+	segment.firstTime = index.front().timeMs;
+	segment.logBytes = offset;
+	segment.idxBytes = index.size() * sizeof(IndexEntry);
+	segment.lastIndexed = index.back().offset;
+	return (true);
+}
+
+// LOOP SIDE
+// =========
+
+void HistoryStore::append(const std::string& channel, const HistoryEntry& entry) {
+	pending_.appends.push_back(Append{channel, entry});
+}
+
+void HistoryStore::query(const HistoryQuery& query) {
+	pending_.queries.push_back(query);
+}
+
+void HistoryStore::submit() {
+	if (pending_.appends.empty() && pending_.queries.empty())
+		return ;
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		if (queued_.appends.empty())
+			queued_.appends.swap(pending_.appends);
+		else
+			std::move(pending_.appends.begin(), pending_.appends.end(), std::back_inserter(queued_.appends));
+		std::move(pending_.queries.begin(), pending_.queries.end(), std::back_inserter(queued_.queries));
+	}
+	pending_.appends.clear();
+	pending_.queries.clear();
+	wakeWriter_.notify_one();
+}
+
+void HistoryStore::takeResults(std::vector<HistoryResult>& results) {
+	std::lock_guard<std::mutex> guard(lock_);
+	results.swap(results_);
+}
+
+int HistoryStore::getWakeFd() const {
+	return (wakeFd_);
+}
+
+uint64_t HistoryStore::getNextMsgId() const {
+	return (nextMsgId_);
+}
+
+bool HistoryStore::hadHistory(const std::string& channel) const {
+	return (recovered_.count(channel) != 0);
+}
+
+HistoryStoreStats HistoryStore::getStats() const {
+	return (HistoryStoreStats{segments_.load(), bytes_.load(), records_.load(), queries_.load(), writeErrors_.load()});
+}
+
+const std::string& HistoryStore::getDir() const {
+	return (dir_);
+}
+
+// WRITER THREAD
+// =============
+
+// appends first so a query sees every line recorded before it was made, then the answers. Dirty
+// files are synced once HISTORY_SYNC_MS passed, also when no new work arrives
+void HistoryStore::run() {
+	std::chrono::steady_clock::time_point lastSync = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> guard(lock_);
+	while (true) {
+		wakeWriter_.wait_for(guard, std::chrono::milliseconds(HISTORY_SYNC_MS), [this]() {
+			return (stopping_ || !queued_.appends.empty() || !queued_.queries.empty());
+		});
+		Batch batch;
+		std::swap(batch, queued_);
+		bool stop = stopping_;
+		guard.unlock();
+
+		std::vector<ChannelLog*> touched;
+		for (const Append& append : batch.appends) {
+			ChannelLog* log = writeRecord(append);
+			if (log && std::find(touched.begin(), touched.end(), log) == touched.end())
+				touched.push_back(log);
+		}
+		for (ChannelLog* log : touched)
+			flush(*log);
+		std::vector<HistoryResult> answers;
+		for (const HistoryQuery& query : batch.queries)
+			answers.push_back(answer(query));
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now - lastSync >= std::chrono::milliseconds(HISTORY_SYNC_MS)) {
+			syncDirty();
+			lastSync = now;
+		}
+
+		guard.lock();
+		if (!answers.empty()) {
+			std::move(answers.begin(), answers.end(), std::back_inserter(results_));
+			uint64_t one = 1;
+			if (::write(wakeFd_, &one, sizeof(one)) < 0)
+				logMessage(WARNING, "HISTORY", std::string("Waking the event loop failed: ") + strerror(errno));
+		}
+		if (stop && queued_.appends.empty() && queued_.queries.empty())
+			break;
+	}
+	guard.unlock();
+	for (auto& [name, log] : channels_) {
+		flush(log);
+		closeFiles(log);
+	}
+}
+
+// the record goes to the channel's buffers, flush() writes them once per batch
+HistoryStore::ChannelLog* HistoryStore::writeRecord(const Append& append) {
+	auto it = channels_.find(append.channel);
+	if (it == channels_.end()) {
+		std::string dir = dir_ + "/" + escapeChannelDir(append.channel);
+		if (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST) {
+			logMessage(WARNING, "HISTORY", "Creating " + dir + " failed: " + strerror(errno));
+			writeErrors_++;
+			return (nullptr);
+		}
+		it = channels_.emplace(append.channel, ChannelLog{dir, {}, 0, -1, -1, 0, false, "", ""}).first;
+	}
+	ChannelLog& log = it->second;
+	const HistoryEntry& entry = append.entry;
+	uint64_t timeMs = log.segments.empty() ? entry.timeMs : std::max(entry.timeMs, log.segments.back().lastTime);
+	uint64_t recordBytes = HISTORY_RECORD_HEADER + entry.line->size();
+
+	if (log.segments.empty() || log.segments.back().logBytes + recordBytes > segmentBytes_) {
+		flush(log);
+		closeFiles(log);
+		if (!openSegment(log, entry.msgId, timeMs)) {
+			writeErrors_++;
+			return (nullptr);
+		}
+		applyRetention(log);
+	}
+	else if (log.logFd < 0 && !reopen(log)) {
+		writeErrors_++;
+		return (nullptr);
+	}
+
+	Segment& segment = log.segments.back();
+	if (segment.logBytes == 0 || segment.logBytes - segment.lastIndexed >= HISTORY_INDEX_STRIDE) {
+		IndexEntry index{entry.msgId, timeMs, segment.logBytes};
+		log.idxBuffer.append(reinterpret_cast<const char*>(&index), sizeof(index));
+		segment.idxBytes += sizeof(index);
+		segment.lastIndexed = segment.logBytes;
+		log.bytes += sizeof(index);
+		bytes_ += sizeof(index);
+	}
+	uint32_t length = entry.line->size();
+	log.logBuffer.append(reinterpret_cast<const char*>(&entry.msgId), 8);
+	log.logBuffer.append(reinterpret_cast<const char*>(&timeMs), 8);
+	log.logBuffer.append(reinterpret_cast<const char*>(&length), 4);
+	log.logBuffer += *entry.line;
+	segment.logBytes += recordBytes;
+	segment.lastId = entry.msgId;
+	segment.lastTime = timeMs;
+	log.bytes += recordBytes;
+	log.lastUsed = ++useClock_;
+	bytes_ += recordBytes;
+	records_++;
+	return (&log);
+}
+
+// on a failed write the segment is cut back to what made it to disk and its bookkeeping rebuilt,
+// the lines of the failed block are lost but the files stay readable
+void HistoryStore::flush(ChannelLog& log) {
+	if (log.logBuffer.empty() && log.idxBuffer.empty())
+		return ;
+	bool written = writeAll(log.logFd, log.logBuffer) && writeAll(log.idxFd, log.idxBuffer);
+	log.logBuffer.clear();
+	log.idxBuffer.clear();
+	log.dirty = true;
+	if (written)
+		return ;
+	writeErrors_++;
+	Segment& segment = log.segments.back();
+	logMessage(WARNING, "HISTORY", "Writing " + segment.path + " failed: " + strerror(errno));
+	closeFiles(log);
+	uint64_t before = segment.logBytes + segment.idxBytes;
+	uint64_t after = recoverSegment(segment, true) ? segment.logBytes + segment.idxBytes : 0;
+	if (!after) {
+		unlink((segment.path + ".log").c_str());
+		unlink((segment.path + ".idx").c_str());
+		log.segments.pop_back();
+		segments_--;
+	}
+	log.bytes -= before - after;
+	bytes_ -= before - after;
+}
+
+bool HistoryStore::openSegment(ChannelLog& log, uint64_t firstId, uint64_t timeMs) {
+	std::string path = log.dir + "/" + segmentName(firstId);
+	if (openChannels_ >= HISTORY_OPEN_CHANNELS)
+		closeLeastUsed();
+	log.logFd = open((path + ".log").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+	log.idxFd = open((path + ".idx").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+	if (log.logFd < 0 || log.idxFd < 0) {
+		logMessage(WARNING, "HISTORY", "Creating segment " + path + " failed: " + strerror(errno));
+		if (log.logFd >= 0)
+			close(log.logFd);
+		if (log.idxFd >= 0)
+			close(log.idxFd);
+		log.logFd = log.idxFd = -1;
+		return (false);
+	}
+	openChannels_++;
+	log.segments.push_back(Segment{path, firstId, firstId, timeMs, timeMs, 0, 0, 0});
+	segments_++;
+	return (true);
+}
+
+bool HistoryStore::reopen(ChannelLog& log) {
+	const std::string& path = log.segments.back().path;
+	if (openChannels_ >= HISTORY_OPEN_CHANNELS)
+		closeLeastUsed();
+	log.logFd = open((path + ".log").c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+	log.idxFd = open((path + ".idx").c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (log.logFd < 0 || log.idxFd < 0) {
+		logMessage(WARNING, "HISTORY", "Opening segment " + path + " failed: " + strerror(errno));
+		if (log.logFd >= 0)
+			close(log.logFd);
+		if (log.idxFd >= 0)
+			close(log.idxFd);
+		log.logFd = log.idxFd = -1;
+		return (false);
+	}
+	openChannels_++;
+	return (true);
+}
+
+// a segment is synced when it is closed, sealed or not
+void HistoryStore::closeFiles(ChannelLog& log) {
+	if (log.logFd < 0)
+		return ;
+	if (log.dirty) {
+		fdatasync(log.logFd);
+		fdatasync(log.idxFd);
+		log.dirty = false;
+	}
+	close(log.logFd);
+	close(log.idxFd);
+	log.logFd = log.idxFd = -1;
+	openChannels_--;
+}
+
+void HistoryStore::closeLeastUsed() {
+	ChannelLog* oldest = nullptr;
+	for (auto& [name, log] : channels_)
+		if (log.logFd >= 0 && (!oldest || log.lastUsed < oldest->lastUsed))
+			oldest = &log;
+	if (oldest) {
+		flush(*oldest);
+		closeFiles(*oldest);
+	}
+}
+
+void HistoryStore::syncDirty() {
+	for (auto& [name, log] : channels_) {
+		if (log.logFd >= 0 && log.dirty) {
+			fdatasync(log.logFd);
+			fdatasync(log.idxFd);
+			log.dirty = false;
+		}
+	}
+}
+
+// whole segments go, oldest first, the one being written always stays
+void HistoryStore::applyRetention(ChannelLog& log) {
+	while (log.bytes > retainBytes_ && log.segments.size() > 1) {
+		const Segment& oldest = log.segments.front();
+		unlink((oldest.path + ".log").c_str());
+		unlink((oldest.path + ".idx").c_str());
+		log.bytes -= oldest.logBytes + oldest.idxBytes;
+		bytes_ -= oldest.logBytes + oldest.idxBytes;
+		segments_--;
+		log.segments.erase(log.segments.begin());
+	}
+}
+
+// QUERIES
+// =======
+
+// segments are skipped by their first and last keys, only the ones overlapping the range get mapped
+HistoryResult HistoryStore::answer(const HistoryQuery& query) {
+	HistoryResult result{query.id, query.channel, {}};
+	queries_++;
+	auto it = channels_.find(query.channel);
+	if (it == channels_.end())
+		return (result);
+	const std::vector<Segment>& segments = it->second.segments;
+	HistoryQuery rest = query;
+
+	for (size_t n = 0; n < segments.size() && result.entries.size() < query.limit; n++) {
+		const Segment& segment = segments[query.newest ? segments.size() - 1 - n : n];
+		bool beforeRange = query.after.type != HistoryRef::NONE
+			&& refKey(segment.lastId, segment.lastTime, query.after.type) <= query.after.value;
+		bool afterRange = query.before.type != HistoryRef::NONE
+			&& refKey(segment.firstId, segment.firstTime, query.before.type) >= query.before.value;
+		if ((query.newest && beforeRange) || (!query.newest && afterRange))
+			break;
+		if (beforeRange || afterRange)
+			continue;
+		rest.limit = query.limit - result.entries.size();
+		std::vector<HistoryEntry> found;
+		readSegment(segment, rest, found);
+		result.entries.insert(query.newest ? result.entries.begin() : result.entries.end(),
+			std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+	}
+	return (result);
+}
+
+// blocks are the log ranges between two index entries. Oldest first starts at the block holding the
+// after reference and walks forward, newest first walks the blocks backwards from the end
+void HistoryStore::readSegment(const Segment& segment, const HistoryQuery& query, std::vector<HistoryEntry>& out) {
+	MappedFile log(segment.path + ".log", segment.logBytes);
+	MappedFile idx(segment.path + ".idx", segment.idxBytes);
+	size_t blocks = idx.size / sizeof(IndexEntry);
+	if (!log.data || !blocks)
+		return ;
+	const IndexEntry* index = reinterpret_cast<const IndexEntry*>(idx.data);
+	auto inRange = [&](const RecordHeader& header) {
+		return ((query.after.type == HistoryRef::NONE || refKey(header.msgId, header.timeMs, query.after.type) > query.after.value)
+			&& (query.before.type == HistoryRef::NONE || refKey(header.msgId, header.timeMs, query.before.type) < query.before.value));
+	};
+	auto readBlock = [&](size_t block, std::vector<HistoryEntry>& entries) {
+		size_t offset = index[block].offset;
+		size_t end = block + 1 < blocks ? index[block + 1].offset : log.size;
+		RecordHeader header;
+		while (offset < end && readRecord(log.data, log.size, offset, header)) {
+			if (inRange(header))
+				entries.push_back(HistoryEntry{header.msgId, header.timeMs, std::make_shared<const std::string>(
+					log.data + offset + HISTORY_RECORD_HEADER, header.length)});
+			offset += HISTORY_RECORD_HEADER + header.length;
+		}
+	};
+
+	if (!query.newest) {
+		size_t block = 0;
+		if (query.after.type != HistoryRef::NONE) {
+			block = std::partition_point(index, index + blocks, [&](const IndexEntry& entry) {
+				return (refKey(entry.msgId, entry.timeMs, query.after.type) <= query.after.value);
+			}) - index;
+			block = block ? block - 1 : 0;
+		}
+		for (; block < blocks && out.size() < query.limit; block++) {
+			if (query.before.type != HistoryRef::NONE
+				&& refKey(index[block].msgId, index[block].timeMs, query.before.type) >= query.before.value)
+				break;
+			readBlock(block, out);
+		}
+		if (out.size() > query.limit)
+			out.resize(query.limit);
+		return ;
+	}
+	std::vector<HistoryEntry> block;
+	for (size_t n = blocks; n > 0 && out.size() < query.limit; n--) {
+		const IndexEntry& first = index[n - 1];
+		if (query.before.type != HistoryRef::NONE && refKey(first.msgId, first.timeMs, query.before.type) >= query.before.value)
+			continue;
+		block.clear();
+		readBlock(n - 1, block);
+		out.insert(out.begin(), std::make_move_iterator(block.begin()), std::make_move_iterator(block.end()));
+		if (query.after.type != HistoryRef::NONE && refKey(first.msgId, first.timeMs, query.after.type) <= query.after.value)
+			break;
+	}
+	if (out.size() > query.limit)
+		out.erase(out.begin(), out.end() - query.limit);
+}
@@ -0,0 +1,344 @@
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "../includes/HotUpgrade.hpp"
+#include "../includes/Server.hpp"
+
+// ENCODING
+// ========
+// host byte order, both ends run on the same machine. Strings and lists carry a u32 length
+
+template <typename T>
+static void appendValue(std::string& out, T value) {
+	out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void appendString(std::string& out, const std::string& str) {
+	appendValue<uint32_t>(out, str.size());
+	out.append(str);
+}
+
+static void appendIndices(std::string& out, const std::vector<uint32_t>& indices) {
+	appendValue<uint32_t>(out, indices.size());
+	out.append(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+}
+
+// stops at the first field that does not fit, ok stays false from then on
+struct Decoder {
+	const std::string&	data;
+	size_t	offset;
+	bool	ok;
+
+	template <typename T>
+	T value() {
+		T result = T();
+		if (!ok || data.size() - offset < sizeof(result)) {
+			ok = false;
+			return (result);
+		}
+		std::memcpy(&result, data.data() + offset, sizeof(result));
+		offset += sizeof(result);
+		return (result);
+	}
+
+	std::string string() {
+		uint32_t length = value<uint32_t>();
+		if (!ok || data.size() - offset < length) {
+			ok = false;
+			return ("");
+		}
+		offset += length;
+		return (data.substr(offset - length, length));
+	}
+
+	// a count is never larger than the bytes left, so a damaged one cannot ask for a huge allocation
+	uint32_t count(size_t minBytes) {
+		uint32_t result = value<uint32_t>();
+		if (ok && result > (data.size() - offset) / minBytes)
+			ok = false;
+		return (ok ? result : 0);
+	}
+
+	std::vector<uint32_t> indices(size_t limit) {
+		std::vector<uint32_t> result(count(sizeof(uint32_t)));
+		for (uint32_t& index : result)
+			if ((index = value<uint32_t>()) >= limit)
+				ok = false;
+		return (result);
+	}
+};
+
+void UpgradeState::encode(std::string& out) const {
+	out.assign(UPGRADE_MAGIC, 8);
+	appendValue<uint32_t>(out, UPGRADE_VERSION);
+	appendValue<uint64_t>(out, nextMsgId);
+	appendValue<uint64_t>(out, nextBatchId);
+	appendValue<uint32_t>(out, nextCaptureId);
+	appendValue<uint32_t>(out, clients.size());
+	for (const ClientHandover& client : clients) {
+		appendString(out, client.hostname);
+		appendString(out, client.address);
+		appendString(out, client.nickname);
+		appendString(out, client.username);
+		appendString(out, client.realName);
+		appendString(out, client.password);
+		appendValue<uint8_t>(out, client.state);
+		appendValue<uint8_t>(out, client.serverOperator);
+		appendValue<uint8_t>(out, client.readPaused);
+		appendValue<int64_t>(out, client.nickTs);
+		appendString(out, client.readBuffer);
+		appendString(out, client.output);
+		appendValue<uint32_t>(out, client.monitored.size());
+		for (const std::string& nickname : client.monitored)
+			appendString(out, nickname);
+		appendValue<uint32_t>(out, client.captureId);
+	}
+	appendValue<uint32_t>(out, channels.size());
+	for (const ChannelHandover& channel : channels) {
+		appendString(out, channel.snapshot.name);
+		appendString(out, channel.snapshot.key);
+		appendString(out, channel.snapshot.topic);
+		appendValue<uint8_t>(out, channel.snapshot.flags);
+		appendValue<int32_t>(out, channel.snapshot.userLimit);
+		appendValue<int64_t>(out, channel.snapshot.createdAt);
+		appendValue<int64_t>(out, channel.snapshot.topicTime);
+		appendValue<uint32_t>(out, channel.snapshot.operators.size());
+		for (const std::string& nickname : channel.snapshot.operators)
+			appendString(out, nickname);
+		appendValue<uint32_t>(out, channel.snapshot.masks.size());
+		for (const MaskSnapshot& mask : channel.snapshot.masks) {
+			appendValue<uint8_t>(out, mask.list);
+			appendString(out, mask.mask);
+			appendString(out, mask.setBy);
+			appendValue<int64_t>(out, mask.setAt);
+		}
+		appendIndices(out, channel.members);
+		appendIndices(out, channel.operators);
+		appendIndices(out, channel.invited);
+		appendValue<uint8_t>(out, channel.historyTruncated);
+		appendValue<uint32_t>(out, channel.history.size());
+		for (const HistoryEntry& entry : channel.history) {
+			appendValue<uint64_t>(out, entry.msgId);
+			appendValue<uint64_t>(out, entry.timeMs);
+			appendString(out, *entry.line);
+		}
+	}
+}
+
+bool UpgradeState::decode(const std::string& data, std::string& error) {
+	Decoder in{data, 8, data.compare(0, 8, UPGRADE_MAGIC, 8) == 0};
+	uint32_t version = in.value<uint32_t>();
+	if (!in.ok || version != UPGRADE_VERSION) {
+		error = in.ok ? "version " + std::to_string(version) + ", expected " + std::to_string(UPGRADE_VERSION) : "not an upgrade state";
+		return (false);
+	}
+	nextMsgId = in.value<uint64_t>();
+	nextBatchId = in.value<uint64_t>();
+	nextCaptureId = in.value<uint32_t>();
+	clients.resize(in.count(8 * sizeof(uint32_t) + 3 + sizeof(int64_t)));
+	for (ClientHandover& client : clients) {
+		client.hostname = in.string();
+		client.address = in.string();
+		client.nickname = in.string();
+		client.username = in.string();
+		client.realName = in.string();
+		client.password = in.string();
+		client.state = in.value<uint8_t>();
+		client.serverOperator = in.value<uint8_t>();
+		client.readPaused = in.value<uint8_t>();
+		client.nickTs = in.value<int64_t>();
+		client.readBuffer = in.string();
+		client.output = in.string();
+		client.monitored.resize(in.count(sizeof(uint32_t)));
+		for (std::string& nickname : client.monitored)
+			nickname = in.string();
+		client.captureId = in.value<uint32_t>();
+	}
+	channels.resize(in.count(4 * sizeof(uint32_t) + 5 + 2 * sizeof(int64_t)));
+	for (ChannelHandover& channel : channels) {
+		channel.snapshot.name = in.string();
+		channel.snapshot.key = in.string();
+		channel.snapshot.topic = in.string();
+		channel.snapshot.flags = in.value<uint8_t>();
+		channel.snapshot.userLimit = in.value<int32_t>();
+		channel.snapshot.createdAt = in.value<int64_t>();
+		channel.snapshot.topicTime = in.value<int64_t>();
+		channel.snapshot.operators.resize(in.count(sizeof(uint32_t)));
+		for (std::string& nickname : channel.snapshot.operators)
+			nickname = in.string();
+		channel.snapshot.masks.resize(in.count(1 + 2 * sizeof(uint32_t) + sizeof(int64_t)));
+		for (MaskSnapshot& mask : channel.snapshot.masks) {
+			mask.list = in.value<uint8_t>();
+			mask.mask = in.string();
+			mask.setBy = in.string();
+			mask.setAt = in.value<int64_t>();
+		}
+		channel.members = in.indices(clients.size());
+		channel.operators = in.indices(clients.size());
+		channel.invited = in.indices(clients.size());
+		channel.historyTruncated = in.value<uint8_t>();
+		channel.history.resize(in.count(2 * sizeof(uint64_t) + sizeof(uint32_t)));
+		for (HistoryEntry& entry : channel.history) {
+			entry.msgId = in.value<uint64_t>();
+			entry.timeMs = in.value<uint64_t>();
+			entry.line = std::make_shared<const std::string>(in.string());
+		}
+	}
+	if (!in.ok || in.offset != data.size()) {
+		error = "damaged upgrade state";
+		return (false);
+	}
+	return (true);
+}
+
+// TRANSPORT
+// =========
+
+static void setTimeout(int sock, int timeoutMs) {
+	struct timeval timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static bool writeAll(int sock, const char* data, size_t size) {
+	while (size > 0) {
+		ssize_t n = send(sock, data, size, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (false);
+		data += n;
+		size -= n;
+	}
+	return (true);
+}
+
+// exactly size bytes: the descriptors ride on the byte after the state and a longer read would drop them
+static bool readAll(int sock, char* data, size_t size) {
+	while (size > 0) {
+		ssize_t n = recv(sock, data, size, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (false);
+		data += n;
+		size -= n;
+	}
+	return (true);
+}
+
+union FdControl {
+	char			buffer[CMSG_SPACE(sizeof(int) * UPGRADE_FDS_PER_MESSAGE)];
+	struct cmsghdr	align;
+};
+
+pid_t spawnUpgrade(const std::string& binary, const std::vector<std::string>& args, int& sock) {
+	int pair[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0)
+		return (-1);
+	std::vector<std::string> childArgs(args);
+	childArgs.push_back("--upgrade-fd=" + std::to_string(pair[1]));
+	std::vector<char*> argv(1, const_cast<char*>(binary.c_str()));
+	for (std::string& arg : childArgs)
+		argv.push_back(&arg[0]);
+	argv.push_back(nullptr);
+
+	pid_t pid = fork();
+	if (pid == 0) { // only async-signal-safe calls until exec, the other threads are not in this process
+		fcntl(pair[1], F_SETFD, 0);
+		execv(binary.c_str(), argv.data());
+		_exit(127);
+	}
+	close(pair[1]);
+	if (pid < 0) {
+		close(pair[0]);
+		return (-1);
+	}
+	setTimeout(pair[0], UPGRADE_TIMEOUT_MS);
+	sock = pair[0];
+	return (pid);
+}
+
+bool sendUpgradeState(int sock, const std::string& state, const std::vector<int>& fds) {
+	uint64_t header[2] = {state.size(), fds.size()};
+	if (!writeAll(sock, reinterpret_cast<const char*>(header), sizeof(header)) || !writeAll(sock, state.data(), state.size()))
+		return (false);
+	for (size_t sent = 0; sent < fds.size(); ) {
+		size_t count = std::min<size_t>(fds.size() - sent, UPGRADE_FDS_PER_MESSAGE);
+		char byte = 0;
+		struct iovec iov = {&byte, 1};
+		FdControl control;
+		struct msghdr msg;
+		std::memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buffer;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+		std::memcpy(CMSG_DATA(cmsg), fds.data() + sent, sizeof(int) * count);
+		ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n != 1)
+			return (false);
+		sent += count;
+	}
+	return (true);
+}
+
+// the descriptors arrive close-on-exec like the ones accept4() hands out, a later upgrade passes them on explicitly
+bool receiveUpgradeState(int sock, std::string& state, std::vector<int>& fds) {
+	uint64_t header[2];
+	setTimeout(sock, UPGRADE_TIMEOUT_MS);
+	if (!readAll(sock, reinterpret_cast<char*>(header), sizeof(header)))
+		return (false);
+	state.resize(header[0]);
+	if (!readAll(sock, &state[0], state.size()))
+		return (false);
+	while (fds.size() < header[1]) {
+		char byte;
+		struct iovec iov = {&byte, 1};
+		FdControl control;
+		struct msghdr msg;
+		std::memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buffer;
+		msg.msg_controllen = sizeof(control.buffer);
+		ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n != 1 || (msg.msg_flags & MSG_CTRUNC))
+			return (false);
+		for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+			size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			const int* received = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+			fds.insert(fds.end(), received, received + count);
+		}
+	}
+	return (fds.size() == header[1]);
+}
+
+bool awaitUpgradeReady(int sock) {
+	char reply = 0;
+	return (readAll(sock, &reply, 1) && reply == UPGRADE_READY);
+}
+
+// the old process exits right after it released the files both would write, no timeout for that part
+bool confirmUpgrade(int sock) {
+	char reply = UPGRADE_READY;
+	if (!writeAll(sock, &reply, 1))
+		return (false);
+	setTimeout(sock, 0);
+	char rest;
+	ssize_t n;
+	while ((n = recv(sock, &rest, 1, 0)) != 0)
+		if (n < 0 && errno != EINTR)
+			return (false);
+	return (true);
+}
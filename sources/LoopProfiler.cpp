@@ -0,0 +1,90 @@
+#include "../includes/LoopProfiler.hpp"
+#include "../includes/Server.hpp"
+
+LoopProfiler::LoopProfiler() : iterationDispatchNs_(0), lastReportAt_(statsNow()) {
+	for (int i = 0; i < 8; i++)
+		reported_[i] = 0;
+}
+
+// single writer, so a relaxed load and store is enough and avoids a locked read-modify-write
+void LoopProfiler::add(std::atomic<uint64_t>& counter, uint64_t value) {
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+void LoopProfiler::addDispatch(uint64_t ns) {
+	iterationDispatchNs_ += ns;
+	add(counters_.dispatchNs, ns);
+}
+
+void LoopProfiler::addLine() {
+	add(counters_.lines, 1);
+}
+
+void LoopProfiler::addBytesIn(size_t bytes) {
+	add(counters_.bytesIn, bytes);
+}
+
+void LoopProfiler::addBytesOut(size_t bytes) {
+	add(counters_.bytesOut, bytes);
+}
+
+void LoopProfiler::endIteration(int events, uint64_t waitCallNs, uint64_t blockedNs, uint64_t flushNs) {
+	if (blockedNs > waitCallNs)
+		blockedNs = waitCallNs;
+	uint64_t handlerNs = waitCallNs - blockedNs; // everything the backend dispatched from inside wait()
+	uint64_t readNs = handlerNs > iterationDispatchNs_ ? handlerNs - iterationDispatchNs_ : 0;
+
+	add(counters_.iterations, 1);
+	add(counters_.events, events > 0 ? events : 0);
+	add(counters_.waitNs, blockedNs);
+	add(counters_.readNs, readNs);
+	add(counters_.flushNs, flushNs);
+	if (handlerNs + flushNs > counters_.maxBusyNs.load(std::memory_order_relaxed))
+		counters_.maxBusyNs.store(handlerNs + flushNs, std::memory_order_relaxed);
+	iterationDispatchNs_ = 0;
+}
+
+static std::string percentOf(uint64_t part, uint64_t total) {
+	return (std::to_string(total ? part * 100 / total : 0) + "%");
+}
+
+// one line per interval with the deltas since the previous one. busy is the share of wall time the
+// loop was not blocked in the kernel, close to 100% means new events already queue up behind the loop
+void LoopProfiler::reportIfDue(uint64_t now) {
+	uint64_t elapsed = now - lastReportAt_;
+	if (elapsed < LOOP_REPORT_INTERVAL * 1000000000ULL)
+		return ;
+
+	uint64_t current[8] = {
+		counters_.iterations.load(std::memory_order_relaxed), counters_.events.load(std::memory_order_relaxed),
+		counters_.waitNs.load(std::memory_order_relaxed), counters_.readNs.load(std::memory_order_relaxed),
+		counters_.dispatchNs.load(std::memory_order_relaxed), counters_.flushNs.load(std::memory_order_relaxed),
+		counters_.bytesIn.load(std::memory_order_relaxed), counters_.bytesOut.load(std::memory_order_relaxed)
+	};
+	uint64_t delta[8];
+	for (int i = 0; i < 8; i++) {
+		delta[i] = current[i] - reported_[i];
+		reported_[i] = current[i];
+	}
+	uint64_t busyNs = delta[3] + delta[4] + delta[5];
+	uint64_t seconds = elapsed / 1000000000ULL;
+	uint64_t busyPercent = busyNs * 100 / elapsed;
+
+	std::string summary = "iterations=" + std::to_string(delta[0])
+		+ " events/wait=" + std::to_string(delta[0] ? delta[1] / delta[0] : 0)
+		+ " wait=" + percentOf(delta[2], elapsed) + " read=" + percentOf(delta[3], elapsed)
+		+ " dispatch=" + percentOf(delta[4], elapsed) + " flush=" + percentOf(delta[5], elapsed)
+		+ " busy=" + std::to_string(busyPercent) + "%"
+		+ " maxIteration=" + std::to_string(counters_.maxBusyNs.load(std::memory_order_relaxed) / 1000) + "us"
+		+ " in=" + std::to_string(delta[6] / seconds) + "B/s out=" + std::to_string(delta[7] / seconds) + "B/s";
+	if (busyPercent >= LOOP_SATURATION_PERCENT)
+		logMessage(WARNING, "LOOP", "Event loop saturated: " + summary);
+	else
+		logMessage(INFO, "LOOP", summary);
+	counters_.maxBusyNs.store(0, std::memory_order_relaxed);
+	lastReportAt_ = now;
+}
+
+const LoopCounters& LoopProfiler::getCounters() const {
+	return (counters_);
+}
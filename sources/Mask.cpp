@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cctype>
+#include "../includes/Mask.hpp"
+
+static char fold(char c) {
+	return (static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+}
+
+std::string foldCase(std::string_view text) {
+	std::string folded(text);
+	for (char& c : folded)
+		c = fold(c);
+	return (folded);
+}
+
+Mask::Mask(std::string_view pattern) : pattern_(foldCase(pattern)) {
+	size_t wildcard = pattern_.find_first_of("*?");
+	literal_ = wildcard == std::string::npos;
+	prefix_ = pattern_.substr(0, wildcard);
+	suffix_ = literal_ ? pattern_ : pattern_.substr(pattern_.find_last_of("*?") + 1);
+}
+
+// the usual greedy match with one backtracking point: a * first matches nothing, when the rest fails it
+// takes one more character. Linear for the patterns people type, O(pattern * text) at worst
+bool Mask::matches(std::string_view text) const {
+	if (literal_)
+		return (text.size() == pattern_.size() && foldCase(text) == pattern_);
+	size_t p = 0;
+	size_t t = 0;
+	size_t starP = std::string::npos;
+	size_t starT = 0;
+	while (t < text.size()) {
+		if (p < pattern_.size() && (pattern_[p] == '?' || pattern_[p] == fold(text[t]))) {
+			p++;
+			t++;
+		}
+		else if (p < pattern_.size() && pattern_[p] == '*') {
+			starP = p++;
+			starT = t;
+		}
+		else if (starP != std::string::npos) {
+			p = starP + 1;
+			t = ++starT;
+		}
+		else
+			return (false);
+	}
+	while (p < pattern_.size() && pattern_[p] == '*')
+		p++;
+	return (p == pattern_.size());
+}
+
+const std::string& Mask::getPattern() const {
+	return (pattern_);
+}
+
+const std::string& Mask::getPrefix() const {
+	return (prefix_);
+}
+
+const std::string& Mask::getSuffix() const {
+	return (suffix_);
+}
+
+bool Mask::isLiteral() const {
+	return (literal_);
+}
+
+bool Mask::matchesAll() const {
+	return (!pattern_.empty() && pattern_.find_first_not_of('*') == std::string::npos);
+}
+
+// MASKLIST
+// ========================================================================
+
+std::string MaskList::normalize(const std::string& mask) {
+	size_t bang = mask.find('!');
+	size_t at = mask.find('@', bang == std::string::npos ? 0 : bang);
+	if (bang == std::string::npos && at == std::string::npos)
+		return (mask + "!*@*");
+	if (bang == std::string::npos)
+		return ("*!" + mask);
+	if (at == std::string::npos)
+		return (mask + "@*");
+	return (mask);
+}
+
+static uint64_t hashStep(uint64_t hash, char c) {
+	return ((hash ^ static_cast<uint8_t>(c)) * 1099511628211ULL); // FNV-1a
+}
+
+static uint64_t anchorHash(std::string_view anchor, bool backwards) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < anchor.size(); i++)
+		hash = hashStep(hash, anchor[backwards ? anchor.size() - 1 - i : i]);
+	return (hash);
+}
+
+// the longest of the prefix, the suffix and the literal runs starting at a ! or @ goes in its bucket
+void MaskList::compile(const std::string& mask) {
+	Mask compiled(mask);
+	if (compiled.isLiteral()) {
+		literals_.insert(compiled.getPattern());
+		return ;
+	}
+	const std::string& pattern = compiled.getPattern();
+	std::string_view anchor = compiled.getPrefix();
+	Buckets* buckets = &byPrefix_;
+	if (compiled.getSuffix().size() > anchor.size()) {
+		anchor = compiled.getSuffix();
+		buckets = &bySuffix_;
+	}
+	for (size_t at = pattern.find_first_of("!@"); at != std::string::npos; at = pattern.find_first_of("!@", at + 1)) {
+		size_t end = pattern.find_first_of("*?", at);
+		if (end != std::string::npos && end - at > anchor.size()) {
+			anchor = std::string_view(pattern).substr(at, end - at);
+			buckets = &byInfix_;
+		}
+	}
+	if (anchor.empty()) {
+		others_.push_back(compiled);
+		return ;
+	}
+	bool backwards = buckets == &bySuffix_;
+	if (anchor.size() > MASKLIST_ANCHOR_CHARS)
+		anchor = backwards ? anchor.substr(anchor.size() - MASKLIST_ANCHOR_CHARS) : anchor.substr(0, MASKLIST_ANCHOR_CHARS);
+	buckets->masks[anchorHash(anchor, backwards)].push_back(compiled);
+	buckets->lengths |= 1ULL << (anchor.size() - 1);
+}
+
+bool MaskList::add(const std::string& mask, const std::string& setBy, time_t setAt) {
+	std::string folded = foldCase(mask);
+	for (const MaskEntry& entry : entries_)
+		if (foldCase(entry.mask) == folded)
+			return (false);
+	entries_.push_back(MaskEntry{mask, setBy, setAt});
+	compile(mask);
+	return (true);
+}
+
+// rare next to matching, the buckets are simply built again
+bool MaskList::remove(const std::string& mask) {
+	std::string folded = foldCase(mask);
+	for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+		if (foldCase(it->mask) != folded)
+			continue;
+		entries_.erase(it);
+		literals_.clear();
+		byPrefix_ = Buckets();
+		bySuffix_ = Buckets();
+		byInfix_ = Buckets();
+		others_.clear();
+		for (const MaskEntry& entry : entries_)
+			compile(entry.mask);
+		return (true);
+	}
+	return (false);
+}
+
+void MaskList::clear() {
+	entries_.clear();
+	literals_.clear();
+	byPrefix_ = Buckets();
+	bySuffix_ = Buckets();
+	byInfix_ = Buckets();
+	others_.clear();
+}
+
+// hashes subject from from on (or from from down to its start) and runs the bucket of every length an
+// anchor has. A hash that only collides costs running the masks of that bucket
+bool MaskList::runBuckets(const Buckets& buckets, std::string_view subject, size_t from, bool backwards) const {
+	uint64_t hash = 14695981039346656037ULL;
+	size_t available = backwards ? from + 1 : subject.size() - from;
+	for (size_t length = 1; length <= available && length <= MASKLIST_ANCHOR_CHARS; length++) {
+		hash = hashStep(hash, subject[backwards ? from + 1 - length : from + length - 1]);
+		if (!(buckets.lengths >> (length - 1)))
+			break; // no longer anchors
+		if (!(buckets.lengths & (1ULL << (length - 1))))
+			continue;
+		auto bucket = buckets.masks.find(hash);
+		if (bucket == buckets.masks.end())
+			continue;
+		for (const Mask& mask : bucket->second)
+			if (mask.matches(subject))
+				return (true);
+	}
+	return (false);
+}
+
+bool MaskList::matches(std::string_view subject) const {
+	if (entries_.empty())
+		return (false);
+	std::string folded = foldCase(subject);
+	if (literals_.count(folded))
+		return (true);
+	if (byPrefix_.lengths && runBuckets(byPrefix_, folded, 0, false))
+		return (true);
+	if (bySuffix_.lengths && !folded.empty() && runBuckets(bySuffix_, folded, folded.size() - 1, true))
+		return (true);
+	for (size_t at = folded.find_first_of("!@"); byInfix_.lengths && at != std::string::npos; at = folded.find_first_of("!@", at + 1))
+		if (runBuckets(byInfix_, folded, at, false))
+			return (true);
+	for (const Mask& mask : others_)
+		if (mask.matches(folded))
+			return (true);
+	return (false);
+}
+
+bool MaskList::empty() const {
+	return (entries_.empty());
+}
+
+size_t MaskList::size() const {
+	return (entries_.size());
+}
+
+const std::vector<MaskEntry>& MaskList::getEntries() const {
+	return (entries_);
+}
@@ -0,0 +1,161 @@
+#include "../includes/MemoryBackend.hpp"
+#include "../includes/Server.hpp"
+
+// fds start above the standard streams, the server treats 0-4 as special
+MemoryBackend::MemoryBackend(size_t outputLimit) : outputLimit_(outputLimit) {
+	conns_.resize(5, Connection{false, true, true, false, false, false, "", ""});
+}
+
+MemoryBackend::Connection& MemoryBackend::conn(int fd) {
+	if (fd < 0 || fd >= static_cast<int>(conns_.size()))
+		throw std::runtime_error("MemoryBackend: unknown fd " + std::to_string(fd));
+	return (conns_[fd]);
+}
+
+void MemoryBackend::queueRead(int fd) {
+	Connection& c = conns_[fd];
+	if (c.open && c.readEnabled && !c.readQueued && !c.input.empty()) {
+		c.readQueued = true;
+		events_.push_back(Event{EVENT_READ, fd});
+	}
+}
+
+const char* MemoryBackend::getName() const {
+	return ("memory");
+}
+
+bool MemoryBackend::usesSockets() const {
+	return (false);
+}
+
+void MemoryBackend::addListener(int listenFd) {
+	(void)listenFd; // connect() plays the listening socket
+}
+
+void MemoryBackend::addClient(int clientFd) {
+	Connection& c = conn(clientFd);
+	c.open = true;
+	c.readEnabled = true;
+	queueRead(clientFd); // the peer may have written before the accept went through
+}
+
+void MemoryBackend::removeClient(int clientFd) {
+	conn(clientFd).open = false;
+}
+
+void MemoryBackend::setReadEnabled(int clientFd, bool enabled) {
+	conn(clientFd).readEnabled = enabled;
+	queueRead(clientFd);
+}
+
+ssize_t MemoryBackend::send(int clientFd, const struct iovec* iov, int iovCount) {
+	Connection& c = conn(clientFd);
+	if (!c.open || c.hungUp)
+		return (-1);
+	size_t room = outputLimit_ ? outputLimit_ - std::min(outputLimit_, c.output.size()) : SIZE_MAX;
+	size_t total = 0;
+	size_t written = 0;
+	for (int i = 0; i < iovCount; i++) {
+		size_t len = std::min(iov[i].iov_len, room - written);
+		c.output.append(static_cast<const char*>(iov[i].iov_base), len);
+		written += len;
+		total += iov[i].iov_len;
+	}
+	c.writeWanted = (written < total); // reported writable once the peer takes its output
+	return (written);
+}
+
+// hands out the events queued before the call, whatever the handlers queue waits for the next one.
+// A read passes at most BUF_SIZE bytes like one recv() would and requeues itself for the rest
+int MemoryBackend::wait(IoHandler& handler, int timeoutMs) {
+	(void)timeoutMs; // nothing to wait for, only the owner makes things happen
+	size_t count = events_.size();
+	int handled = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		Event event = events_.front();
+		events_.pop_front();
+		Connection& c = conns_[event.fd];
+		if (event.type == EVENT_ACCEPT) {
+			struct sockaddr_in addr;
+			std::memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_addr.s_addr = htonl((10u << 24) | static_cast<uint32_t>(event.fd)); // 10.x.y.z from the fd
+			handler.onAccept(event.fd, addr);
+		}
+		else if (event.type == EVENT_READ) {
+			c.readQueued = false;
+			if (!c.open || !c.readEnabled || c.input.empty())
+				continue;
+			size_t len = std::min(c.input.size(), static_cast<size_t>(BUF_SIZE));
+			std::memcpy(readBuf_, c.input.data(), len);
+			c.input.erase(0, len);
+			handler.onRead(event.fd, readBuf_, len);
+			queueRead(event.fd);
+		}
+		else if (event.type == EVENT_WRITABLE && c.open)
+			handler.onWritable(event.fd);
+		else if (event.type == EVENT_HANGUP && c.open)
+			handler.onHangup(event.fd);
+		handled++;
+	}
+	return (handled);
+}
+
+void MemoryBackend::closeClient(int clientFd) {
+	Connection& c = conn(clientFd);
+	c.open = false;
+	c.closed = true;
+	std::string().swap(c.input);
+}
+
+void MemoryBackend::refuseClient(int clientFd, const std::string& line) {
+	conn(clientFd).output += line; // the peer can still take it
+	closeClient(clientFd);
+}
+
+int MemoryBackend::connect() {
+	conns_.push_back(Connection{false, false, false, true, false, false, "", ""});
+	int fd = conns_.size() - 1;
+	events_.push_back(Event{EVENT_ACCEPT, fd});
+	return (fd);
+}
+
+void MemoryBackend::deliver(int fd, const std::string& data) {
+	Connection& c = conn(fd);
+	if (c.closed || c.hungUp)
+		return ;
+	c.input += data;
+	queueRead(fd);
+}
+
+std::string MemoryBackend::takeOutput(int fd) {
+	Connection& c = conn(fd);
+	std::string output;
+	output.swap(c.output);
+	if (c.writeWanted && c.open) {
+		c.writeWanted = false;
+		events_.push_back(Event{EVENT_WRITABLE, fd});
+	}
+	return (output);
+}
+
+size_t MemoryBackend::discardOutput(int fd) {
+	return (takeOutput(fd).size());
+}
+
+void MemoryBackend::disconnect(int fd) {
+	Connection& c = conn(fd);
+	if (c.closed || c.hungUp)
+		return ;
+	c.hungUp = true;
+	events_.push_back(Event{EVENT_HANGUP, fd});
+}
+
+bool MemoryBackend::isClosed(int fd) const {
+	return (fd < 0 || fd >= static_cast<int>(conns_.size()) || conns_[fd].closed);
+}
+
+size_t MemoryBackend::getPendingEvents() const {
+	return (events_.size());
+}
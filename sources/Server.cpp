@@ -1,21 +1,68 @@
 #include "../includes/Server.hpp"
 #include "../includes/Client.hpp"
 #include "../includes/responseCodes.hpp"
+#include "../includes/probes.hpp"
+#include <sys/wait.h>
 
 volatile sig_atomic_t Server::isRunning_ = true; // change the value to true when it start
+volatile sig_atomic_t Server::upgradeRequested_ = false;
 
-Server::Server(int port, std::string password) : port_(port), password_(password), serverSocket_(-1), epollFd(-1) {
-	initAddrInfo();
-	createAddrInfo();
-	createServSocket();
-	setNonBlocking();
-	setSocketOption();
-	bindSocket();
-	initListen();
+Server::Server(int port, std::string password, const ServerConfig& config)
+	: Server(port, password, config, createIoBackend(config.ioBackend)) {
+}
+
+// a backend without sockets (MemoryBackend) is driven by its owner through runIteration(), the server
+// then neither listens nor takes over the signals
+Server::Server(int port, std::string password, const ServerConfig& config, std::unique_ptr<IoBackend> io)
+	: port_(port), password_(password), serverSocket_(-1), config_(config), io_(std::move(io)), res_(nullptr),
+	serverName_(config_.serverName), published_(), publishedBusyNs_(0), lastPublishAt_(0), nextMsgId_(1), nextBatchId_(1), historyBytes_(0), historyStale_(0), nextQueryId_(1), lastSnapshotAt_(0), upgradeDeadline_(0),
+	lastLinkTick_(0), admission_(config_.ipLimit, config_.ipRate, config_.shedLatencyMs), loopBusyNs_(0), lastRefusalLog_(0),
+	refusedSinceLog_(0) {
+	if (config_.upgradeFd >= 0)
+		resumeUpgrade(); // listening socket, clients and channels of the process this one replaces
+	else if (io_->usesSockets()) {
+		initAddrInfo();
+		createAddrInfo();
+		createServSocket();
+		setNonBlocking();
+		setSocketOption();
+		bindSocket();
+		initListen();
+	}
 
 	logMessage(INFO, "SERVER", "Server created. PORT: [" + std::to_string(port_) + "] PASSWORD: [" + password_ + "]");
-	customSignals(true);
+	if (io_->usesSockets())
+		customSignals(true);
 	registerCommands();
+	if (config_.shmName != "off") {
+		std::string shmName = config_.shmName.empty() ? "/ircserv-" + std::to_string(port_) : config_.shmName;
+		try {
+			sharedStats_ = std::make_unique<SharedStats>(shmName);
+			logMessage(INFO, "SERVER", "Publishing stats in shared memory [" + shmName + "]");
+		}
+		catch (const std::exception& e) { // monitoring is optional, keep serving without it
+			logMessage(WARNING, "SERVER", std::string("Shared memory stats disabled: ") + e.what());
+		}
+	}
+	if (!config_.captureFile.empty()) {
+		if (!capture_) // an upgrade already went on with the capture of the old process
+			capture_ = std::make_unique<TrafficCapture>(config_.captureFile);
+		logMessage(INFO, "SERVER", "Capturing inbound traffic to [" + config_.captureFile + "]");
+	}
+	if (!config_.historyDir.empty()) {
+		historyStore_ = std::make_unique<HistoryStore>(config_.historyDir, config_.historySegmentBytes, config_.historyRetainBytes);
+		nextMsgId_ = std::max(nextMsgId_, historyStore_->getNextMsgId()); // msgids stay unique across restarts
+		io_->addWakeup(historyStore_->getWakeFd());
+		logMessage(INFO, "SERVER", "Storing channel history in [" + config_.historyDir + "], next msgid " + std::to_string(nextMsgId_));
+	}
+	if (!config_.snapshotFile.empty()) {
+		if (config_.upgradeFd < 0) // an upgrade brought the live channels already
+			restoreSnapshot(); // the loop has not run yet, nobody is accepted before the channels are back
+		snapshot_ = std::make_unique<StateSnapshot>(config_.snapshotFile);
+		lastSnapshotAt_ = statsNow();
+	}
+	published_.pid = getpid();
+	published_.startedAt = time(nullptr);
 }
 
 Server::~Server() {
@@ -26,6 +73,15 @@ Server::~Server() {
 void Server::closeServer() {
 	logMessage(INFO, "SERVER", "Server closing [closeServer()]");
 
+	if (snapshot_) { // before the clients go, their operator status goes with them
+		snapshot_->begin();
+		for (auto& [channelName, channel] : channelMap_)
+			snapshot_->add(*channel);
+		snapshot_->commit(true);
+		logMessage(INFO, "SERVER", "Saved " + std::to_string(snapshot_->getCount()) + " channels to [" + snapshot_->getPath() + "]");
+		snapshot_.reset();
+	}
+
 	auto it = clients_.begin();
 	while (it != clients_.end())
 	{
@@ -43,8 +99,12 @@ void Server::closeServer() {
 			delete channel;
 	}
 	channelMap_.clear();
-	if (epollFd >= 0)
-		close(epollFd);
+	if (io_)
+		logMessage(INFO, "SERVER", std::string("IO backend [") + io_->getName() + "] syscalls: " + std::to_string(io_->getSyscalls()));
+	io_.reset();
+	sharedStats_.reset(); // unlinks the segment
+	capture_.reset(); // writes out the last block
+	historyStore_.reset(); // writes out and syncs what is still queued
 	if (serverSocket_ >= 0)
 		close(serverSocket_);
 	if (res_ != nullptr) {
@@ -78,7 +138,7 @@ void Server::createAddrInfo() {
 
 // creates a new TCP socket
 void Server::createServSocket() {
-	serverSocket_ = socket(res_->ai_family, res_->ai_socktype, 0);
+	serverSocket_ = socket(res_->ai_family, res_->ai_socktype | SOCK_CLOEXEC, 0); // a hot upgrade passes it on explicitly
 	if (serverSocket_ < 0)
 		throw std::runtime_error("failed to create socket");
 }
@@ -94,60 +154,68 @@ void Server::customSignals(bool customSignals) {
 		signal(SIGTERM, stop); // kill command shutdown
 		signal(SIGTSTP, stop); // ctrl+z
 		signal(SIGPIPE, SIG_IGN); // prevent crashes from broken pipes
+		signal(SIGUSR2, stop); // hot upgrade
 	}
 	else {
 		signal(SIGINT, SIG_DFL);
 		signal(SIGTERM, SIG_DFL);
 		signal(SIGTSTP, SIG_DFL);
 		signal(SIGPIPE, SIG_DFL);
+		signal(SIGUSR2, SIG_DFL);
 	}
 }
 
 void Server::stop(int signum) {
 	if (signum == SIGINT || signum == SIGTSTP || signum == SIGTERM)
 		isRunning_ = false;
+	else if (signum == SIGUSR2)
+		upgradeRequested_ = true;
 }
 
 void Server::startServer() {
-	epollFd = epoll_create1(EPOLL_CLOEXEC);
-
-	if (epollFd < 0) {
-		throw std::runtime_error("epoll fd creating failed");
-	}
-	struct epoll_event serverEvent; // epoll event for Listening socket (new connections monitoring)
-	serverEvent.events = EPOLLIN;
-	serverEvent.data.fd = serverSocket_;
-	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, serverEvent.data.fd, &serverEvent) < 0) {
-		close (epollFd);
-		throw std::runtime_error("Adding server socket to epoll failed");
-	}
-
-	struct epoll_event epEventList[MAX_EVENTS];
+	io_->addListener(serverSocket_);
 
-	logMessage(INFO, "SERVER", "Server is running. NAME: [" + serverName_ + "], SERVER_FD: [" + std::to_string(epollFd) + "]");
-	while(true) {
-		int epActiveSockets = epoll_wait(epollFd, epEventList, MAX_EVENTS, 4200); // timeout time?
+	logMessage(INFO, "SERVER", "Server is running. NAME: [" + serverName_ + "], IO: [" + io_->getName() + "]");
+	publishSharedStats(statsNow()); // readers get a valid segment before the first event
+	flushClients(); // output taken over by a hot upgrade, before the first wait
+	while(true)
+		runIteration(4200); // timeout time?
+}
 
-		if (!isRunning_)
-			closeServer();
-		if (epActiveSockets < 0) {
-			throw std::runtime_error("Epoll waiting failed");
-		}
-		if (epActiveSockets > 0) {
-			for (int i = 0; i < epActiveSockets; ++i)
-			{
-				if (epEventList[i].data.fd == serverSocket_) {
-					acceptNewClient(epollFd);
-				}
-				else if (epEventList[i].events & EPOLLIN) {
-					receiveData(epEventList[i].data.fd);
-				}
-				else if (epEventList[i].events & EPOLLOUT) {
-					sendData(epEventList[i].data.fd);
-				}
-			}
-		}
+// one pass of the event loop: dispatch what the backend has, then flush the output it produced
+int Server::runIteration(int timeoutMs) {
+	uint64_t waitStart = statsNow();
+	uint64_t blockedBefore = io_->getBlockedNs();
+	for (const auto& [fd, query] : listQueries_)
+		if (clients_.at(fd)->getSendQueueSize() < SENDQ_LOW_WATERMARK)
+			timeoutMs = 0; // a listing has room for its next batch, do not sleep on it
+	int activeEvents = io_->wait(*this, timeoutMs);
+	uint64_t waitEnd = statsNow();
+
+	if (!isRunning_)
+		closeServer();
+	if (activeEvents < 0) {
+		throw std::runtime_error("Waiting for I/O events failed");
 	}
+	if (historyStore_) {
+		deliverHistoryResults();
+		historyStore_->submit(); // the lines recorded during this iteration, in one hand-over
+	}
+	linkTick(waitEnd);
+	continueLists();
+	uint64_t flushStart = statsNow(); // the work above is in the profiler totals, not in the flush phase
+	flushClients(); // write everything queued while handling this batch of events
+	uint64_t iterationEnd = statsNow();
+	stats_.phaseLatency[PHASE_FLUSH].record(iterationEnd - flushStart);
+	uint64_t busyNs = iterationEnd - waitStart - (io_->getBlockedNs() - blockedBefore);
+	loopBusyNs_ = loopBusyNs_ - loopBusyNs_ / 8 + busyNs / 8;
+	profiler_.endIteration(activeEvents, waitEnd - waitStart, io_->getBlockedNs() - blockedBefore, iterationEnd - waitEnd);
+	profiler_.reportIfDue(iterationEnd);
+	publishSharedStats(iterationEnd);
+	snapshotTick(iterationEnd);
+	if (upgradeRequested_)
+		hotUpgrade();
+	return (activeEvents);
 }
 
 // here we split the line into command and arguments (params)
@@ -172,23 +240,48 @@ std::pair<std::string, std::vector<std::string>> Server::parseCommand(const std:
 
 void Server::processBuffer(Client& client) {
 	std::string buf = client.getReadBuffer();
+	size_t start = 0; // lines before this are handled, the buffer is trimmed once at the end
 	size_t pos;
 
-	while ((pos = buf.find("\r\n")) != std::string::npos) {
-		std::string line = buf.substr(0, pos);
-		buf.erase(0, pos + 2);
+	while ((pos = buf.find("\r\n", start)) != std::string::npos) {
+		if (client.getSendQueueSize() >= SENDQ_HIGH_WATERMARK && client.getState() != CLIENT_SERVER) { // leave the rest unread until the replies drain
+			throttleClient(client, "Output queue backed up (" + std::to_string(client.getSendQueueSize()) + " bytes)");
+			break;
+		}
+		if (listQueries_.count(client.getClientFD())) { // the next lines wait until the listing ended
+			client.setWaitingForList(true);
+			break;
+		}
+		uint64_t parseStart = statsNow();
+		std::string line = buf.substr(start, pos - start);
+		start = pos + 2;
+		if (capture_)
+			capture_->lineReceived(client.getClientFD(), line);
+		if (client.getState() == CLIENT_SERVER) { // another server, the link protocol has its own commands
+			int linkFd = client.getClientFD();
+			stats_.linesIn++;
+			profiler_.addLine();
+			handleLinkLine(client, line);
+			if (!clients_.count(linkFd))
+				return ;
+			continue;
+		}
 		std::pair<std::string, std::vector<std::string>> parsed = parseCommand(line);
 		std::string commandStr = parsed.first;
         std::vector<std::string> params = parsed.second;
 		std::transform(commandStr.begin(), commandStr.end(), commandStr.begin(), ::toupper);
+		stats_.phaseLatency[PHASE_PARSE].record(statsNow() - parseStart);
+		stats_.linesIn++;
+		profiler_.addLine();
 		logMessage(DEBUG, "COMMAND", "C[" + commandStr + "]");
 		if (commandStr == "QUIT")
 			return handleQuit(client, params);
-		if ((commandStr == "USER" || commandStr == "PASS" || commandStr == "CAP") && client.isAuthenticated()) {
+		bool registered = client.isRegistered();
+		if ((commandStr == "USER" || commandStr == "PASS" || commandStr == "CAP") && registered) {
 			messageHandle(ERR_ALREADYREGISTERED, client, commandStr, params);
 			continue;
 		}
-		if ((commandStr != "NICK" && commandStr != "USER" && commandStr != "PASS" && commandStr != "CAP") && !client.isAuthenticated()) {
+		if ((commandStr != "NICK" && commandStr != "USER" && commandStr != "PASS" && commandStr != "CAP" && commandStr != "SERVER") && !registered) {
 			messageHandle(ERR_NOTREGISTERED, client, commandStr, params);
 			continue;
 		}
@@ -198,27 +291,387 @@ void Server::processBuffer(Client& client) {
 			messageHandle(ERR_UNKNOWNCOMMAND, client, commandStr, params);
 			continue;
 		}
-		it->second(client, params);
+		int clientFd = client.getClientFD();
+		uint64_t dispatchStart = statsNow();
+		it->second(client, params); // may close the client, do not touch it after this
+		uint64_t elapsed = statsNow() - dispatchStart;
+		stats_.phaseLatency[PHASE_DISPATCH].record(elapsed);
+		stats_.commandLatency[commandStr].record(elapsed);
+		PROBE_COMMAND(clientFd, commandStr.c_str(), elapsed);
+		if (!clients_.count(clientFd))
+			return ;
 	}
-	client.setBuffer(buf);
+	client.setBuffer(buf.substr(start));
+}
+
+// IoHandler callbacks, the backend calls these from inside io_->wait()
+// ========================================================================
+
+void Server::onAccept(int clientFd, const struct sockaddr_in& clientAddr) {
+	acceptNewClient(clientFd, clientAddr);
+}
+
+void Server::onRead(int clientFd, const char* data, size_t len) {
+	receiveData(clientFd, data, len);
+}
+
+void Server::onWritable(int clientFd) {
+	sendData(clientFd);
 }
 
-void Server::receiveData(int currentFD) {
-	std::unique_ptr<Client>& client = clients_.at(currentFD); //get current Client from map
-	if (client->receiveData() == FAIL) {
-		client->setConnected(false);
-		epoll_ctl(client->getEpollFd(), EPOLL_CTL_DEL, currentFD, NULL);
-		clients_.erase(currentFD);
-		return;
+void Server::onSendComplete(int clientFd, ssize_t result) {
+	auto it = clients_.find(clientFd);
+	if (it == clients_.end() || !it->second)
+		return ;
+	if (result > 0) {
+		stats_.bytesOut += result;
+		profiler_.addBytesOut(result);
+	}
+	if (it->second->sendCompleted(result) == FAIL) {
+		logMessage(WARNING, "SEND", "Sending failed, closing ClientFD: " + std::to_string(clientFd));
+		closeClient(*it->second);
 	}
-	processBuffer(*client);
+}
+
+void Server::onHangup(int clientFd) {
+	auto it = clients_.find(clientFd);
+	if (it == clients_.end() || !it->second)
+		return ;
+	logMessage(INFO, "CLIENT", "Client " + std::to_string(clientFd) + " disconnected.");
+	closeClient(*it->second); // also drops the client from its channels and the throttle count
+}
+
+void Server::receiveData(int currentFD, const char* data, size_t len) {
+	auto it = clients_.find(currentFD); //get current Client from map
+	if (it == clients_.end() || !it->second)
+		return ;
+	stats_.bytesIn += len;
+	profiler_.addBytesIn(len);
+	it->second->addReadBuffer(data, len);
+	if (it->second->isReadPaused() || it->second->isWaitingForList())
+		return ; // completions already in flight when reading got paused, parsed once the client resumes
+	uint64_t dispatchStart = statsNow();
+	processBuffer(*it->second);
+	profiler_.addDispatch(statsNow() - dispatchStart);
 }
 
 void Server::sendData(int currentFD) {
-	std::unique_ptr<Client>& client = clients_.at(currentFD);
-	if (client->sendData() == FAIL) {
-		throw std::runtime_error("Sending Msg Failed");
+	auto it = clients_.find(currentFD);
+	if (it == clients_.end() || !it->second)
+		return ; // closed earlier in the same batch of events
+	flushClient(*it->second);
+}
+
+void Server::flushClient(Client& client) {
+	if (client.isSendQueueExceeded()) {
+		stats_.sendqEvictions++;
+		logMessage(WARNING, "SEND", "Max SendQ exceeded, evicting ClientFD: " + std::to_string(client.getClientFD()));
+		return closeClient(client);
+	}
+	size_t queued = client.getSendQueueSize();
+	int sendStatus = client.sendData();
+	stats_.bytesOut += queued - client.getSendQueueSize(); // completion backends report through onSendComplete()
+	profiler_.addBytesOut(queued - client.getSendQueueSize());
+	if (sendStatus == FAIL) {
+		logMessage(WARNING, "SEND", "Sending failed, closing ClientFD: " + std::to_string(client.getClientFD()));
+		return closeClient(client);
+	}
+	if (client.isReadPaused() && client.getSendQueueSize() < SENDQ_LOW_WATERMARK && !listQueries_.count(client.getClientFD())) {
+		unthrottleClient(client);
+		processBuffer(client); // handle the lines that were held back while throttled
+	}
+}
+
+// end of loop iteration flush: every client that got output gets one writev() no matter how many
+// replies and broadcasts were queued for it. Flushing can queue more (resumed clients), so loop until empty
+void Server::flushClients() {
+	while (!flushList_.empty()) {
+		flushing_.swap(flushList_);
+		for (int fd : flushing_) {
+			auto it = clients_.find(fd);
+			if (it == clients_.end() || !it->second)
+				continue; // closed while its output was pending
+			it->second->clearPendingFlush();
+			flushClient(*it->second);
+		}
+		flushing_.clear();
+	}
+}
+
+// once per SHM_STATS_INTERVAL_MS from the loop itself, so readers never touch the loop. Walking the
+// clients for the queue depths is the only per client work and happens once per interval
+void Server::publishSharedStats(uint64_t now) {
+	if (!sharedStats_ || now - lastPublishAt_ < SHM_STATS_INTERVAL_MS * 1000000ULL)
+		return ;
+	const LoopCounters& loop = profiler_.getCounters();
+	SharedStatsValues values = published_;
+	uint64_t elapsedNs = lastPublishAt_ ? now - lastPublishAt_ : 0;
+
+	values.updatedAt = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	values.clients = clients_.size();
+	values.channels = channelMap_.size();
+	values.linesIn = loop.lines.load(std::memory_order_relaxed);
+	values.bytesIn = loop.bytesIn.load(std::memory_order_relaxed);
+	values.bytesOut = loop.bytesOut.load(std::memory_order_relaxed);
+	values.sendqBytes = 0;
+	values.sendqMaxBytes = 0;
+	for (const auto& entry : clients_) {
+		if (!entry.second)
+			continue;
+		size_t queued = entry.second->getSendQueueSize();
+		values.sendqBytes += queued;
+		values.sendqMaxBytes = std::max<uint64_t>(values.sendqMaxBytes, queued);
+	}
+	values.throttledClients = stats_.throttledClients;
+	values.throttleEvents = stats_.throttleEvents;
+	values.sendqEvictions = stats_.sendqEvictions;
+	values.loopIterations = loop.iterations.load(std::memory_order_relaxed);
+	uint64_t busyNs = loop.readNs.load(std::memory_order_relaxed) + loop.dispatchNs.load(std::memory_order_relaxed)
+		+ loop.flushNs.load(std::memory_order_relaxed);
+	values.loopMaxIterationUs = loop.maxBusyNs.load(std::memory_order_relaxed) / 1000;
+	if (elapsedNs) {
+		values.linesPerSec = (values.linesIn - published_.linesIn) * 1000000000ULL / elapsedNs;
+		values.bytesInPerSec = (values.bytesIn - published_.bytesIn) * 1000000000ULL / elapsedNs;
+		values.bytesOutPerSec = (values.bytesOut - published_.bytesOut) * 1000000000ULL / elapsedNs;
+		values.loopBusyPermille = std::min<uint64_t>(1000, (busyNs - publishedBusyNs_) * 1000 / elapsedNs);
+	}
+	sharedStats_->publish(values);
+
+	published_ = values;
+	publishedBusyNs_ = busyNs;
+	lastPublishAt_ = now;
+}
+
+// A snapshot is taken SNAPSHOT_CHANNELS_PER_ITERATION channels per loop iteration, resuming after the
+// last name added, so no iteration pays for all channels. Every record is consistent on its own and
+// channels are only removed at shutdown, so the cursor stays valid. The file is written off the loop
+void Server::snapshotTick(uint64_t now) {
+	if (!snapshot_)
+		return ;
+	if (snapshotCursor_.empty()) {
+		if (now - lastSnapshotAt_ < config_.snapshotInterval * 1000000000ULL || snapshot_->isWriting() || channelMap_.empty())
+			return ;
+		snapshot_->begin();
+	}
+	auto it = snapshotCursor_.empty() ? channelMap_.begin() : channelMap_.upper_bound(snapshotCursor_);
+	for (int added = 0; it != channelMap_.end() && added < SNAPSHOT_CHANNELS_PER_ITERATION; ++it, ++added) {
+		snapshot_->add(*it->second);
+		snapshotCursor_ = it->first;
+	}
+	if (it != channelMap_.end())
+		return ;
+	snapshot_->commit(false);
+	snapshotCursor_.clear();
+	lastSnapshotAt_ = now;
+	logMessage(DEBUG, "SNAPSHOT", std::to_string(snapshot_->getCount()) + " channels saved to [" + snapshot_->getPath() + "]");
+}
+
+// the snapshot is written in channelMap_ order, each channel goes in right behind the previous one.
+// A damaged file is kept aside as <file>.bad and the server starts without channels
+void Server::restoreSnapshot() {
+	uint64_t start = statsNow();
+	std::vector<ChannelSnapshot> channels;
+	std::string error;
+	if (!StateSnapshot::load(config_.snapshotFile, channels, error)) {
+		logMessage(ERROR, "SNAPSHOT", "Cannot restore [" + config_.snapshotFile + "]: " + error + ", moved to .bad");
+		rename(config_.snapshotFile.c_str(), (config_.snapshotFile + ".bad").c_str());
+		return ;
+	}
+	size_t skipped = 0;
+	for (const ChannelSnapshot& snapshot : channels) {
+		if (!isValidChannelName(snapshot.name) || channelMap_.count(snapshot.name)) {
+			skipped++;
+			continue;
+		}
+		Channel* channel = new Channel(snapshot);
+		if (historyStore_ && historyStore_->hadHistory(snapshot.name))
+			channel->getHistory().markTruncated();
+		channelMap_.emplace_hint(channelMap_.end(), snapshot.name, channel);
+	}
+	if (channels.empty() && !error.empty())
+		return ; // no snapshot yet
+	logMessage(INFO, "SNAPSHOT", "Restored " + std::to_string(channels.size() - skipped) + " channels from ["
+		+ config_.snapshotFile + "] in " + std::to_string((statsNow() - start) / 1000000) + " ms"
+		+ (skipped ? ", skipped " + std::to_string(skipped) + " invalid or duplicate" : ""));
+}
+
+// Hands the listening socket, every client and all channel state to a freshly started binary. Runs at the
+// end of a loop iteration: what the iteration queued is flushed, and nothing is read until the new
+// process confirmed or failed. The old process releases nothing before that confirmation, so when the
+// new one fails it simply keeps serving. See HotUpgrade.hpp for the protocol
+void Server::hotUpgrade() {
+	uint64_t start = statsNow();
+	if (!upgradeDeadline_)
+		upgradeDeadline_ = start + UPGRADE_DRAIN_MS * 1000000ULL;
+	if ((!historyQueries_.empty() || !listQueries_.empty()) && start < upgradeDeadline_)
+		return ; // answers from disk or listings still on their way, the handover has no place for them
+	upgradeRequested_ = false;
+	upgradeDeadline_ = 0;
+	if (!io_->supportsHandover()) {
+		logMessage(WARNING, "UPGRADE", std::string("Hot upgrade is not supported by the [") + io_->getName() + "] backend");
+		return ;
+	}
+	if (!links_.empty() || !dialing_.empty()) { // the handover has no place for links and remote users
+		logMessage(WARNING, "UPGRADE", "Hot upgrade is not supported while linked to other servers");
+		return ;
+	}
+	int sock;
+	pid_t pid = spawnUpgrade(config_.upgradeBinary, config_.upgradeArgs, sock);
+	if (pid < 0) {
+		logMessage(ERROR, "UPGRADE", "Starting [" + config_.upgradeBinary + "] failed: " + strerror(errno));
+		return ;
+	}
+
+	for (const auto& [fd, query] : listQueries_) { // cut short, the new process would not know where they were
+		Client& client = *clients_.at(fd);
+		messageHandle(RPL_LISTEND, client, "LIST", {});
+		if (client.isWaitingForList()) // held lines go on as for a throttled client, in whichever process resumes it
+			throttleClient(client, "LIST cut short by the upgrade");
+		client.setWaitingForList(false);
+	}
+	listQueries_.clear();
+
+	UpgradeState state;
+	state.nextMsgId = nextMsgId_;
+	state.nextBatchId = nextBatchId_;
+	state.nextCaptureId = capture_ ? capture_->getNextConnection() : 0;
+	std::vector<int> fds(1, serverSocket_);
+	std::map<Client*, uint32_t> indices;
+	for (auto& [fd, client] : clients_) {
+		if (!client)
+			continue;
+		indices[client.get()] = state.clients.size();
+		fds.push_back(fd);
+		state.clients.push_back(ClientHandover{client->getHostname(), client->getAddress(), client->getNickname(), client->getUsername(),
+			client->getRealName(), client->getPassword(), client->getState(), client->isServerOperator(),
+			client->isReadPaused(), client->getNickTs(), client->getReadBuffer(), client->getPendingOutput(), {},
+			capture_ ? capture_->getConnectionId(fd) : 0});
+		for (const auto& [key, nickname] : client->getMonitored())
+			state.clients.back().monitored.push_back(nickname);
+	}
+	for (auto& [channelName, channel] : channelMap_) {
+		ChannelHandover handover;
+		handover.snapshot = ChannelSnapshot{channelName, channel->getChannelKey(), channel->getTopic(), StateSnapshot::flagsOf(*channel),
+			channel->getUserLimit(), std::vector<std::string>(channel->getPendingOperators().begin(), channel->getPendingOperators().end()),
+			StateSnapshot::masksOf(*channel), channel->getCreatedAt(), channel->getTopicTime()};
+		for (Client* member : channel->getMembers())
+			handover.members.push_back(indices[member]);
+		for (Client* op : channel->getOperators())
+			handover.operators.push_back(indices[op]);
+		for (Client* invited : channel->getInvited())
+			if (indices.count(invited))
+				handover.invited.push_back(indices[invited]);
+		ChannelHistory& history = channel->getHistory();
+		handover.historyTruncated = history.isTruncated();
+		for (const HistoryEntry* entry : history.select(HistoryRef{HistoryRef::NONE, 0}, HistoryRef{HistoryRef::NONE, 0}, history.getSize(), false))
+			handover.history.push_back(*entry);
+		state.channels.push_back(std::move(handover));
+	}
+	std::string encoded;
+	state.encode(encoded);
+
+	if (!sendUpgradeState(sock, encoded, fds) || !awaitUpgradeReady(sock)) {
+		close(sock);
+		kill(pid, SIGKILL);
+		waitpid(pid, nullptr, 0);
+		logMessage(ERROR, "UPGRADE", "New process " + std::to_string(pid) + " did not take over, still serving");
+		return ;
+	}
+	logMessage(INFO, "UPGRADE", "Handed " + std::to_string(state.clients.size()) + " clients and " + std::to_string(state.channels.size())
+		+ " channels (" + std::to_string(encoded.size() / 1024) + " KiB) to pid " + std::to_string(pid) + " in "
+		+ std::to_string((statsNow() - start) / 1000000) + " ms");
+	// the new process opens these once this one is gone: history and capture written out, stats segment unlinked
+	snapshot_.reset();
+	historyStore_.reset();
+	capture_.reset();
+	sharedStats_.reset();
+	close(sock);
+	exit(0);
+}
+
+// the other half of hotUpgrade(), in the new process before anything else is set up. Clients keep their
+// fds open through all of it, they only see a short pause
+void Server::resumeUpgrade() {
+	uint64_t start = statsNow();
+	std::string encoded;
+	std::string error;
+	std::vector<int> fds;
+	UpgradeState state;
+	if (!receiveUpgradeState(config_.upgradeFd, encoded, fds))
+		throw std::runtime_error("Receiving the upgrade state failed: " + std::string(strerror(errno)));
+	if (!state.decode(encoded, error))
+		throw std::runtime_error("Upgrade state rejected: " + error);
+	if (fds.size() != state.clients.size() + 1)
+		throw std::runtime_error("Upgrade state rejected: " + std::to_string(fds.size()) + " descriptors for "
+			+ std::to_string(state.clients.size()) + " clients");
+
+	serverSocket_ = fds[0];
+	nextMsgId_ = state.nextMsgId;
+	nextBatchId_ = state.nextBatchId;
+	std::vector<Client*> clients;
+	for (size_t i = 0; i < state.clients.size(); i++) {
+		int fd = fds[i + 1];
+		io_->addClient(fd);
+		std::unique_ptr<Client>& client = clients_[fd] = std::make_unique<Client>(fd, state.clients[i], *io_, flushList_);
+		if (!client->getAddress().empty())
+			admission_.restore(client->getAddress());
+		if (state.clients[i].readPaused) {
+			client->setReadPaused(true);
+			stats_.throttledClients++;
+		}
+		setClientNickname(*client, client->getNickname());
+		if (client->isRegistered())
+			indexUser(*client);
+		for (const std::string& nickname : state.clients[i].monitored)
+			watchNickname(*client, nickname);
+		clients.push_back(client.get());
+	}
+	size_t historyLines = 0;
+	for (const ChannelHandover& handover : state.channels) {
+		Channel* channel = new Channel(handover, clients);
+		for (Client* member : channel->getMembers())
+			member->addToJoinedChannelList(handover.snapshot.name);
+		historyBytes_ += channel->getHistory().getBytes();
+		historyLines += channel->getHistory().getSize();
+		for (const HistoryEntry& entry : handover.history)
+			historyOrder_.emplace_back(channel, entry.msgId);
+		channelMap_.emplace_hint(channelMap_.end(), handover.snapshot.name, channel);
 	}
+	std::sort(historyOrder_.begin(), historyOrder_.end(),
+		[](const std::pair<Channel*, uint64_t>& a, const std::pair<Channel*, uint64_t>& b) { return (a.second < b.second); });
+	historyStale_ = historyOrder_.size() - historyLines; // only when this binary keeps fewer lines per channel
+
+	if (!confirmUpgrade(config_.upgradeFd))
+		throw std::runtime_error("Upgrade confirmation failed: " + std::string(strerror(errno)));
+	close(config_.upgradeFd);
+	// the old process is gone and wrote its last records, the capture carries on in the same file with the
+	// same connection ids so a replay sees one session
+	if (!config_.captureFile.empty()) {
+		capture_ = std::make_unique<TrafficCapture>(config_.captureFile, true, state.nextCaptureId);
+		for (size_t i = 0; i < state.clients.size(); i++)
+			capture_->connectionResumed(fds[i + 1], state.clients[i].captureId);
+	}
+	logMessage(INFO, "UPGRADE", "Took over " + std::to_string(clients_.size()) + " clients and " + std::to_string(channelMap_.size())
+		+ " channels in " + std::to_string((statsNow() - start) / 1000000) + " ms");
+}
+
+// stop polling EPOLLIN for a client that does not read its replies, the kernel socket buffer then pushes back on the sender
+void Server::throttleClient(Client& client, const std::string& reason) {
+	if (client.isReadPaused())
+		return ;
+	client.setReadPaused(true);
+	stats_.throttleEvents++;
+	stats_.throttledClients++;
+	logMessage(WARNING, "THROTTLE", reason + ", reading paused. ClientFD: " + std::to_string(client.getClientFD()));
+}
+
+void Server::unthrottleClient(Client& client) {
+	if (!client.isReadPaused())
+		return ;
+	client.setReadPaused(false);
+	stats_.throttledClients--;
+	logMessage(DEBUG, "THROTTLE", "Output queue drained, reading resumed. ClientFD: " + std::to_string(client.getClientFD()));
 }
 
 std::string Server::getClientIP(struct sockaddr_in clientSocAddr) {
@@ -231,39 +684,41 @@ std::string Server::getClientIP(struct sockaddr_in clientSocAddr) {
 	return (std::string(clientIP));
 }
 
-void Server::acceptNewClient(int epollFd) {
-	struct  sockaddr_in clientSocAddr;
-	socklen_t clientSocLen = sizeof(clientSocAddr);
-
-	int clientFd = accept(serverSocket_, (struct sockaddr*)&clientSocAddr, &clientSocLen);
-	if  (clientFd < 0) {
-		throw std::runtime_error("Client accept() failed");
-		// should exit or return to main/server loop??? ****
+// the backend already accepted the connection as a non-blocking socket. Whatever goes wrong here costs
+// this one connection, never the server: a reconnect flood is turned away one socket at a time
+void Server::acceptNewClient(int clientFd, const struct sockaddr_in& clientSocAddr) {
+	std::string clientIP = getClientIP(clientSocAddr);
+	if (clientIP.empty()) {
+		logMessage(WARNING, "SERVER", "Dropped a connection without a peer address. ClientFD[" + std::to_string(clientFd) + "]");
+		io_->closeClient(clientFd);
+		return ;
 	}
-	else
-	{
-		if (fcntl(clientFd, F_SETFL, O_NONBLOCK) < 0) { // Make client non-blocking
-			close(clientFd);
-			throw std::runtime_error("fcntl() failed for client");
-		}
-		std::string clientIP = getClientIP(clientSocAddr);
-		if (clientIP.empty()) {
-			close(clientFd);
-			throw std::runtime_error("Failed to retrieve client IP");
-		}
-
-		// Prepare epoll_event for this client
-		struct epoll_event clientEvent;
-		clientEvent.events = EPOLLIN; // start listening for read events
-		clientEvent.data.fd = clientFd;
-
-		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientFd, &clientEvent) < 0) {
-			close(clientFd);
-			throw std::runtime_error("epoll_ctl() failed for client");
+	uint64_t now = statsNow();
+	AdmissionVerdict verdict = admission_.admit(clientIP, now, loopBusyNs_);
+	if (verdict != ADMIT) {
+		refusedSinceLog_++;
+		if (now - lastRefusalLog_ >= 1000000000ULL) {
+			logMessage(WARNING, "ADMISSION", "Refused " + clientIP + ": " + AdmissionControl::reason(verdict) + " ("
+				+ std::to_string(refusedSinceLog_) + " refused since the last notice)");
+			lastRefusalLog_ = now;
+			refusedSinceLog_ = 0;
 		}
-		// Adding new client
-		clients_[clientFd] = std::make_unique<Client>(clientFd, clientIP, epollFd); // what about client Index 0-3??*****
+		io_->refuseClient(clientFd, "ERROR :Closing Link: " + clientIP + " (" + AdmissionControl::reason(verdict) + ")\r\n");
+		return ;
+	}
+	try {
+		io_->addClient(clientFd);
 	}
+	catch (const std::exception& e) {
+		logMessage(ERROR, "SERVER", "Dropped " + clientIP + ": " + e.what());
+		admission_.release(clientIP);
+		io_->closeClient(clientFd);
+		return ;
+	}
+	std::unique_ptr<Client>& client = clients_[clientFd] = std::make_unique<Client>(clientFd, clientIP, *io_, flushList_);
+	client->setAddress(clientIP);
+	if (capture_)
+		capture_->connectionOpened(clientFd);
 }
 
 // we set socket option for all sockets (SOL_SOCKET) to SO_REUSEADDR which enables us to reuse local addresses
@@ -305,6 +760,10 @@ std::string Server::getServerName() const {
 	return (this->serverName_);
 }
 
+const ServerStats& Server::getStats() const {
+	return (this->stats_);
+}
+
 bool Server::stringCompCaseIgnore(const std::string &str1, const std::string &str2) {
 	std::string str1Lower = str1;
 	std::transform(str1Lower.begin(), str1Lower.end(), str1Lower.begin(),
@@ -324,13 +783,7 @@ bool Server::stringCompCaseIgnore(const std::string &str1, const std::string &st
 
 bool	Server::isNickDuplicate(std::string  nickName) {
 
-	for (auto& [fd, client] : this->clients_) {
-		if (client && stringCompCaseIgnore(client->getNickname(), nickName))
-		{
-			return (true);// Duplicate found
-		}
-	}
-	return (false);
+	return (getClient(nickName) != nullptr);
 }
 
 Channel* Server::getChannel(const std::string& channelName) {
@@ -349,10 +802,100 @@ bool Server::isClientChannelMember(Channel *channel, Client& client) {
 }
 
 Client* Server::getClient(const std::string& nickName) {
-	for (auto& [fd, clientPtr] : clients_) {
-		if (clientPtr && stringCompCaseIgnore(clientPtr->getNickname(), nickName)) {
-			return clientPtr.get();
+	auto it = nickIndex_.find(foldCase(nickName));
+	if (it == nickIndex_.end())
+		return nullptr; // not found
+	return it->second;
+}
+
+// every nickname change goes through here, getClient() looks them up in nickIndex_
+void Server::setClientNickname(Client& client, const std::string& nickname) {
+	std::string previous = client.getNickname();
+	auto it = nickIndex_.find(foldCase(previous));
+	if (it != nickIndex_.end() && it->second == &client)
+		nickIndex_.erase(it);
+	client.setNickname(nickname);
+	if (!nickname.empty())
+		nickIndex_[foldCase(nickname)] = &client;
+	if (client.isRegistered() && foldCase(previous) != foldCase(nickname)) { // a change of case is the same nickname to MONITOR
+		if (!previous.empty())
+			notifyWatchers(previous, nullptr);
+		if (!nickname.empty())
+			notifyWatchers(nickname, &client);
+	}
+}
+
+// username and host are final once the client is registered
+void Server::indexUser(Client& client) {
+	userIndex_.emplace(foldCase(client.getUsername()), &client);
+	hostIndex_.emplace(foldCase(client.getHostname()), &client);
+}
+
+static bool eraseIndexEntry(std::multimap<std::string, Client*>& index, const std::string& key, Client* client) {
+	auto range = index.equal_range(key);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second == client) {
+			index.erase(it);
+			return (true);
 		}
 	}
-	return nullptr; // not found
+	return (false);
+}
+
+// the client is gone, MONITOR watchers hear about it if it was registered
+void Server::unindexClient(Client& client) {
+	auto it = nickIndex_.find(foldCase(client.getNickname()));
+	bool named = it != nickIndex_.end() && it->second == &client;
+	if (named)
+		nickIndex_.erase(it);
+	bool registered = eraseIndexEntry(userIndex_, foldCase(client.getUsername()), &client); // nothing there before registration
+	eraseIndexEntry(hostIndex_, foldCase(client.getHostname()), &client);
+	if (named && registered)
+		notifyWatchers(client.getNickname(), nullptr);
+}
+
+// a local client just got through NICK and USER: it can be found by WHO and the other servers learn about it
+void Server::announceRegistration(Client& client) {
+	client.setNickTs(time(nullptr));
+	indexUser(client);
+	notifyWatchers(client.getNickname(), &client);
+	propagate(nickLine(client), nullptr);
+}
+
+// MONITOR keeps a reverse index, a nickname coming or going costs one lookup and a reply per watcher
+// instead of the watchers polling with ISON or WHOIS. False when the client already watched it
+bool Server::watchNickname(Client& client, const std::string& nickname) {
+	std::string key = foldCase(nickname);
+	if (!client.addMonitored(key, nickname))
+		return (false);
+	watchers_[key].insert(&client);
+	return (true);
+}
+
+void Server::unwatchNickname(Client& client, const std::string& nickname) {
+	std::string key = foldCase(nickname);
+	if (!client.removeMonitored(key))
+		return ;
+	auto it = watchers_.find(key);
+	it->second.erase(&client);
+	if (it->second.empty())
+		watchers_.erase(it);
+}
+
+void Server::unwatchAll(Client& client) {
+	while (!client.getMonitored().empty())
+		unwatchNickname(client, client.getMonitored().begin()->first);
+}
+
+// RPL_MONONLINE with the full prefix when user took nickname, RPL_MONOFFLINE when user is null
+void Server::notifyWatchers(const std::string& nickname, Client* user) {
+	auto it = watchers_.find(foldCase(nickname));
+	if (it == watchers_.end())
+		return ;
+	for (Client* watcher : it->second) {
+		if (user)
+			messageHandle(RPL_MONONLINE, *watcher, "MONITOR", {user->getClientIdentifier()});
+		else
+			messageHandle(RPL_MONOFFLINE, *watcher, "MONITOR", {":" + nickname});
+	}
 }
@@ -1,7 +1,8 @@
 #include "../includes/Server.hpp"
 #include "../includes/responseCodes.hpp"
+#include "../includes/probes.hpp"
 
-std::string	Server::createMessage(int code, Client &client, std::string cmd, const std::vector<std::string>& params) {
+std::string	Server::createMessage(int code, Client &client, const std::string& cmd, const std::vector<std::string>& params) {
 	std::string message;
 	std::string paramString;
 
@@ -31,7 +32,7 @@ std::string	Server::createMessage(int code, Client &client, std::string cmd, con
 	} else if (code == RPL_MYINFO) {
 		message += this->getServerName() + ": Version 1.0";
 	} else if (code == RPL_ISUPPORT) {
-		message += this->getServerName() + " supports.......";
+		message += params[0] + " :are supported by this server";
 	} else if (code == ERR_NEEDMOREPARAMS) {
 		message += cmd + " :Not enough parameters";
 	} else if (code == ERR_PASSWDMISMATCH) {
@@ -76,6 +77,18 @@ std::string	Server::createMessage(int code, Client &client, std::string cmd, con
 		message += cmd + " :Cannot join channel (+i)";
 	} else if (code == ERR_USERONCHANNEL) {
 		message += params[0] + " " + cmd + " :is already on channel";
+	} else if (code == RPL_MONONLINE || code == RPL_MONOFFLINE || code == RPL_MONLIST) {
+		message += paramString;
+	} else if (code == RPL_ENDOFMONLIST) {
+		message += ":End of MONITOR list";
+	} else if (code == ERR_MONLISTFULL) {
+		message += paramString + " :Monitor list is full";
+	} else if (code == RPL_LISTSTART) {
+		message += "Channel :Users  Name";
+	} else if (code == RPL_LIST) {
+		message += paramString;
+	} else if (code == RPL_LISTEND) {
+		message += ":End of /LIST";
 	} else if (code == RPL_WHOISUSER) {
 		message += client.getUsername() + " " + client.getHostname() + " * :" + client.getRealName();
 	} else if (code == RPL_ENDOFWHOIS) {
@@ -100,6 +113,18 @@ std::string	Server::createMessage(int code, Client &client, std::string cmd, con
 		message += params[0] + " " + params[1];
 	} else if (code == RPL_ENDOFBANLIST) {
 		message += cmd + " :End of channel ban list";
+	} else if (code == RPL_BANLIST || code == RPL_EXCEPTLIST || code == RPL_INVITELIST) {
+		message += paramString;
+	} else if (code == RPL_ENDOFEXCEPTLIST) {
+		message += cmd + " :End of channel exception list";
+	} else if (code == RPL_ENDOFINVITELIST) {
+		message += cmd + " :End of channel invite exception list";
+	} else if (code == ERR_BANNEDFROMCHAN) {
+		message += cmd + " :Cannot join channel (+b)";
+	} else if (code == ERR_BANLISTFULL) {
+		message += paramString + " :Channel list is full";
+	} else if (code == ERR_BANNICKCHANGE) {
+		message += cmd + " :Cannot change nickname while banned on channel";
 	} else if (code == RPL_UMODEIS) {
 		message += paramString;
 	} else if (code == ERR_BADCHANNELKEY) {
@@ -108,6 +133,24 @@ std::string	Server::createMessage(int code, Client &client, std::string cmd, con
 		message += paramString;
 	} else if (code == ERR_UNKNOWNMODE) {
 		message += paramString;
+	} else if (code == RPL_YOUREOPER) {
+		message += ":You are now an IRC operator";
+	} else if (code == RPL_UPGRADING) {
+		message += cmd + " :Upgrading";
+	} else if (code == ERR_NOOPERHOST) {
+		message += ":No O-lines for your host";
+	} else if (code == ERR_NOPRIVILEGES) {
+		message += ":Permission Denied- You're not an IRC operator";
+	} else if (code == RPL_WHOREPLY || code == RPL_WHOSPCRPL) {
+		message += paramString;
+	} else if (code == RPL_ENDOFWHO) {
+		message += paramString + " :End of WHO list";
+	} else if (code == ERR_TOOMANYMATCHES) {
+		message += cmd + " " + paramString + " :Output too large, truncated";
+	} else if (code == RPL_STATSCOMMANDS || code == RPL_STATSDEBUG) {
+		message += paramString;
+	} else if (code == RPL_ENDOFSTATS) {
+		message += cmd + " :End of STATS report";
 	} else {
 		message += cmd + " " + paramString;
 	}
@@ -116,14 +159,16 @@ std::string	Server::createMessage(int code, Client &client, std::string cmd, con
 	return (message);
 }
 
-void Server::messageHandle(int code, Client &client, std::string cmd, const std::vector<std::string>& params) {
+void Server::messageHandle(int code, Client &client, const std::string& cmd, const std::vector<std::string>& params) {
 	if (!code)
 		return ;
+	if (code >= 400)
+		stats_.errorNumerics[code]++;
 	std::string message = createMessage(code, client, cmd, params);
 	client.appendSendBuffer(message);
 }
 
-void Server::messageHandle(Client &client, std::string cmd, const std::vector<std::string>& params) {
+void Server::messageHandle(Client &client, const std::string& cmd, const std::vector<std::string>& params) {
 
 	std::vector<int> responseCodes = {
 		RPL_WELCOME,
@@ -136,16 +181,31 @@ void Server::messageHandle(Client &client, std::string cmd, const std::vector<st
 		std::string message = createMessage(code, client, cmd, params);
 		client.appendSendBuffer(message);
 	}
+	// clients only use MONITOR, WHOX, the LIST filters, +e/+I and CHATHISTORY when they are announced
+	static const std::vector<std::string> isupport = {
+		"CASEMAPPING=ascii CHANTYPES=# PREFIX=(o)@ CHANMODES=beI,k,l,it NICKLEN=" + std::to_string(NICK_MAX_LEN)
+			+ " CHANNELLEN=" + std::to_string(CHANNEL_NAME_MAX_LEN) + " MAXLIST=beI:" + std::to_string(CHAN_MASK_LIST_MAX),
+		"EXCEPTS=e INVEX=I ELIST=CMNTU MONITOR=" + std::to_string(MONITOR_MAX_TARGETS) + " WHOX CHATHISTORY="
+			+ std::to_string(HISTORY_PAGE_MAX) + " MSGREFTYPES=msgid,timestamp"
+	};
+	for (const std::string& tokens : isupport)
+		client.appendSendBuffer(createMessage(RPL_ISUPPORT, client, cmd, {tokens}));
 }
 
-void Server::messageToClient(Client &targetClient, Client &fromClient, std::string command, const std::string msgToSend) {
+void Server::messageToClient(Client &targetClient, Client &fromClient, const std::string& command, const std::string& msgToSend) {
 
+	if (targetClient.isRemote()) { // goes to the server the user is on, unless it came from there
+		if (targetClient.getUplink() != fromClient.getUplink())
+			targetClient.getUplink()->appendSendBuffer(":" + fromClient.getNickname() + " " + command + " "
+				+ targetClient.getNickname() + " :" + msgToSend + "\r\n");
+		return ;
+	}
 	std::string	finalMsg = fromClient.getClientIdentifier() + " " + command + " " + targetClient.getNickname() + " " + msgToSend + "\r\n";
 
 	targetClient.appendSendBuffer(finalMsg);
 }
 
-void Server::messageToClient(Client &targetClient, Client &fromClient, std::string command, const std::string msgToSend, std::string channelName) {
+void Server::messageToClient(Client &targetClient, Client &fromClient, const std::string& command, const std::string& msgToSend, const std::string& channelName) {
 
 	std::string finalMsg;
 	if (command == "NICK") {
@@ -157,7 +217,7 @@ void Server::messageToClient(Client &targetClient, Client &fromClient, std::stri
 	targetClient.appendSendBuffer(finalMsg);
 }
 
-void Server::messageBroadcast(Channel &targetChannel, Client &fromClient, std::string command, const std::string msgToSend) {
+void Server::messageBroadcast(Channel &targetChannel, Client &fromClient, const std::string& command, const std::string& msgToSend) {
 
 	if (!isClientChannelMember(&targetChannel, fromClient)) {
 		messageHandle(ERR_NOTONCHANNEL, fromClient, command, {msgToSend});
@@ -165,25 +225,49 @@ void Server::messageBroadcast(Channel &targetChannel, Client &fromClient, std::s
 		return ;
 	}
 
+	uint64_t broadcastStart = statsNow();
 	const std::set<Client*>& clients = targetChannel.getMembers();
+	size_t recipients = 0;
 
+	// the line is the same for every member, build it once (messageToClient() would per recipient).
+	// Shared so the channel history can keep it without a copy
+	std::shared_ptr<std::string> line = std::make_shared<std::string>();
+	if (command == "NICK")
+		*line = msgToSend;
+	else {
+		const std::string& prefix = fromClient.getClientIdentifier();
+		const std::string& channelName = targetChannel.getName();
+		line->reserve(prefix.size() + command.size() + channelName.size() + msgToSend.size() + 5);
+		line->append(prefix).append(" ").append(command).append(" ").append(channelName).append(" ")
+			.append(msgToSend).append("\r\n");
+	}
+	bool skipSender = (command == "PRIVMSG" || command == "NICK");
+	bool forward = command == "PRIVMSG" && !links_.empty();
+	std::vector<Client*> links; // the links with members behind them, each gets the message once
 	for (Client* targetClient : clients) {
-		if (command == "PRIVMSG" || command == "NICK") {
-			if (targetClient->getClientFD() != fromClient.getClientFD()) {
-				if (isClientChannelMember(&targetChannel, *targetClient)) {
-					messageToClient(*targetClient, fromClient, command, msgToSend, targetChannel.getName());
-				}
-			}
-		}
-		else {
-			if (isClientChannelMember(&targetChannel, *targetClient)) {
-				messageToClient(*targetClient, fromClient, command, msgToSend, targetChannel.getName());
-			}
+		if (skipSender && targetClient == &fromClient)
+			continue;
+		if (Client* uplink = targetClient->getUplink()) {
+			if (forward && uplink != fromClient.getUplink() && std::find(links.begin(), links.end(), uplink) == links.end())
+				links.push_back(uplink);
+			continue;
 		}
+		targetClient->appendSendBuffer(*line);
+		recipients++;
+	}
+	if (!links.empty()) {
+		std::string linkLine = ":" + fromClient.getNickname() + " PRIVMSG " + targetChannel.getName() + " :" + msgToSend + "\r\n";
+		for (Client* link : links)
+			link->appendSendBuffer(linkLine);
 	}
+	size_t lineBytes = line->size();
+	if (command == "PRIVMSG" || command == "TOPIC" || command == "KICK")
+		recordHistory(targetChannel, std::move(line));
+	stats_.phaseLatency[PHASE_BROADCAST].record(statsNow() - broadcastStart);
+	PROBE_BROADCAST(targetChannel.getName().c_str(), clients.size(), recipients * lineBytes);
 }
 
-void Server::messageBroadcast(Client &fromClient, std::string command, const std::string msgToSend)
+void Server::messageBroadcast(Client &fromClient, const std::string& command, const std::string& msgToSend)
 {
 	std::set<std::string> channels = fromClient.getJoinedChannels();
 	for (const std::string& channelName : channels) {
@@ -193,3 +277,44 @@ void Server::messageBroadcast(Client &fromClient, std::string command, const std
 		}
 	}
 }
+
+// IRCv3 standard reply: FAIL <command> <code> [<context>] :<description>
+void Server::sendFail(Client &client, const std::string& command, const std::string& code, const std::string& context, const std::string& description) {
+	std::string message = ":" + serverName_ + " FAIL " + command + " " + code;
+	if (!context.empty())
+		message += " " + context;
+	client.appendSendBuffer(message + " :" + description + "\r\n");
+}
+
+// the per channel caps are applied by the ring, the global one here by evicting the oldest line of the
+// whole server. historyOrder_ keeps the lines a ring dropped on its own until they reach the front or
+// make up half of it, then it is compacted
+void Server::recordHistory(Channel &channel, std::shared_ptr<const std::string> line) {
+	ChannelHistory& history = channel.getHistory();
+	uint64_t msgId = nextMsgId_++;
+	size_t bytesBefore = history.getBytes();
+	size_t linesBefore = history.getSize();
+	const HistoryEntry& entry = history.add(HistoryEntry{msgId, serverTimeNow(), std::move(line)});
+	if (historyStore_)
+		historyStore_->append(channel.getName(), entry);
+	historyBytes_ = historyBytes_ - bytesBefore + history.getBytes();
+	historyStale_ += linesBefore + 1 - history.getSize();
+	historyOrder_.emplace_back(&channel, msgId);
+
+	while (historyBytes_ > HISTORY_TOTAL_MAX_BYTES && !historyOrder_.empty()) {
+		auto [oldest, oldestId] = historyOrder_.front();
+		historyOrder_.pop_front();
+		size_t freed = oldest->getHistory().evictThrough(oldestId);
+		if (!freed)
+			historyStale_--;
+		historyBytes_ -= freed;
+	}
+	if (historyStale_ > 1024 && historyStale_ > historyOrder_.size() / 2) {
+		std::deque<std::pair<Channel*, uint64_t>> live;
+		for (const std::pair<Channel*, uint64_t>& kept : historyOrder_)
+			if (kept.second >= kept.first->getHistory().getOldestId())
+				live.push_back(kept);
+		historyOrder_.swap(live);
+		historyStale_ = 0;
+	}
+}
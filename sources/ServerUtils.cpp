@@ -1,21 +1,19 @@
 #include "../includes/Server.hpp"
 #include "../includes/macros.hpp"
 
-bool Server::isNickUserValid(std::string cmd, std::string name) {
-	if (cmd == "NICK") {
-		std::regex nickName_regex(R"(^([A-Za-z\[\]\\`_^{}|])(?![$#&~@+%:])[-A-Za-z0-9\[\]\\`_^{}|]{0,8}$)");
-		return (std::regex_match(name, nickName_regex));
-	}
-	else if (cmd == "USER") {
-		std::regex userName_regex(R"(^[^\s@]{1,10}$)");
-		return (std::regex_match(name, userName_regex));
-	}
+bool Server::isNickUserValid(const std::string& cmd, const std::string& name) {
+	if (cmd == "NICK")
+		return (isValidNickname(name));
+	else if (cmd == "USER")
+		return (isValidUsername(name));
 	return (false);
 }
 
 Channel* Server::createChannel(Client* client, const std::string& channelName, const std::string& channelKey) {
 
 	Channel* newChannel = new Channel(client, channelName, channelKey);
+	if (historyStore_ && historyStore_->hadHistory(channelName))
+		newChannel->getHistory().markTruncated(); // the lines from before the restart are on disk only
 	channelMap_[channelName] = newChannel;
 	return newChannel;
 }
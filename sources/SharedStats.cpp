@@ -0,0 +1,49 @@
+#include "../includes/SharedStats.hpp"
+#include "../includes/Server.hpp"
+#include <sys/mman.h>
+
+SharedStats::SharedStats(const std::string& name) : name_(name), block_(nullptr) {
+	int fd = shm_open(name_.c_str(), O_CREAT | O_RDWR, 0644);
+	if (fd < 0)
+		throw std::runtime_error("shm_open(" + name_ + "): " + strerror(errno));
+	if (ftruncate(fd, sizeof(SharedStatsBlock)) < 0) {
+		std::string error = strerror(errno);
+		close(fd);
+		shm_unlink(name_.c_str());
+		throw std::runtime_error("ftruncate(" + name_ + "): " + error);
+	}
+	void* mapped = mmap(nullptr, sizeof(SharedStatsBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		shm_unlink(name_.c_str());
+		throw std::runtime_error("mmap(" + name_ + "): " + strerror(errno));
+	}
+	block_ = static_cast<SharedStatsBlock*>(mapped);
+	block_->seq.store(1, std::memory_order_relaxed); // odd until the first publish
+	block_->magic = SHM_STATS_MAGIC;
+	block_->version = SHM_STATS_VERSION;
+	block_->valueCount = sizeof(SharedStatsValues) / sizeof(uint64_t);
+	block_->reserved = 0;
+}
+
+SharedStats::~SharedStats() {
+	if (block_)
+		munmap(block_, sizeof(SharedStatsBlock));
+	shm_unlink(name_.c_str());
+}
+
+void SharedStats::publish(const SharedStatsValues& values) {
+	uint64_t words[sizeof(SharedStatsValues) / sizeof(uint64_t)];
+	std::memcpy(words, &values, sizeof(words));
+
+	uint64_t seq = block_->seq.load(std::memory_order_relaxed) | 1;
+	block_->seq.store(seq, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+		block_->values[i].store(words[i], std::memory_order_relaxed);
+	block_->seq.store(seq + 1, std::memory_order_release);
+}
+
+const std::string& SharedStats::getName() const {
+	return (name_);
+}
@@ -0,0 +1,257 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "../includes/StateSnapshot.hpp"
+#include "../includes/Server.hpp"
+
+static uint64_t fnv1a(const char* data, size_t len) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ static_cast<uint8_t>(data[i])) * 1099511628211ULL;
+	return (hash);
+}
+
+template <typename T>
+static void appendValue(std::string& buffer, T value) {
+	buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static bool readValue(const std::string& data, size_t& offset, size_t end, T& value) {
+	if (end - offset < sizeof(value))
+		return (false);
+	std::memcpy(&value, data.data() + offset, sizeof(value));
+	offset += sizeof(value);
+	return (true);
+}
+
+template <typename Length>
+static bool readString(const std::string& data, size_t& offset, size_t end, std::string& str) {
+	Length length;
+	if (!readValue(data, offset, end, length) || end - offset < length)
+		return (false);
+	str.assign(data, offset, length);
+	offset += length;
+	return (true);
+}
+
+StateSnapshot::StateSnapshot(const std::string& path) : path_(path), count_(0), writing_(false), failed_(false) {}
+
+StateSnapshot::~StateSnapshot() {
+	if (writer_.joinable())
+		writer_.join();
+}
+
+void StateSnapshot::appendString(const std::string& str, size_t lengthBytes) {
+	size_t length = std::min(str.size(), (static_cast<size_t>(1) << (8 * lengthBytes)) - 1);
+	buffer_.append(reinterpret_cast<const char*>(&length), lengthBytes); // little endian, low bytes first
+	buffer_.append(str, 0, length);
+}
+
+void StateSnapshot::begin() {
+	buffer_.clear();
+	count_ = 0;
+	buffer_.append(SNAPSHOT_MAGIC, 8);
+	appendValue<uint32_t>(buffer_, SNAPSHOT_VERSION);
+	appendValue<uint32_t>(buffer_, 0); // channel count, filled in by commit()
+	appendValue<uint64_t>(buffer_, 0);
+	appendValue<uint64_t>(buffer_, std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+// operators are saved as nick!user@address (Channel::operatorKey()), the ones still waiting to rejoin
+// after the last restart included
+void StateSnapshot::add(const Channel& channel) {
+	std::vector<std::string> operators(channel.getPendingOperators().begin(), channel.getPendingOperators().end());
+	for (Client* op : channel.getOperators())
+		if (!Channel::operatorKey(*op).empty())
+			operators.push_back(Channel::operatorKey(*op));
+	appendString(channel.getName(), 2);
+	appendString(channel.getChannelKey(), 2);
+	appendString(channel.getTopic(), 2);
+	appendValue<uint8_t>(buffer_, flagsOf(channel));
+	appendValue<int32_t>(buffer_, channel.getUserLimit());
+	appendValue<uint16_t>(buffer_, std::min(operators.size(), static_cast<size_t>(UINT16_MAX)));
+	for (size_t i = 0; i < operators.size() && i < UINT16_MAX; i++)
+		appendString(operators[i], 1);
+	std::vector<MaskSnapshot> masks = masksOf(channel);
+	appendValue<uint16_t>(buffer_, std::min(masks.size(), static_cast<size_t>(UINT16_MAX)));
+	for (size_t i = 0; i < masks.size() && i < UINT16_MAX; i++) {
+		appendValue<uint8_t>(buffer_, masks[i].list);
+		appendString(masks[i].mask, 2);
+		appendString(masks[i].setBy, 1);
+		appendValue<int64_t>(buffer_, masks[i].setAt);
+	}
+	appendValue<int64_t>(buffer_, channel.getCreatedAt());
+	appendValue<int64_t>(buffer_, channel.getTopicTime());
+	count_++;
+}
+
+void StateSnapshot::commit(bool wait) {
+	std::memcpy(&buffer_[12], &count_, sizeof(count_));
+	appendValue<uint64_t>(buffer_, fnv1a(buffer_.data(), buffer_.size()));
+	if (writer_.joinable())
+		writer_.join();
+	if (wait) {
+		failed_ = !writeFile(buffer_);
+		buffer_.clear();
+		return ;
+	}
+	writing_ = true;
+	writer_ = std::thread([this, data = std::move(buffer_)]() {
+		failed_ = !writeFile(data);
+		writing_ = false;
+	});
+	buffer_.clear();
+}
+
+// temporary file, fsync, rename over the old snapshot, fsync the directory so the rename sticks
+bool StateSnapshot::writeFile(const std::string& data) {
+	std::string tmpPath = path_ + ".tmp";
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	size_t written = 0;
+	while (fd >= 0 && written < data.size()) {
+		ssize_t n = write(fd, data.data() + written, data.size() - written);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		written += n;
+	}
+	bool ok = fd >= 0 && written == data.size() && fsync(fd) == 0;
+	if (fd >= 0)
+		close(fd);
+	if (ok && rename(tmpPath.c_str(), path_.c_str()) == 0) {
+		size_t slash = path_.rfind('/');
+		std::string dir = slash == std::string::npos ? "." : path_.substr(0, slash + (slash == 0));
+		int dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dirFd >= 0) {
+			fsync(dirFd);
+			close(dirFd);
+		}
+		return (true);
+	}
+	logMessage(WARNING, "SNAPSHOT", "Writing " + path_ + " failed: " + strerror(errno));
+	unlink(tmpPath.c_str());
+	return (false);
+}
+
+uint8_t StateSnapshot::flagsOf(const Channel& channel) {
+	return ((channel.isKeyProtected() ? SNAPSHOT_FLAG_KEY : 0) | (channel.isInviteOnly() ? SNAPSHOT_FLAG_INVITE_ONLY : 0)
+		| (channel.isTopicOperatorOnly() ? SNAPSHOT_FLAG_TOPIC_OPS : 0));
+}
+
+std::vector<MaskSnapshot> StateSnapshot::masksOf(const Channel& channel) {
+	std::vector<MaskSnapshot> masks;
+	for (char list : {'b', 'e', 'I'})
+		for (const MaskEntry& entry : channel.getMaskList(list).getEntries())
+			masks.push_back(MaskSnapshot{list, entry.mask, entry.setBy, entry.setAt});
+	return (masks);
+}
+
+bool StateSnapshot::isWriting() const {
+	return (writing_);
+}
+
+size_t StateSnapshot::getCount() const {
+	return (count_);
+}
+
+const std::string& StateSnapshot::getPath() const {
+	return (path_);
+}
+
+// a snapshot from a newer server throws instead of returning false: starting without it would let the
+// next snapshot overwrite state this version cannot read
+bool StateSnapshot::load(const std::string& path, std::vector<ChannelSnapshot>& channels, std::string& error) {
+	channels.clear();
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		error = strerror(errno);
+		return (errno == ENOENT);
+	}
+	struct stat st;
+	std::string data;
+	if (fstat(fd, &st) == 0)
+		data.resize(st.st_size);
+	size_t done = 0;
+	while (done < data.size()) {
+		ssize_t n = read(fd, &data[done], data.size() - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	close(fd);
+	if (done != data.size() || data.size() < SNAPSHOT_HEADER_SIZE + sizeof(uint64_t)
+		|| data.compare(0, 8, SNAPSHOT_MAGIC, 8) != 0) {
+		error = "not a snapshot file";
+		return (false);
+	}
+
+	size_t offset = 8;
+	size_t end = data.size() - sizeof(uint64_t);
+	uint32_t version = 0, count = 0;
+	uint64_t reserved = 0, createdMs = 0, hash;
+	readValue(data, offset, end, version);
+	readValue(data, offset, end, count);
+	readValue(data, offset, end, reserved);
+	readValue(data, offset, end, createdMs);
+	std::memcpy(&hash, data.data() + end, sizeof(hash));
+	if (version > SNAPSHOT_VERSION)
+		throw std::runtime_error("snapshot " + path + " has version " + std::to_string(version)
+			+ ", this server reads up to " + std::to_string(SNAPSHOT_VERSION));
+	if (version == 0 || hash != fnv1a(data.data(), end)) {
+		error = version ? "checksum mismatch" : "invalid version";
+		return (false);
+	}
+
+	if (count > (end - offset) / (version >= 3 ? 31 : version >= 2 ? 15 : 13)) { // the smallest record: empty strings, flags, limit, no operators or masks, times
+		error = "channel count " + std::to_string(count) + " does not fit the file";
+		return (false);
+	}
+	channels.resize(count);
+	for (ChannelSnapshot& channel : channels) {
+		uint16_t operators;
+		if (!readString<uint16_t>(data, offset, end, channel.name) || !readString<uint16_t>(data, offset, end, channel.key)
+			|| !readString<uint16_t>(data, offset, end, channel.topic) || !readValue(data, offset, end, channel.flags)
+			|| !readValue(data, offset, end, channel.userLimit) || !readValue(data, offset, end, operators)) {
+			error = "truncated channel record";
+			return (false);
+		}
+		channel.operators.resize(operators);
+		for (std::string& op : channel.operators) {
+			if (!readString<uint8_t>(data, offset, end, op)) {
+				error = "truncated operator list";
+				return (false);
+			}
+		}
+		uint16_t masks = 0;
+		if (version >= 2 && !readValue(data, offset, end, masks)) {
+			error = "truncated channel record";
+			return (false);
+		}
+		channel.masks.resize(masks);
+		for (MaskSnapshot& mask : channel.masks) {
+			uint8_t list;
+			if (!readValue(data, offset, end, list) || !readString<uint16_t>(data, offset, end, mask.mask)
+				|| !readString<uint8_t>(data, offset, end, mask.setBy) || !readValue(data, offset, end, mask.setAt)) {
+				error = "truncated mask list";
+				return (false);
+			}
+			mask.list = list;
+		}
+		channel.createdAt = channel.topicTime = 0;
+		if (version >= 3 && (!readValue(data, offset, end, channel.createdAt) || !readValue(data, offset, end, channel.topicTime))) {
+			error = "truncated channel record";
+			return (false);
+		}
+		if (version < 3)
+			channel.operators.clear();
+	}
+	if (offset != end) {
+		error = "trailing data after " + std::to_string(count) + " channels";
+		return (false);
+	}
+	return (true);
+}
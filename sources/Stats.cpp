@@ -0,0 +1,86 @@
+#include "../includes/Stats.hpp"
+#include <algorithm>
+
+LatencyHistogram::LatencyHistogram() {
+	reset();
+}
+
+// values below 2 * SUB_COUNT get a bucket each, above that the top SUB_BITS + 1 bits pick the bucket
+int LatencyHistogram::bucketIndex(uint64_t value) {
+	if (value < 2 * SUB_COUNT)
+		return (static_cast<int>(value));
+	int msb = 63 - __builtin_clzll(value);
+	int shift = msb - SUB_BITS;
+	return ((shift + 1) * SUB_COUNT + static_cast<int>((value >> shift) - SUB_COUNT));
+}
+
+// middle of the value range covered by the bucket
+uint64_t LatencyHistogram::bucketValue(int index) {
+	if (index < 2 * SUB_COUNT)
+		return (index);
+	int shift = index / SUB_COUNT - 1;
+	uint64_t low = static_cast<uint64_t>(index % SUB_COUNT + SUB_COUNT) << shift;
+	return (low + ((1ULL << shift) >> 1));
+}
+
+void LatencyHistogram::record(uint64_t value) {
+	counts_[bucketIndex(value)]++;
+	total_++;
+	sum_ += value;
+	if (value > max_)
+		max_ = value;
+}
+
+void LatencyHistogram::reset() {
+	for (int i = 0; i < BUCKET_COUNT; i++)
+		counts_[i] = 0;
+	total_ = 0;
+	sum_ = 0;
+	max_ = 0;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+	if (!total_)
+		return (0);
+	uint64_t rank = static_cast<uint64_t>(p * total_);
+	if (rank >= total_)
+		rank = total_ - 1;
+	uint64_t seen = 0;
+	for (int i = 0; i < BUCKET_COUNT; i++) {
+		seen += counts_[i];
+		if (seen > rank)
+			return (std::min(bucketValue(i), max_));
+	}
+	return (max_);
+}
+
+uint64_t LatencyHistogram::getCount() const {
+	return (total_);
+}
+
+uint64_t LatencyHistogram::getMean() const {
+	return (total_ ? sum_ / total_ : 0);
+}
+
+uint64_t LatencyHistogram::getMax() const {
+	return (max_);
+}
+
+const char* statsPhaseName(StatsPhase phase) {
+	static const char* names[PHASE_COUNT] = { "parse", "dispatch", "broadcast", "flush" };
+	return (names[phase]);
+}
+
+void ServerStats::reset() {
+	throttleEvents = 0;
+	sendqEvictions = 0;
+	linesIn = 0;
+	bytesIn = 0;
+	bytesOut = 0;
+	resetAt = statsNow();
+	for (auto& entry : commandLatency)
+		entry.second.reset();
+	for (int i = 0; i < PHASE_COUNT; i++)
+		phaseLatency[i].reset();
+	errorNumerics.clear();
+}
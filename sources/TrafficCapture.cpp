@@ -0,0 +1,104 @@
+#include "../includes/TrafficCapture.hpp"
+#include "../includes/Server.hpp"
+
+// the file holds every PASS line, so only the owner may read it. resume is set after a hot upgrade: the
+// records go after the old process's ones without a second header, the time of the first one then
+// counts from this process's start and leaves out the short handover pause
+TrafficCapture::TrafficCapture(const std::string& path, bool resume, uint32_t nextConnection)
+	: path_(path), fd_(-1), startNs_(statsNow()), lastNs_(startNs_), nextConnection_(std::max<uint32_t>(nextConnection, 1)) {
+	fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | (resume ? O_APPEND : O_TRUNC) | O_CLOEXEC, 0600);
+	if (fd_ < 0)
+		throw std::runtime_error("capture " + path_ + ": " + strerror(errno));
+	if (resume && lseek(fd_, 0, SEEK_END) > 0)
+		return ;
+	uint64_t startMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	buffer_.reserve(CAPTURE_FLUSH_BYTES + MAX_MSG_LEN * 2);
+	buffer_.append(CAPTURE_MAGIC, 6);
+	buffer_ += static_cast<char>(CAPTURE_VERSION);
+	buffer_ += '\0';
+	buffer_.append(reinterpret_cast<const char*>(&startMs), sizeof(startMs));
+}
+
+TrafficCapture::~TrafficCapture() {
+	flush();
+	close(fd_);
+}
+
+void TrafficCapture::appendVarint(uint64_t value) {
+	while (value >= 0x80) {
+		buffer_ += static_cast<char>((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	buffer_ += static_cast<char>(value);
+}
+
+void TrafficCapture::appendRecord(CaptureRecordType type, int clientFd, const char* line, size_t len) {
+	auto it = connections_.find(clientFd);
+	if (it == connections_.end())
+		return ;
+	uint64_t now = statsNow();
+	buffer_ += static_cast<char>(type);
+	appendVarint(now - lastNs_);
+	appendVarint(it->second);
+	if (type == CAPTURE_LINE) {
+		appendVarint(len);
+		buffer_.append(line, len);
+	}
+	lastNs_ = now;
+	if (type == CAPTURE_CLOSE)
+		connections_.erase(it);
+	if (buffer_.size() >= CAPTURE_FLUSH_BYTES)
+		flush();
+}
+
+// a failed write drops the block rather than stalling the event loop, replay stops at the gap
+void TrafficCapture::flush() {
+	size_t written = 0;
+	while (written < buffer_.size()) {
+		ssize_t n = write(fd_, buffer_.data() + written, buffer_.size() - written);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			logMessage(WARNING, "CAPTURE", "Writing " + path_ + " failed: " + strerror(errno));
+			break;
+		}
+		written += n;
+	}
+	buffer_.clear();
+}
+
+void TrafficCapture::connectionOpened(int clientFd) {
+	connections_[clientFd] = nextConnection_++;
+	appendRecord(CAPTURE_OPEN, clientFd, nullptr, 0);
+}
+
+// a client taken over in a hot upgrade keeps the id its open record already carries, one the old
+// process did not capture is opened now
+void TrafficCapture::connectionResumed(int clientFd, uint32_t connection) {
+	if (!connection)
+		return (connectionOpened(clientFd));
+	connections_[clientFd] = connection;
+	nextConnection_ = std::max(nextConnection_, connection + 1);
+}
+
+void TrafficCapture::connectionClosed(int clientFd) {
+	appendRecord(CAPTURE_CLOSE, clientFd, nullptr, 0);
+}
+
+void TrafficCapture::lineReceived(int clientFd, const std::string& line) {
+	appendRecord(CAPTURE_LINE, clientFd, line.data(), line.size());
+}
+
+uint32_t TrafficCapture::getConnectionId(int clientFd) const {
+	auto it = connections_.find(clientFd);
+	return (it == connections_.end() ? 0 : it->second);
+}
+
+uint32_t TrafficCapture::getNextConnection() const {
+	return (nextConnection_);
+}
+
+const std::string& TrafficCapture::getPath() const {
+	return (path_);
+}
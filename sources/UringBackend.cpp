@@ -0,0 +1,398 @@
+#include "../includes/UringBackend.hpp"
+#include "../includes/Server.hpp"
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// liburing is not required, the three io_uring syscalls are called directly
+static int sysIoUringSetup(unsigned entries, struct io_uring_params* params) {
+	return (static_cast<int>(syscall(__NR_io_uring_setup, entries, params)));
+}
+
+static int sysIoUringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argSize) {
+	return (static_cast<int>(syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, arg, argSize)));
+}
+
+static int sysIoUringRegister(int ringFd, unsigned opcode, void* arg, unsigned nrArgs) {
+	return (static_cast<int>(syscall(__NR_io_uring_register, ringFd, opcode, arg, nrArgs)));
+}
+
+UringBackend::UringBackend()
+: ringFd_(-1), listenFd_(-1), wakeFd_(-1), sqEntries_(0), sqMask_(0), cqMask_(0), sqTail_(0), toSubmit_(0),
+ sqRing_(MAP_FAILED), sqRingSize_(0), cqRing_(MAP_FAILED), cqRingSize_(0), sqes_(nullptr), sqesSize_(0),
+ sqHead_(nullptr), sqTailPtr_(nullptr), sqArray_(nullptr), cqHead_(nullptr), cqTail_(nullptr), cqes_(nullptr),
+ bufRing_(nullptr), bufRingSize_(0), bufPool_(nullptr), bufTail_(0) {
+
+	struct io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+	params.cq_entries = URING_CQ_ENTRIES;
+
+	ringFd_ = sysIoUringSetup(URING_ENTRIES, &params);
+	if (ringFd_ < 0)
+		throw std::runtime_error("io_uring_setup: " + std::string(strerror(errno)));
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+		close(ringFd_);
+		throw std::runtime_error("kernel lacks IORING_FEAT_SINGLE_MMAP/EXT_ARG");
+	}
+
+	// with SINGLE_MMAP the submission and completion rings share one mapping
+	sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (cqRingSize_ > sqRingSize_)
+		sqRingSize_ = cqRingSize_;
+	sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+	sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+	void* sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+	if (sqRing_ == MAP_FAILED || sqes == MAP_FAILED) {
+		if (sqRing_ != MAP_FAILED)
+			munmap(sqRing_, sqRingSize_);
+		if (sqes != MAP_FAILED)
+			munmap(sqes, sqesSize_);
+		close(ringFd_);
+		throw std::runtime_error("io_uring mmap failed");
+	}
+	cqRing_ = sqRing_;
+	sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+	char* sq = static_cast<char*>(sqRing_);
+	sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	sqTailPtr_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	sqEntries_ = params.sq_entries;
+	sqTail_ = *sqTailPtr_;
+	char* cq = static_cast<char*>(cqRing_);
+	cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	// provided buffer ring: the kernel picks a free buffer for each multishot recv completion
+	bufRingSize_ = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+	void* bufRing = mmap(nullptr, bufRingSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (bufRing == MAP_FAILED) {
+		munmap(sqes_, sqesSize_);
+		munmap(sqRing_, sqRingSize_);
+		close(ringFd_);
+		throw std::runtime_error("io_uring buffer ring mmap failed");
+	}
+	bufRing_ = static_cast<struct io_uring_buf_ring*>(bufRing);
+	struct io_uring_buf_reg reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = reinterpret_cast<uint64_t>(bufRing_);
+	reg.ring_entries = URING_BUF_COUNT;
+	reg.bgid = URING_BUF_GROUP;
+	if (sysIoUringRegister(ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		std::string error = strerror(errno);
+		munmap(bufRing_, bufRingSize_);
+		munmap(sqes_, sqesSize_);
+		munmap(sqRing_, sqRingSize_);
+		close(ringFd_);
+		throw std::runtime_error("IORING_REGISTER_PBUF_RING: " + error);
+	}
+	bufPool_ = new char[URING_BUF_COUNT * BUF_SIZE];
+	for (uint16_t bid = 0; bid < URING_BUF_COUNT; bid++)
+		recycleBuffer(bid);
+	logMessage(INFO, "SERVER", "io_uring backend ready. SQ: [" + std::to_string(sqEntries_) + "] BUFFERS: ["
+		+ std::to_string(URING_BUF_COUNT) + "x" + std::to_string(BUF_SIZE) + "]");
+}
+
+UringBackend::~UringBackend() {
+	if (ringFd_ >= 0)
+		close(ringFd_); // cancels everything still in flight
+	munmap(bufRing_, bufRingSize_);
+	munmap(sqes_, sqesSize_);
+	munmap(sqRing_, sqRingSize_);
+	delete[] bufPool_;
+}
+
+const char* UringBackend::getName() const {
+	return ("uring");
+}
+
+uint64_t UringBackend::packUserData(Op op, int fd, uint16_t gen, uint8_t seq) {
+	return ((static_cast<uint64_t>(op) << 56) | (static_cast<uint64_t>(seq) << 48)
+		| (static_cast<uint64_t>(gen) << 32) | static_cast<uint32_t>(fd));
+}
+
+UringBackend::FdState& UringBackend::state(int fd) {
+	if (fd >= static_cast<int>(fds_.size()))
+		fds_.resize(fd + 1, FdState{0, 0, false, false, false, 0});
+	return (fds_[fd]);
+}
+
+struct io_uring_sqe* UringBackend::getSqe() {
+	unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+	if (sqTail_ - head >= sqEntries_) {
+		submit(0, 0);
+		head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+		if (sqTail_ - head >= sqEntries_)
+			throw std::runtime_error("io_uring submission queue full");
+	}
+	unsigned index = sqTail_ & sqMask_;
+	struct io_uring_sqe* sqe = &sqes_[index];
+	std::memset(sqe, 0, sizeof(*sqe));
+	sqArray_[index] = index;
+	sqTail_++;
+	toSubmit_++;
+	return (sqe);
+}
+
+// publishes the queued SQEs and optionally waits for minComplete completions
+int UringBackend::submit(unsigned minComplete, int timeoutMs) {
+	__atomic_store_n(sqTailPtr_, sqTail_, __ATOMIC_RELEASE);
+
+	unsigned flags = 0;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	void* argPtr = nullptr;
+	size_t argSize = 0;
+	if (minComplete) {
+		std::memset(&arg, 0, sizeof(arg));
+		if (timeoutMs >= 0) {
+			ts.tv_sec = timeoutMs / 1000;
+			ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+			arg.ts = reinterpret_cast<uint64_t>(&ts);
+		}
+		flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		argPtr = &arg;
+		argSize = sizeof(arg);
+	}
+	syscalls_++;
+	int ret = sysIoUringEnter(ringFd_, toSubmit_, minComplete, flags, argPtr, argSize);
+	toSubmit_ = sqTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+	if (ret < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		return (-1);
+	return (0);
+}
+
+// the entries overlay the ring header (tail lives in the reserved field of entry 0). Indexed from the
+// base because bufs[] of the uapi header is shifted by an empty struct when compiled as C++
+void UringBackend::recycleBuffer(uint16_t bid) {
+	struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(bufRing_) + (bufTail_ & (URING_BUF_COUNT - 1));
+	buf->addr = reinterpret_cast<uint64_t>(bufPool_ + static_cast<size_t>(bid) * BUF_SIZE);
+	buf->len = BUF_SIZE;
+	buf->bid = bid;
+	bufTail_++;
+	__atomic_store_n(&bufRing_->tail, bufTail_, __ATOMIC_RELEASE);
+}
+
+void UringBackend::armAccept() {
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listenFd_;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe->user_data = packUserData(OP_ACCEPT, listenFd_, 0, 0);
+}
+
+// multishot poll, one completion per write to the eventfd
+void UringBackend::armWakeup() {
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = wakeFd_;
+	sqe->poll32_events = POLLIN;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = packUserData(OP_WAKEUP, wakeFd_, 0, 0);
+}
+
+void UringBackend::armRecv(int fd) {
+	FdState& st = state(fd);
+	st.recvSeq++;
+	st.recvArmed = true;
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUF_GROUP;
+	sqe->user_data = packUserData(OP_RECV, fd, st.gen, st.recvSeq);
+}
+
+void UringBackend::cancel(uint64_t userData, int fd, uint32_t flags) {
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = userData;
+	sqe->cancel_flags = flags;
+	sqe->user_data = packUserData(OP_CANCEL, fd, 0, 0);
+}
+
+void UringBackend::addListener(int listenFd) {
+	listenFd_ = listenFd;
+	armAccept();
+}
+
+void UringBackend::addWakeup(int fd) {
+	wakeFd_ = fd;
+	armWakeup();
+}
+
+void UringBackend::addClient(int clientFd) {
+	if (!setNoDelay(clientFd))
+		logMessage(WARNING, "SERVER", "Failed to set TCP_NODELAY for ClientFD: " + std::to_string(clientFd));
+	FdState& st = state(clientFd);
+	st.gen++;
+	st.open = true;
+	st.readEnabled = true;
+	st.recvArmed = false;
+	armRecv(clientFd);
+}
+
+// sends still sitting in the submission queue go to the kernel first: they name the fd by number and
+// the client closes it next, after which the number may belong to another connection. The kernel
+// then has a reference on the socket and writes what it can before shutdown() completes the pending
+// multishot recv (EOF) and fails the sends still waiting. Their completions carry the old generation,
+// the ones of a client with sends pending are counted down in retired_ until its chunks can go
+void UringBackend::removeClient(int clientFd) {
+	if (toSubmit_)
+		submit(0, 0);
+	FdState& st = state(clientFd);
+	if (st.sendsPending)
+		retired_.push_back(Retired{clientFd, st.gen, st.sendsPending, {}});
+	st.open = false;
+	st.readEnabled = false;
+	st.recvArmed = false;
+	st.sendsPending = 0;
+	st.gen++;
+	syscalls_++;
+	shutdown(clientFd, SHUT_RDWR);
+}
+
+// the client is destroyed right after removeClient(), so its record is the last one for the fd
+void UringBackend::retireSendQueue(int clientFd, std::deque<std::string>&& queue) {
+	for (auto it = retired_.rbegin(); it != retired_.rend(); ++it) {
+		if (it->fd == clientFd) {
+			it->queue = std::move(queue);
+			return ;
+		}
+	}
+}
+
+void UringBackend::setReadEnabled(int clientFd, bool enabled) {
+	FdState& st = state(clientFd);
+	st.readEnabled = enabled;
+	if (!enabled && st.recvArmed) {
+		cancel(packUserData(OP_RECV, clientFd, st.gen, st.recvSeq), clientFd, 0);
+		st.recvArmed = false;
+	}
+	else if (enabled && st.open && !st.recvArmed)
+		armRecv(clientFd);
+}
+
+// one SEND per chunk, linked so they hit the socket in order. MSG_WAITALL makes a short send fail
+// the link instead of letting the next chunk overtake the remainder
+ssize_t UringBackend::send(int clientFd, const struct iovec* iov, int iovCount) {
+	FdState& st = state(clientFd);
+	if (!st.open)
+		return (-1);
+	unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+	if (sqEntries_ - (sqTail_ - head) < static_cast<unsigned>(iovCount))
+		submit(0, 0); // a chain must not be split across two submissions
+
+	uint64_t userData = packUserData(OP_SEND, clientFd, st.gen, 0);
+	st.sendsPending += iovCount;
+	for (int i = 0; i < iovCount; i++) {
+		struct io_uring_sqe* sqe = getSqe();
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = clientFd;
+		sqe->addr = reinterpret_cast<uint64_t>(iov[i].iov_base);
+		sqe->len = iov[i].iov_len;
+		sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+		if (i < iovCount - 1)
+			sqe->flags = IOSQE_IO_LINK;
+		sqe->user_data = userData;
+	}
+	return (SEND_PENDING);
+}
+
+void UringBackend::handleCompletion(IoHandler& handler, const struct io_uring_cqe& cqe) {
+	Op op = static_cast<Op>(cqe.user_data >> 56);
+	uint8_t seq = static_cast<uint8_t>(cqe.user_data >> 48);
+	uint16_t gen = static_cast<uint16_t>(cqe.user_data >> 32);
+	int fd = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+	bool more = cqe.flags & IORING_CQE_F_MORE;
+
+	if (op == OP_ACCEPT) {
+		if (cqe.res >= 0) {
+			struct sockaddr_in clientSocAddr;
+			socklen_t clientSocLen = sizeof(clientSocAddr);
+			std::memset(&clientSocAddr, 0, sizeof(clientSocAddr));
+			syscalls_++;
+			getpeername(cqe.res, (struct sockaddr*)&clientSocAddr, &clientSocLen);
+			handler.onAccept(cqe.res, clientSocAddr);
+		}
+		else if ((cqe.res != -EMFILE && cqe.res != -ENFILE) || dropPendingConnection(listenFd_))
+			logMessage(WARNING, "SERVER", "Client accept() failed: " + std::string(strerror(-cqe.res))
+				+ " (" + std::to_string(acceptDrops_) + " connections dropped for lack of descriptors)");
+		if (!more)
+			armAccept();
+	}
+	else if (op == OP_RECV) {
+		bool hasBuffer = cqe.flags & IORING_CQE_F_BUFFER;
+		uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+		FdState& st = state(fd);
+		bool current = st.open && st.gen == gen;
+		if (!more && current && st.recvSeq == seq)
+			st.recvArmed = false;
+		if (!current) {
+			if (hasBuffer)
+				recycleBuffer(bid);
+			return ;
+		}
+		if (cqe.res > 0 && hasBuffer) {
+			handler.onRead(fd, bufPool_ + static_cast<size_t>(bid) * BUF_SIZE, cqe.res);
+			recycleBuffer(bid);
+		}
+		else if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED)) {
+			if (hasBuffer)
+				recycleBuffer(bid);
+			return handler.onHangup(fd);
+		}
+		FdState& after = state(fd); // the handler may have closed or throttled the client
+		if (!more && after.open && after.gen == gen && after.readEnabled && !after.recvArmed)
+			armRecv(fd);
+	}
+	else if (op == OP_WAKEUP) {
+		uint64_t count;
+		syscalls_++;
+		if (read(wakeFd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+			logMessage(WARNING, "SERVER", "Reading wakeup fd failed: " + std::string(strerror(errno)));
+		if (!more)
+			armWakeup();
+	}
+	else if (op == OP_SEND) {
+		FdState& st = state(fd);
+		if (st.open && st.gen == gen) {
+			st.sendsPending--;
+			return handler.onSendComplete(fd, cqe.res);
+		}
+		for (auto it = retired_.begin(); it != retired_.end(); ++it) {
+			if (it->fd == fd && it->gen == gen) {
+				if (--it->sendsPending == 0)
+					retired_.erase(it); // the last chunk is done, its queue goes
+				return ;
+			}
+		}
+	}
+}
+
+int UringBackend::wait(IoHandler& handler, int timeoutMs) {
+	uint64_t waitStart = statsNow();
+	int submitted = submit(1, timeoutMs);
+	blockedNs_ += statsNow() - waitStart;
+	if (submitted < 0)
+		return (-1);
+
+	int handled = 0;
+	unsigned head = *cqHead_;
+	unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		struct io_uring_cqe cqe = cqes_[head & cqMask_];
+		head++;
+		__atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+		handleCompletion(handler, cqe);
+		handled++;
+	}
+	return (handled);
+}
@@ -1,20 +1,11 @@
 #include <iostream>
 #include <string>
 #include <cstdlib>
-#include <regex>
+#include <cctype>
+#include <climits>		// PATH_MAX
 #include "../includes/Server.hpp"
 #include "../includes/macros.hpp"
 
-bool isPasswordValid(const std::string &password)
-{
-	if (password.empty())
-		return (false);
-
-	std::regex passPattern("^[a-zA-Z0-9]{6,16}$");
-
-	return (std::regex_match(password, passPattern));
-}
-
 int portValidation(const std::string &_port)
 {
 	int port = std::stoi(static_cast<std::string>(_port));
@@ -24,17 +15,120 @@ int portValidation(const std::string &_port)
 	return (port);
 }
 
+// a byte count with an optional k, m or g suffix
+uint64_t parseByteSize(const std::string &option, const std::string &value)
+{
+	char *end;
+	unsigned long long size = std::strtoull(value.c_str(), &end, 10);
+	std::string suffix = end;
+	if (suffix == "k" || suffix == "K")
+		size <<= 10;
+	else if (suffix == "m" || suffix == "M")
+		size <<= 20;
+	else if (suffix == "g" || suffix == "G")
+		size <<= 30;
+	else if (!suffix.empty())
+		size = 0;
+	if (value.empty() || !std::isdigit(value[0]) || size == 0)
+		throw std::runtime_error("Invalid option: " + option + " (expected a size like 64m)");
+	return (size);
+}
+
+// optional settings after <port> <password>, given as --key=value
+void parseServerOption(ServerConfig &config, const std::string &option)
+{
+	size_t eq = option.find('=');
+	if (option.compare(0, 2, "--") != 0 || eq == std::string::npos)
+		throw std::runtime_error("Invalid option: " + option + " (expected --key=value)");
+
+	std::string key = option.substr(2, eq - 2);
+	std::string value = option.substr(eq + 1);
+	if (key == "io")
+		config.ioBackend = value;
+	else if (key == "shm")
+		config.shmName = value;
+	else if (key == "capture")
+		config.captureFile = value;
+	else if (key == "history-dir")
+		config.historyDir = value;
+	else if (key == "history-segment")
+		config.historySegmentBytes = parseByteSize(option, value);
+	else if (key == "history-retain")
+		config.historyRetainBytes = parseByteSize(option, value);
+	else if (key == "snapshot")
+		config.snapshotFile = value;
+	else if (key == "snapshot-interval") {
+		config.snapshotInterval = std::atoi(value.c_str());
+		if (config.snapshotInterval < 1 || value.find_first_not_of("0123456789") != std::string::npos)
+			throw std::runtime_error("Invalid option: " + option + " (expected seconds)");
+	}
+	else if (key == "upgrade-fd") {
+		config.upgradeFd = std::atoi(value.c_str());
+		if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+			throw std::runtime_error("Invalid option: " + option + " (expected a descriptor)");
+	}
+	else if (key == "server-name") {
+		if (value.empty() || value.find_first_of(" :!@,#") != std::string::npos)
+			throw std::runtime_error("Invalid option: " + option + " (expected a name without spaces, ':', '!', '@', ',' or '#')");
+		config.serverName = value;
+	}
+	else if (key == "link") {
+		size_t colon = value.find(':');
+		size_t at = value.find('@', colon == std::string::npos ? 0 : colon);
+		LinkBlock link;
+		link.name = value.substr(0, colon);
+		link.password = colon == std::string::npos ? "" : value.substr(colon + 1, at == std::string::npos ? std::string::npos : at - colon - 1);
+		if (at != std::string::npos) {
+			size_t portColon = value.rfind(':');
+			link.host = value.substr(at + 1, portColon > at ? portColon - at - 1 : std::string::npos);
+			link.port = portColon > at ? std::atoi(value.c_str() + portColon + 1) : 0;
+		}
+		if (link.name.find('.') == std::string::npos || link.password.empty() || link.password.find(' ') != std::string::npos
+			|| (at != std::string::npos && (link.host.empty() || link.port <= 0 || link.port > 65535)))
+			throw std::runtime_error("Invalid option: " + option + " (expected --link=server.name:password[@host:port])");
+		config.links.push_back(link);
+	}
+	else if (key == "ip-limit" || key == "ip-rate" || key == "shed-latency") {
+		if (value.empty() || value.size() > 9 || value.find_first_not_of("0123456789") != std::string::npos)
+			throw std::runtime_error("Invalid option: " + option + " (expected a number, 0 turns the limit off)");
+		uint32_t number = std::atoi(value.c_str());
+		(key == "ip-limit" ? config.ipLimit : key == "ip-rate" ? config.ipRate : config.shedLatencyMs) = number;
+	}
+	else if (key == "oper") {
+		size_t colon = value.find(':');
+		if (colon == std::string::npos || colon == 0 || colon == value.size() - 1)
+			throw std::runtime_error("Invalid option: " + option + " (expected --oper=name:password)");
+		config.operName = value.substr(0, colon);
+		config.operPassword = value.substr(colon + 1);
+	}
+	else
+		throw std::runtime_error("Unknown option: " + option);
+}
+
 int main(int argc, char **argv)
 {
 	try
 	{
-		if (argc != 3)
+		if (argc < 3)
 			throw std::runtime_error("Invalid number of arguments");
 
 		int port = portValidation(argv[1]);
-		if (!isPasswordValid(argv[2]))
+		if (!isValidPassword(argv[2]))
 			throw std::runtime_error("Invalid password");
-		Server ircserv(port, argv[2]);
+		ServerConfig config;
+		for (int i = 3; i < argc; i++)
+			parseServerOption(config, argv[i]);
+		// nicknames never have a dot, a line from a link tells users and servers apart by it
+		if (!config.links.empty() && config.serverName.find('.') == std::string::npos)
+			throw std::runtime_error("Linking needs a --server-name with a dot in it, like irc1.local");
+		// a hot upgrade runs whatever is at this path by then, with the same arguments
+		char binary[PATH_MAX];
+		ssize_t length = readlink("/proc/self/exe", binary, sizeof(binary) - 1);
+		config.upgradeBinary = length > 0 ? std::string(binary, length) : argv[0];
+		for (int i = 1; i < argc; i++)
+			if (std::string(argv[i]).compare(0, 13, "--upgrade-fd=") != 0)
+				config.upgradeArgs.push_back(argv[i]);
+		Server ircserv(port, argv[2], config);
 		ircserv.startServer();
 	}
 	catch(const std::exception& e)
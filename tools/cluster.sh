@@ -0,0 +1,57 @@
+#!/bin/sh
+# Linked servers under load: starts a hub and SERVERS-1 leaves that dial it on consecutive ports, waits
+# until every link finished its burst and drives them with ircbench --spread, so each channel has members
+# on every server and each PRIVMSG crosses the links. Compare with the same ircbench run against one
+# server to see what the hop costs in latency.
+#
+# usage: tools/cluster.sh [port] [ircbench options...]   (after `make ircbench`, SERVERS=n to change the count)
+
+PORT=${1:-6665}
+[ $# -gt 0 ] && shift
+PASS=benchpass
+SERVERS=${SERVERS:-3}
+BENCH_ARGS=${*:---clients=1500 --channels=150 --rate=3000 --duration=10}
+
+LOGS=$(mktemp -d)
+OUT=$(mktemp)
+LEAVES=""
+i=1
+while [ "$i" -lt "$SERVERS" ]; do
+	LEAVES="$LEAVES --link=leaf$i.local:linkpass"
+	i=$((i + 1))
+done
+./ircserv "$PORT" "$PASS" --server-name=hub.local $LEAVES > "$LOGS/hub.log" 2>&1 &
+PIDS=$!
+i=1
+while [ "$i" -lt "$SERVERS" ]; do
+	./ircserv $((PORT + i)) "$PASS" --server-name=leaf$i.local --link=hub.local:linkpass@127.0.0.1:"$PORT" \
+		> "$LOGS/leaf$i.log" 2>&1 &
+	PIDS="$PIDS $!"
+	i=$((i + 1))
+done
+
+WAITED=0
+while [ "$(cat "$LOGS"/leaf*.log 2>/dev/null | grep -c 'Burst to hub.local processed')" -lt $((SERVERS - 1)) ]; do
+	if [ "$WAITED" -ge 30 ]; then
+		echo "links did not come up, see $LOGS"
+		kill -INT $PIDS
+		exit 1
+	fi
+	sleep 1
+	WAITED=$((WAITED + 1))
+done
+
+./ircbench "$PORT" "$PASS" --spread="$SERVERS" $BENCH_ARGS > "$OUT" 2>&1
+DROPPED=$(grep -c 'Lost link' "$LOGS"/hub.log)
+kill -INT $PIDS
+
+cat "$OUT"
+echo "servers:          $SERVERS, linked after ${WAITED}s"
+echo "closed by server: $(grep -c 'server closed' "$OUT")"
+echo "nick collisions:  $(cat "$LOGS"/*.log | grep -c 'Nick collision on')"
+rm -f "$OUT"
+if [ "$DROPPED" -gt 0 ]; then
+	echo "$DROPPED links dropped during the run, see $LOGS"
+else
+	rm -rf "$LOGS"
+fi
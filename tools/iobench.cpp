@@ -0,0 +1,219 @@
+// I/O backend benchmark client: opens a large number of idle connections to the server and drives
+// PING round trips over a few registered ones, reporting throughput and latency percentiles.
+// Run through tools/iobench.sh, which also collects the syscall count the server logs on shutdown
+//
+// usage: iobench <port> <password> [--conns=N] [--active=N] [--pings=N]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+typedef std::chrono::steady_clock Clock;
+
+struct BenchConn {
+	int			fd;
+	bool		registered;
+	std::string	readBuf;
+	Clock::time_point	sentAt;		//-> when the outstanding PING went out
+};
+
+struct BenchConfig {
+	int		port = 6667;
+	std::string	password;
+	int		conns = 50000;			//-> total connections, idle ones only keep the server's fd tables busy
+	int		active = 100;			//-> registered connections that send PINGs
+	long	pings = 200000;			//-> PING round trips in the measured phase
+};
+
+static bool parseOption(BenchConfig& config, const std::string& arg) {
+	size_t eq = arg.find('=');
+	if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+		return (false);
+	std::string key = arg.substr(2, eq - 2);
+	long value = std::atol(arg.c_str() + eq + 1);
+	if (value <= 0)
+		return (false);
+	if (key == "conns")
+		config.conns = static_cast<int>(value);
+	else if (key == "active")
+		config.active = static_cast<int>(value);
+	else if (key == "pings")
+		config.pings = value;
+	else
+		return (false);
+	return (true);
+}
+
+// connections are spread over 127.0.0.1-64 as source addresses, a single one would run out of
+// ephemeral ports. The port is picked at connect() so ports in TIME_WAIT from earlier runs are reused
+static int openConnection(int port, int index) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return (-1);
+	int noPort = 1;
+	setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &noPort, sizeof(noPort));
+	struct sockaddr_in local;
+	std::memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK + index % 64);
+	if (bind(fd, (struct sockaddr*)&local, sizeof(local)) < 0) {
+		close(fd);
+		return (-1);
+	}
+	struct sockaddr_in server;
+	std::memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr*)&server, sizeof(server)) < 0) {
+		close(fd);
+		return (-1);
+	}
+	int noDelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	return (fd);
+}
+
+static bool sendAll(int fd, const std::string& msg) {
+	size_t sent = 0;
+	while (sent < msg.size()) {
+		ssize_t n = send(fd, msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+		if (n <= 0)
+			return (false);
+		sent += n;
+	}
+	return (true);
+}
+
+static double percentile(std::vector<double>& samples, double p) {
+	if (samples.empty())
+		return (0);
+	size_t index = static_cast<size_t>(p * (samples.size() - 1));
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+	return (samples[index]);
+}
+
+int main(int argc, char** argv) {
+	BenchConfig config;
+	if (argc < 3) {
+		std::cerr << "usage: " << argv[0] << " <port> <password> [--conns=N] [--active=N] [--pings=N]" << std::endl;
+		return (1);
+	}
+	config.port = std::atoi(argv[1]);
+	config.password = argv[2];
+	for (int i = 3; i < argc; i++) {
+		if (!parseOption(config, argv[i])) {
+			std::cerr << "invalid option: " << argv[i] << std::endl;
+			return (1);
+		}
+	}
+	config.active = std::min(config.active, config.conns);
+
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < static_cast<rlim_t>(config.conns + 64)) {
+		limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, config.conns + 64);
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	// connection phase: the idle connections never register and never send anything
+	std::vector<BenchConn> conns;
+	conns.reserve(config.conns);
+	Clock::time_point connectStart = Clock::now();
+	for (int i = 0; i < config.conns; i++) {
+		int fd = openConnection(config.port, i);
+		if (fd < 0) {
+			std::cerr << "connection " << i << " failed: " << strerror(errno) << std::endl;
+			break;
+		}
+		conns.push_back(BenchConn{fd, false, "", Clock::time_point()});
+	}
+	double connectSecs = std::chrono::duration<double>(Clock::now() - connectStart).count();
+	if (static_cast<int>(conns.size()) < config.active) {
+		std::cerr << "not enough connections for the active clients" << std::endl;
+		return (1);
+	}
+
+	int epollFd = epoll_create1(0);
+	for (int i = 0; i < config.active; i++) {
+		fcntl(conns[i].fd, F_SETFL, O_NONBLOCK);
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.u32 = i;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, conns[i].fd, &event);
+		std::string nick = "bench" + std::to_string(i);
+		sendAll(conns[i].fd, "PASS " + config.password + "\r\nNICK " + nick + "\r\nUSER " + nick + " 0 * :bench\r\n");
+	}
+
+	// measured phase: every active connection keeps exactly one PING outstanding
+	std::vector<double> latencies;
+	latencies.reserve(config.pings);
+	long sent = 0;
+	int registered = 0;
+	std::string serverName;
+	struct epoll_event events[256];
+	char buf[65536];
+	Clock::time_point start = Clock::now();
+	while (static_cast<long>(latencies.size()) < config.pings) {
+		int n = epoll_wait(epollFd, events, 256, 5000);
+		if (n <= 0) {
+			std::cerr << "server stopped answering" << std::endl;
+			break;
+		}
+		for (int e = 0; e < n; e++) {
+			BenchConn& conn = conns[events[e].data.u32];
+			ssize_t bytes = recv(conn.fd, buf, sizeof(buf), 0);
+			if (bytes <= 0) {
+				std::cerr << "server closed a connection" << std::endl;
+				return (1);
+			}
+			conn.readBuf.append(buf, bytes);
+			size_t pos;
+			bool ready = false;
+			while ((pos = conn.readBuf.find("\r\n")) != std::string::npos) {
+				std::string line = conn.readBuf.substr(0, pos);
+				conn.readBuf.erase(0, pos + 2);
+				if (!conn.registered && line.find(" 001 ") != std::string::npos) {
+					conn.registered = true;
+					serverName = line.substr(1, line.find(' ') - 1); // PING has to name the server
+					registered++;
+					ready = true;
+				}
+				else if (line.find("PONG") != std::string::npos) {
+					latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - conn.sentAt).count());
+					ready = true;
+				}
+			}
+			if (ready && sent < config.pings) {
+				conn.sentAt = Clock::now();
+				sendAll(conn.fd, "PING " + serverName + "\r\n");
+				sent++;
+			}
+		}
+	}
+	double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::cout << "connections: " << conns.size() << " (opened in " << connectSecs << " s)" << std::endl;
+	std::cout << "active:      " << registered << std::endl;
+	std::cout << "messages:    " << latencies.size() << std::endl;
+	std::cout << "msg/s:       " << static_cast<long>(latencies.size() / secs) << std::endl;
+	std::cout << "p50 us:      " << percentile(latencies, 0.50) << std::endl;
+	std::cout << "p99 us:      " << percentile(latencies, 0.99) << std::endl;
+	std::cout << "max us:      " << percentile(latencies, 1.0) << std::endl;
+
+	for (size_t i = 0; i < conns.size(); i++)
+		close(conns[i].fd);
+	close(epollFd);
+	return (0);
+}
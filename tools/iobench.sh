@@ -0,0 +1,34 @@
+#!/bin/sh
+# Compares the epoll and io_uring backends: starts the server with each one, runs iobench against it
+# and divides the syscall count the server logs on shutdown by the number of PING round trips.
+# The count includes the connection phase, so keep --pings large compared to --conns.
+#
+# usage: tools/iobench.sh [port] [iobench options...]   (after `make iobench`)
+
+PORT=${1:-6667}
+[ $# -gt 0 ] && shift
+PASS=benchpass
+BENCH_ARGS=${*:---conns=50000 --active=100 --pings=200000}
+
+ulimit -n 120000 2>/dev/null || echo "warning: could not raise the fd limit, large --conns will fail"
+
+for IO in epoll uring; do
+	LOG=$(mktemp)
+	OUT=$(mktemp)
+	./ircserv "$PORT" "$PASS" --io="$IO" > "$LOG" 2>&1 &
+	SERVER=$!
+	sleep 1
+	./iobench "$PORT" "$PASS" $BENCH_ARGS > "$OUT"
+	kill -INT "$SERVER"
+	wait "$SERVER" 2>/dev/null
+
+	echo "== backend: $(grep -o 'IO: \[[a-z]*\]' "$LOG")"
+	cat "$OUT"
+	SYSCALLS=$(grep -o 'syscalls: [0-9]*' "$LOG" | grep -o '[0-9]*$')
+	MESSAGES=$(grep '^messages:' "$OUT" | grep -o '[0-9]*$')
+	if [ -n "$SYSCALLS" ] && [ -n "$MESSAGES" ] && [ "$MESSAGES" -gt 0 ]; then
+		echo "syscalls:    $SYSCALLS"
+		echo "syscalls/msg: $(awk "BEGIN { printf \"%.3f\", $SYSCALLS / $MESSAGES }")"
+	fi
+	rm -f "$LOG" "$OUT"
+done
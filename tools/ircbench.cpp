@@ -0,0 +1,582 @@
+// End-to-end load generator: registers a population of clients over loopback, spreads them over
+// channels with a configurable size distribution and then drives PRIVMSG, JOIN/PART churn and NICK
+// changes at a fixed rate. Every PRIVMSG carries its send time, so the receiving side measures
+// fanout delivery latency (sender -> server -> every other member). Clients are split over worker
+// threads that each run their own epoll loop, so the generator is rarely the bottleneck. With --spread
+// the clients connect round robin to that many linked servers on consecutive ports (tools/cluster.sh)
+//
+// usage: ircbench <port> <password> [--clients=N] [--channels=N] [--maxsize=N] [--dist=zipf|uniform]
+//                 [--rate=N] [--duration=S] [--threads=N] [--churn=PCT] [--nicks=PCT] [--payload=B] [--pid=P]
+//                 [--spread=N]
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../includes/SharedStats.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+#define SERVER_CHAN_LIMIT 100		// default +l of a channel, larger channels would reject joins
+#define SETUP_TIMEOUT_SEC 30
+#define DRAIN_QUIET_MS 500			// the measured phase ends once no message arrived for this long
+
+struct BenchConfig {
+	int			port = 6667;
+	std::string	password;
+	int			clients = 1000;
+	int			channels = 100;
+	int			maxSize = 100;		//-> members of the largest channel
+	bool		zipf = true;		//-> channel k gets maxSize/k members, otherwise all get maxSize
+	long		rate = 5000;		//-> operations per second over all threads
+	int			duration = 10;		//-> seconds of the measured phase
+	int			threads = 4;
+	int			churn = 5;			//-> percent of operations that PART and re-JOIN a channel
+	int			nicks = 1;			//-> percent of operations that change the nickname
+	int			payload = 64;		//-> PRIVMSG text bytes besides the timestamp
+	long		pid = 0;			//-> server pid for RSS, read from the stats segment when unset
+	int			spread = 1;			//-> servers on port, port + 1, ..., client i connects to port + i % spread
+};
+
+struct BenchClient {
+	int					fd;
+	int					index;
+	int					nickGeneration;
+	bool				registered;
+	int					pendingJoins;	//-> JOINs not yet answered with 366
+	std::vector<int>	channels;
+	std::string			readBuf;
+	std::string			writeBuf;		//-> what the socket did not take yet
+	bool				wantWrite;
+};
+
+struct WorkerResult {
+	std::vector<double>	latencies;		//-> microseconds, one per delivered PRIVMSG
+	long				privmsgs = 0;
+	long				churns = 0;
+	long				nickChanges = 0;
+	long				linesIn = 0;
+	long				errors = 0;		//-> numerics of 400 and above
+};
+
+// std::barrier is C++20
+class Barrier {
+	private:
+		std::mutex				mutex_;
+		std::condition_variable	cv_;
+		int						count_;
+		int						waiting_;
+		int						generation_;
+
+	public:
+		explicit Barrier(int count) : count_(count), waiting_(0), generation_(0) {}
+		void wait() {
+			std::unique_lock<std::mutex> lock(mutex_);
+			int generation = generation_;
+			if (++waiting_ == count_) {
+				waiting_ = 0;
+				generation_++;
+				cv_.notify_all();
+				return ;
+			}
+			cv_.wait(lock, [&] { return generation != generation_; });
+		}
+};
+
+static uint64_t nowNs() {
+	return (std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count());
+}
+
+static std::string channelName(int channel) {
+	return ("#bench" + std::to_string(channel));
+}
+
+// nicks are limited to 9 characters, a letter plus the index in base 36 fits 36^8 clients.
+// The leading letter flips on every NICK change so the new one is never taken
+static std::string nickName(int index, int generation) {
+	static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+	std::string nick;
+	do {
+		nick.insert(nick.begin(), digits[index % 36]);
+		index /= 36;
+	} while (index);
+	return ((generation % 2 ? "m" : "b") + nick);
+}
+
+static int openConnection(int port, int index) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return (-1);
+	int noPort = 1;
+	setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &noPort, sizeof(noPort));
+	struct sockaddr_in local;
+	std::memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK + index % 64);
+	struct sockaddr_in server;
+	std::memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr*)&local, sizeof(local)) < 0
+		|| connect(fd, (struct sockaddr*)&server, sizeof(server)) < 0) {
+		close(fd);
+		return (-1);
+	}
+	int noDelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return (fd);
+}
+
+class Worker {
+	private:
+		const BenchConfig&			config_;
+		std::vector<BenchClient>	clients_;
+		int							epollFd_;
+		std::mt19937				rng_;
+		WorkerResult				result_;
+		uint64_t					lastPrivmsgAt_;
+		bool						failed_;
+
+		void watch(BenchClient& client, bool wantWrite) {
+			struct epoll_event event;
+			event.events = wantWrite ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+			event.data.ptr = &client;
+			epoll_ctl(epollFd_, EPOLL_CTL_MOD, client.fd, &event);
+			client.wantWrite = wantWrite;
+		}
+
+		void flush(BenchClient& client) {
+			while (!client.writeBuf.empty()) {
+				ssize_t sent = send(client.fd, client.writeBuf.data(), client.writeBuf.size(), MSG_NOSIGNAL);
+				if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+					break;
+				if (sent <= 0) {
+					failed_ = true;
+					return ;
+				}
+				client.writeBuf.erase(0, sent);
+			}
+			if (client.writeBuf.empty() == client.wantWrite)
+				watch(client, !client.writeBuf.empty());
+		}
+
+		void queue(BenchClient& client, const std::string& lines) {
+			client.writeBuf += lines;
+			if (!client.wantWrite)
+				flush(client);
+		}
+
+		void handleLine(BenchClient& client, const std::string& line, uint64_t receivedAt) {
+			result_.linesIn++;
+			size_t command = line.find(' ');
+			if (command == std::string::npos)
+				return ;
+			if (line.compare(command + 1, 8, "PRIVMSG ") == 0) {
+				// channel messages are relayed without the ':' before the text
+				size_t text = line.find(' ', command + 9);
+				if (text == std::string::npos)
+					return ;
+				text += (line.compare(text, 2, " :") == 0) ? 2 : 1;
+				uint64_t sentAt = std::strtoull(line.c_str() + text, nullptr, 10);
+				if (sentAt && sentAt <= receivedAt)
+					result_.latencies.push_back((receivedAt - sentAt) / 1000.0);
+				lastPrivmsgAt_ = receivedAt;
+			}
+			else if (line.compare(command + 1, 4, "001 ") == 0)
+				client.registered = true;
+			else if (line.compare(command + 1, 4, "366 ") == 0)
+				client.pendingJoins--;
+			else if (line.compare(0, 5, "PING ") == 0)
+				queue(client, "PONG " + line.substr(5) + "\r\n");
+			else if (line.size() > command + 4 && line[command + 1] >= '4' && line[command + 1] <= '5'
+				&& std::isdigit(static_cast<unsigned char>(line[command + 2])) && line[command + 4] == ' ')
+				result_.errors++;
+		}
+
+		void receive(BenchClient& client, uint64_t receivedAt) {
+			char buf[65536];
+			for (;;) {
+				ssize_t bytes = recv(client.fd, buf, sizeof(buf), 0);
+				if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+					break;
+				if (bytes <= 0) {
+					std::cerr << "ircbench: server closed " << nickName(client.index, client.nickGeneration) << std::endl;
+					failed_ = true;
+					return ;
+				}
+				client.readBuf.append(buf, bytes);
+			}
+			size_t start = 0;
+			size_t pos;
+			while ((pos = client.readBuf.find("\r\n", start)) != std::string::npos) {
+				handleLine(client, client.readBuf.substr(start, pos - start), receivedAt);
+				start = pos + 2;
+			}
+			client.readBuf.erase(0, start);
+		}
+
+		// picks a client that has at least one channel, most of them do
+		BenchClient* pickMember() {
+			for (int attempt = 0; attempt < 16; attempt++) {
+				BenchClient& client = clients_[rng_() % clients_.size()];
+				if (!client.channels.empty() && client.pendingJoins <= 0)
+					return (&client);
+			}
+			return (nullptr);
+		}
+
+		void runOperation(const std::string& padding) {
+			BenchClient* client = pickMember();
+			if (!client)
+				return ;
+			int roll = rng_() % 100;
+			int channel = client->channels[rng_() % client->channels.size()];
+			if (roll < config_.churn) {
+				client->pendingJoins++;
+				queue(*client, "PART " + channelName(channel) + " :churn\r\nJOIN " + channelName(channel) + "\r\n");
+				result_.churns++;
+			}
+			else if (roll < config_.churn + config_.nicks) {
+				client->nickGeneration++;
+				queue(*client, "NICK " + nickName(client->index, client->nickGeneration) + "\r\n");
+				result_.nickChanges++;
+			}
+			else {
+				queue(*client, "PRIVMSG " + channelName(channel) + " :" + std::to_string(nowNs()) + padding + "\r\n");
+				result_.privmsgs++;
+			}
+		}
+
+	public:
+		explicit Worker(const BenchConfig& config, unsigned seed)
+			: config_(config), epollFd_(epoll_create1(0)), rng_(seed), lastPrivmsgAt_(0), failed_(false) {}
+
+		~Worker() {
+			for (BenchClient& client : clients_)
+				close(client.fd);
+			close(epollFd_);
+		}
+
+		// all clients are added before any is watched, epoll keeps pointers into clients_
+		void addClient(int index, const std::vector<int>& channels) {
+			clients_.push_back(BenchClient{-1, index, 0, false, 0, channels, "", "", false});
+		}
+
+		bool connectAll() {
+			for (BenchClient& client : clients_) {
+				client.fd = openConnection(config_.port + client.index % config_.spread, client.index);
+				if (client.fd < 0) {
+					std::cerr << "ircbench: connection " << client.index << " failed: " << strerror(errno) << std::endl;
+					return (false);
+				}
+				struct epoll_event event;
+				event.events = EPOLLIN;
+				event.data.ptr = &client;
+				epoll_ctl(epollFd_, EPOLL_CTL_ADD, client.fd, &event);
+				std::string nick = nickName(client.index, 0);
+				queue(client, "PASS " + config_.password + "\r\nNICK " + nick + "\r\nUSER " + nick + " 0 * :ircbench\r\n");
+			}
+			return (!failed_);
+		}
+
+		void joinAll() {
+			for (BenchClient& client : clients_) {
+				for (int channel : client.channels) {
+					queue(client, "JOIN " + channelName(channel) + "\r\n");
+					client.pendingJoins++;
+				}
+			}
+		}
+
+		void poll(int timeoutMs) {
+			struct epoll_event events[256];
+			int n = epoll_wait(epollFd_, events, 256, timeoutMs);
+			uint64_t receivedAt = nowNs();
+			for (int i = 0; i < n; i++) {
+				BenchClient& client = *static_cast<BenchClient*>(events[i].data.ptr);
+				if (events[i].events & EPOLLOUT)
+					flush(client);
+				if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+					receive(client, receivedAt);
+			}
+		}
+
+		// polls until every client is registered (or every JOIN answered), false on timeout
+		bool settle(bool joins) {
+			Clock::time_point deadline = Clock::now() + std::chrono::seconds(SETUP_TIMEOUT_SEC);
+			for (;;) {
+				bool done = true;
+				for (const BenchClient& client : clients_)
+					if (joins ? client.pendingJoins > 0 : !client.registered)
+						done = false;
+				if (done)
+					return (true);
+				if (failed_ || Clock::now() > deadline)
+					return (false);
+				poll(10);
+			}
+		}
+
+		// open loop: operations are due at a fixed rate whether or not the server keeps up, so a slow
+		// server shows up as latency rather than as a lower offered load
+		void drive(long rate, uint64_t startNs, uint64_t endNs) {
+			std::string padding(config_.payload > 0 ? config_.payload + 1 : 0, 'x');
+			if (!padding.empty())
+				padding[0] = ' ';
+			long done = 0;
+			uint64_t now;
+			while ((now = nowNs()) < endNs && !failed_) {
+				long due = static_cast<long>((now - startNs) / 1e9 * rate);
+				for (; done < due; done++)
+					runOperation(padding);
+				poll(1);
+			}
+			lastPrivmsgAt_ = nowNs();
+			while (!failed_ && nowNs() - lastPrivmsgAt_ < DRAIN_QUIET_MS * 1000000ULL)
+				poll(10);
+		}
+
+		bool failed() const {
+			return (failed_);
+		}
+
+		WorkerResult& result() {
+			return (result_);
+		}
+};
+
+static bool parseOption(BenchConfig& config, const std::string& arg) {
+	size_t eq = arg.find('=');
+	if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+		return (false);
+	std::string key = arg.substr(2, eq - 2);
+	std::string value = arg.substr(eq + 1);
+	if (key == "dist") {
+		config.zipf = (value == "zipf");
+		return (value == "zipf" || value == "uniform");
+	}
+	long number = std::atol(value.c_str());
+	if (number < 0 || (number == 0 && key != "churn" && key != "nicks" && key != "payload"))
+		return (false);
+	if (key == "clients")
+		config.clients = number;
+	else if (key == "channels")
+		config.channels = number;
+	else if (key == "maxsize")
+		config.maxSize = number;
+	else if (key == "rate")
+		config.rate = number;
+	else if (key == "duration")
+		config.duration = number;
+	else if (key == "threads")
+		config.threads = number;
+	else if (key == "churn")
+		config.churn = number;
+	else if (key == "nicks")
+		config.nicks = number;
+	else if (key == "payload")
+		config.payload = number;
+	else if (key == "pid")
+		config.pid = number;
+	else if (key == "spread")
+		config.spread = number;
+	else
+		return (false);
+	return (true);
+}
+
+// channel k (from 1) has maxSize/k members with zipf, so a few big channels dominate the fanout the
+// way they do on real networks. Members are a run of consecutive clients from a random offset
+static std::vector<std::vector<int>> assignChannels(const BenchConfig& config, std::mt19937& rng) {
+	std::vector<std::vector<int>> memberships(config.clients);
+	for (int channel = 0; channel < config.channels; channel++) {
+		int size = config.zipf ? std::max(2, config.maxSize / (channel + 1)) : config.maxSize;
+		size = std::min(size, config.clients);
+		int offset = rng() % config.clients;
+		for (int i = 0; i < size; i++)
+			memberships[(offset + i) % config.clients].push_back(channel);
+	}
+	return (memberships);
+}
+
+static long findServerPid(const BenchConfig& config) {
+	if (config.pid)
+		return (config.pid);
+	std::string name = "/ircserv-" + std::to_string(config.port);
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if (fd < 0)
+		return (0);
+	void* mapped = mmap(nullptr, sizeof(SharedStatsBlock), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+		return (0);
+	SharedStatsValues values;
+	long pid = 0;
+	for (int attempt = 0; attempt < 1000 && !pid; attempt++)
+		if (readSharedStats(static_cast<const SharedStatsBlock*>(mapped), values))
+			pid = values.pid;
+	munmap(mapped, sizeof(SharedStatsBlock));
+	return (pid);
+}
+
+// VmRSS or VmHWM of the server in kB, 0 when unknown
+static long readServerMemory(long pid, const std::string& field) {
+	if (!pid)
+		return (0);
+	std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+	std::string line;
+	while (std::getline(status, line))
+		if (line.compare(0, field.size() + 1, field + ":") == 0)
+			return (std::atol(line.c_str() + field.size() + 1));
+	return (0);
+}
+
+static double percentile(std::vector<double>& samples, double p) {
+	if (samples.empty())
+		return (0);
+	size_t index = static_cast<size_t>(p * (samples.size() - 1));
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+	return (samples[index]);
+}
+
+int main(int argc, char** argv) {
+	BenchConfig config;
+	if (argc < 3) {
+		std::cerr << "usage: " << argv[0] << " <port> <password> [--clients=N] [--channels=N] [--maxsize=N]"
+			" [--dist=zipf|uniform] [--rate=N] [--duration=S] [--threads=N] [--churn=PCT] [--nicks=PCT]"
+			" [--payload=B] [--pid=P] [--spread=N]" << std::endl;
+		return (1);
+	}
+	config.port = std::atoi(argv[1]);
+	config.password = argv[2];
+	for (int i = 3; i < argc; i++) {
+		if (!parseOption(config, argv[i])) {
+			std::cerr << "invalid option: " << argv[i] << std::endl;
+			return (1);
+		}
+	}
+	config.maxSize = std::min(config.maxSize, SERVER_CHAN_LIMIT);
+	config.threads = std::min(config.threads, config.clients);
+
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < static_cast<rlim_t>(config.clients + 64)) {
+		limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, config.clients + 64);
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	std::mt19937 rng(42); // fixed seed, runs are comparable
+	std::vector<std::vector<int>> memberships = assignChannels(config, rng);
+	std::vector<Worker*> workers;
+	long memberCount = 0;
+	for (int t = 0; t < config.threads; t++)
+		workers.push_back(new Worker(config, 1000 + t));
+	for (int i = 0; i < config.clients; i++) {
+		workers[i % config.threads]->addClient(i, memberships[i]);
+		memberCount += memberships[i].size();
+	}
+
+	long pid = findServerPid(config);
+	long rssBefore = readServerMemory(pid, "VmRSS");
+	Barrier barrier(config.threads + 1);
+	std::atomic<bool> setupFailed(false);
+	uint64_t startNs = 0;
+	uint64_t endNs = 0;
+	std::vector<std::thread> threads;
+	for (Worker* worker : workers) {
+		threads.emplace_back([&, worker] {
+			if (!worker->connectAll() || !worker->settle(false))
+				setupFailed = true;
+			barrier.wait();
+			if (!setupFailed) {
+				worker->joinAll();
+				if (!worker->settle(true))
+					setupFailed = true;
+			}
+			barrier.wait(); // main sets the measured window
+			barrier.wait();
+			if (!setupFailed)
+				worker->drive(config.rate / config.threads, startNs, endNs);
+		});
+	}
+
+	Clock::time_point setupStart = Clock::now();
+	barrier.wait();
+	double registerSecs = std::chrono::duration<double>(Clock::now() - setupStart).count();
+	barrier.wait();
+	double joinSecs = std::chrono::duration<double>(Clock::now() - setupStart).count() - registerSecs;
+	long rssSetup = readServerMemory(pid, "VmRSS");
+	startNs = nowNs();
+	endNs = startNs + config.duration * 1000000000ULL;
+	barrier.wait();
+	for (std::thread& thread : threads)
+		thread.join();
+	if (setupFailed) {
+		std::cerr << "ircbench: setup did not complete, is ircserv running on port " << config.port << "?" << std::endl;
+		return (1);
+	}
+	double secs = config.duration;
+	long rssAfter = readServerMemory(pid, "VmRSS");
+	long rssPeak = readServerMemory(pid, "VmHWM");
+
+	WorkerResult total;
+	bool failed = false;
+	for (Worker* worker : workers) {
+		WorkerResult& result = worker->result();
+		total.latencies.insert(total.latencies.end(), result.latencies.begin(), result.latencies.end());
+		total.privmsgs += result.privmsgs;
+		total.churns += result.churns;
+		total.nickChanges += result.nickChanges;
+		total.linesIn += result.linesIn;
+		total.errors += result.errors;
+		failed = failed || worker->failed();
+		delete worker;
+	}
+
+	long operations = total.privmsgs + total.churns + total.nickChanges;
+	std::cout << std::fixed << std::setprecision(1)
+		<< "clients:        " << config.clients << " over " << config.threads << " threads\n"
+		<< "channels:       " << config.channels << " (" << (config.zipf ? "zipf" : "uniform")
+			<< ", largest " << std::min(config.maxSize, config.clients) << ", "
+			<< memberCount << " memberships)\n"
+		<< "setup:          register " << registerSecs << " s, join " << joinSecs << " s\n"
+		<< "operations:     " << operations << " (" << total.privmsgs << " privmsg, " << total.churns
+			<< " part/join, " << total.nickChanges << " nick)\n"
+		<< "ops/s:          " << static_cast<long>(operations / secs) << " (target " << config.rate << ")\n"
+		<< "deliveries:     " << total.latencies.size() << " ("
+			<< (total.privmsgs ? static_cast<double>(total.latencies.size()) / total.privmsgs : 0) << " per privmsg)\n"
+		<< "deliveries/s:   " << static_cast<long>(total.latencies.size() / secs) << "\n"
+		<< "lines in/s:     " << static_cast<long>(total.linesIn / secs) << "\n"
+		<< "error replies:  " << total.errors << "\n"
+		<< "fanout p50 us:  " << percentile(total.latencies, 0.50) << "\n"
+		<< "fanout p99 us:  " << percentile(total.latencies, 0.99) << "\n"
+		<< "fanout p999 us: " << percentile(total.latencies, 0.999) << "\n"
+		<< "fanout max us:  " << percentile(total.latencies, 1.0) << "\n";
+	if (pid)
+		std::cout << "server rss kB:  " << rssBefore << " idle, " << rssSetup << " after setup, "
+			<< rssAfter << " after run, " << rssPeak << " peak" << std::endl;
+	else
+		std::cout << "server rss kB:  unknown (pass --pid or run ircserv with its stats segment)" << std::endl;
+	return (failed ? 1 : 0);
+}
@@ -0,0 +1,398 @@
+// Replays a capture written by `ircserv --capture=file` against a local server: one connection per
+// captured connection, opened, fed and closed in the captured order. With the default pacing every
+// record is sent at its original offset (scaled by --speed), --fast sends everything as quickly as
+// the server takes it: records go out in batches and every batch waits for the replies to the one
+// before, so one connection's lines cannot overtake the JOINs of another by more than a batch. Latency comes from probes: after every --probe lines the connection that sent
+// the last one adds a PING, in-order replies make its PONG time an upper bound for handling the lines
+// before it. A last probe on every connection at the end makes the replay time include the backlog
+//
+// usage: ircreplay <capture> <port> <password> [--fast] [--speed=X] [--probe=N]
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../includes/TrafficCapture.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+#define REPLAY_BATCH 1024			// records between two ordering barriers with --fast
+#define REPLAY_BARRIER_MS 1000		// a barrier gives up on connections that stay silent this long
+#define REPLAY_DRAIN_SEC 5			// how long to wait for outstanding replies at the end
+#define REPLAY_QUIET_MS 100			// then read until nothing arrived for this long
+
+struct ReplayConfig {
+	std::string	capture;
+	int			port = 6667;
+	std::string	password;
+	bool		fast = false;
+	double		speed = 1.0;
+	int			probeEvery = 50;
+};
+
+struct ReplayConn {
+	int					fd;
+	bool				registered;
+	bool				closing;		//-> captured connection ended, close once the output is written
+	bool				awaitingWelcome;	//-> sent USER, no 001 or error yet
+	std::string			readBuf;
+	std::string			writeBuf;
+	bool				wantWrite;
+	std::deque<uint64_t>	pongs;		//-> per PING sent: probe send time, 0 for PINGs from the capture
+};
+
+struct ReplayTotals {
+	long				connections = 0;
+	long				lines = 0;
+	long				bytes = 0;
+	long				linesIn = 0;
+	long				closedByServer = 0;
+	std::vector<double>	latencies;		//-> microseconds per answered probe
+};
+
+static uint64_t nowNs() {
+	return (std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count());
+}
+
+static int openConnection(int port, uint32_t index) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return (-1);
+	int noPort = 1;
+	setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &noPort, sizeof(noPort));
+	struct sockaddr_in local;
+	std::memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK + index % 64);
+	struct sockaddr_in server;
+	std::memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr*)&local, sizeof(local)) < 0
+		|| connect(fd, (struct sockaddr*)&server, sizeof(server)) < 0) {
+		close(fd);
+		return (-1);
+	}
+	int noDelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return (fd);
+}
+
+static bool loadCapture(const std::string& path, std::vector<CaptureRecord>& records) {
+	std::ifstream file(path, std::ios::binary);
+	std::stringstream contents;
+	contents << file.rdbuf();
+	std::string data = contents.str();
+	if (!file || data.size() < CAPTURE_HEADER_SIZE || data.compare(0, 6, CAPTURE_MAGIC) != 0
+		|| data[6] != CAPTURE_VERSION) {
+		std::cerr << "ircreplay: " << path << " is not a version " << CAPTURE_VERSION << " capture" << std::endl;
+		return (false);
+	}
+	size_t offset = CAPTURE_HEADER_SIZE;
+	CaptureRecord record;
+	record.timeNs = 0;
+	while (readCaptureRecord(data, offset, record))
+		records.push_back(record);
+	if (offset < data.size())
+		std::cerr << "ircreplay: capture truncated after " << records.size() << " records" << std::endl;
+	return (true);
+}
+
+class Replayer {
+	private:
+		const ReplayConfig&				config_;
+		int								epollFd_;
+		std::map<uint32_t, ReplayConn>	conns_;		//-> by capture connection id, std::map keeps epoll's pointers valid
+		std::string						serverName_;
+		ReplayTotals					totals_;
+		int								linesSinceProbe_;
+		std::vector<ReplayConn*>		touched_;	//-> connections that sent lines since the last barrier
+
+		void watch(ReplayConn& conn, bool wantWrite) {
+			struct epoll_event event;
+			event.events = wantWrite ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+			event.data.ptr = &conn;
+			epoll_ctl(epollFd_, EPOLL_CTL_MOD, conn.fd, &event);
+			conn.wantWrite = wantWrite;
+		}
+
+		void closeConn(ReplayConn& conn) {
+			close(conn.fd); // also leaves the epoll set
+			conn.fd = -1;
+			conn.pongs.clear();
+		}
+
+		void flush(ReplayConn& conn) {
+			while (!conn.writeBuf.empty()) {
+				ssize_t sent = send(conn.fd, conn.writeBuf.data(), conn.writeBuf.size(), MSG_NOSIGNAL);
+				if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+					break;
+				if (sent <= 0)
+					return closeConn(conn);
+				conn.writeBuf.erase(0, sent);
+			}
+			if (conn.writeBuf.empty() && conn.closing)
+				return closeConn(conn);
+			if (conn.writeBuf.empty() == conn.wantWrite)
+				watch(conn, !conn.writeBuf.empty());
+		}
+
+		void handleLine(ReplayConn& conn, const std::string& line) {
+			totals_.linesIn++;
+			size_t command = line.find(' ');
+			if (command == std::string::npos)
+				return ;
+			if (line.compare(command + 1, 4, "001 ") == 0) {
+				conn.registered = true;
+				conn.awaitingWelcome = false;
+				serverName_ = line.substr(1, command - 1);
+			}
+			else if (conn.awaitingWelcome && line[command + 1] == '4')
+				conn.awaitingWelcome = false; // registration failed
+			else if (line.compare(command + 1, 5, "PONG ") == 0 && !conn.pongs.empty()) {
+				if (conn.pongs.front())
+					totals_.latencies.push_back((nowNs() - conn.pongs.front()) / 1000.0);
+				conn.pongs.pop_front();
+			}
+		}
+
+		void receive(ReplayConn& conn) {
+			char buf[65536];
+			for (;;) {
+				ssize_t bytes = recv(conn.fd, buf, sizeof(buf), 0);
+				if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+					break;
+				if (bytes <= 0) {
+					if (!conn.closing)
+						totals_.closedByServer++; // QUIT or eviction
+					return closeConn(conn);
+				}
+				conn.readBuf.append(buf, bytes);
+			}
+			size_t start = 0;
+			size_t pos;
+			while ((pos = conn.readBuf.find("\r\n", start)) != std::string::npos) {
+				handleLine(conn, conn.readBuf.substr(start, pos - start));
+				start = pos + 2;
+			}
+			conn.readBuf.erase(0, start);
+		}
+
+		// PASS carries the password of the captured server, the one we replay against may differ
+		void sendLine(ReplayConn& conn, const std::string& line) {
+			std::string upper = line.substr(0, 5);
+			std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+			if (upper == "PASS ")
+				conn.writeBuf += "PASS " + config_.password + "\r\n";
+			else
+				conn.writeBuf += line + "\r\n";
+			if (upper == "PING " && line.compare(5, std::string::npos, serverName_) == 0)
+				conn.pongs.push_back(0); // answered with a PONG that is not ours
+			if (upper == "USER " && !conn.registered)
+				conn.awaitingWelcome = true;
+			if (config_.fast)
+				touched_.push_back(&conn);
+			totals_.lines++;
+			totals_.bytes += line.size() + 2;
+			if (config_.probeEvery && ++linesSinceProbe_ >= config_.probeEvery && probe(conn))
+				linesSinceProbe_ = 0;
+		}
+
+		bool probe(ReplayConn& conn) {
+			if (!conn.registered || conn.closing)
+				return (false);
+			conn.writeBuf += "PING " + serverName_ + "\r\n";
+			conn.pongs.push_back(nowNs());
+			return (true);
+		}
+
+	public:
+		explicit Replayer(const ReplayConfig& config) : config_(config), epollFd_(epoll_create1(0)), linesSinceProbe_(0) {}
+
+		~Replayer() {
+			for (auto& [id, conn] : conns_)
+				if (conn.fd >= 0)
+					close(conn.fd);
+			close(epollFd_);
+		}
+
+		bool apply(const CaptureRecord& record) {
+			if (record.type == CAPTURE_OPEN) {
+				int fd = openConnection(config_.port, record.connection);
+				if (fd < 0) {
+					std::cerr << "ircreplay: connect failed: " << strerror(errno) << std::endl;
+					return (false);
+				}
+				ReplayConn& conn = conns_[record.connection];
+				conn = ReplayConn{fd, false, false, false, "", "", false, {}};
+				struct epoll_event event;
+				event.events = EPOLLIN;
+				event.data.ptr = &conn;
+				epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event);
+				totals_.connections++;
+				return (true);
+			}
+			auto it = conns_.find(record.connection);
+			if (it == conns_.end() || it->second.fd < 0)
+				return (true); // opened before the capture started, or already closed by the server
+			if (record.type == CAPTURE_LINE)
+				sendLine(it->second, record.line);
+			else
+				it->second.closing = true;
+			flush(it->second);
+			return (true);
+		}
+
+		int poll(int timeoutMs) {
+			struct epoll_event events[256];
+			int n = epoll_wait(epollFd_, events, 256, timeoutMs);
+			for (int i = 0; i < n; i++) {
+				ReplayConn& conn = *static_cast<ReplayConn*>(events[i].data.ptr);
+				if (conn.fd >= 0 && (events[i].events & EPOLLOUT))
+					flush(conn);
+				if (conn.fd >= 0 && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+					receive(conn);
+			}
+			return (n);
+		}
+
+		void probeAll() {
+			for (auto& [id, conn] : conns_) {
+				if (conn.fd >= 0 && probe(conn))
+					flush(conn);
+			}
+		}
+
+		// replies come in order per connection, so once every connection that sent something answered
+		// a probe (or its registration) the server has handled everything sent before the barrier
+		void barrier() {
+			for (ReplayConn* conn : touched_) {
+				if (conn->fd >= 0 && (conn->pongs.empty() || conn->pongs.back() == 0) && probe(*conn))
+					flush(*conn);
+			}
+			touched_.clear();
+			uint64_t start = nowNs();
+			while (busy() && nowNs() - start < REPLAY_BARRIER_MS * 1000000ULL)
+				poll(1);
+		}
+
+		// true while output is unsent or probes are unanswered
+		bool busy() const {
+			for (const auto& [id, conn] : conns_)
+				if (conn.fd >= 0 && (!conn.writeBuf.empty() || !conn.pongs.empty() || conn.awaitingWelcome))
+					return (true);
+			return (false);
+		}
+
+		ReplayTotals& totals() {
+			return (totals_);
+		}
+};
+
+static double percentile(std::vector<double>& samples, double p) {
+	if (samples.empty())
+		return (0);
+	size_t index = static_cast<size_t>(p * (samples.size() - 1));
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+	return (samples[index]);
+}
+
+int main(int argc, char** argv) {
+	ReplayConfig config;
+	if (argc < 4) {
+		std::cerr << "usage: " << argv[0] << " <capture> <port> <password> [--fast] [--speed=X] [--probe=N]" << std::endl;
+		return (1);
+	}
+	config.capture = argv[1];
+	config.port = std::atoi(argv[2]);
+	config.password = argv[3];
+	for (int i = 4; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--fast")
+			config.fast = true;
+		else if (arg.compare(0, 8, "--speed=") == 0 && std::atof(arg.c_str() + 8) > 0)
+			config.speed = std::atof(arg.c_str() + 8);
+		else if (arg.compare(0, 8, "--probe=") == 0)
+			config.probeEvery = std::atoi(arg.c_str() + 8);
+		else {
+			std::cerr << "invalid option: " << arg << std::endl;
+			return (1);
+		}
+	}
+
+	std::vector<CaptureRecord> records;
+	if (!loadCapture(config.capture, records))
+		return (1);
+	if (records.empty()) {
+		std::cerr << "ircreplay: capture is empty" << std::endl;
+		return (1);
+	}
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	Replayer replayer(config);
+	uint64_t start = nowNs();
+	size_t next = 0;
+	while (next < records.size()) {
+		uint64_t elapsed = static_cast<uint64_t>((nowNs() - start) * config.speed);
+		size_t applied = 0;
+		while (next < records.size() && (config.fast ? applied < REPLAY_BATCH : records[next].timeNs <= elapsed)) {
+			if (!replayer.apply(records[next++]))
+				return (1);
+			applied++;
+		}
+		if (config.fast) {
+			replayer.barrier();
+			continue;
+		}
+		int timeoutMs = 0;
+		if (next < records.size() && next < records.size()) // sleep until the next record is due, but keep reading
+			timeoutMs = std::min<uint64_t>(10, (records[next].timeNs - std::min(elapsed, records[next].timeNs)) / config.speed / 1000000);
+		replayer.poll(timeoutMs);
+	}
+	replayer.probeAll();
+	uint64_t sentAt = nowNs();
+	while (replayer.busy() && nowNs() - sentAt < REPLAY_DRAIN_SEC * 1000000000ULL)
+		replayer.poll(10);
+	while (replayer.poll(REPLAY_QUIET_MS) > 0) // fanout to connections without a pending probe
+		;
+	double secs = (nowNs() - start) / 1e9;
+	double captureSecs = records.back().timeNs / 1e9;
+
+	ReplayTotals& totals = replayer.totals();
+	std::cout << std::fixed << std::setprecision(1)
+		<< "records:        " << records.size() << " over " << captureSecs << " s of capture\n"
+		<< "pacing:         " << (config.fast ? std::string("as fast as possible") : "original x" + std::to_string(config.speed)) << "\n"
+		<< "connections:    " << totals.connections << " (" << totals.closedByServer << " closed by the server)\n"
+		<< "lines sent:     " << totals.lines << " (" << totals.bytes << " bytes)\n"
+		<< "replay time:    " << secs << " s\n"
+		<< "lines/s:        " << static_cast<long>(totals.lines / secs) << "\n"
+		<< "lines in/s:     " << static_cast<long>(totals.linesIn / secs) << "\n"
+		<< "probes:         " << totals.latencies.size() << " (every " << config.probeEvery << " lines)\n"
+		<< "probe p50 us:   " << percentile(totals.latencies, 0.50) << "\n"
+		<< "probe p99 us:   " << percentile(totals.latencies, 0.99) << "\n"
+		<< "probe p999 us:  " << percentile(totals.latencies, 0.999) << "\n"
+		<< "probe max us:   " << percentile(totals.latencies, 1.0) << std::endl;
+	return (0);
+}
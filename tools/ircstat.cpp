@@ -0,0 +1,120 @@
+// Reads the stats segment a running ircserv publishes in POSIX shared memory. Only maps the segment
+// read-only and never talks to the server, so it works while the event loop is saturated
+//
+// usage: ircstat [port | /segment-name] [--watch[=seconds]]
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../includes/SharedStats.hpp"
+
+static uint64_t nowMs() {
+	return (std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+// the writer is only mid-update for a few hundred nanoseconds, a handful of retries is plenty
+static bool snapshot(const SharedStatsBlock* block, SharedStatsValues& values) {
+	for (int attempt = 0; attempt < 1000; attempt++) {
+		if (readSharedStats(block, values))
+			return (true);
+		std::this_thread::yield();
+	}
+	return (false);
+}
+
+static void printFull(const SharedStatsValues& v) {
+	uint64_t now = nowMs();
+	std::cout << "pid               " << v.pid << "\n"
+		<< "uptime            " << (now / 1000 - v.startedAt) << " s\n"
+		<< "last update       " << (now - v.updatedAt) << " ms ago\n"
+		<< "clients           " << v.clients << "\n"
+		<< "channels          " << v.channels << "\n"
+		<< "lines in          " << v.linesIn << " (" << v.linesPerSec << "/s)\n"
+		<< "bytes in          " << v.bytesIn << " (" << v.bytesInPerSec << " B/s)\n"
+		<< "bytes out         " << v.bytesOut << " (" << v.bytesOutPerSec << " B/s)\n"
+		<< "sendq total       " << v.sendqBytes << " B\n"
+		<< "sendq max client  " << v.sendqMaxBytes << " B\n"
+		<< "throttled         " << v.throttledClients << " (" << v.throttleEvents << " events)\n"
+		<< "sendq evictions   " << v.sendqEvictions << "\n"
+		<< "loop iterations   " << v.loopIterations << "\n"
+		<< "loop busy         " << v.loopBusyPermille / 10 << "." << v.loopBusyPermille % 10 << " %\n"
+		<< "loop max iter     " << v.loopMaxIterationUs << " us" << std::endl;
+}
+
+static void printHeader() {
+	std::cout << std::setw(8) << "clients" << std::setw(8) << "chans" << std::setw(10) << "lines/s"
+		<< std::setw(12) << "in B/s" << std::setw(12) << "out B/s" << std::setw(12) << "sendq"
+		<< std::setw(10) << "throttled" << std::setw(8) << "evict" << std::setw(8) << "busy%"
+		<< std::setw(10) << "maxIt us" << std::setw(8) << "age ms" << std::endl;
+}
+
+static void printLine(const SharedStatsValues& v) {
+	std::cout << std::setw(8) << v.clients << std::setw(8) << v.channels << std::setw(10) << v.linesPerSec
+		<< std::setw(12) << v.bytesInPerSec << std::setw(12) << v.bytesOutPerSec << std::setw(12) << v.sendqBytes
+		<< std::setw(10) << v.throttledClients << std::setw(8) << v.sendqEvictions
+		<< std::setw(8) << v.loopBusyPermille / 10 << std::setw(10) << v.loopMaxIterationUs
+		<< std::setw(8) << (nowMs() - v.updatedAt) << std::endl;
+}
+
+int main(int argc, char** argv) {
+	std::string name = "/ircserv-6667";
+	int watchSeconds = 0;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--watch")
+			watchSeconds = 1;
+		else if (arg.compare(0, 8, "--watch=") == 0)
+			watchSeconds = std::max(1, std::atoi(arg.c_str() + 8));
+		else if (!arg.empty() && arg[0] == '/')
+			name = arg;
+		else if (!arg.empty() && std::isdigit(static_cast<unsigned char>(arg[0])))
+			name = "/ircserv-" + arg;
+		else {
+			std::cerr << "usage: " << argv[0] << " [port | /segment-name] [--watch[=seconds]]" << std::endl;
+			return (1);
+		}
+	}
+
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if (fd < 0) {
+		std::cerr << "ircstat: cannot open " << name << ": " << strerror(errno) << " (is the server running?)" << std::endl;
+		return (1);
+	}
+	void* mapped = mmap(nullptr, sizeof(SharedStatsBlock), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		std::cerr << "ircstat: mmap failed: " << strerror(errno) << std::endl;
+		return (1);
+	}
+	const SharedStatsBlock* block = static_cast<const SharedStatsBlock*>(mapped);
+	if (block->magic != SHM_STATS_MAGIC || block->version != SHM_STATS_VERSION) {
+		std::cerr << "ircstat: " << name << " is not a version " << SHM_STATS_VERSION << " ircserv stats segment" << std::endl;
+		return (1);
+	}
+
+	SharedStatsValues values;
+	if (!watchSeconds) {
+		if (!snapshot(block, values)) {
+			std::cerr << "ircstat: no consistent snapshot yet" << std::endl;
+			return (1);
+		}
+		printFull(values);
+		return (0);
+	}
+	for (int line = 0; ; line++) {
+		if (line % 20 == 0)
+			printHeader();
+		if (snapshot(block, values))
+			printLine(values);
+		std::this_thread::sleep_for(std::chrono::seconds(watchSeconds));
+	}
+}
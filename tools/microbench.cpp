@@ -0,0 +1,651 @@
+// In-process microbenchmarks for the hot paths: the server objects are linked in directly (everything
+// but main.o) and run on a MemoryBackend, so no sockets or syscalls end up in the numbers. Reports
+// ns/op and heap allocations/op per benchmark, writes them as JSON and compares them with a stored
+// baseline. Run through `make bench`, `make bench-baseline` stores a new baseline. Before timing
+// anything the table driven validators of Validators.hpp are checked against the code they replaced,
+// channel fanout is checked to allocate nothing per recipient and SNAPSHOT_CHECK_CHANNELS channels
+// are taken through a state snapshot and restored by a fresh server. The hot upgrade state is checked to
+// decode to what was encoded and to reject every truncated copy of itself
+//
+// usage: microbench [--out=file.json] [--baseline=file.json] [--filter=substring]
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <regex>
+#include <random>
+#include <cctype>
+#include <sys/stat.h>
+#include "../includes/Server.hpp"
+#include "../includes/MemoryBackend.hpp"
+#include "../includes/responseCodes.hpp"
+
+#define BENCH_ROUNDS 5				// rounds per benchmark, the median ns/op is reported
+#define BENCH_ROUND_NS 100000000ULL	// minimum time measured per round
+#define BENCH_REGRESSION_PERCENT 10	// slower than the baseline by more than this gets flagged
+#define BENCH_PASSWORD "benchpass1"
+#define SNAPSHOT_CHECK_CHANNELS 100000
+#define BAN_LIST_SIZE 1000			// masks on #bans100, CHAN_MASK_LIST_MAX
+#define BROADCAST_ALLOCS 2			// per channel message: make_shared's block holding the std::string, then its buffer
+#define BROADCAST_CHECK_LINES 64	// channel messages measured per channel size
+
+// every allocation in the process goes through these, the server's included. They stay out of line,
+// inlined into a caller gcc pairs malloc()/free() with new/delete and warns about a mismatch
+static uint64_t allocations = 0;
+
+__attribute__((noinline)) void* operator new(size_t size) {
+	allocations++;
+	void* ptr = std::malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return (ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept {
+	std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr, size_t) noexcept {
+	std::free(ptr);
+}
+
+static volatile size_t sink; // keeps results observable so nothing gets optimized away
+static std::string filter;		//-> --filter, benchmarks whose name does not contain it are skipped
+
+struct BenchResult {
+	std::string	name;
+	double		nsPerOp;
+	double		allocsPerOp;
+	uint64_t	ops;
+};
+
+// Server grants this class access to its private members
+class ServerBench {
+	private:
+		Server&				server_;
+		MemoryBackend&		net_;
+		std::vector<int>	fds_;
+
+	public:
+		ServerBench(Server& server, MemoryBackend& net) : server_(server), net_(net) {}
+
+		Client* connect(const std::string& nick) {
+			int fd = net_.connect();
+			server_.runIteration(0); // accepts it
+			fds_.push_back(fd);
+			if (!nick.empty())
+				send(fd, "PASS " BENCH_PASSWORD "\r\nNICK " + nick + "\r\nUSER " + nick + " 0 * :bench\r\n");
+			return (server_.clients_[fd].get());
+		}
+
+		// straight into the handler, skipping the backend's event queue
+		void send(int fd, const std::string& lines) {
+			server_.onRead(fd, lines.data(), lines.size());
+		}
+
+		// what the event loop does at the end of an iteration, then throws the output away
+		void drain() {
+			server_.flushClients();
+			for (int fd : fds_)
+				net_.discardOutput(fd);
+		}
+
+		std::pair<std::string, std::vector<std::string>> parseCommand(const std::string& line) {
+			return (server_.parseCommand(line));
+		}
+};
+
+// runs op in batches until a round has BENCH_ROUND_NS of measured time, between() runs untimed after
+// every batch (draining queues and the like)
+template <typename Op, typename Between>
+static BenchResult measure(const std::string& name, size_t batch, Op op, Between between) {
+	if (name.find(filter) == std::string::npos)
+		return (BenchResult{name, 0, 0, 0});
+	std::vector<double> rounds;
+	uint64_t totalOps = 0;
+	uint64_t totalAllocs = 0;
+
+	for (size_t i = 0; i < batch; i++) // warm up caches and lazily built state
+		op(i);
+	between();
+	for (int round = 0; round < BENCH_ROUNDS; round++) {
+		uint64_t elapsed = 0;
+		uint64_t ops = 0;
+		while (elapsed < BENCH_ROUND_NS) {
+			uint64_t allocsBefore = allocations;
+			uint64_t start = statsNow();
+			for (size_t i = 0; i < batch; i++)
+				op(ops + i);
+			elapsed += statsNow() - start;
+			totalAllocs += allocations - allocsBefore;
+			ops += batch;
+			between();
+		}
+		rounds.push_back(static_cast<double>(elapsed) / ops);
+		totalOps += ops;
+	}
+	std::sort(rounds.begin(), rounds.end());
+	return (BenchResult{name, rounds[rounds.size() / 2], static_cast<double>(totalAllocs) / totalOps, totalOps});
+}
+
+template <typename Op>
+static BenchResult measure(const std::string& name, size_t batch, Op op) {
+	return (measure(name, batch, op, [] {}));
+}
+
+static const std::vector<std::string> commandCorpus = {
+	"PRIVMSG #general :hello everyone, how is it going today?",
+	"PRIVMSG alice :did you see the release notes",
+	"JOIN #rust,#cpp,#linux key1,key2",
+	"MODE #general +o bob",
+	"NICK newnick",
+	"USER guest 0 * :Real Name Here",
+	"PING IRCS_SERV",
+	"KICK #general bob :spamming the channel",
+	"TOPIC #general :Welcome to the general discussion channel",
+	"PART #general :see you tomorrow"
+};
+
+static const std::vector<std::string> nickCorpus = {
+	"alice", "Bob_42", "[guest]", "x", "abcdefghi", "nick-name", "{away}",
+	"1abc", "toolongnick123", "#chan", "bad nick", "-dash"
+};
+
+// the checks Validators.hpp replaced, as they were
+static const std::regex nickRegex(R"(^([A-Za-z\[\]\\`_^{}|])(?![$#&~@+%:])[-A-Za-z0-9\[\]\\`_^{}|]{0,8}$)");
+static const std::regex userRegex(R"(^[^\s@]{1,10}$)");
+static const std::regex passwordRegex("^[a-zA-Z0-9]{6,16}$");
+
+static bool referenceChannelKey(const std::string& key) {
+	if (key.length() < 1 || key.length() > 32)
+		return (false);
+	const std::string allowedSymbols = "!@#$%^&*()-_+=~";
+	for (char c : key)
+		if (!std::isalnum(static_cast<unsigned char>(c)) && allowedSymbols.find(c) == std::string::npos)
+			return (false);
+	return (true);
+}
+
+static bool referenceChannelName(const std::string& name) {
+	if (name.empty() || name.size() > 50 || name[0] != '#')
+		return (false);
+	return (name.find_first_of(std::string(" ,\a:")) == std::string::npos);
+}
+
+// differential check: every string of up to two bytes, then random strings over the characters the
+// rules care about with some high bytes, around each length limit. Returns the number of mismatches
+static size_t checkValidators(size_t& checked) {
+	std::vector<std::string> inputs = {""};
+	for (int a = 0; a < 256; a++) {
+		inputs.push_back(std::string(1, static_cast<char>(a)));
+		for (int b = 0; b < 256; b++)
+			inputs.push_back(std::string{static_cast<char>(a), static_cast<char>(b)});
+	}
+	static const std::string alphabet = std::string("aZz09#&@~+%:!$^*()=-_[]\\`{}|, \t\n\r\v\f\a\x7f\x80\xa0\xff") + '\0';
+	static const std::string common = "aZz09_"; // valid for every rule, keeps long inputs near acceptance
+	static const std::vector<size_t> limits = {5, 6, 7, 8, 9, 10, 11, 15, 16, 17, 31, 32, 33, 49, 50, 51};
+	std::mt19937 rng(42);
+	for (int i = 0; i < 200000; i++) {
+		std::string input(rng() % 2 ? limits[rng() % limits.size()] : rng() % 56, ' ');
+		for (char& c : input)
+			c = (rng() % 8) ? common[rng() % common.size()] : alphabet[rng() % alphabet.size()];
+		if (!input.empty() && rng() % 2)
+			input[0] = "#a[9"[rng() % 4];
+		inputs.push_back(input);
+	}
+
+	size_t mismatches = 0;
+	auto expect = [&](const char* rule, const std::string& input, bool fast, bool reference) {
+		checked++;
+		if (fast != reference && mismatches++ < 10)
+			std::cerr << "validator mismatch: " << rule << " \"" << input << "\" table " << fast
+				<< " reference " << reference << std::endl;
+	};
+	for (const std::string& input : inputs) {
+		expect("nick", input, isValidNickname(input), std::regex_match(input, nickRegex));
+		expect("user", input, isValidUsername(input), std::regex_match(input, userRegex));
+		expect("password", input, isValidPassword(input), std::regex_match(input, passwordRegex));
+		expect("channel name", input, isValidChannelName(input), referenceChannelName(input));
+		expect("channel key", input, isValidChannelKey(input), referenceChannelKey(input));
+	}
+	return (mismatches);
+}
+
+// a channel message costs the same allocations whatever the channel size: BROADCAST_ALLOCS for the line
+// built once and shared with the channel history, nothing per recipient as long as their send queues
+// have an open chunk. The history deques add a block every 16 entries (HistoryEntry) and every 32
+// (history order) and now and then grow their maps, so the count is summed over many messages and that
+// share, for the warm-up messages' entries too, is allowed on top
+static bool checkBroadcastAllocations(Server& server, ServerBench& bench) {
+	Client& sender = *server.getClient("user0");
+	const std::string command = "PRIVMSG";
+	const std::string text = ":hello everyone, how is it going today?";
+	const uint64_t limit = BROADCAST_CHECK_LINES * BROADCAST_ALLOCS + 2 * BROADCAST_CHECK_LINES / 16 + 2 * BROADCAST_CHECK_LINES / 32 + 4;
+	uint64_t perSize[2];
+	int i = 0;
+	for (int size : {10, 100}) {
+		Channel& channel = *server.getChannel("#size" + std::to_string(size));
+		perSize[i] = 0;
+		for (int line = 0; line < BROADCAST_CHECK_LINES; line++) {
+			bench.drain();
+			server.messageBroadcast(channel, sender, command, text); // opens a chunk in every send queue
+			uint64_t before = allocations;
+			server.messageBroadcast(channel, sender, command, text);
+			perSize[i] += allocations - before;
+		}
+		i++;
+	}
+	bench.drain();
+	if (perSize[0] < BROADCAST_CHECK_LINES * BROADCAST_ALLOCS || perSize[0] > limit || perSize[1] > limit) {
+		std::cerr << "microbench: " << BROADCAST_CHECK_LINES << " channel messages allocated " << perSize[0]
+			<< " times for 10 members and " << perSize[1] << " for 100, expected " << BROADCAST_CHECK_LINES * BROADCAST_ALLOCS
+			<< " to " << limit << std::endl;
+		return (false);
+	}
+	return (true);
+}
+
+// random channel state through StateSnapshot into a server started on the file, which has to come
+// back identical. Returns the restore time in ms or -1 on a mismatch, size is set to the file size
+static double checkSnapshot(size_t& size) {
+	std::mt19937 rng(7);
+	auto word = [&](size_t maxLen) {
+		std::string str(rng() % (maxLen + 1), 'a');
+		for (char& c : str)
+			c = 'a' + rng() % 26;
+		return (str);
+	};
+	std::map<std::string, ChannelSnapshot> original;
+	for (int i = 0; i < SNAPSHOT_CHECK_CHANNELS; i++) {
+		ChannelSnapshot channel{"#" + word(12) + std::to_string(i), "", word(80), static_cast<uint8_t>(rng() % 8),
+			rng() % 2 ? -1 : static_cast<int32_t>(rng() % 500), {}, {}, 1000000 + static_cast<int64_t>(rng() % 1000000), 0};
+		if (!channel.topic.empty())
+			channel.topicTime = channel.createdAt + rng() % 1000;
+		if (channel.flags & SNAPSHOT_FLAG_KEY)
+			channel.key = "k" + word(20);
+		for (size_t ops = rng() % 4; ops > 0; ops--)
+			channel.operators.push_back("o" + word(8));
+		for (size_t masks = rng() % 4; masks > 0; masks--)
+			channel.masks.push_back(MaskSnapshot{"beI"[masks % 3], "*!*@" + word(10) + std::to_string(masks), "o" + word(8),
+				static_cast<int64_t>(rng())});
+		original[channel.name] = channel;
+	}
+	std::string path = "/tmp/microbench-snapshot-" + std::to_string(getpid());
+	{
+		StateSnapshot snapshot(path);
+		snapshot.begin();
+		for (const auto& [name, state] : original)
+			snapshot.add(Channel(state));
+		snapshot.commit(true);
+	}
+	struct stat st;
+	size = stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+
+	ServerConfig config;
+	config.shmName = "off";
+	config.snapshotFile = path;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Server* restored = new Server(0, BENCH_PASSWORD, config, std::make_unique<MemoryBackend>()); // never deleted, see main()
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	unlink(path.c_str());
+	for (const auto& [name, state] : original) {
+		Channel* channel = restored->getChannel(name);
+		if (!channel || channel->getChannelKey() != state.key || channel->getTopic() != state.topic
+			|| channel->isKeyProtected() != bool(state.flags & SNAPSHOT_FLAG_KEY)
+			|| channel->isInviteOnly() != bool(state.flags & SNAPSHOT_FLAG_INVITE_ONLY)
+			|| channel->isTopicOperatorOnly() != bool(state.flags & SNAPSHOT_FLAG_TOPIC_OPS)
+			|| channel->getUserLimit() != state.userLimit
+			|| channel->getCreatedAt() != state.createdAt || channel->getTopicTime() != state.topicTime
+			|| channel->getPendingOperators() != std::set<std::string>(state.operators.begin(), state.operators.end())
+			|| StateSnapshot::masksOf(*channel).size() != state.masks.size()) {
+			std::cerr << "microbench: channel " << name << " did not survive the snapshot" << std::endl;
+			return (-1);
+		}
+	}
+	return (ms);
+}
+
+// the kinds of masks a busy channel collects, i picks one and makes it unique
+static std::string banMask(size_t i) {
+	switch (i % 5) {
+		case 0: return ("*!*@host" + std::to_string(i) + ".example.net");
+		case 1: return ("Nick" + std::to_string(i) + "!*@*");
+		case 2: return ("*!ident" + std::to_string(i) + "@*");
+		case 3: return ("*!*@*.isp" + std::to_string(i) + ".NET");
+		default: return ("bot" + std::to_string(i) + "*!*@10.0." + std::to_string(i % 256) + ".*");
+	}
+}
+
+// MaskList against running every Mask in turn, for subjects that hit each kind of mask and for misses
+static bool checkMaskList() {
+	std::mt19937 rng(13);
+	MaskList list;
+	std::vector<Mask> masks;
+	for (size_t i = 0; i < BAN_LIST_SIZE; i++) {
+		list.add(banMask(i), "bench", 0);
+		masks.emplace_back(banMask(i));
+	}
+	list.add("exact!user@literal.host", "bench", 0);
+	masks.emplace_back("exact!user@literal.host");
+	for (int i = 0; i < 20000; i++) {
+		size_t n = rng() % (2 * BAN_LIST_SIZE);
+		std::string subject;
+		switch (rng() % 6) {
+			case 0: subject = "x!y@host" + std::to_string(n) + ".example.net"; break;
+			case 1: subject = "nick" + std::to_string(n) + "!u@h"; break;
+			case 2: subject = "x!IDENT" + std::to_string(n) + "@h"; break;
+			case 3: subject = "x!y@a.b.isp" + std::to_string(n) + ".net"; break;
+			case 4: subject = "bot" + std::to_string(n) + "x!y@10.0." + std::to_string(n % 256) + ".7"; break;
+			default: subject = rng() % 2 ? "exact!user@literal.host" : "user" + std::to_string(n) + "!user@127.0.0.1"; break;
+		}
+		bool expected = std::any_of(masks.begin(), masks.end(), [&](const Mask& mask) { return (mask.matches(subject)); });
+		if (list.matches(subject) != expected) {
+			std::cerr << "microbench: MaskList says " << !expected << " for " << subject << std::endl;
+			return (false);
+		}
+	}
+	return (true);
+}
+
+// burst, rate, open connection cap, loopback exemption, load shedding and the sweep of idle addresses
+static bool checkAdmission() {
+	const uint64_t second = 1000000000ULL;
+	AdmissionControl admission(3, 30, 100);
+	uint64_t now = second;
+	std::vector<AdmissionVerdict> verdicts;
+	for (int i = 0; i < 5; i++)
+		verdicts.push_back(admission.admit("10.1.1.1", now, 0));
+	admission.release("10.1.1.1");
+	verdicts.push_back(admission.admit("10.1.1.1", now, 0));
+	for (int i = 0; i < 50; i++)
+		verdicts.push_back(admission.admit("127.0.0.1", now, 0));
+	verdicts.push_back(admission.admit("10.1.1.2", now, 200 * 1000000ULL));
+	AdmissionControl rate(0, 30, 0);
+	for (int i = 0; i < ADMISSION_IP_BURST + 1; i++)
+		verdicts.push_back(rate.admit("10.2.2.2", now, 0));
+	verdicts.push_back(rate.admit("10.2.2.2", now + second, 0));		// half a connection drained
+	verdicts.push_back(rate.admit("10.2.2.2", now + 2 * second, 0));	// one
+	std::vector<AdmissionVerdict> expected = {ADMIT, ADMIT, ADMIT, REFUSE_IP_LIMIT, REFUSE_IP_LIMIT, ADMIT};
+	expected.insert(expected.end(), 50, ADMIT);
+	expected.push_back(REFUSE_OVERLOAD);
+	expected.insert(expected.end(), ADMISSION_IP_BURST, ADMIT);
+	expected.insert(expected.end(), {REFUSE_IP_RATE, REFUSE_IP_RATE, ADMIT});
+	if (verdicts != expected) {
+		std::cerr << "microbench: admission control decided differently than expected" << std::endl;
+		return (false);
+	}
+	for (int i = 0; i < ADMISSION_SWEEP_EVERY; i++) {
+		std::string address = "10.3." + std::to_string(i / 256) + "." + std::to_string(i % 256);
+		rate.admit(address, now + i * second, 0); // a second apart, the bucket of each drains in two
+		rate.release(address);
+	}
+	if (rate.getTracked() > 100) { // the addresses since the sweep and 10.2.2.2, which has connections open
+		std::cerr << "microbench: admission control kept " << rate.getTracked() << " idle addresses" << std::endl;
+		return (false);
+	}
+	return (true);
+}
+
+static bool checkUpgradeState() {
+	std::mt19937 rng(11);
+	auto word = [&](size_t maxLen) {
+		std::string str(rng() % (maxLen + 1), 'a');
+		for (char& c : str)
+			c = 'a' + rng() % 26;
+		return (str);
+	};
+	UpgradeState state{rng(), rng(), static_cast<uint32_t>(rng()), {}, {}};
+	for (int i = 0; i < 200; i++)
+		state.clients.push_back(ClientHandover{"127.0.0.1", rng() % 2 ? "10.0.0." + std::to_string(i) : "", "n" + word(8), word(9), word(30), word(12),
+			static_cast<uint8_t>(rng() % 5), rng() % 2 == 0, rng() % 5 == 0, static_cast<int64_t>(rng()), word(40), word(3000),
+			std::vector<std::string>(rng() % 4, "m" + word(8)), static_cast<uint32_t>(rng())});
+	for (int i = 0; i < 50; i++) {
+		ChannelHandover channel{ChannelSnapshot{"#" + word(12), word(20), word(80), static_cast<uint8_t>(rng() % 8),
+			static_cast<int32_t>(rng() % 500) - 1, {"o" + word(8)}, {MaskSnapshot{'b', "*!*@" + word(20), "o" + word(8),
+			static_cast<int64_t>(rng())}}, static_cast<int64_t>(rng()), static_cast<int64_t>(rng())},
+			{}, {}, {}, rng() % 2 == 0, {}};
+		for (size_t member = rng() % state.clients.size(); member < state.clients.size(); member += 1 + rng() % 20)
+			(rng() % 3 ? channel.members : channel.operators).push_back(member);
+		for (uint64_t msgId = 1 + rng() % 1000; channel.history.size() < rng() % 100; msgId += 1 + rng() % 10)
+			channel.history.push_back(HistoryEntry{msgId, rng(), std::make_shared<const std::string>(word(200) + "\r\n")});
+		state.channels.push_back(std::move(channel));
+	}
+	std::string encoded;
+	std::string reencoded;
+	std::string error;
+	state.encode(encoded);
+	UpgradeState decoded;
+	if (!decoded.decode(encoded, error) || (decoded.encode(reencoded), reencoded != encoded)) {
+		std::cerr << "microbench: upgrade state did not survive encoding: " << error << std::endl;
+		return (false);
+	}
+	for (size_t length = 0; length < encoded.size(); length += 1 + length / 64) {
+		if (UpgradeState().decode(encoded.substr(0, length), error)) {
+			std::cerr << "microbench: upgrade state truncated to " << length << " bytes was accepted" << std::endl;
+			return (false);
+		}
+	}
+	return (true);
+}
+
+static std::vector<BenchResult> runBenchmarks(Server& server, ServerBench& bench) {
+	std::vector<BenchResult> results;
+
+	results.push_back(measure("parseCommand", commandCorpus.size(), [&](size_t i) {
+		sink = bench.parseCommand(commandCorpus[i % commandCorpus.size()]).second.size();
+	}));
+
+	results.push_back(measure("isNickUserValid/nick", nickCorpus.size(), [&](size_t i) {
+		sink = server.isNickUserValid("NICK", nickCorpus[i % nickCorpus.size()]);
+	}));
+	results.push_back(measure("isNickUserValid/user", nickCorpus.size(), [&](size_t i) {
+		sink = server.isNickUserValid("USER", nickCorpus[i % nickCorpus.size()]);
+	}));
+	results.push_back(measure("isValidChannelName", nickCorpus.size(), [&](size_t i) {
+		sink = isValidChannelName(nickCorpus[i % nickCorpus.size()]);
+	}));
+
+	Client& sender = *server.getClient("user0");
+	const std::vector<std::pair<int, std::vector<std::string>>> replies = {
+		{RPL_WELCOME, {}}, {ERR_NEEDMOREPARAMS, {"JOIN"}}, {ERR_NOSUCHNICK, {"ghost"}},
+		{ERR_UNKNOWNCOMMAND, {"FOO"}}, {ERR_NOTONCHANNEL, {"#general"}},
+		{RPL_NAMREPLY, {"= #general :@alice bob carol dave"}}
+	};
+	results.push_back(measure("createMessage", replies.size(), [&](size_t i) {
+		const std::pair<int, std::vector<std::string>>& reply = replies[i % replies.size()];
+		sink = server.createMessage(reply.first, sender, "JOIN", reply.second).size();
+	}));
+
+	// a thousand addresses connecting and leaving again, each within its limits
+	AdmissionControl admission(ADMISSION_IP_LIMIT, ADMISSION_IP_RATE, ADMISSION_SHED_LATENCY_MS);
+	std::vector<std::string> addresses;
+	for (int i = 0; i < 1000; i++)
+		addresses.push_back("10.0." + std::to_string(i / 256) + "." + std::to_string(i % 256));
+	results.push_back(measure("AdmissionControl/admit", 64, [&](size_t i) {
+		const std::string& address = addresses[i % addresses.size()];
+		sink = admission.admit(address, statsNow(), 0);
+		admission.release(address);
+	}));
+
+	// population of 1000 registered clients, see main()
+	results.push_back(measure("getClient/hit", 64, [&](size_t i) {
+		sink = server.getClient("user" + std::to_string(i * 7919 % 1000)) != nullptr;
+	}));
+	results.push_back(measure("getClient/miss", 64, [&](size_t i) {
+		sink = server.getClient("ghost" + std::to_string(i % 1000)) != nullptr;
+	}));
+	// a prefix only visits its range of the indexes, a leading wildcard walks all of them
+	const std::vector<std::string> whoMasks = {"user12*", "USER99?", "*7", "user500"};
+	results.push_back(measure("findUsers", whoMasks.size(), [&](size_t i) {
+		std::vector<Client*> users;
+		server.findUsers(Mask(whoMasks[i % whoMasks.size()]), false, users);
+		sink = users.size();
+	}));
+	// #bans100 carries BAN_LIST_SIZE masks none of its members match, main() sets them
+	Channel& banned = *server.getChannel("#bans100");
+	const MaskList& bans = banned.getMaskList('b');
+	results.push_back(measure("MaskList/miss", 64, [&](size_t i) {
+		sink = bans.matches("user" + std::to_string(i % 1000) + "!user@127.0.0.1");
+	}));
+	results.push_back(measure("isBanned/member", 64, [&](size_t) {
+		sink = banned.isBanned(sender);
+	}));
+	results.push_back(measure("dispatch/who100", 8, [&](size_t) {
+		bench.send(sender.getClientFD(), "WHO #size100\r\n");
+	}, [&] { bench.drain(); }));
+
+	// batches stay far below the send queue limits, drain() empties them in between
+	for (int size : {10, 100}) {
+		Channel& channel = *server.getChannel("#size" + std::to_string(size));
+		results.push_back(measure("messageBroadcast/" + std::to_string(size), 32, [&](size_t) {
+			server.messageBroadcast(channel, sender, "PRIVMSG", ":hello everyone, how is it going today?");
+		}, [&] { bench.drain(); }));
+	}
+
+	// the whole inbound path of a channel message: buffering, parsing, dispatch and fanout
+	results.push_back(measure("dispatch/privmsg100", 32, [&](size_t) {
+		bench.send(sender.getClientFD(), "PRIVMSG #size100 :hello everyone, how is it going today?\r\n");
+	}, [&] { bench.drain(); }));
+	results.push_back(measure("dispatch/privmsg100bans", 32, [&](size_t) {
+		bench.send(sender.getClientFD(), "PRIVMSG #bans100 :hello everyone, how is it going today?\r\n");
+	}, [&] { bench.drain(); }));
+	return (results);
+}
+
+static std::string toJson(const std::vector<BenchResult>& results) {
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(2) << "{\"benchmarks\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		out << "  {\"name\": \"" << results[i].name << "\", \"ns_per_op\": " << results[i].nsPerOp
+			<< ", \"allocs_per_op\": " << results[i].allocsPerOp << ", \"ops\": " << results[i].ops << "}"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "]}\n";
+	return (out.str());
+}
+
+// reads back what toJson() writes, one benchmark per line
+static std::map<std::string, BenchResult> loadBaseline(const std::string& path) {
+	std::map<std::string, BenchResult> baseline;
+	std::ifstream file(path);
+	std::string line;
+	while (std::getline(file, line)) {
+		size_t name = line.find("\"name\": \"");
+		size_t ns = line.find("\"ns_per_op\": ");
+		size_t allocs = line.find("\"allocs_per_op\": ");
+		if (name == std::string::npos || ns == std::string::npos || allocs == std::string::npos)
+			continue;
+		BenchResult result;
+		result.name = line.substr(name + 9, line.find('"', name + 9) - name - 9);
+		result.nsPerOp = std::atof(line.c_str() + ns + 13);
+		result.allocsPerOp = std::atof(line.c_str() + allocs + 17);
+		result.ops = 0;
+		baseline[result.name] = result;
+	}
+	return (baseline);
+}
+
+static void printResults(const std::vector<BenchResult>& results, const std::map<std::string, BenchResult>& baseline) {
+	std::cout << std::fixed << std::setprecision(1) << std::left << std::setw(26) << "benchmark" << std::right
+		<< std::setw(12) << "ns/op" << std::setw(12) << "allocs/op";
+	if (!baseline.empty())
+		std::cout << std::setw(12) << "base ns" << std::setw(10) << "delta";
+	std::cout << std::endl;
+	for (const BenchResult& result : results) {
+		std::cout << std::left << std::setw(26) << result.name << std::right << std::setw(12) << result.nsPerOp
+			<< std::setw(12) << result.allocsPerOp;
+		auto base = baseline.find(result.name);
+		if (base != baseline.end() && base->second.nsPerOp > 0) {
+			double delta = (result.nsPerOp / base->second.nsPerOp - 1) * 100;
+			std::cout << std::setw(12) << base->second.nsPerOp << std::setw(9) << std::showpos << delta
+				<< std::noshowpos << "%";
+			if (delta > BENCH_REGRESSION_PERCENT || result.allocsPerOp > base->second.allocsPerOp + 0.5)
+				std::cout << "  REGRESSION";
+		}
+		std::cout << std::endl;
+	}
+}
+
+int main(int argc, char** argv) {
+	std::string outPath = "bench.json";
+	std::string baselinePath;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg.compare(0, 6, "--out=") == 0)
+			outPath = arg.substr(6);
+		else if (arg.compare(0, 11, "--baseline=") == 0)
+			baselinePath = arg.substr(11);
+		else if (arg.compare(0, 9, "--filter=") == 0)
+			filter = arg.substr(9);
+		else {
+			std::cerr << "usage: " << argv[0] << " [--out=file.json] [--baseline=file.json] [--filter=substring]" << std::endl;
+			return (1);
+		}
+	}
+
+	size_t checked = 0;
+	if (checkValidators(checked)) {
+		std::cerr << "microbench: validators disagree with the reference checks" << std::endl;
+		return (1);
+	}
+	std::cout << "validators: " << checked << " inputs agree with the reference checks" << std::endl;
+
+	// the server logs every command, timing includes building the log lines but not the terminal
+	std::ofstream devNull("/dev/null");
+	std::streambuf* console = std::cout.rdbuf(devNull.rdbuf());
+	ServerConfig config;
+	config.shmName = "off";
+	std::unique_ptr<MemoryBackend> backend = std::make_unique<MemoryBackend>();
+	MemoryBackend& net = *backend;
+	Server* server = new Server(0, BENCH_PASSWORD, config, std::move(backend)); // never deleted, its destructor exits the process
+	ServerBench bench(*server, net);
+	std::vector<Client*> clients;
+	for (int i = 0; i < 1000; i++)
+		clients.push_back(bench.connect("user" + std::to_string(i)));
+	for (int size : {10, 100})
+		for (int i = 0; i < size; i++)
+			bench.send(clients[i]->getClientFD(), "JOIN #size" + std::to_string(size) + "\r\n");
+	for (int i = 0; i < 100; i++)
+		bench.send(clients[i]->getClientFD(), "JOIN #bans100\r\n");
+	for (size_t i = 0; i < BAN_LIST_SIZE; i++)
+		server->getChannel("#bans100")->addMask('b', MaskList::normalize(banMask(i)), "bench", 0);
+	server->getChannel("#bans100")->setOperator(clients[0], false); // the sender, operators skip the check
+	bench.drain();
+
+	if (!checkBroadcastAllocations(*server, bench))
+		return (1);
+	size_t snapshotSize = 0;
+	double restoreMs = checkSnapshot(snapshotSize);
+	if (restoreMs < 0 || !checkUpgradeState() || !checkMaskList() || !checkAdmission())
+		return (1);
+	std::vector<BenchResult> results = runBenchmarks(*server, bench);
+	std::cout.rdbuf(console);
+	std::cout << "snapshot: " << SNAPSHOT_CHECK_CHANNELS << " channels (" << snapshotSize / 1024 << " KiB) restored in "
+		<< std::fixed << std::setprecision(1) << restoreMs << " ms" << std::endl;
+	results.erase(std::remove_if(results.begin(), results.end(), [](const BenchResult& result) {
+		return (result.ops == 0);
+	}), results.end());
+
+	std::map<std::string, BenchResult> baseline;
+	if (!baselinePath.empty()) {
+		baseline = loadBaseline(baselinePath);
+		if (baseline.empty())
+			std::cout << "no baseline in " << baselinePath << ", store one with `make bench-baseline`" << std::endl;
+	}
+	printResults(results, baseline);
+	std::ofstream out(outPath);
+	out << toJson(results);
+	if (!out) {
+		std::cerr << "microbench: cannot write " << outPath << std::endl;
+		return (1);
+	}
+	std::cout << "results written to " << outPath << std::endl;
+	return (0);
+}
@@ -0,0 +1,19 @@
+#!/bin/sh
+# Training run for `make pgo`: starts the instrumented server and drives it with ircbench through
+# registration, channel chat with a zipf spread of channel sizes, JOIN/PART churn and NICK changes.
+# The server must exit through its SIGINT handler, the profile is written by exit().
+#
+# usage: tools/pgo-train.sh [port]   (after building the instrumented ircserv and ircbench)
+
+PORT=${1:-6669}
+PASS=pgotrain1
+
+./ircserv "$PORT" "$PASS" > /dev/null 2>&1 &
+SERVER=$!
+sleep 1
+./ircbench "$PORT" "$PASS" --clients=500 --channels=50 --dist=zipf --rate=5000 --duration=5 --churn=10 --nicks=5 --pid="$SERVER"
+STATUS=$?
+./ircbench "$PORT" "$PASS" --clients=2000 --channels=400 --dist=uniform --rate=2000 --duration=3 --churn=30 --nicks=10 --pid="$SERVER" > /dev/null
+kill -INT "$SERVER"
+wait "$SERVER" 2>/dev/null
+exit $STATUS
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Hot upgrade under load: starts the server, drives it with ircbench and upgrades it to the same binary
+# with SIGUSR2 every few seconds of the measured phase. Clients must not notice: ircbench reports no
+# connection closed by the server and no error replies, only the latency of the messages in flight
+# during a handover goes up. Each upgrade logs how long the old and the new process took.
+#
+# usage: tools/upgrade.sh [port] [ircbench options...]   (after `make ircbench`, UPGRADES=n to change the count)
+
+PORT=${1:-6667}
+[ $# -gt 0 ] && shift
+PASS=benchpass
+UPGRADES=${UPGRADES:-3}
+BENCH_ARGS=${*:---clients=2000 --channels=200 --rate=20000 --duration=12}
+
+LOG=$(mktemp)
+OUT=$(mktemp)
+./ircserv "$PORT" "$PASS" > "$LOG" 2>&1 &
+PID=$!
+sleep 1
+./ircbench "$PORT" "$PASS" $BENCH_ARGS > "$OUT" 2>&1 &
+BENCH=$!
+
+DONE=0
+sleep 3
+while [ "$DONE" -lt "$UPGRADES" ] && kill -0 "$BENCH" 2>/dev/null; do
+	kill -USR2 "$PID"
+	sleep 1
+	NEXT=$(grep -o 'to pid [0-9]*' "$LOG" | tail -1 | grep -o '[0-9]*$')
+	if [ -z "$NEXT" ] || [ "$NEXT" = "$PID" ]; then
+		echo "upgrade $((DONE + 1)) failed, see $LOG"
+		break
+	fi
+	PID=$NEXT
+	DONE=$((DONE + 1))
+	sleep 2
+done
+wait "$BENCH"
+kill -INT "$PID"
+
+cat "$OUT"
+echo "upgrades:       $DONE of $UPGRADES"
+echo "closed by server: $(grep -c 'server closed' "$OUT")"
+grep -E '\[UPGRADE\] (Handed|Took)' "$LOG" | sed 's/^.*\[UPGRADE\] /  /'
+rm -f "$OUT"
+grep -q 'did not take over\|not supported' "$LOG" || rm -f "$LOG"